@@ -28,6 +28,8 @@ if (macx) {
 }
 if (linux) {
     QMAKE_LFLAGS += -Wl,-z,relro -Wl,-z,now -Wl,-z,noexecstack -Wl,--gc-sections -pie
+    # shm_open for the shared memory video ring
+    LIBS += -lrt
 }
 
 QMAKE_CFLAGS += $$GLOBAL_FLAGS
@@ -57,6 +59,8 @@ SOURCES +=  utils.cpp \
     mainwindow.cpp \
     romselection.cpp \
     qtframebuffer.cpp \
+    memorydevice.cpp \
+    profiledialog.cpp \
     lcdwidget.cpp \
     emuthread.cpp \
     qtkeypadbridge.cpp \
@@ -66,6 +70,8 @@ SOURCES +=  utils.cpp \
     core/cpu.c \
     core/keypad.c \
     core/lcd.c \
+    core/lcdframe.cpp \
+    core/lcdconv.c \
     core/registers.c \
     core/apb.c \
     core/interrupt.c \
@@ -81,10 +87,19 @@ SOURCES +=  utils.cpp \
     core/cert.c \
     core/control.c \
     core/mem.c \
+    core/flashimage.cpp \
     core/link.c \
+    core/input.cpp \
+    core/script.cpp \
     core/vat.c \
     core/capture/gif.cpp \
+    core/capture/video.cpp \
     core/debug/disasm.cpp \
+    core/debug/disasmcache.cpp \
+    core/debug/search.cpp \
+    core/debug/condition.cpp \
+    core/debug/profile.c \
+    core/debug/timeline.cpp \
     core/debug/debug.c \
     qhexedit/chunks.cpp \
     qhexedit/commands.cpp \
@@ -99,6 +114,8 @@ HEADERS  +=  os/os.h \
     mainwindow.h \
     romselection.h \
     qtframebuffer.h \
+    memorydevice.h \
+    profiledialog.h \
     lcdwidget.h \
     emuthread.h \
     disasmwidget.h \
@@ -110,6 +127,8 @@ HEADERS  +=  os/os.h \
     core/defines.h \
     core/keypad.h \
     core/lcd.h \
+    core/lcdframe.h \
+    core/lcdconv.h \
     core/registers.h \
     core/tidevices.h \
     core/apb.h \
@@ -126,12 +145,21 @@ HEADERS  +=  os/os.h \
     core/cert.h \
     core/control.h \
     core/mem.h \
+    core/flashimage.h \
     core/link.h \
+    core/input.h \
+    core/script.h \
     core/vat.h \
     core/capture/gif.h \
+    core/capture/video.h \
     core/capture/giflib.h \
     core/debug/debug.h \
     core/debug/disasm.h \
+    core/debug/disasmcache.h \
+    core/debug/search.h \
+    core/debug/condition.h \
+    core/debug/profile.h \
+    core/debug/timeline.h \
     core/debug/disasmc.h \
     qhexedit/chunks.h \
     qhexedit/commands.h \
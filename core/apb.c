@@ -4,7 +4,14 @@
 #include "debug/debug.h"
 #include <stdio.h>
 // Global APB state
-apb_map_entry_t apb_map[0x10];
+eZ80portrange_t apb_map[0x10];
+bool apb_slow_path;
+
+/* Port range of each 64K block of 0xE00000-0xFFFFFF, what mmio_range() works out */
+static const uint8_t mmio_ranges[0x20] = {
+    0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF, 0x0,
+    0x5, 0x6, 0x7, 0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF, 0x0, 0x1, 0x2, 0x3, 0x4
+};
 
 /* The APB (Advanced Peripheral Bus) hosts peripherals that do not require
  * high bandwidth. The bridge to the APB is accessed via addresses 0xE00000-0xFB0000.
@@ -13,12 +20,15 @@ apb_map_entry_t apb_map[0x10];
  * Reads/Writes can be 8 bits wide. */
 
 void apb_set_map(int entry, eZ80portrange_t *range){
-    apb_map[entry].range = range;
+    apb_map[entry] = *range;
 }
 
-uint8_t port_read_byte(const uint16_t addr) {
-    uint16_t port = (port_range(addr) << 12) | addr_range(addr);
-    uint8_t value = apb_map[port_range(addr)].range->read_in(addr_range(addr));
+void apb_update_slow_path(void) {
+    apb_slow_path = mem.debug.ports_armed != 0;
+}
+
+static uint8_t port_read_slow(const uint16_t port) {
+    uint8_t value = apb_map[port_range(port)].read_in(addr_range(port));
 
     if (mem.debug.ports[port] & DBG_PORT_READ) {
         debugger(HIT_PORT_READ_BREAKPOINT, port);
@@ -26,21 +36,46 @@ uint8_t port_read_byte(const uint16_t addr) {
     return value;
 }
 
-void port_write_byte(const uint16_t addr, const uint8_t value) {
-    uint16_t port = (port_range(addr) << 12) | addr_range(addr);
-
+static void port_write_slow(const uint16_t port, const uint8_t value) {
     if (mem.debug.ports[port] & DBG_PORT_FREEZE) {
         printf("%04X -> %02X\n",port,mem.debug.ports[port]);
         return;
     }
 
-    apb_map[port_range(addr)].range->write_out(addr_range(addr), value);
+    apb_map[port_range(port)].write_out(addr_range(port), value);
 
     if (mem.debug.ports[port] & DBG_PORT_WRITE) {
         debugger(HIT_PORT_WRITE_BREAKPOINT, port);
     }
 }
 
+uint8_t port_read_byte(const uint16_t addr) {
+    if (apb_slow_path) {
+        return port_read_slow(addr);
+    }
+    return apb_map[port_range(addr)].read_in(addr_range(addr));
+}
+
+void port_write_byte(const uint16_t addr, const uint8_t value) {
+    if (apb_slow_path) {
+        port_write_slow(addr, value);
+        return;
+    }
+    apb_map[port_range(addr)].write_out(addr_range(addr), value);
+}
+
 void port_force_write_byte(const uint16_t addr, const uint8_t value) {
-    apb_map[port_range(addr)].range->write_out(addr_range(addr), value);
+    apb_map[port_range(addr)].write_out(addr_range(addr), value);
+}
+
+uint16_t mmio_port(const uint32_t addr) {
+    return mmio_ranges[(addr >> 16) & 0x1F] << 12 | addr_range(addr);
+}
+
+uint8_t mmio_read_byte(const uint32_t addr) {
+    return port_read_byte(mmio_port(addr));
+}
+
+void mmio_write_byte(const uint32_t addr, const uint8_t value) {
+    port_write_byte(mmio_port(addr), value);
 }
@@ -10,22 +10,27 @@ extern "C" {
 typedef struct eZ80portrange {
     uint8_t (*read_in)(const uint16_t);
     void (*write_out)(const uint16_t, const uint8_t);
+    uint8_t (*peek)(const uint16_t);    /* Optional, read_in without side effects for the debugger */
 } eZ80portrange_t;
 
-/* Standard APB entry */
-typedef struct apb_map_entry {
-    eZ80portrange_t *range;
-} apb_map_entry_t;
+/* Handlers of each port range, copied in so an access is a single indirect call */
+extern eZ80portrange_t apb_map[0x10];
 
-/* External APB entries */
-extern apb_map_entry_t apb_map[0x10];
+/* Accesses only leave the fast path while a port monitor entry is set */
+extern bool apb_slow_path;
 
 void apb_set_map(int entry, eZ80portrange_t* range);
+void apb_update_slow_path(void);
 
 uint8_t port_read_byte(const uint16_t addr);
 void port_write_byte(const uint16_t addr, const uint8_t value);
 void port_force_write_byte(const uint16_t addr, const uint8_t value);
 
+/* For 0xE00000-0xFFFFFF, mapped to the ports through a table rather than mmio_range() */
+uint16_t mmio_port(const uint32_t addr);
+uint8_t mmio_read_byte(const uint32_t addr);
+void mmio_write_byte(const uint32_t addr, const uint8_t value);
+
 #ifdef __cplusplus
 }
 #endif
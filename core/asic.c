@@ -46,7 +46,7 @@ void write_unimplemented_port(const uint16_t addr, uint8_t value) {
 static void plug_devices(void) {
     /* Unimplemented devices */
     int i;
-    eZ80portrange_t unimplemented_range = { read_unimplemented_port, write_unimplemented_port };
+    eZ80portrange_t unimplemented_range = { read_unimplemented_port, write_unimplemented_port, NULL };
     for (i=0; i<=0xF; i++) {
         asic.cpu->prange[i] = unimplemented_range;
     }
@@ -82,6 +82,7 @@ static void plug_devices(void) {
     add_reset_proc(gpt_reset);
     add_reset_proc(rtc_reset);
     add_reset_proc(watchdog_reset);
+    add_reset_proc(usb_reset);
     add_reset_proc(mem_reset);
 
     gui_console_printf("Initialized APB...\n");
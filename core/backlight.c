@@ -1,8 +1,23 @@
 #include "backlight.h"
+#include "lcd.h"
 
 /* Global BACKLIGHT state */
 backlight_state_t backlight;
 
+/* The level is taken as linear, BACKLIGHT_FULL showing colors as they are and 0 being off,
+ * the same as before it was applied to the display */
+#define BACKLIGHT_FULL 0xFF
+
+void backlight_update(uint8_t brightness) {
+    uint16_t scale = (brightness * 256 + BACKLIGHT_FULL / 2) / BACKLIGHT_FULL;
+
+    backlight.brightness = brightness;
+    if (backlight.scale != scale) {
+        backlight.scale = scale;
+        lcd_dirty_all();
+    }
+}
+
 /* Read from the 0xBXXX range of ports */
 static uint8_t backlight_read(const uint16_t pio) {
     uint8_t addr = (pio >> 2) & 0xFF;
@@ -41,11 +56,11 @@ static void backlight_write(const uint16_t pio, const uint8_t byte)
         case 0x25:
         case 0x26:
             if(byte != 0) {
-                backlight.brightness = 0x00;
+                backlight_update(0x00);
             }
             break;
         case 0x24:
-            backlight.brightness = byte;
+            backlight_update(byte);
             break;
         default:
             backlight.ports[addr] = byte;
@@ -69,7 +84,8 @@ eZ80portrange_t init_backlight(void) {
     backlight.ports[0x02] = 0x61;
     backlight.ports[0x03] = 0x4C;
     backlight.ports[0x20] = 0xFF; /* backlight scaler? (unimplemented) */
-    backlight.brightness = 0xFF;  /* backlight level (PWM)             */
+    backlight.brightness = BACKLIGHT_FULL; /* backlight level (PWM)    */
+    backlight.scale = 256;                 /* so colors are unchanged */
 
     return device;
 }
@@ -10,12 +10,15 @@ extern "C" {
 typedef struct backlight_state {
     uint8_t ports[0x100];
     uint8_t brightness;
+    uint16_t scale;     /* Applied to displayed colors, 0-256 */
 } backlight_state_t;
 
 /* Global BACKLIGHT state */
 extern backlight_state_t backlight;
 
 eZ80portrange_t init_backlight(void);
+/* Sets the PWM level as the port does, rescaling the displayed colors */
+void backlight_update(uint8_t brightness);
 
 #ifdef __cplusplus
 }
@@ -1,9 +1,12 @@
-#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "../emu.h"
-#include "../lcd.h"
 #include "gif.h"
 #include "giflib.h"
 
@@ -11,74 +14,362 @@ struct RGB24 {
     uint8_t r, g, b, a;
 };
 
+/* Frames are copied into a small queue on the emulator thread and encoded by a
+ * worker thread, so quantization and LZW never stall emulation. */
+struct GifSlot {
+    std::vector<uint32_t> pixels;
+    uint32_t rows[LCD_ROW_WORDS];   /* Scanlines changed since the previously queued frame */
+    unsigned int delay;
+    unsigned int colors;
+    uint32_t palette[256];
+};
+
+static const unsigned int queue_size = 8;
+
 static std::mutex gif_mutex;
-static bool recording = false;
-static GifWriter writer;
-static std::vector<RGB24> buffer;
+static std::condition_variable queue_filled, queue_drained;
+static std::thread worker;
+static std::atomic<bool> recording(false);
+static std::atomic<bool> failed(false);
+static bool stopping = false;
+static gif_backpressure_t backpressure = GIF_DROP_FRAMES;
+
+/* Protected by gif_mutex */
+static GifSlot queue[queue_size];
+static unsigned int queue_head = 0, queue_count = 0;
+static bool queue_busy = false;         /* The worker is converting queue[queue_head] */
+static unsigned int extra_delay = 0;    /* Repeats of the newest frame the worker already took */
+static unsigned int dropped = 0;
+
+/* Producer side, also protected by gif_mutex */
 static unsigned int framenr = 0, framenrskip = 0, framedelay = 0;
+static bool changed = false;
+static uint32_t last_seq = 0;
+static uint32_t rows[LCD_ROW_WORDS];    /* Scanlines changed since the last queued frame */
+
+/* Worker side. The newest frame is held back until a different one arrives, so
+ * runs of identical frames turn into a single longer frame. In paletted modes
+ * the LCD palette is used as is and only the changed rectangle gets written;
+ * other modes go through quantization. */
+static GifWriter writer;
+static std::vector<RGB24> buffer;           /* held as RGB, for quantization */
+static std::vector<uint32_t> held, shown;   /* held frame, and what the GIF shows so far */
+static std::vector<uint8_t> indices;
+static uint32_t held_palette[256];
+static unsigned int held_colors, held_delay;
+static bool have_held, shown_valid;
+static uint32_t rgb_rows[LCD_ROW_WORDS];    /* Scanlines of buffer that are out of date */
+
+static bool gif_write_rgb()
+{
+    for(unsigned int row = 0; row < 240; ++row)
+    {
+        if(!(rgb_rows[row >> 5] >> (row & 31) & 1)) {
+            continue;
+        }
+        const uint32_t *ptr32 = held.data() + row*320;
+        RGB24 *ptr24 = buffer.data() + row*320;
+        for(unsigned int i = 0; i < 320; ++i)
+        {
+            ptr24->r = *ptr32 >> 16;
+            ptr24->g = *ptr32 >> 8;
+            ptr24->b = *ptr32;
+            ++ptr24;
+            ++ptr32;
+        }
+    }
+    memset(rgb_rows, 0, sizeof(rgb_rows));
+
+    shown_valid = false;
+    return GifWriteFrame(&writer, reinterpret_cast<const uint8_t*>(buffer.data()), 320, 240, held_delay);
+}
+
+static bool gif_write_paletted()
+{
+    unsigned int left = 320, top = 240, right = 0, bottom = 0;
+
+    /* Bounding box of what changed since the last written frame */
+    if(shown_valid) {
+        for(unsigned int y = 0; y < 240; ++y) {
+            const uint32_t *a = held.data() + y*320, *b = shown.data() + y*320;
+            if(!memcmp(a, b, 320 * sizeof(uint32_t))) {
+                continue;
+            }
+            unsigned int x0 = 0, x1 = 320;
+            while(a[x0] == b[x0]) { ++x0; }
+            while(a[x1 - 1] == b[x1 - 1]) { --x1; }
+            left = x0 < left ? x0 : left;
+            right = x1 > right ? x1 : right;
+            top = y < top ? y : top;
+            bottom = y + 1;
+        }
+        if(left >= right) {
+            left = top = 0;
+            right = bottom = 1;
+        }
+    } else {
+        left = top = 0;
+        right = 320;
+        bottom = 240;
+    }
+
+    /* Duplicate palette entries share one GIF color. Index 0 is transparent if there's room for it. */
+    GifPalette pal;
+    std::unordered_map<uint32_t, uint8_t> map;
+    unsigned int count = 0;
+    for(unsigned int i = 0; i < held_colors; ++i) {
+        if(map.count(held_palette[i])) {
+            continue;
+        }
+        map[held_palette[i]] = count;
+        pal.r[count] = held_palette[i] >> 16;
+        pal.g[count] = held_palette[i] >> 8;
+        pal.b[count] = held_palette[i];
+        count++;
+    }
+    bool transparent = shown_valid && count < 256;
+    unsigned int first = transparent ? 1 : 0;
+    if(transparent) {
+        for(unsigned int i = count; i > 0; --i) {
+            pal.r[i] = pal.r[i - 1];
+            pal.g[i] = pal.g[i - 1];
+            pal.b[i] = pal.b[i - 1];
+        }
+    }
+    for(pal.bitDepth = 2; (1u << pal.bitDepth) < count + first; ++pal.bitDepth) { }
+    for(unsigned int i = count + first; i < (1u << pal.bitDepth); ++i) {
+        pal.r[i] = pal.g[i] = pal.b[i] = 0;
+    }
+
+    unsigned int width = right - left, height = bottom - top;
+    uint32_t last = held[top*320 + left];
+    uint8_t last_index = map[last] + first;
+    indices.resize(width * height);
+    for(unsigned int y = 0; y < height; ++y) {
+        const uint32_t *a = held.data() + (top + y)*320 + left, *b = shown.data() + (top + y)*320 + left;
+        uint8_t *out = indices.data() + y*width;
+        for(unsigned int x = 0; x < width; ++x) {
+            if(transparent && a[x] == b[x]) {
+                out[x] = kGifTransIndex;
+                continue;
+            }
+            if(a[x] != last) {
+                last = a[x];
+                last_index = map[last] + first;
+            }
+            out[x] = last_index;
+        }
+        memcpy(shown.data() + (top + y)*320 + left, a, width * sizeof(uint32_t));
+    }
+
+    GifWriteLzwIndices(writer.f, indices.data(), 1, width, left, top, width, height, held_delay, &pal, transparent);
+
+    /* The quantizer's idea of the previous frame is out of date now */
+    writer.firstFrame = true;
+    memset(rgb_rows, 0xFF, sizeof(rgb_rows));
+    shown_valid = true;
+    return !ferror(writer.f);
+}
+
+static bool gif_write_held()
+{
+    return held_colors ? gif_write_paletted() : gif_write_rgb();
+}
+
+static void gif_worker()
+{
+    std::unique_lock<std::mutex> lock(gif_mutex);
+
+    have_held = shown_valid = false;
+    memset(rgb_rows, 0xFF, sizeof(rgb_rows));
+
+    for(;;) {
+        queue_filled.wait(lock, [] { return queue_count || stopping; });
+        if(!queue_count) {
+            break;
+        }
+
+        GifSlot *slot = &queue[queue_head];
+        held_delay += extra_delay;
+        queue_busy = true;
+        extra_delay = 0;
+        lock.unlock();
+
+        /* The slot only differs from the held frame in its changed scanlines */
+        bool same = have_held;
+        for(unsigned int row = 0; same && row < 240; ++row) {
+            if(slot->rows[row >> 5] >> (row & 31) & 1) {
+                same = !memcmp(slot->pixels.data() + row*320, held.data() + row*320, 320 * sizeof(uint32_t));
+            }
+        }
+
+        if(!same) {
+            if(have_held && !failed && !gif_write_held()) {
+                failed = true;
+            }
+            for(unsigned int row = 0; row < 240; ++row) {
+                if(slot->rows[row >> 5] >> (row & 31) & 1) {
+                    memcpy(held.data() + row*320, slot->pixels.data() + row*320, 320 * sizeof(uint32_t));
+                }
+            }
+            for(unsigned int i = 0; i < LCD_ROW_WORDS; ++i) {
+                rgb_rows[i] |= slot->rows[i];
+            }
+            held_colors = slot->colors;
+            memcpy(held_palette, slot->palette, sizeof(held_palette));
+        }
+
+        lock.lock();
+        held_delay = same ? held_delay + slot->delay : slot->delay;
+        have_held = true;
+        queue_busy = false;
+        queue_head = (queue_head + 1) % queue_size;
+        queue_count--;
+        queue_drained.notify_all();
+    }
+
+    held_delay += extra_delay;
+    if(have_held && !failed && !gif_write_held()) {
+        failed = true;
+    }
+}
+
+void gif_set_backpressure(gif_backpressure_t policy)
+{
+    std::lock_guard<std::mutex> lock(gif_mutex);
+    backpressure = policy;
+}
+
+unsigned int gif_dropped_frames()
+{
+    std::lock_guard<std::mutex> lock(gif_mutex);
+    return dropped;
+}
 
 bool gif_start_recording(const char *filename, unsigned int frameskip)
 {
     std::lock_guard<std::mutex> lock(gif_mutex);
 
+    if(recording) {
+        return false;
+    }
+
     framenr = framenrskip = frameskip;
     framedelay = 100 / (60/(frameskip+1));
 
-    if(GifBegin(&writer, filename, 320, 240, framedelay))
-        recording = true;
+    if(!GifBegin(&writer, filename, 320, 240, framedelay))
+        return false;
 
     buffer.resize(320*240);
+    held.resize(320*240);
+    shown.resize(320*240);
+    for(GifSlot &slot : queue) {
+        slot.pixels.resize(320*240);
+    }
+    queue_head = queue_count = 0;
+    queue_busy = stopping = false;
+    extra_delay = dropped = 0;
+    changed = true;
+    memset(rows, 0xFF, sizeof(rows));
+    failed = false;
+    recording = true;
+    worker = std::thread(gif_worker);
 
     gui_console_printf("Started recording GIF image.\n");
-    return recording;
+    return true;
 }
 
-void gif_new_frame()
+void gif_new_frame(const lcd_frame_t *frame)
 {
     if(!recording) {
         return;
     }
 
-    std::lock_guard<std::mutex> gif_lock(gif_mutex);
+    std::unique_lock<std::mutex> lock(gif_mutex);
 
-    if(!recording || --framenr) {
+    if(!recording || failed) {
         return;
     }
 
-    framenr = framenrskip;
+    if(frame->seq != last_seq) {
+        /* frame->changed is only against the previous publish, which may not have been
+         * passed on here (resets, power toggles, script hashes), so take a gap as all rows */
+        if(frame->seq != last_seq + 1) {
+            memset(rows, 0xFF, sizeof(rows));
+        } else {
+            for(unsigned int i = 0; i < LCD_ROW_WORDS; ++i) {
+                rows[i] |= frame->changed[i];
+            }
+        }
+        last_seq = frame->seq;
+        changed = true;
+    }
 
-    static std::array<uint16_t, 320 * 240> framebuffer;
+    if(--framenr) {
+        return;
+    }
 
-    uint32_t bitfields[] = { 0x01F, 0x000, 0x000};
+    framenr = framenrskip;
 
-    lcd_drawframe(framebuffer.data(), bitfields);
+    if(queue_count == queue_size && changed) {
+        if(backpressure == GIF_DROP_FRAMES) {
+            dropped++;
+            changed = false;    /* Its scanlines are still in rows for the next queued frame */
+        } else {
+            queue_drained.wait(lock, [] { return queue_count < queue_size || !recording; });
+            if(!recording) {
+                return;
+            }
+        }
+    }
 
-    uint16_t *ptr16 = framebuffer.data();
-    RGB24 *ptr24 = buffer.data();
-    for(unsigned int i = 0; i < 320*240; ++i)
-    {
-        ptr24->r = (*ptr16 & 0b1111100000000000) >> 8;
-        ptr24->g = (*ptr16 & 0b0000011111100000) >> 3;
-        ptr24->b = (*ptr16 & 0b0000000000011111) << 3;
-        ++ptr24;
-        ++ptr16;
+    if(!changed) {
+        /* Same picture as before, so just show the newest frame for longer */
+        if(queue_count > (queue_busy ? 1u : 0u)) {
+            queue[(queue_head + queue_count - 1) % queue_size].delay += framedelay;
+        } else {
+            extra_delay += framedelay;
+        }
+        return;
     }
 
-    if(!GifWriteFrame(&writer, reinterpret_cast<const uint8_t*>(buffer.data()), 320, 240, framedelay))
-        recording = false;
+    GifSlot &slot = queue[(queue_head + queue_count) % queue_size];
+    memcpy(slot.pixels.data(), frame->pixels, sizeof(frame->pixels));
+    memcpy(slot.rows, rows, sizeof(rows));
+    slot.delay = framedelay;
+    slot.colors = frame->colors;
+    memcpy(slot.palette, frame->palette, frame->colors * sizeof(uint32_t));
+    queue_count++;
+    queue_filled.notify_one();
+
+    memset(rows, 0, sizeof(rows));
+    changed = false;
 }
 
 bool gif_stop_recording()
 {
-    std::lock_guard<std::mutex> lock(gif_mutex);
-
-    bool ret = recording;
+    {
+        std::lock_guard<std::mutex> lock(gif_mutex);
+        if(!recording) {
+            return false;
+        }
+        recording = false;
+        stopping = true;
+    }
 
-    recording = false;
+    queue_filled.notify_one();
+    queue_drained.notify_all();
+    worker.join();
 
-    buffer.clear();
     GifEnd(&writer);
+    buffer.clear();
+    held.clear();
+    shown.clear();
 
-    gui_console_printf("Done recording GIF image.\n");
-    return ret;
+    if(dropped) {
+        gui_console_printf("Done recording GIF image, %u frames dropped.\n", dropped);
+    } else {
+        gui_console_printf("Done recording GIF image.\n");
+    }
+    return !failed;
 }
@@ -7,10 +7,21 @@ extern "C" {
 
 #include <stdbool.h>
 
+#include "../lcdframe.h"
+
+/* What gif_new_frame() does when the encoder falls behind */
+typedef enum {
+    GIF_DROP_FRAMES,    /* Skip the frame, emulation never waits */
+    GIF_BLOCK           /* Wait for the encoder, every frame is kept */
+} gif_backpressure_t;
+
 bool gif_start_recording(const char *filename, unsigned int frameskip);
-void gif_new_frame();
+void gif_new_frame(const lcd_frame_t *frame);
 bool gif_stop_recording();
 
+void gif_set_backpressure(gif_backpressure_t policy);
+unsigned int gif_dropped_frames();
+
 #ifdef __cplusplus
 }
 #endif
@@ -122,8 +122,9 @@ void GifThresholdImage( const uint8_t* lastFrame, const uint8_t* nextFrame, uint
 void GifWriteBit( GifBitStatus& stat, uint32_t bit );
 void GifWriteChunk( FILE* f, GifBitStatus& stat );
 void GifWriteCode( FILE* f, GifBitStatus& stat, uint32_t code, uint32_t length );
-void GifWritePalette( const GifPalette* pPal, FILE* f );
+void GifWritePalette( const GifPalette* pPal, FILE* f, bool transparent = true );
 void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal);
+void GifWriteLzwIndices(FILE* f, const uint8_t* indices, uint32_t pixelStride, uint32_t rowStride, uint32_t left, uint32_t top, uint32_t width, uint32_t height, uint32_t delay, const GifPalette* pPal, bool transparent);
 bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t height, uint32_t delay);
 bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth = 8, bool dither = false );
 bool GifEnd( GifWriter* writer );
@@ -626,11 +627,11 @@ void GifWriteCode( FILE* f, GifBitStatus& stat, uint32_t code, uint32_t length )
 }
 
 // write a 256-color (8-bit) image palette to the file
-void GifWritePalette( const GifPalette* pPal, FILE* f )
+void GifWritePalette( const GifPalette* pPal, FILE* f, bool transparent )
 {
-    fputc(0, f);  // first color: transparency
-    fputc(0, f);
-    fputc(0, f);
+    fputc(transparent ? 0 : pPal->r[0], f);  // first color: transparency
+    fputc(transparent ? 0 : pPal->g[0], f);
+    fputc(transparent ? 0 : pPal->b[0], f);
 
     for(int ii=1; ii<(1 << pPal->bitDepth); ++ii)
     {
@@ -646,12 +647,19 @@ void GifWritePalette( const GifPalette* pPal, FILE* f )
 
 // write the image header, LZW-compress and write out the image
 void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal)
+{
+    // the palette index of each pixel is kept in its alpha byte
+    GifWriteLzwIndices(f, image+3, 4, width*4, left, top, width, height, delay, pPal, true);
+}
+
+// same as above, for an image of palette indices that may be part of a larger buffer
+void GifWriteLzwIndices(FILE* f, const uint8_t* indices, uint32_t pixelStride, uint32_t rowStride, uint32_t left, uint32_t top, uint32_t width, uint32_t height, uint32_t delay, const GifPalette* pPal, bool transparent)
 {
     // graphics control extension
     fputc(0x21, f);
     fputc(0xf9, f);
     fputc(0x04, f);
-    fputc(0x05, f); // leave prev frame in place, this frame has transparency
+    fputc(transparent ? 0x05 : 0x04, f); // leave prev frame in place, this frame may have transparency
     fputc(delay & 0xff, f);
     fputc((delay >> 8) & 0xff, f);
     fputc(kGifTransIndex, f); // transparent color index
@@ -673,7 +681,7 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
     //fputc(0x80, f); // no local color table, but transparency
 
     fputc(0x80 + pPal->bitDepth-1, f); // local color table present, 2 ^ bitDepth entries
-    GifWritePalette(pPal, f);
+    GifWritePalette(pPal, f, transparent);
 
     const int minCodeSize = pPal->bitDepth;
     const uint32_t clearCode = 1 << pPal->bitDepth;
@@ -698,7 +706,7 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
     {
         for(uint32_t xx=0; xx<width; ++xx)
         {
-            uint8_t nextValue = image[(yy*width+xx)*4+3];
+            uint8_t nextValue = indices[yy*rowStride+xx*pixelStride];
 
             // "loser mode" - no compression, every single code is followed immediately by a clear
             //WriteCode( f, stat, nextValue, codeSize );
@@ -734,7 +742,6 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
                     GifWriteCode(f, stat, clearCode, codeSize); // clear tree
 
                     memset(codetree, 0, sizeof(GifLzwNode)*4096);
-                    nextValue = -1;
                     codeSize = minCodeSize+1;
                     maxCode = clearCode+1;
                 }
@@ -0,0 +1,292 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#define fdopen _fdopen
+#define close _close
+#endif
+
+#include "../emu.h"
+#include "../schedule.h"
+#include "../../os/os.h"
+#include "video.h"
+
+/* Stream recording: frames are copied into a small queue and written out by a
+ * worker thread. When the reader is too slow the queue fills up and frames are
+ * dropped, the emulator never waits. */
+struct VideoSlot {
+    std::vector<uint32_t> pixels;
+    uint64_t cycles;
+    bool repeat;                /* Same picture as the slot before it, pixels not copied */
+};
+
+static const unsigned int queue_size = 16;
+
+static std::mutex video_mutex;
+static std::condition_variable queue_filled;
+static std::thread worker;
+static std::atomic<bool> streaming(false);
+static std::atomic<bool> failed(false);
+static bool stopping = false;
+static VideoSlot queue[queue_size];
+static unsigned int queue_head = 0, queue_count = 0;
+static unsigned int dropped = 0;
+static uint32_t last_seq = 0;
+
+static FILE *file = NULL;
+static video_format_t format;
+
+/* Shared memory ring, written directly by the emulator thread */
+static video_shm_header_t *shm = NULL;
+static size_t shm_size = 0;
+static char shm_name[256];
+
+static void video_convert(const uint32_t *in, std::vector<uint8_t> &out)
+{
+    if(format == VIDEO_RGB24) {
+        uint8_t *p = out.data();
+        for(unsigned int i = 0; i < 320*240; ++i) {
+            *p++ = in[i] >> 16;
+            *p++ = in[i] >> 8;
+            *p++ = in[i];
+        }
+    } else {
+        /* BT.601, limited range */
+        uint8_t *y = out.data(), *u = y + 320*240, *v = u + 320*240;
+        for(unsigned int i = 0; i < 320*240; ++i) {
+            int r = in[i] >> 16 & 0xFF, g = in[i] >> 8 & 0xFF, b = in[i] & 0xFF;
+            y[i] = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+            u[i] = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+            v[i] = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
+        }
+    }
+}
+
+static void video_worker()
+{
+    std::unique_lock<std::mutex> lock(video_mutex);
+    std::vector<uint8_t> out(320*240*3);
+
+    if(format == VIDEO_Y4M) {
+        fputs("YUV4MPEG2 W320 H240 F60:1 Ip A1:1 C444 XCOLORRANGE=LIMITED\n", file);
+    }
+
+    for(;;) {
+        queue_filled.wait(lock, [] { return queue_count || stopping; });
+        if(!queue_count) {
+            break;
+        }
+
+        VideoSlot *slot = &queue[queue_head];
+        lock.unlock();
+
+        if(!slot->repeat) {
+            video_convert(slot->pixels.data(), out);
+        }
+        if(format == VIDEO_Y4M) {
+            fprintf(file, "FRAME XCYCLE=%llu\n", static_cast<unsigned long long>(slot->cycles));
+        }
+        if(fwrite(out.data(), 1, out.size(), file) != out.size()) {
+            failed = true;
+        }
+
+        lock.lock();
+        queue_head = (queue_head + 1) % queue_size;
+        queue_count--;
+        if(failed) {
+            break;
+        }
+    }
+}
+
+static bool video_start_file(FILE *f, video_format_t fmt)
+{
+    std::lock_guard<std::mutex> lock(video_mutex);
+
+    if(streaming || shm) {
+        fclose(f);
+        return false;
+    }
+
+    file = f;
+    format = fmt;
+    for(VideoSlot &slot : queue) {
+        slot.pixels.resize(320*240);
+    }
+    queue_head = queue_count = dropped = last_seq = 0;
+    stopping = false;
+    failed = false;
+    streaming = true;
+    worker = std::thread(video_worker);
+
+    gui_console_printf("Started streaming video.\n");
+    return true;
+}
+
+bool video_start_stream(const char *filename, video_format_t fmt)
+{
+    FILE *f = fopen_utf8(filename, "wb");
+    return f && video_start_file(f, fmt);
+}
+
+bool video_start_fd(int fd, video_format_t fmt)
+{
+    FILE *f = fdopen(fd, "wb");
+    if(!f) {
+        close(fd);
+        return false;
+    }
+    return video_start_file(f, fmt);
+}
+
+bool video_start_shm(const char *name, unsigned int slots)
+{
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lock(video_mutex);
+
+    if(streaming || shm || !slots || strlen(name) >= sizeof(shm_name)) {
+        return false;
+    }
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if(fd < 0) {
+        return false;
+    }
+
+    size_t size = sizeof(video_shm_header_t) + slots * sizeof(video_shm_slot_t);
+    void *map = MAP_FAILED;
+    if(!ftruncate(fd, size)) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+
+    shm = static_cast<video_shm_header_t*>(map);
+    shm_size = size;
+    strcpy(shm_name, name);
+    memset(shm, 0, size);
+    shm->header_size = sizeof(video_shm_header_t);
+    shm->width = 320;
+    shm->height = 240;
+    shm->format = 0;
+    shm->slots = slots;
+    shm->slot_size = sizeof(video_shm_slot_t);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(shm->magic, VIDEO_SHM_MAGIC, sizeof(shm->magic));
+    dropped = 0;
+
+    gui_console_printf("Started publishing video to shared memory %s.\n", name);
+    return true;
+#else
+    (void)name;
+    (void)slots;
+    return false;
+#endif
+}
+
+/* A seqlock per slot. The readers are other processes, so the seq fields are plain words
+ * in the mapping, stored to with atomic builtins rather than through std::atomic. */
+static void video_shm_frame(const lcd_frame_t *frame, uint64_t cycles)
+{
+#ifndef _WIN32
+    uint64_t seq = shm->write_seq + 1;
+    video_shm_slot_t *slot = reinterpret_cast<video_shm_slot_t*>(reinterpret_cast<uint8_t*>(shm) + shm->header_size)
+                             + seq % shm->slots;
+
+    /* Readers see the slot as being written before any of the new pixels */
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(slot->pixels, frame->pixels, sizeof(slot->pixels));
+    slot->cycles = cycles;
+    /* And only see the new seq once all of them are there */
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->write_seq, seq, __ATOMIC_RELEASE);
+#else
+    (void)frame;
+    (void)cycles;
+#endif
+}
+
+void video_new_frame(const lcd_frame_t *frame)
+{
+    if(!streaming && !shm) {
+        return;
+    }
+
+    uint64_t cycles = sched_cycles();
+    std::lock_guard<std::mutex> lock(video_mutex);
+
+    if(shm) {
+        video_shm_frame(frame, cycles);
+        return;
+    }
+
+    if(!streaming || failed) {
+        return;
+    }
+
+    if(queue_count == queue_size) {
+        dropped++;
+        last_seq = 0;   /* The next frame can't refer to this one */
+        return;
+    }
+
+    VideoSlot &slot = queue[(queue_head + queue_count) % queue_size];
+    slot.cycles = cycles;
+    slot.repeat = frame->seq == last_seq;
+    if(!slot.repeat) {
+        memcpy(slot.pixels.data(), frame->pixels, sizeof(frame->pixels));
+        last_seq = frame->seq;
+    }
+    queue_count++;
+    queue_filled.notify_one();
+}
+
+unsigned int video_dropped_frames(void)
+{
+    std::lock_guard<std::mutex> lock(video_mutex);
+    return dropped;
+}
+
+bool video_stop(void)
+{
+    bool ok = true;
+
+    if(streaming) {
+        {
+            std::lock_guard<std::mutex> lock(video_mutex);
+            streaming = false;
+            stopping = true;
+        }
+        queue_filled.notify_one();
+        worker.join();
+        ok = !failed && !ferror(file);
+        fclose(file);
+        file = NULL;
+        gui_console_printf("Done streaming video, %u frames dropped.\n", dropped);
+    }
+
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lock(video_mutex);
+    if(shm) {
+        munmap(shm, shm_size);
+        shm_unlink(shm_name);
+        shm = NULL;
+        gui_console_printf("Stopped publishing video to shared memory.\n");
+    }
+#endif
+
+    return ok;
+}
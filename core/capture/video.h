@@ -0,0 +1,67 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "../lcdframe.h"
+
+/* Lossless frame capture at the full LCD refresh rate, for external tools.
+ * Every LCD refresh is captured and stamped with the emulated CPU cycle count.
+ * Capturing never blocks the emulator thread; frames that can't be written in
+ * time are dropped and counted. */
+
+typedef enum {
+    VIDEO_RGB24,    /* Raw rgb24, 320x240, e.g. ffmpeg -f rawvideo -pix_fmt rgb24 -s 320x240 -r 60 -i <pipe> */
+    VIDEO_Y4M       /* YUV4MPEG2 4:4:4, each FRAME header carries XCYCLE=<cpu cycles> */
+} video_format_t;
+
+/* Stream to a file or named pipe */
+bool video_start_stream(const char *filename, video_format_t format);
+/* Stream to an already open file descriptor, which is closed when recording stops */
+bool video_start_fd(int fd, video_format_t format);
+
+/* Publish frames into a POSIX shared memory ring that other processes can map.
+ * The layout is described by video_shm_header_t below. Not available on Windows. */
+bool video_start_shm(const char *name, unsigned int slots);
+
+void video_new_frame(const lcd_frame_t *frame);
+bool video_stop(void);
+unsigned int video_dropped_frames(void);
+
+/* Shared memory layout: the header, followed by `slots` slots of `slot_size` bytes.
+ * Slot n holds frame number seq with seq % slots == n. A slot's seq is 0 while it
+ * is being written. Both seq fields are stored with release ordering after the data
+ * they cover. To read the newest frame:
+ *
+ *   seq = __atomic_load_n(&header->write_seq, __ATOMIC_ACQUIRE);
+ *   if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) retry;
+ *   copy the pixels and cycles;
+ *   atomic_thread_fence(memory_order_acquire);
+ *   if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) retry, the copy is torn */
+#define VIDEO_SHM_MAGIC "CEMUVID1"
+
+typedef struct video_shm_header {
+    char magic[8];
+    uint32_t header_size;
+    uint32_t width, height;
+    uint32_t format;            /* 0: ARGB32 (0xAARRGGBB words in host byte order) */
+    uint32_t slots;
+    uint32_t slot_size;
+    volatile uint64_t write_seq; /* Number of the newest complete frame, 0 if none yet */
+} video_shm_header_t;
+
+typedef struct video_shm_slot {
+    volatile uint64_t seq;
+    uint64_t cycles;            /* Emulated CPU cycles since reset */
+    uint32_t pixels[320 * 240];
+} video_shm_slot_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
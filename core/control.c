@@ -44,6 +44,15 @@ static uint8_t control_read(const uint16_t pio) {
     return read_byte;
 }
 
+static uint8_t control_peek(const uint16_t pio) {
+    uint8_t addr = pio & 0x7F;
+
+    if (addr == 0x0B && (control.ports[0x0A] & 2) == 0) {
+        return control.ports[addr] | 2;
+    }
+    return control_read(pio);
+}
+
 // Write to the 0x0XXX range of ports
 static void control_write(const uint16_t pio, const uint8_t byte)
 {
@@ -168,7 +177,8 @@ static void control_write(const uint16_t pio, const uint8_t byte)
 
 static const eZ80portrange_t device = {
     .read_in    = control_read,
-    .write_out  = control_write
+    .write_out  = control_write,
+    .peek       = control_peek
 };
 
 eZ80portrange_t init_control(void) {
@@ -24,6 +24,8 @@
 #include "registers.h"
 #include "interrupt.h"
 #include "debug/debug.h"
+#include "debug/profile.h"
+#include "debug/timeline.h"
 
 // Global CPU state
 eZ80cpu_t cpu;
@@ -52,8 +54,22 @@ static void cpu_prefetch(uint32_t address, bool mode) {
 }
 static uint8_t cpu_fetch_byte(void) {
     uint8_t value;
-    if (!in_debugger && mem.debug.block[cpu.registers.PC] & (DBG_EXEC_BREAKPOINT | DBG_STEP_OVER_BREAKPOINT)) {
-        debugger(mem.debug.block[cpu.registers.PC] & DBG_EXEC_BREAKPOINT ? HIT_EXEC_BREAKPOINT : DBG_STEP, cpu.registers.PC);
+    if (!in_debugger && mem.debug.block[cpu.registers.PC] & (DBG_EXEC_BREAKPOINT | DBG_STEP_OVER_BREAKPOINT | DBG_STOP_BREAKPOINT)) {
+        uint8_t flags = mem.debug.block[cpu.registers.PC];
+        if (flags & DBG_STOP_BREAKPOINT) {
+            mem.debug.stoppedAt = cpu.registers.PC;
+            cpu_events |= EVENT_STOP;
+        }
+        if (flags & DBG_CONDITIONAL && flags & DBG_EXEC_BREAKPOINT &&
+            !debug_condition_check(cpu.registers.PC, DBG_EXEC_BREAKPOINT)) {
+            flags &= ~DBG_EXEC_BREAKPOINT;
+        }
+        if (flags & (DBG_EXEC_BREAKPOINT | DBG_STEP_OVER_BREAKPOINT)) {
+            debugger(flags & DBG_EXEC_BREAKPOINT ? HIT_EXEC_BREAKPOINT : DBG_STEP, cpu.registers.PC);
+        }
+    }
+    if (mem.debug.watched[cpu.registers.PC >> 12] & DBG_EXEC_BREAKPOINT) {
+        debug_watch_access(cpu.registers.PC, cpu.prefetch, DBG_EXEC_BREAKPOINT);
     }
     value = cpu.prefetch;
     cpu_prefetch(cpu.registers.PC + 1, cpu.ADL);
@@ -129,11 +145,20 @@ static uint32_t cpu_pop_word(void) {
 }
 
 static uint8_t cpu_read_in(uint16_t pio) {
-    return port_read_byte(pio);
+    int cycles = cpu.cycles;
+    uint8_t value = port_read_byte(pio);
+    if (profiling) {
+        profile_port(pio, false, cpu.cycles - cycles);
+    }
+    return value;
 }
 
 static void cpu_write_out(uint16_t pio, uint8_t value) {
+    int cycles = cpu.cycles;
     port_write_byte(pio, value);
+    if (profiling) {
+        profile_port(pio, true, cpu.cycles - cycles);
+    }
 }
 
 static uint32_t cpu_read_sp(void) {
@@ -1037,6 +1062,10 @@ void cpu_execute(void) {
             cpu.IEF1 = cpu.IEF2 = 1;
         }
         if (cpu.IEF1 && (intrpt.request->status & intrpt.request->enabled)) {
+            if (timeline_recording) {
+                timeline_interrupt_ack(intrpt.request->status & intrpt.request->enabled);
+            }
+            mem.debug.instructionAt = r->PC;
             cpu.IEF1 = cpu.IEF2 = cpu.halted = 0;
             cycle_count_delta++;
             if (cpu.IM != 3) {
@@ -1052,6 +1081,10 @@ void cpu_execute(void) {
 
         while (!exiting && (cpu.PREFIX || cpu.SUFFIX || cycle_count_delta < 0)) {
             cpu.cycles = 0;
+            if (!cpu.PREFIX && !cpu.SUFFIX) {
+                /* PC moves on with every fetch, watch hits report where the instruction began */
+                mem.debug.instructionAt = r->PC;
+            }
 
             // fetch opcode
             context.opcode = cpu_fetch_byte();
@@ -1733,6 +1766,7 @@ void cpu_execute(void) {
                                                             break;
                                                         case 0xEE: // flash erase
                                                             memset(mem.flash.block + (r->HL & ~0x3FFF), 0xFF, 0x4000);
+                                                            mem_flash_touched(r->HL & ~0x3FFF, 0x4000);
                                                             break;
                                                         default:   // OPCODETRAP
                                                             cpu.IEF_wait = 1;
@@ -1776,7 +1810,15 @@ exit_loop:
                 //logprintf(LOG_CPU, "Error: Unrecognized instruction 0x%02X.", context.opcode);
                 cycle_count_delta++;
             }
+            if (cpu_events & EVENT_STOP && !cpu.PREFIX && !cpu.SUFFIX) {
+                break;
+            }
         }
         cycle_count_delta += cycle_offset;
+        if (cpu_events & EVENT_STOP) {
+            // Return with the remaining cycles left for the next call
+            cpu_events &= ~EVENT_STOP;
+            break;
+        }
     }
 }
@@ -0,0 +1,527 @@
+#include <ctype.h>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "condition.h"
+#include "debug.h"
+#include "../cpu.h"
+#include "../mem.h"
+#include "../schedule.h"
+
+/* Deep enough for any sane expression, checked when compiling so running needs no checks */
+static const int max_depth = 32;
+static const size_t trace_size = 0x1000;
+
+enum {
+    OP_CONST, OP_REG, OP_READ8, OP_READ16, OP_READ24,
+    OP_NEG, OP_NOT, OP_LNOT,
+    OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_AND, OP_XOR, OP_OR, OP_LAND, OP_LOR
+};
+
+enum {
+    REG_A, REG_F, REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, REG_IXH, REG_IXL, REG_IYH, REG_IYL,
+    REG_I, REG_R, REG_MB, REG_AF, REG_BC, REG_DE, REG_HL, REG_IX, REG_IY, REG_SP, REG_SPS, REG_SPL,
+    REG_PC, REG_CF, REG_NF, REG_PVF, REG_HF, REG_ZF, REG_SF, REG_ADL, REG_IEF, REG_CYCLES
+};
+
+static const struct {
+    const char *name;
+    uint8_t reg;
+} names[] = {
+    { "A", REG_A }, { "F", REG_F }, { "B", REG_B }, { "C", REG_C }, { "D", REG_D }, { "E", REG_E },
+    { "H", REG_H }, { "L", REG_L }, { "IXH", REG_IXH }, { "IXL", REG_IXL }, { "IYH", REG_IYH },
+    { "IYL", REG_IYL }, { "I", REG_I }, { "R", REG_R }, { "MB", REG_MB }, { "AF", REG_AF },
+    { "BC", REG_BC }, { "DE", REG_DE }, { "HL", REG_HL }, { "IX", REG_IX }, { "IY", REG_IY },
+    { "SP", REG_SP }, { "SPS", REG_SPS }, { "SPL", REG_SPL }, { "PC", REG_PC }, { "CF", REG_CF },
+    { "NF", REG_NF }, { "PVF", REG_PVF }, { "HF", REG_HF }, { "ZF", REG_ZF }, { "SF", REG_SF },
+    { "ADL", REG_ADL }, { "IEF", REG_IEF }, { "CYCLES", REG_CYCLES },
+};
+
+/* Longest match wins, so < doesn't take the first half of << or <= */
+static const struct {
+    const char *token;
+    uint8_t op;
+    int level;
+} binary_ops[] = {
+    { "||", OP_LOR, 0 }, { "&&", OP_LAND, 1 }, { "|", OP_OR, 2 }, { "^", OP_XOR, 3 }, { "&", OP_AND, 4 },
+    { "==", OP_EQ, 5 }, { "!=", OP_NE, 5 }, { "<", OP_LT, 6 }, { "<=", OP_LE, 6 }, { ">", OP_GT, 6 },
+    { ">=", OP_GE, 6 }, { "<<", OP_SHL, 7 }, { ">>", OP_SHR, 7 }, { "+", OP_ADD, 8 }, { "-", OP_SUB, 8 },
+    { "*", OP_MUL, 9 }, { "/", OP_DIV, 9 }, { "%", OP_MOD, 9 },
+};
+static const int unary_level = 10;
+
+typedef struct {
+    uint8_t code;
+    int64_t value;
+} op_t;
+
+typedef std::vector<op_t> program_t;
+
+typedef struct {
+    uint32_t id;
+    program_t condition;                /* Empty for always */
+    bool trace;
+    std::vector<program_t> values;
+} condition_t;
+
+typedef struct {
+    const std::string *text;
+    size_t pos;
+    program_t *program;
+    int depth, max_depth;
+    int nesting;                        /* Of parentheses, brackets and unary operators */
+    std::string error;
+} parser_t;
+
+static std::mutex conditions_lock;
+static std::unordered_map<uint32_t, std::unique_ptr<condition_t>> conditions;
+static std::unordered_map<uint32_t, std::vector<std::string>> trace_labels;
+static debug_trace_entry_t trace_ring[trace_size];
+static uint64_t trace_head;
+static uint32_t next_id;
+
+/* Unsigned where signed could overflow, nothing an expression does is undefined */
+static int64_t apply_unary(uint8_t code, int64_t a) {
+    switch (code) {
+        case OP_NEG:  return (int64_t)(0 - (uint64_t)a);
+        case OP_NOT:  return ~a;
+        default:      return !a;
+    }
+}
+
+static int64_t apply_binary(uint8_t code, int64_t a, int64_t b) {
+    switch (code) {
+        case OP_MUL:  return (int64_t)((uint64_t)a * (uint64_t)b);
+        case OP_DIV:  return !b ? 0 : b == -1 ? (int64_t)(0 - (uint64_t)a) : a / b;
+        case OP_MOD:  return !b || b == -1 ? 0 : a % b;
+        case OP_ADD:  return (int64_t)((uint64_t)a + (uint64_t)b);
+        case OP_SUB:  return (int64_t)((uint64_t)a - (uint64_t)b);
+        case OP_SHL:  return b < 0 || b > 63 ? 0 : (int64_t)((uint64_t)a << b);
+        case OP_SHR:  return b < 0 || b > 63 ? 0 : a >> b;
+        case OP_LT:   return a < b;
+        case OP_LE:   return a <= b;
+        case OP_GT:   return a > b;
+        case OP_GE:   return a >= b;
+        case OP_EQ:   return a == b;
+        case OP_NE:   return a != b;
+        case OP_AND:  return a & b;
+        case OP_XOR:  return a ^ b;
+        case OP_OR:   return a | b;
+        case OP_LAND: return a && b;
+        default:      return a || b;
+    }
+}
+
+static int64_t reg_value(int64_t reg) {
+    const eZ80registers_t &r = cpu.registers;
+
+    switch (reg) {
+        case REG_A:      return r.A;
+        case REG_F:      return r.F;
+        case REG_B:      return r.B;
+        case REG_C:      return r.C;
+        case REG_D:      return r.D;
+        case REG_E:      return r.E;
+        case REG_H:      return r.H;
+        case REG_L:      return r.L;
+        case REG_IXH:    return r.IXH;
+        case REG_IXL:    return r.IXL;
+        case REG_IYH:    return r.IYH;
+        case REG_IYL:    return r.IYL;
+        case REG_I:      return r.I;
+        case REG_R:      return r.R;
+        case REG_MB:     return r.MBASE;
+        case REG_AF:     return r.AF;
+        case REG_BC:     return r.BC;
+        case REG_DE:     return r.DE;
+        case REG_HL:     return r.HL;
+        case REG_IX:     return r.IX;
+        case REG_IY:     return r.IY;
+        case REG_SP:     return cpu.ADL ? r.SPL : r.SPS;
+        case REG_SPS:    return r.SPS;
+        case REG_SPL:    return r.SPL;
+        case REG_PC:     return r.PC;
+        case REG_CF:     return r.flags.C;
+        case REG_NF:     return r.flags.N;
+        case REG_PVF:    return r.flags.PV;
+        case REG_HF:     return r.flags.H;
+        case REG_ZF:     return r.flags.Z;
+        case REG_SF:     return r.flags.S;
+        case REG_ADL:    return cpu.ADL;
+        case REG_IEF:    return cpu.IEF1;
+        default:         return (int64_t)sched_cycles();
+    }
+}
+
+static int64_t read_memory(int64_t address, uint32_t size) {
+    uint8_t bytes[3] = { 0, 0, 0 };
+
+    debug_read_range((uint32_t)address, size, bytes);
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16;
+}
+
+static int64_t run(const program_t &program) {
+    int64_t stack[max_depth];
+    int top = 0;
+
+    for (const op_t &op : program) {
+        switch (op.code) {
+            case OP_CONST:
+                stack[top++] = op.value;
+                break;
+            case OP_REG:
+                stack[top++] = reg_value(op.value);
+                break;
+            case OP_READ8:
+                stack[top - 1] = read_memory(stack[top - 1], 1);
+                break;
+            case OP_READ16:
+                stack[top - 1] = read_memory(stack[top - 1], 2);
+                break;
+            case OP_READ24:
+                stack[top - 1] = read_memory(stack[top - 1], 3);
+                break;
+            case OP_NEG: case OP_NOT: case OP_LNOT:
+                stack[top - 1] = apply_unary(op.code, stack[top - 1]);
+                break;
+            default:
+                top--;
+                stack[top - 1] = apply_binary(op.code, stack[top - 1], stack[top]);
+                break;
+        }
+    }
+    return stack[0];
+}
+
+/* Compiling */
+
+static bool fail(parser_t *p, const std::string &message) {
+    p->error = message + " at column " + std::to_string(p->pos + 1);
+    return false;
+}
+
+static void skip_space(parser_t *p) {
+    while (p->pos < p->text->size() && isspace((unsigned char)(*p->text)[p->pos])) {
+        p->pos++;
+    }
+}
+
+static char peek(parser_t *p) {
+    skip_space(p);
+    return p->pos < p->text->size() ? (*p->text)[p->pos] : '\0';
+}
+
+static bool accept(parser_t *p, char c) {
+    if (peek(p) != c) {
+        return false;
+    }
+    p->pos++;
+    return true;
+}
+
+static std::string identifier(parser_t *p) {
+    std::string name;
+
+    skip_space(p);
+    while (p->pos < p->text->size() && (isalnum((unsigned char)(*p->text)[p->pos]) || (*p->text)[p->pos] == '_')) {
+        name += toupper((unsigned char)(*p->text)[p->pos++]);
+    }
+    return name;
+}
+
+/* Operands that are constants are folded right away, so only what depends on state is left to run */
+static void emit(parser_t *p, uint8_t code, int64_t value) {
+    program_t &program = *p->program;
+    size_t size = program.size();
+
+    if (code == OP_CONST || code == OP_REG) {
+        if (++p->depth > p->max_depth) {
+            p->max_depth = p->depth;
+        }
+    } else if (code >= OP_NEG && code <= OP_LNOT) {
+        if (program.back().code == OP_CONST) {
+            program.back().value = apply_unary(code, program.back().value);
+            return;
+        }
+    } else if (code >= OP_MUL) {
+        p->depth--;
+        if (program[size - 1].code == OP_CONST && program[size - 2].code == OP_CONST) {
+            program[size - 2].value = apply_binary(code, program[size - 2].value, program[size - 1].value);
+            program.pop_back();
+            return;
+        }
+    }
+    program.push_back({ code, value });
+}
+
+static bool parse_binary(parser_t *p, int level);
+
+/* Checked while parsing, as each level recurses, where max_depth is only known at the end */
+static bool nest(parser_t *p) {
+    return ++p->nesting <= max_depth || fail(p, "Expression too deep");
+}
+
+static bool parse_number(parser_t *p, int base) {
+    const std::string &text = *p->text;
+    size_t start = p->pos;
+    uint64_t value = 0;
+
+    while (p->pos < text.size() && isxdigit((unsigned char)text[p->pos])) {
+        int digit = isdigit((unsigned char)text[p->pos]) ? text[p->pos] - '0' : (text[p->pos] | 0x20) - 'a' + 10;
+        if (digit >= base) {
+            break;
+        }
+        value = value * base + digit;
+        p->pos++;
+    }
+    if (p->pos == start || (p->pos < text.size() && (isalnum((unsigned char)text[p->pos]) || text[p->pos] == '_'))) {
+        return fail(p, "Malformed number");
+    }
+    emit(p, OP_CONST, (int64_t)value);
+    return true;
+}
+
+static bool parse_memory(parser_t *p, uint8_t code) {
+    if (!nest(p) || !parse_binary(p, 0)) {
+        return false;
+    }
+    p->nesting--;
+    if (!accept(p, ']')) {
+        return fail(p, "Expected ]");
+    }
+    emit(p, code, 0);
+    return true;
+}
+
+static bool parse_primary(parser_t *p) {
+    const std::string &text = *p->text;
+    char c = peek(p);
+
+    if (accept(p, '(')) {
+        if (!nest(p) || !parse_binary(p, 0)) {
+            return false;
+        }
+        p->nesting--;
+        return accept(p, ')') || fail(p, "Expected )");
+    }
+    if (accept(p, '[')) {
+        return parse_memory(p, OP_READ8);
+    }
+    if (accept(p, '$')) {
+        return parse_number(p, 16);
+    }
+    if (c == '0' && p->pos + 1 < text.size() && (text[p->pos + 1] | 0x20) == 'x') {
+        p->pos += 2;
+        return parse_number(p, 16);
+    }
+    if (isdigit((unsigned char)c)) {
+        return parse_number(p, 10);
+    }
+    if (isalpha((unsigned char)c) || c == '_') {
+        size_t start = p->pos;
+        std::string name = identifier(p);
+        if ((name == "W" || name == "L") && accept(p, '[')) {
+            return parse_memory(p, name == "W" ? OP_READ16 : OP_READ24);
+        }
+        for (const auto &entry : names) {
+            if (name == entry.name) {
+                emit(p, OP_REG, entry.reg);
+                return true;
+            }
+        }
+        p->pos = start;
+        return fail(p, "Unknown name " + name + ", hex numbers start with $ or 0x");
+    }
+    return fail(p, c ? std::string("Unexpected ") + c : "Expected a value");
+}
+
+static bool parse_binary(parser_t *p, int level) {
+    if (level == unary_level) {
+        char c = peek(p);
+        if (c == '-' || c == '~' || c == '!') {
+            p->pos++;
+            if (!nest(p) || !parse_binary(p, unary_level)) {
+                return false;
+            }
+            p->nesting--;
+            emit(p, c == '-' ? OP_NEG : c == '~' ? OP_NOT : OP_LNOT, 0);
+            return true;
+        }
+        return parse_primary(p);
+    }
+
+    if (!parse_binary(p, level + 1)) {
+        return false;
+    }
+    for (;;) {
+        size_t best = 0, length = 0;
+        skip_space(p);
+        for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+            size_t n = strlen(binary_ops[i].token);
+            if (n > length && !p->text->compare(p->pos, n, binary_ops[i].token)) {
+                best = i;
+                length = n;
+            }
+        }
+        if (!length || binary_ops[best].level != level) {
+            return true;
+        }
+        p->pos += length;
+        if (!parse_binary(p, level + 1)) {
+            return false;
+        }
+        emit(p, binary_ops[best].op, 0);
+    }
+}
+
+static bool compile(parser_t *p, program_t *program) {
+    p->program = program;
+    p->depth = p->max_depth = p->nesting = 0;
+    if (!parse_binary(p, 0)) {
+        return false;
+    }
+    if (p->max_depth > max_depth) {
+        return fail(p, "Expression too deep");
+    }
+    return true;
+}
+
+/* Whether the next word is keyword, consumed if so */
+static bool keyword(parser_t *p, const char *word) {
+    size_t start = p->pos;
+
+    if (identifier(p) == word) {
+        return true;
+    }
+    p->pos = start;
+    return false;
+}
+
+bool debug_condition_set(uint32_t address, const std::string &text, std::string *error) {
+    std::unique_ptr<condition_t> condition(new condition_t());
+    std::vector<std::string> labels;
+    parser_t p = { &text, 0, nullptr, 0, 0, 0, std::string() };
+
+    address &= 0xFFFFFF;
+    if (text.find_first_not_of(" \t") == std::string::npos) {
+        debug_condition_remove(address);
+        return true;
+    }
+
+    condition->trace = keyword(&p, "TRACE");
+    if (condition->trace) {
+        do {
+            size_t start;
+            skip_space(&p);
+            start = p.pos;
+            if (condition->values.size() == DEBUG_TRACE_VALUES) {
+                fail(&p, "At most " + std::to_string(DEBUG_TRACE_VALUES) + " values can be traced");
+                *error = p.error;
+                return false;
+            }
+            condition->values.emplace_back();
+            if (!compile(&p, &condition->values.back())) {
+                *error = p.error;
+                return false;
+            }
+            labels.push_back(text.substr(start, p.pos - start));
+            labels.back().erase(labels.back().find_last_not_of(" \t") + 1);
+        } while (accept(&p, ','));
+    }
+    if (keyword(&p, "IF") || (!condition->trace && peek(&p))) {
+        if (!compile(&p, &condition->condition)) {
+            *error = p.error;
+            return false;
+        }
+        if (condition->condition.size() == 1 && condition->condition[0].code == OP_CONST &&
+            condition->condition[0].value) {
+            condition->condition.clear();
+        }
+    }
+    if (peek(&p)) {
+        fail(&p, std::string("Unexpected ") + peek(&p));
+        *error = p.error;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(conditions_lock);
+    condition->id = next_id++;
+    if (condition->trace) {
+        trace_labels[condition->id] = std::move(labels);
+    }
+    conditions[address] = std::move(condition);
+    mem.debug.block[address] |= DBG_CONDITIONAL;
+    return true;
+}
+
+void debug_condition_remove(uint32_t address) {
+    std::lock_guard<std::mutex> guard(conditions_lock);
+
+    address &= 0xFFFFFF;
+    conditions.erase(address);
+    mem.debug.block[address] &= ~DBG_CONDITIONAL;
+}
+
+bool debug_condition_check(uint32_t address, uint8_t type) {
+    std::lock_guard<std::mutex> guard(conditions_lock);
+    auto it = conditions.find(address & 0xFFFFFF);
+
+    if (it == conditions.end()) {
+        return true;
+    }
+    const condition_t &condition = *it->second;
+    if (!condition.condition.empty() && !run(condition.condition)) {
+        return false;
+    }
+    if (!condition.trace) {
+        return true;
+    }
+
+    debug_trace_entry_t &entry = trace_ring[trace_head++ % trace_size];
+    entry.cycle = sched_cycles();
+    entry.id = condition.id;
+    entry.address = address & 0xFFFFFF;
+    entry.pc = mem.debug.instructionAt;
+    entry.type = type;
+    entry.count = condition.values.size();
+    for (size_t i = 0; i < condition.values.size(); i++) {
+        entry.values[i] = (uint32_t)run(condition.values[i]);
+    }
+    return false;
+}
+
+uint64_t debug_trace_read(uint64_t *cursor, std::vector<debug_trace_entry_t> *entries) {
+    std::lock_guard<std::mutex> guard(conditions_lock);
+    uint64_t lost = 0;
+
+    if (trace_head - *cursor > trace_size) {
+        lost = trace_head - *cursor - trace_size;
+        *cursor = trace_head - trace_size;
+    }
+    for (; *cursor < trace_head; ++*cursor) {
+        entries->push_back(trace_ring[*cursor % trace_size]);
+    }
+    return lost;
+}
+
+std::string debug_trace_format(const debug_trace_entry_t &entry) {
+    std::lock_guard<std::mutex> guard(conditions_lock);
+    auto it = trace_labels.find(entry.id);
+    char buffer[48];
+    std::string line;
+
+    snprintf(buffer, sizeof buffer, "[%llu] %06X %s PC %06X:", (unsigned long long)entry.cycle, entry.address,
+             entry.type == DBG_READ_BREAKPOINT ? "read" : entry.type == DBG_WRITE_BREAKPOINT ? "write" : "exec",
+             entry.pc);
+    line = buffer;
+    for (uint8_t i = 0; i < entry.count; i++) {
+        snprintf(buffer, sizeof buffer, " = %X", entry.values[i]);
+        line += (i ? ", " : " ") + (it != trace_labels.end() && i < it->second.size() ? it->second[i] : "?") + buffer;
+    }
+    return line;
+}
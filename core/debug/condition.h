@@ -0,0 +1,39 @@
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Conditions and tracepoints for the breakpoints at an address, compiled to bytecode when set and
+ * run on the emu thread by debug_condition_check() when one of those breakpoints is hit. The text is
+ *   a condition, optionally after "if":          HL == $D031F6 && A > 3
+ *   a tracepoint, logged without stopping:       trace A, HL, w[$D00595] if ZF
+ * Expressions are C like, over integers. Names are the registers A F B C D E H L IXH IXL IYH IYL I R
+ * MB AF BC DE HL IX IY SP SPS SPL PC, the flags CF NF PVF HF ZF SF, ADL, IEF and CYCLES. [x], w[x]
+ * and l[x] read 8, 16 and 24 bits of memory without side effects. Numbers are decimal, or hex after
+ * $ or 0x. Names are case insensitive. */
+
+#define DEBUG_TRACE_VALUES 4
+
+typedef struct {
+    uint64_t cycle;
+    uint32_t id;                        /* Of the tracepoint, for debug_trace_format() */
+    uint32_t address;
+    uint32_t pc;
+    uint8_t type;                       /* DBG_*_BREAKPOINT that was hit */
+    uint8_t count;
+    uint32_t values[DEBUG_TRACE_VALUES];
+} debug_trace_entry_t;
+
+/* Compiles text and attaches it to address, replacing what was there. Empty text removes it. On
+ * error returns false with a message in *error, and leaves the address as it was. */
+bool debug_condition_set(uint32_t address, const std::string &text, std::string *error);
+void debug_condition_remove(uint32_t address);
+
+/* Appends the trace entries logged since *cursor to *entries, oldest first, and moves *cursor past
+ * them. Returns how many were overwritten in the ring before they could be read. */
+uint64_t debug_trace_read(uint64_t *cursor, std::vector<debug_trace_entry_t> *entries);
+std::string debug_trace_format(const debug_trace_entry_t &entry);
+
+#endif
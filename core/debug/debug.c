@@ -1,12 +1,243 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "debug.h"
 #include "../apb.h"
+#include "../cpu.h"
 #include "../emu.h"
 #include "../mem.h"
+#include "../lcd.h"
 
 volatile bool in_debugger = false;
 
 uint8_t debug_port_read_byte(const uint32_t addr) {
-    return apb_map[port_range(addr)].range->read_in(addr_range(addr));
+    const eZ80portrange_t *range = &apb_map[port_range(addr)];
+    return (range->peek ? range->peek : range->read_in)(addr_range(addr));
+}
+
+void debug_port_set(uint16_t port, uint8_t flags) {
+    mem.debug.ports_armed += !mem.debug.ports[port] - !flags;
+    mem.debug.ports[port] = flags;
+    apb_update_slow_path();
+}
+
+/* Bulk access for the debugger views. Flash and RAM are copied directly, ports go through
+ * their peek handlers, and nothing here costs cycles, sets highlights or hits breakpoints. */
+void debug_read_range(uint32_t addr, uint32_t len, uint8_t *out) {
+    while (len) {
+        const uint8_t *src = NULL;
+        uint32_t chunk, offset;
+
+        addr &= 0xFFFFFF;
+        if (addr < 0x400000) {
+            chunk = 0x400000 - addr;
+            src = mem.flash.block + addr;
+        } else if (addr < 0x800000) {
+            chunk = 0x800000 - addr;
+            if (mem.flash.mapped) {
+                src = mem.flash.block + addr - 0x400000;
+            }
+        } else if (addr < 0xD00000) {
+            chunk = 0xD00000 - addr;
+        } else if (addr < 0xE00000) {
+            /* RAM, unmapped, then mirrored from 0xD80000 */
+            offset = (addr - 0xD00000) & 0x7FFFF;
+            if (offset < 0x65800) {
+                chunk = 0x65800 - offset;
+                src = mem.ram.block + offset;
+            } else {
+                chunk = 0x80000 - offset;
+            }
+        } else {
+            *out++ = debug_port_read_byte(mmio_range(addr) << 12 | addr_range(addr));
+            addr++;
+            len--;
+            continue;
+        }
+
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (src) {
+            memcpy(out, src, chunk);
+        } else {
+            memset(out, 0, chunk);
+        }
+        out += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+void debug_write_range(uint32_t addr, uint32_t len, const uint8_t *in) {
+    while (len) {
+        uint8_t *dst = NULL;
+        uint32_t chunk, offset, first, last;
+
+        addr &= 0xFFFFFF;
+        if (addr < 0x800000) {
+            offset = addr & 0x3FFFFF;
+            chunk = 0x400000 - offset;
+            if (addr < 0x400000 || mem.flash.mapped) {
+                dst = mem.flash.block + offset;
+                mem_flash_touched(offset, chunk < len ? chunk : len);
+            }
+        } else if (addr < 0xD00000) {
+            chunk = 0xD00000 - addr;
+        } else if (addr < 0xE00000) {
+            offset = (addr - 0xD00000) & 0x7FFFF;
+            if (offset < 0x65800) {
+                chunk = 0x65800 - offset;
+                dst = mem.ram.block + offset;
+                first = offset > lcd_dirty.base ? offset : lcd_dirty.base;
+                last = offset + (chunk < len ? chunk : len);
+                if (last > lcd_dirty.base + lcd_dirty.size) {
+                    last = lcd_dirty.base + lcd_dirty.size;
+                }
+                if (first < last) {
+                    for (; first < last; first += lcd_dirty.stride) {
+                        lcd_dirty_ram(first);
+                    }
+                    lcd_dirty_ram(last - 1);
+                }
+            } else {
+                chunk = 0x80000 - offset;
+            }
+        } else {
+            port_force_write_byte(mmio_range(addr) << 12 | addr_range(addr), *in++);
+            addr++;
+            len--;
+            continue;
+        }
+
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (dst) {
+            memcpy(dst, in, chunk);
+        }
+        in += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+/* Watch ranges as set, and flattened into sorted disjoint segments carrying the union of the
+ * flags over them, so a lookup is one binary search however much the ranges overlap */
+typedef struct {
+    uint32_t start, end;
+    uint8_t flags;
+} watch_range_t;
+
+static watch_range_t *watch_ranges, *watch_segments;
+static size_t watch_count, watch_segment_count;
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void watch_rebuild(void) {
+    uint32_t *points = (uint32_t*)malloc(watch_count * 2 * sizeof(uint32_t));
+    size_t i, j, point_count = 0;
+
+    for (i = 0; i < watch_count; i++) {
+        points[point_count++] = watch_ranges[i].start;
+        points[point_count++] = watch_ranges[i].end;
+    }
+    qsort(points, point_count, sizeof(uint32_t), compare_u32);
+
+    watch_segments = (watch_range_t*)realloc(watch_segments, (watch_count * 2 + 1) * sizeof(watch_range_t));
+    watch_segment_count = 0;
+    for (i = 0; i + 1 < point_count; i++) {
+        uint8_t flags = 0;
+        if (points[i] == points[i + 1]) {
+            continue;
+        }
+        for (j = 0; j < watch_count; j++) {
+            if (watch_ranges[j].start <= points[i] && points[i] < watch_ranges[j].end) {
+                flags |= watch_ranges[j].flags;
+            }
+        }
+        if (!flags) {
+            continue;
+        }
+        if (watch_segment_count && watch_segments[watch_segment_count - 1].end == points[i] &&
+            watch_segments[watch_segment_count - 1].flags == flags) {
+            watch_segments[watch_segment_count - 1].end = points[i + 1];
+        } else {
+            watch_segments[watch_segment_count].start = points[i];
+            watch_segments[watch_segment_count].end = points[i + 1];
+            watch_segments[watch_segment_count].flags = flags;
+            watch_segment_count++;
+        }
+    }
+    free(points);
+
+    memset(mem.debug.watched, 0, sizeof(mem.debug.watched));
+    for (i = 0; i < watch_segment_count; i++) {
+        for (j = watch_segments[i].start >> 12; j <= (watch_segments[i].end - 1) >> 12; j++) {
+            mem.debug.watched[j] |= watch_segments[i].flags;
+        }
+    }
+}
+
+bool debug_watch_set(uint32_t start, uint32_t end, uint8_t flags) {
+    size_t i;
+
+    if (start >= end || end > 0x1000000) {
+        return false;
+    }
+    flags &= DBG_READ_BREAKPOINT | DBG_WRITE_BREAKPOINT | DBG_EXEC_BREAKPOINT;
+
+    for (i = 0; i < watch_count; i++) {
+        if (watch_ranges[i].start == start && watch_ranges[i].end == end) {
+            break;
+        }
+    }
+    if (i < watch_count) {
+        if (flags) {
+            watch_ranges[i].flags = flags;
+        } else {
+            watch_ranges[i] = watch_ranges[--watch_count];
+        }
+    } else if (flags) {
+        watch_ranges = (watch_range_t*)realloc(watch_ranges, (watch_count + 1) * sizeof(watch_range_t));
+        watch_ranges[watch_count].start = start;
+        watch_ranges[watch_count].end = end;
+        watch_ranges[watch_count].flags = flags;
+        watch_count++;
+    }
+    watch_rebuild();
+    return true;
+}
+
+uint8_t debug_watch_flags(uint32_t address) {
+    size_t low = 0, high = watch_segment_count;
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (watch_segments[middle].end <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < watch_segment_count && watch_segments[low].start <= address) {
+        return watch_segments[low].flags;
+    }
+    return 0;
+}
+
+void debug_watch_access(uint32_t address, uint8_t value, uint8_t type) {
+    if (in_debugger || !(debug_watch_flags(address) & type)) {
+        return;
+    }
+    mem.debug.watch_hit.address = address;
+    mem.debug.watch_hit.pc = mem.debug.instructionAt;
+    mem.debug.watch_hit.value = value;
+    mem.debug.watch_hit.type = type;
+    debugger(HIT_WATCHPOINT, address);
 }
 
 /* okay, so looking at the data inside the asic should be okay when using this function, */
@@ -17,7 +17,8 @@ enum {
         HIT_READ_BREAKPOINT,
         HIT_WRITE_BREAKPOINT,
         HIT_PORT_WRITE_BREAKPOINT,
-        HIT_PORT_READ_BREAKPOINT
+        HIT_PORT_READ_BREAKPOINT,
+        HIT_WATCHPOINT              /* Details in mem.debug.watch_hit */
 };
 
 /* For Port Monitoring */
@@ -31,14 +32,42 @@ enum {
 #define DBG_WRITE_BREAKPOINT      2
 #define DBG_EXEC_BREAKPOINT       4
 #define DBG_STEP_OVER_BREAKPOINT  8
+#define DBG_STOP_BREAKPOINT       16    /* Leave cpu_execute() early, not the debugger */
+#define DBG_CONDITIONAL           32    /* Breakpoints here go through debug_condition_check() */
+
+typedef struct {
+    uint32_t address;
+    uint32_t pc;
+    uint8_t value;          /* Read, written or fetched */
+    uint8_t type;           /* DBG_READ_BREAKPOINT, DBG_WRITE_BREAKPOINT or DBG_EXEC_BREAKPOINT */
+} debug_watch_hit_t;
 
 typedef struct {        /* For debugging */
     uint32_t stepOverAddress;
+    uint32_t stoppedAt;     /* Last DBG_STOP_BREAKPOINT hit */
+    uint32_t instructionAt; /* Start of the instruction or interrupt the CPU is running */
     uint8_t *block;
     uint8_t *ports;
+    uint32_t ports_armed;   /* Number of ports with flags set, see debug_port_set() */
+    uint8_t watched[0x1000];        /* Per 4K page, the flags of all watch ranges touching it */
+    debug_watch_hit_t watch_hit;
 } debug_state_t;
 
 uint8_t debug_port_read_byte(const uint32_t addr);
+/* Sets the DBG_PORT_* flags of a port, use this rather than writing mem.debug.ports */
+void debug_port_set(uint16_t port, uint8_t flags);
+void debug_read_range(uint32_t addr, uint32_t len, uint8_t *out);
+void debug_write_range(uint32_t addr, uint32_t len, const uint8_t *in);
+
+/* Range watchpoints over [start, end), with DBG_READ_BREAKPOINT, DBG_WRITE_BREAKPOINT and
+ * DBG_EXEC_BREAKPOINT flags. Setting replaces the flags of that exact range, 0 removes it. */
+bool debug_watch_set(uint32_t start, uint32_t end, uint8_t flags);
+uint8_t debug_watch_flags(uint32_t address);
+/* For the memory paths, once mem.debug.watched says the page is watched */
+void debug_watch_access(uint32_t address, uint8_t value, uint8_t type);
+/* For the breakpoint paths at addresses marked DBG_CONDITIONAL: whether to break, after logging
+ * a tracepoint if there is one. See condition.h. */
+bool debug_condition_check(uint32_t address, uint8_t type);
 void debugger(int reason, uint32_t addr);
 
 #ifdef __cplusplus
@@ -1,1016 +1,909 @@
+#include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
-#include <unordered_map>
 
 #include "disasm.h"
 #include "disasmc.h"
+#include "disasmcache.h"
+#include "debug.h"
 #include "../cpu.h"
+#include "../mem.h"
 
 disasm_state_t disasm;
 
-static char tmpbuf[20];
+static const char *const mnemonic_names[] = {
+    "nop", "ex", "djnz", "jr", "ld", "add", "adc", "sub",
+    "sbc", "and", "xor", "or", "cp", "inc", "dec", "rlca",
+    "rrca", "rla", "rra", "daa", "cpl", "scf", "ccf", "halt",
+    "ret", "pop", "push", "exx", "jp", "call", "rst", "di",
+    "ei", "out", "in", "rlc", "rrc", "rl", "rr", "sla",
+    "sra", "srl", "bit", "res", "set", "in0", "out0", "lea",
+    "pea", "tst", "tstio", "mlt", "neg", "retn", "reti", "stmix",
+    "rsmix", "im", "slp", "rrd", "rld", "inim", "otim", "ini2",
+    "indm", "otdm", "ind2", "inimr", "otimr", "ini2r", "indmr", "otdmr",
+    "ind2r", "ldi", "cpi", "ini", "outi", "outi2", "ldd", "cpd",
+    "ind", "outd", "outd2", "ldir", "cpir", "inir", "otir", "oti2r",
+    "lddr", "cpdr", "indr", "otdr", "otdr2", "inirx", "otirx", "indrx",
+    "otdrx", "FLASH_ERASE", "OPCODETRAP",
+};
 
-static const std::string index_h[] = {
-    "h",
-    "i",
-    "ixh",
-    "iyh",
+static const char *const reg_names[] = {
+    "b", "c", "d", "e", "h", "l", "a",
+    "ixh", "ixl", "iyh", "iyl", "i", "r", "mb",
+    "bc", "de", "hl", "ix", "iy", "sp", "af",
+    "af'",
 };
 
-static const std::string index_l[] = {
-    "l",
-    "i",
-    "ixl",
-    "iyl",
+static const char *const suffix_names[] = {
+    " ", ".sis ", ".lis ", ".sil ", ".lil ",
 };
 
-static const std::string index_table[] = {
-    "hl",
-    "i",
-    "ix",
-    "iy",
+static const char *const cc_names[] = {
+    "nz", "z", "nc", "c", "po", "pe", "p", "m",
 };
 
-static const std::string alu_table[] = {
-    "add",
-    "adc",
-    "sub",
-    "sbc",
-    "and",
-    "xor",
-    "or",
-    "cp",
+static const char *const im_names[] = {
+    "0", "?", "1", "2",
 };
 
-static const std::string rot_table[] = {
-    "rlc",
-    "rrc",
-    "rl",
-    "rr",
-    "sla",
-    "sra",
-    "OPCODETRAP",
-    "srl",
+static const uint8_t alu_table[] = {
+    DISASM_ADD, DISASM_ADC, DISASM_SUB, DISASM_SBC, DISASM_AND, DISASM_XOR, DISASM_OR, DISASM_CP,
 };
 
-static const std::string rot_acc_table[] = {
-    "rlca",
-    "rrca",
-    "rla",
-    "rra",
-    "daa",
-    "cpl",
-    "scf",
-    "ccf",
+static const uint8_t rot_table[] = {
+    DISASM_RLC, DISASM_RRC, DISASM_RL, DISASM_RR, DISASM_SLA, DISASM_SRA, DISASM_TRAP, DISASM_SRL,
 };
 
-static const std::string cc_table[] = {
-    "nz",
-    "z",
-    "nc",
-    "c",
-    "po",
-    "pe",
-    "p",
-    "m",
+static const uint8_t rot_acc_table[] = {
+    DISASM_RLCA, DISASM_RRCA, DISASM_RLA, DISASM_RRA, DISASM_DAA, DISASM_CPL, DISASM_SCF, DISASM_CCF,
 };
 
-static const std::string im_table[] = {
-    "0",
-    "?",
-    "1",
-    "2",
+/* Block instructions by [y][z], the first four rows only use z = 2..4 */
+static const uint8_t bli_table[8][5] = {
+    { DISASM_TRAP, DISASM_TRAP, DISASM_INIM,  DISASM_OTIM,  DISASM_INI2  },
+    { DISASM_TRAP, DISASM_TRAP, DISASM_INDM,  DISASM_OTDM,  DISASM_IND2  },
+    { DISASM_TRAP, DISASM_TRAP, DISASM_INIMR, DISASM_OTIMR, DISASM_INI2R },
+    { DISASM_TRAP, DISASM_TRAP, DISASM_INDMR, DISASM_OTDMR, DISASM_IND2R },
+    { DISASM_LDI,  DISASM_CPI,  DISASM_INI,   DISASM_OUTI,  DISASM_OUTI2 },
+    { DISASM_LDD,  DISASM_CPD,  DISASM_IND,   DISASM_OUTD,  DISASM_OUTD2 },
+    { DISASM_LDIR, DISASM_CPIR, DISASM_INIR,  DISASM_OTIR,  DISASM_OTI2R },
+    { DISASM_LDDR, DISASM_CPDR, DISASM_INDR,  DISASM_OTDR,  DISASM_OTDR2 },
 };
 
-static std::string strW(uint32_t data) {
-    if (!disasm.l) {
-        data += cpu.registers.MBASE << 16;
-    }
-    addressMap_t::const_iterator item = disasm.address_map.find(data);
-    if (item == disasm.address_map.end()) {
-        if(disasm.il) {
-            sprintf(tmpbuf,"$%06X",data);
-        } else {
-            sprintf(tmpbuf,"$%04X",data);
-        }
-    } else {
-        return item->second;
+/* By prefix: none, unused, DD, FD */
+static const uint8_t index_table[] = { DISASM_REG_HL, DISASM_REG_I, DISASM_REG_IX, DISASM_REG_IY };
+static const uint8_t index_h[] = { DISASM_REG_H, DISASM_REG_I, DISASM_REG_IXH, DISASM_REG_IYH };
+static const uint8_t index_l[] = { DISASM_REG_L, DISASM_REG_I, DISASM_REG_IXL, DISASM_REG_IYL };
+
+typedef struct {
+    disasm_record_t *record;
+    const uint8_t *code;
+    uint32_t length;
+    uint8_t prefix;
+    int operand;
+} decoder_t;
+
+static uint8_t fetch_byte(decoder_t *d) {
+    disasm_record_t *record = d->record;
+    uint8_t value = record->size < d->length ? d->code[record->size] : 0;
+    if (record->size < DISASM_MAX_BYTES) {
+        record->bytes[record->size] = value;
     }
-    return std::string(tmpbuf);
-}
-
-static std::string strWind(uint32_t data) {
-    return "("+strW(data)+")";
-}
-
-static std::string strS(uint8_t data) {
-    sprintf(tmpbuf,"$%02X",data);
-    return std::string(tmpbuf);
+    record->size++;
+    return value;
 }
 
-static std::string strSind(uint8_t data) {
-    sprintf(tmpbuf,"($%02X)",data);
-    return std::string(tmpbuf);
+static uint32_t fetch_word(decoder_t *d) {
+    uint32_t value = fetch_byte(d);
+    value |= fetch_byte(d) << 8;
+    if (d->record->il) {
+        value |= fetch_byte(d) << 16;
+    }
+    return value;
 }
 
-
-static std::string strOffset(uint8_t data) {
-    if (data & 128) {
-        sprintf(tmpbuf,"-$%02X",0x100-data);
-    } else if (data) {
-        sprintf(tmpbuf,"+$%02X",data);
-    }
-    return std::string(tmpbuf);
+static disasm_operand_t *add_operand(decoder_t *d, uint8_t kind) {
+    disasm_operand_t *operand = &d->record->operands[d->operand++];
+    operand->kind = kind;
+    return operand;
 }
 
-static uint8_t disasm_fetch_byte(void) {
-    uint8_t value = memory_read_byte(disasm.new_address++);
-    sprintf(tmpbuf,"%02X",value);
-    disasm.instruction.data += std::string(tmpbuf);
-    disasm.instruction.size++;
-    return value;
+static void op_reg(decoder_t *d, uint8_t reg) {
+    add_operand(d, DISASM_OP_REG)->reg = reg;
 }
 
-static int8_t disasm_fetch_offset(void) {
-    return (int8_t)disasm_fetch_byte();
+static void op_reg_ind(decoder_t *d, uint8_t reg) {
+    add_operand(d, DISASM_OP_REG_IND)->reg = reg;
 }
 
-static uint32_t disasm_fetch_word(void) {
-    uint32_t value = disasm_fetch_byte();
-    value |= disasm_fetch_byte() << 8;
-    if (disasm.il) {
-        value |= disasm_fetch_byte() << 16;
-    }
-    return value;
+static void op_value(decoder_t *d, uint8_t kind, uint32_t value) {
+    add_operand(d, kind)->value = value;
 }
 
-static std::string disasm_read_index(void) {
-    return index_table[disasm.prefix];
+static void op_indexed(decoder_t *d, uint8_t kind, uint8_t reg, int8_t offset) {
+    disasm_operand_t *operand = add_operand(d, kind);
+    operand->reg = reg;
+    operand->offset = offset;
 }
 
-static std::string disasm_index_address(void) {
-    std::string value = disasm_read_index();
-    if (disasm.prefix) {
-        value += strOffset(disasm_fetch_offset());
+/* (hl), or (ix/iy+d) with the offset already fetched */
+static void op_index_address(decoder_t *d, int8_t offset) {
+    if (d->prefix) {
+        op_indexed(d, DISASM_OP_INDEXED, index_table[d->prefix], offset);
+    } else {
+        op_reg_ind(d, DISASM_REG_HL);
     }
-    return value;
 }
 
-static std::string disasm_read_reg(int i) {
-    std::string value;
+static void op_r_prefetched(decoder_t *d, int i, int8_t offset) {
     switch (i) {
-        case 0: value = "b"; break;
-        case 1: value = "c"; break;
-        case 2: value = "d"; break;
-        case 3: value = "e"; break;
-        case 4: value = index_h[disasm.prefix]; break;
-        case 5: value = index_l[disasm.prefix]; break;
-        case 6: value = "("+index_table[disasm.prefix]+ ((disasm.prefix) ? strOffset(disasm_fetch_offset()) : "") +")"; break;
-        case 7: value = "a"; break;
-        default: break;
+        case 4: op_reg(d, index_h[d->prefix]); break;
+        case 5: op_reg(d, index_l[d->prefix]); break;
+        case 6: op_index_address(d, offset); break;
+        case 7: op_reg(d, DISASM_REG_A); break;
+        default: op_reg(d, DISASM_REG_B + i); break;
     }
-    return value;
 }
 
-static void disasm_write_reg(int i, std::string value) {
-    switch (i) {
-        case 0: disasm.instruction.arguments = "b,"+value; break;
-        case 1: disasm.instruction.arguments = "c,"+value; break;
-        case 2: disasm.instruction.arguments = "d,"+value; break;
-        case 3: disasm.instruction.arguments = "e,"+value; break;
-        case 4: disasm.instruction.arguments = index_h[disasm.prefix]+","+value; break;
-        case 5: disasm.instruction.arguments = index_l[disasm.prefix]+","+value; break;
-        case 6: disasm.instruction.arguments = "("+index_table[disasm.prefix]+ ((disasm.prefix) ? strOffset(disasm_fetch_offset()) : "") +"),"+value; break;
-        case 7: disasm.instruction.arguments = "a,"+value; break;
-        default: break;
-    }
+static void op_r(decoder_t *d, int i) {
+    op_r_prefetched(d, i, i == 6 && d->prefix ? (int8_t)fetch_byte(d) : 0);
 }
 
-static void disasm_read_write_reg(uint8_t read, uint8_t write) {
-    std::string value;
-    uint8_t old_prefix = disasm.prefix;
-    disasm.prefix = (write != 6) ? old_prefix : 0;
-    value = disasm_read_reg(read);
-    disasm.prefix = (read != 6) ? old_prefix : 0;
-    disasm_write_reg(write, value);
-    disasm.instruction.opcode = "ld";
+static void op_rp(decoder_t *d, int i) {
+    static const uint8_t rp[] = { DISASM_REG_BC, DISASM_REG_DE, DISASM_REG_HL, DISASM_REG_SP };
+    op_reg(d, i == 2 ? index_table[d->prefix] : rp[i]);
 }
 
-static std::string disasm_read_reg_prefetched(int i, std::string address) {
-    std::string value;
-    switch (i) {
-        case 0: value = "b"; break;
-        case 1: value = "c"; break;
-        case 2: value = "d"; break;
-        case 3: value = "e"; break;
-        case 4: value = index_h[disasm.prefix]; break;
-        case 5: value = index_l[disasm.prefix]; break;
-        case 6: value = "("+address+")"; break;
-        case 7: value = "a"; break;
-        default: abort();
+static void op_rp2(decoder_t *d, int i) {
+    if (i == 3) {
+        op_reg(d, DISASM_REG_AF);
+    } else {
+        op_rp(d, i);
     }
-    return value;
 }
 
-static void disasm_write_reg_prefetched(int i, std::string address, std::string value) {
-    switch (i) {
-        case 0: disasm.instruction.arguments = "b,"+value; break;
-        case 1: disasm.instruction.arguments = "c,"+value; break;
-        case 2: disasm.instruction.arguments = "d,"+value; break;
-        case 3: disasm.instruction.arguments = "e,"+value; break;
-        case 4: disasm.instruction.arguments = index_h[disasm.prefix]+","+value; break;
-        case 5: disasm.instruction.arguments = index_l[disasm.prefix]+","+value; break;
-        case 6: disasm.instruction.arguments = address+value; break;
-        case 7: disasm.instruction.arguments = "a,"+value; break;
-        default: abort();
-    }
+static void op_rp3(decoder_t *d, int i) {
+    op_reg(d, i == 3 ? index_table[d->prefix] : DISASM_REG_BC + i);
 }
 
-static std::string disasm_read_rp(int i) {
-    std::string value;
-    switch (i) {
-        case 0: value = "bc"; break;
-        case 1: value = "de"; break;
-        case 2: value = index_table[disasm.prefix]; break;
-        case 3: value = "sp"; break;
-        default: abort();
-    }
-    return value;
+static void op_relative(decoder_t *d) {
+    int8_t offset = (int8_t)fetch_byte(d);
+    uint32_t target = d->record->address + d->record->size + offset;
+    op_value(d, DISASM_OP_ADDR, target & (d->record->l ? 0xFFFFFF : 0xFFFF));
 }
 
-static std::string disasm_read_rp2(int i) {
-    if (i == 3) {
-        return "af";
-    } else {
-        return disasm_read_rp(i);
-    }
+static void set_mnemonic(decoder_t *d, uint8_t mnemonic) {
+    d->record->mnemonic = mnemonic;
 }
 
-static std::string disasm_read_rp3(int i) {
-    std::string value;
-    switch (i) {
-        case 0: value = "bc"; break;
-        case 1: value = "de"; break;
-        case 2: value = "hl"; break;
-        case 3: value = index_table[disasm.prefix]; break;
-        default: abort();
-    }
-    return value;
+static void decode_ld_r_r(decoder_t *d, int read, int write) {
+    uint8_t prefix = d->prefix;
+    set_mnemonic(d, DISASM_LD);
+    /* Only the (hl) side is indexed, the register side uses h and l then */
+    d->prefix = read != 6 ? prefix : 0;
+    op_r(d, write);
+    d->prefix = write != 6 ? prefix : 0;
+    op_r(d, read);
+    d->prefix = prefix;
 }
 
-static void disasm_bli(int y, int z) {
-    switch (y) {
+static void decode_ed(decoder_t *d) {
+    uint8_t opcode = fetch_byte(d);
+    int x = opcode >> 6, y = opcode >> 3 & 7, z = opcode & 7, p = y >> 1, q = y & 1;
+
+    d->prefix = 0; // ED cancels effect of DD/FD prefix
+    switch (x) {
         case 0:
             switch (z) {
-                case 2: // INIM
-                    disasm.instruction.opcode = "inim";
+                case 0:
+                    if (y == 6) { // OPCODETRAP
+                        set_mnemonic(d, DISASM_TRAP);
+                    } else { // IN0 r[y], (n)
+                        set_mnemonic(d, DISASM_IN0);
+                        op_r(d, y);
+                        op_value(d, DISASM_OP_PORT, fetch_byte(d));
+                    }
+                    break;
+                case 1:
+                    if (y == 6) { // LD IY, (HL)
+                        set_mnemonic(d, DISASM_LD);
+                        op_reg(d, DISASM_REG_IY);
+                        op_reg_ind(d, DISASM_REG_HL);
+                    } else { // OUT0 (n), r[y]
+                        set_mnemonic(d, DISASM_OUT0);
+                        op_value(d, DISASM_OP_PORT, fetch_byte(d));
+                        op_r(d, y);
+                    }
+                    break;
+                case 2: // LEA rp3[p], IX + d
+                case 3: // LEA rp3[p], IY + d
+                    if (q) { // OPCODETRAP
+                        set_mnemonic(d, DISASM_TRAP);
+                    } else {
+                        d->prefix = z;
+                        set_mnemonic(d, DISASM_LEA);
+                        op_rp3(d, p);
+                        op_indexed(d, DISASM_OP_INDEX_OFFSET, index_table[z], (int8_t)fetch_byte(d));
+                    }
                     break;
-                case 3: // OTIM
-                    disasm.instruction.opcode = "otim";
+                case 4: // TST A, r[y]
+                    set_mnemonic(d, DISASM_TST);
+                    op_reg(d, DISASM_REG_A);
+                    op_r(d, y);
                     break;
-                case 4: // INI2
-                    disasm.instruction.opcode = "ini2";
+                case 6:
+                    if (y == 7) { // LD (HL), IY
+                        set_mnemonic(d, DISASM_LD);
+                        op_reg_ind(d, DISASM_REG_HL);
+                        op_reg(d, DISASM_REG_IY);
+                        break;
+                    }
+                    /* fallthrough */
+                case 5: // OPCODETRAP
+                    set_mnemonic(d, DISASM_TRAP);
+                    break;
+                case 7:
+                    d->prefix = 2;
+                    set_mnemonic(d, DISASM_LD);
+                    if (q) { // LD (HL), rp3[p]
+                        op_reg_ind(d, DISASM_REG_HL);
+                        op_rp3(d, p);
+                    } else { // LD rp3[p], (HL)
+                        op_rp3(d, p);
+                        op_reg_ind(d, DISASM_REG_HL);
+                    }
                     break;
             }
             break;
         case 1:
             switch (z) {
-                case 2: // INDM
-                    disasm.instruction.opcode = "indm";
+                case 0:
+                    if (y == 6) { // OPCODETRAP (ADL)
+                        set_mnemonic(d, DISASM_TRAP);
+                    } else { // IN r[y], (BC)
+                        set_mnemonic(d, DISASM_IN);
+                        op_r(d, y);
+                        op_reg_ind(d, DISASM_REG_BC);
+                    }
                     break;
-                case 3: // OTDM
-                    disasm.instruction.opcode = "otdm";
+                case 1:
+                    if (y == 6) { // OPCODETRAP (ADL)
+                        set_mnemonic(d, DISASM_TRAP);
+                    } else { // OUT (BC), r[y]
+                        set_mnemonic(d, DISASM_OUT);
+                        op_reg_ind(d, DISASM_REG_BC);
+                        op_r(d, y);
+                    }
                     break;
-                case 4: // IND2
-                    disasm.instruction.opcode = "ind2";
+                case 2: // SBC HL, rp[p] / ADC HL, rp[p]
+                    set_mnemonic(d, q ? DISASM_ADC : DISASM_SBC);
+                    op_reg(d, DISASM_REG_HL);
+                    op_rp(d, p);
+                    break;
+                case 3:
+                    set_mnemonic(d, DISASM_LD);
+                    if (q == 0) { // LD (nn), rp[p]
+                        op_value(d, DISASM_OP_ADDR_IND, fetch_word(d));
+                        op_rp(d, p);
+                    } else { // LD rp[p], (nn)
+                        op_rp(d, p);
+                        op_value(d, DISASM_OP_ADDR_IND, fetch_word(d));
+                    }
                     break;
-            }
-            break;
-        case 2:
-            switch (z) {
-                case 2: // INIMR
-                    disasm.instruction.opcode = "inimr";
+                case 4:
+                    if (q) { // MLT rp[p]
+                        set_mnemonic(d, DISASM_MLT);
+                        op_rp(d, p);
+                        break;
+                    }
+                    switch (p) {
+                        case 0:  // NEG
+                            set_mnemonic(d, DISASM_NEG);
+                            break;
+                        case 1:  // LEA IX, IY + d
+                            set_mnemonic(d, DISASM_LEA);
+                            op_reg(d, DISASM_REG_IX);
+                            op_indexed(d, DISASM_OP_INDEX_OFFSET, DISASM_REG_IY, (int8_t)fetch_byte(d));
+                            break;
+                        case 2:  // TST A, n
+                            set_mnemonic(d, DISASM_TST);
+                            op_reg(d, DISASM_REG_A);
+                            op_value(d, DISASM_OP_IMM, fetch_byte(d));
+                            break;
+                        case 3:  // TSTIO n
+                            set_mnemonic(d, DISASM_TSTIO);
+                            op_value(d, DISASM_OP_IMM, fetch_byte(d));
+                            break;
+                    }
+                    break;
+                case 5:
+                    switch (y) {
+                        case 0: // RETN
+                            set_mnemonic(d, DISASM_RETN);
+                            break;
+                        case 1: // RETI
+                            set_mnemonic(d, DISASM_RETI);
+                            break;
+                        case 2: // LEA IY, IX + d
+                            set_mnemonic(d, DISASM_LEA);
+                            op_reg(d, DISASM_REG_IY);
+                            op_indexed(d, DISASM_OP_INDEX_OFFSET, DISASM_REG_IX, (int8_t)fetch_byte(d));
+                            break;
+                        case 3:
+                        case 6: // OPCODETRAP
+                            set_mnemonic(d, DISASM_TRAP);
+                            break;
+                        case 4: // PEA IX + d
+                            set_mnemonic(d, DISASM_PEA);
+                            op_indexed(d, DISASM_OP_INDEX_OFFSET, DISASM_REG_IX, (int8_t)fetch_byte(d));
+                            break;
+                        case 5: // LD MB, A
+                            if (d->record->il) {
+                                set_mnemonic(d, DISASM_LD);
+                                op_reg(d, DISASM_REG_MB);
+                                op_reg(d, DISASM_REG_A);
+                            } else { // OPCODETRAP
+                                set_mnemonic(d, DISASM_TRAP);
+                            }
+                            break;
+                        case 7: // STMIX
+                            set_mnemonic(d, DISASM_STMIX);
+                            break;
+                    }
                     break;
-                case 3: // OTIMR
-                    disasm.instruction.opcode = "otimr";
+                case 6:
+                    switch (y) {
+                        case 0:
+                        case 2:
+                        case 3: // IM im[y]
+                            set_mnemonic(d, DISASM_IM);
+                            op_value(d, DISASM_OP_IM, y);
+                            break;
+                        case 1: // OPCODETRAP
+                            set_mnemonic(d, DISASM_TRAP);
+                            break;
+                        case 4: // PEA IY + d
+                            set_mnemonic(d, DISASM_PEA);
+                            op_indexed(d, DISASM_OP_INDEX_OFFSET, DISASM_REG_IY, (int8_t)fetch_byte(d));
+                            break;
+                        case 5: // LD A, MB
+                            if (d->record->il) {
+                                set_mnemonic(d, DISASM_LD);
+                                op_reg(d, DISASM_REG_A);
+                                op_reg(d, DISASM_REG_MB);
+                            } else { // OPCODETRAP
+                                set_mnemonic(d, DISASM_TRAP);
+                            }
+                            break;
+                        case 6: // SLP
+                            set_mnemonic(d, DISASM_SLP);
+                            break;
+                        case 7: // RSMIX
+                            set_mnemonic(d, DISASM_RSMIX);
+                            break;
+                    }
                     break;
-                case 4: // INI2R
-                    disasm.instruction.opcode = "ini2r";
+                case 7:
+                    switch (y) {
+                        case 0: // LD I, A
+                        case 1: // LD R, A
+                            set_mnemonic(d, DISASM_LD);
+                            op_reg(d, y ? DISASM_REG_R : DISASM_REG_I);
+                            op_reg(d, DISASM_REG_A);
+                            break;
+                        case 2: // LD A, I
+                        case 3: // LD A, R
+                            set_mnemonic(d, DISASM_LD);
+                            op_reg(d, DISASM_REG_A);
+                            op_reg(d, y == 3 ? DISASM_REG_R : DISASM_REG_I);
+                            break;
+                        case 4: // RRD
+                            set_mnemonic(d, DISASM_RRD);
+                            break;
+                        case 5: // RLD
+                            set_mnemonic(d, DISASM_RLD);
+                            break;
+                        default: // OPCODETRAP
+                            set_mnemonic(d, DISASM_TRAP);
+                            break;
+                    }
                     break;
             }
             break;
-        case 3:
-            switch (z) {
-                case 2: // INDMR
-                    disasm.instruction.opcode = "indmr";
+        case 2:
+            if (z <= 4) { // bli[y,z]
+                set_mnemonic(d, bli_table[y][z]);
+            } else { // OPCODETRAP
+                set_mnemonic(d, DISASM_TRAP);
+            }
+            break;
+        case 3:  // There are only a few of these, so a simple switch for these shouldn't matter too much
+            switch (opcode) {
+                case 0xC2: // INIRX
+                    set_mnemonic(d, DISASM_INIRX);
                     break;
-                case 3: // OTDMR
-                    disasm.instruction.opcode = "otdmr";
+                case 0xC3: // OTIRX
+                    set_mnemonic(d, DISASM_OTIRX);
                     break;
-                case 4: // IND2R
-                    disasm.instruction.opcode = "ind2r";
+                case 0xC7: // LD I, HL
+                    set_mnemonic(d, DISASM_LD);
+                    op_reg(d, DISASM_REG_I);
+                    op_reg(d, DISASM_REG_HL);
                     break;
-            }
-            break;
-        case 4:
-            switch (z) {
-                case 0: // LDI
-                    disasm.instruction.opcode = "ldi";
+                case 0xD7: // LD HL, I
+                    set_mnemonic(d, DISASM_LD);
+                    op_reg(d, DISASM_REG_HL);
+                    op_reg(d, DISASM_REG_I);
                     break;
-                case 1: // CPI
-                    disasm.instruction.opcode = "cpi";
+                case 0xCA: // INDRX
+                    set_mnemonic(d, DISASM_INDRX);
                     break;
-                case 2: // INI
-                    disasm.instruction.opcode = "ini";
+                case 0xCB: // OTDRX
+                    set_mnemonic(d, DISASM_OTDRX);
                     break;
-                case 3: // OUTI
-                    disasm.instruction.opcode = "outi";
+                case 0xEE: // flash erase
+                    set_mnemonic(d, DISASM_FLASH_ERASE);
                     break;
-                case 4: // OUTI2
-                    disasm.instruction.opcode = "outi2";
+                default:   // OPCODETRAP
+                    set_mnemonic(d, DISASM_TRAP);
                     break;
             }
             break;
-        case 5:
+    }
+}
+
+/* Returns false for prefixes and suffixes, which need another byte */
+static bool decode_opcode(decoder_t *d) {
+    disasm_record_t *record = d->record;
+    uint8_t opcode = fetch_byte(d);
+    int x = opcode >> 6, y = opcode >> 3 & 7, z = opcode & 7, p = y >> 1, q = y & 1;
+    int8_t offset;
+
+    switch (x) {
+        case 0:
             switch (z) {
-                case 0: // LDD
-                    disasm.instruction.opcode = "ldd";
+                case 0:
+                    switch (y) {
+                        case 0:  // NOP
+                            set_mnemonic(d, DISASM_NOP);
+                            break;
+                        case 1:  // EX af,af'
+                            set_mnemonic(d, DISASM_EX);
+                            op_reg(d, DISASM_REG_AF);
+                            op_reg(d, DISASM_REG_AF_ALT);
+                            break;
+                        case 2: // DJNZ d
+                            set_mnemonic(d, DISASM_DJNZ);
+                            op_relative(d);
+                            break;
+                        case 3: // JR d
+                            set_mnemonic(d, DISASM_JR);
+                            op_relative(d);
+                            break;
+                        default: // JR cc[y-4], d
+                            set_mnemonic(d, DISASM_JR);
+                            add_operand(d, DISASM_OP_COND)->reg = y - 4;
+                            op_relative(d);
+                            break;
+                    }
                     break;
-                case 1: // CPD
-                   disasm.instruction.opcode = "cpd";
+                case 1:
+                    if (q) { // ADD HL,rr
+                        set_mnemonic(d, DISASM_ADD);
+                        op_reg(d, index_table[d->prefix]);
+                        op_rp(d, p);
+                    } else if (p == 3 && d->prefix) { // LD IY/IX, (IX/IY + d)
+                        set_mnemonic(d, DISASM_LD);
+                        op_reg(d, index_table[d->prefix]);
+                        op_indexed(d, DISASM_OP_INDEXED, index_table[d->prefix ^ 1], (int8_t)fetch_byte(d));
+                    } else { // LD rr, Mmn
+                        set_mnemonic(d, DISASM_LD);
+                        op_rp(d, p);
+                        op_value(d, DISASM_OP_ADDR, fetch_word(d));
+                    }
                     break;
-                case 2: // IND
-                   disasm.instruction.opcode = "ind";
+                case 2:
+                    set_mnemonic(d, DISASM_LD);
+                    switch (y) {
+                        case 0: // LD (BC), A
+                        case 2: // LD (DE), A
+                            op_reg_ind(d, p ? DISASM_REG_DE : DISASM_REG_BC);
+                            op_reg(d, DISASM_REG_A);
+                            break;
+                        case 4: // LD (Mmn), HL
+                            op_value(d, DISASM_OP_ADDR_IND, fetch_word(d));
+                            op_reg(d, index_table[d->prefix]);
+                            break;
+                        case 6: // LD (Mmn), A
+                            op_value(d, DISASM_OP_ADDR_IND, fetch_word(d));
+                            op_reg(d, DISASM_REG_A);
+                            break;
+                        case 1: // LD A, (BC)
+                        case 3: // LD A, (DE)
+                            op_reg(d, DISASM_REG_A);
+                            op_reg_ind(d, p ? DISASM_REG_DE : DISASM_REG_BC);
+                            break;
+                        case 5: // LD HL, (Mmn)
+                            op_reg(d, index_table[d->prefix]);
+                            op_value(d, DISASM_OP_ADDR_IND, fetch_word(d));
+                            break;
+                        case 7: // LD A, (Mmn)
+                            op_reg(d, DISASM_REG_A);
+                            op_value(d, DISASM_OP_ADDR_IND, fetch_word(d));
+                            break;
+                    }
                     break;
-                case 3: // OUTD
-                    disasm.instruction.opcode = "outd";
+                case 3: // INC rp[p] / DEC rp[p]
+                    set_mnemonic(d, q ? DISASM_DEC : DISASM_INC);
+                    op_rp(d, p);
+                    break;
+                case 4: // INC r[y]
+                case 5: // DEC r[y]
+                    set_mnemonic(d, z == 4 ? DISASM_INC : DISASM_DEC);
+                    op_r(d, y);
+                    break;
+                case 6:
+                    set_mnemonic(d, DISASM_LD);
+                    if (y == 7 && d->prefix) { // LD (IX/IY + d), IY/IX
+                        op_indexed(d, DISASM_OP_INDEXED, index_table[d->prefix], (int8_t)fetch_byte(d));
+                        op_reg(d, index_table[d->prefix ^ 1]);
+                    } else { // LD r[y], n
+                        op_r(d, y);
+                        op_value(d, DISASM_OP_IMM, fetch_byte(d));
+                    }
                     break;
-                case 4: // OUTD2
-                    disasm.instruction.opcode = "outd2";
+                case 7:
+                    if (!d->prefix) {
+                        set_mnemonic(d, rot_acc_table[y]);
+                        break;
+                    }
+                    set_mnemonic(d, DISASM_LD);
+                    offset = (int8_t)fetch_byte(d);
+                    if (q) { // LD (IX/IY + d), rp3[p]
+                        op_indexed(d, DISASM_OP_INDEXED, index_table[d->prefix], offset);
+                        op_rp3(d, p);
+                    } else { // LD rp3[p], (IX/IY + d)
+                        op_rp3(d, p);
+                        op_indexed(d, DISASM_OP_INDEXED, index_table[d->prefix], offset);
+                    }
                     break;
             }
             break;
-        case 6:
+        case 1: // ignore prefixed prefixes
+            if (z != y) {
+                decode_ld_r_r(d, z, y);
+                break;
+            }
             switch (z) {
-                case 0: // LDIR
-                    disasm.instruction.opcode = "ldir";
-                    break;
-                case 1: // CPIR
-                    disasm.instruction.opcode = "cpir";
-                    break;
-                case 2: // INIR
-                    disasm.instruction.opcode = "inir";
-                    break;
-                case 3: // OTIR
-                    disasm.instruction.opcode = "otir";
-                    break;
-                case 4: // OTI2R
-                    disasm.instruction.opcode = "oti2r";
+                case 0: // .SIS
+                case 1: // .LIS
+                case 2: // .SIL
+                case 3: // .LIL
+                    record->suffix = z + 1;
+                    record->l = z & 1;
+                    record->il = z >> 1;
+                    return false;
+                case 6: // HALT
+                    set_mnemonic(d, DISASM_HALT);
+                    break;
+                default: // LD H, H / LD L, L / LD A, A
+                    decode_ld_r_r(d, z, y);
                     break;
             }
             break;
-        case 7:
+        case 2: // ALU[y] r[z]
+            set_mnemonic(d, alu_table[y]);
+            op_reg(d, DISASM_REG_A);
+            op_r(d, z);
+            break;
+        case 3:
             switch (z) {
-                case 0: // LDDR
-                    disasm.instruction.opcode = "lddr";
+                case 0: // RET cc[y]
+                    set_mnemonic(d, DISASM_RET);
+                    add_operand(d, DISASM_OP_COND)->reg = y;
+                    break;
+                case 1:
+                    if (!q) { // POP rp2[p]
+                        set_mnemonic(d, DISASM_POP);
+                        op_rp2(d, p);
+                        break;
+                    }
+                    switch (p) {
+                        case 0: // RET
+                            set_mnemonic(d, DISASM_RET);
+                            break;
+                        case 1: // EXX
+                            set_mnemonic(d, DISASM_EXX);
+                            break;
+                        case 2: // JP (rr)
+                            set_mnemonic(d, DISASM_JP);
+                            op_reg_ind(d, index_table[d->prefix]);
+                            break;
+                        case 3: // LD SP, INDEX
+                            set_mnemonic(d, DISASM_LD);
+                            op_reg(d, DISASM_REG_SP);
+                            op_reg(d, index_table[d->prefix]);
+                            break;
+                    }
                     break;
-                case 1: // CPDR
-                    disasm.instruction.opcode = "cpdr";
+                case 2: // JP cc[y], nn
+                    set_mnemonic(d, DISASM_JP);
+                    add_operand(d, DISASM_OP_COND)->reg = y;
+                    op_value(d, DISASM_OP_ADDR, fetch_word(d));
                     break;
-                case 2: // INDR
-                    disasm.instruction.opcode = "indr";
+                case 3:
+                    switch (y) {
+                        case 0: // JP nn
+                            set_mnemonic(d, DISASM_JP);
+                            op_value(d, DISASM_OP_ADDR, fetch_word(d));
+                            break;
+                        case 1: // 0xCB prefixed opcodes, the index offset comes first
+                            offset = d->prefix ? (int8_t)fetch_byte(d) : 0;
+                            opcode = fetch_byte(d);
+                            x = opcode >> 6;
+                            y = opcode >> 3 & 7;
+                            z = opcode & 7;
+                            if (x == 0) { // rot[y] r[z]
+                                set_mnemonic(d, rot_table[y]);
+                            } else { // BIT/RES/SET y, r[z]
+                                set_mnemonic(d, x == 1 ? DISASM_BIT : x == 2 ? DISASM_RES : DISASM_SET);
+                                op_value(d, DISASM_OP_BIT, y);
+                            }
+                            op_r_prefetched(d, z, offset);
+                            break;
+                        case 2: // OUT (n), A
+                            set_mnemonic(d, DISASM_OUT);
+                            op_value(d, DISASM_OP_PORT, fetch_byte(d));
+                            op_reg(d, DISASM_REG_A);
+                            break;
+                        case 3: // IN A, (n)
+                            set_mnemonic(d, DISASM_IN);
+                            op_reg(d, DISASM_REG_A);
+                            op_value(d, DISASM_OP_PORT, fetch_byte(d));
+                            break;
+                        case 4: // EX (SP), HL/I
+                            set_mnemonic(d, DISASM_EX);
+                            op_reg_ind(d, DISASM_REG_SP);
+                            op_reg(d, index_table[d->prefix]);
+                            break;
+                        case 5: // EX DE, HL
+                            set_mnemonic(d, DISASM_EX);
+                            op_reg(d, DISASM_REG_DE);
+                            op_reg(d, DISASM_REG_HL);
+                            break;
+                        case 6: // DI
+                            set_mnemonic(d, DISASM_DI);
+                            break;
+                        case 7: // EI
+                            set_mnemonic(d, DISASM_EI);
+                            break;
+                    }
                     break;
-                case 3: // OTDR
-                    disasm.instruction.opcode = "otdr";
+                case 4: // CALL cc[y], nn
+                    set_mnemonic(d, DISASM_CALL);
+                    add_operand(d, DISASM_OP_COND)->reg = y;
+                    op_value(d, DISASM_OP_ADDR, fetch_word(d));
                     break;
-                case 4: // OTD2R
-                    disasm.instruction.opcode = "otdr2";
+                case 5:
+                    if (!q) { // PUSH rp2[p]
+                        set_mnemonic(d, DISASM_PUSH);
+                        op_rp2(d, p);
+                        break;
+                    }
+                    switch (p) {
+                        case 0: // CALL nn
+                            set_mnemonic(d, DISASM_CALL);
+                            op_value(d, DISASM_OP_ADDR, fetch_word(d));
+                            break;
+                        case 1: // 0xDD prefixed opcodes
+                            d->prefix = 2;
+                            return false;
+                        case 2: // 0xED prefixed opcodes
+                            decode_ed(d);
+                            break;
+                        case 3: // 0xFD prefixed opcodes
+                            d->prefix = 3;
+                            return false;
+                    }
+                    break;
+                case 6: // alu[y] n
+                    set_mnemonic(d, alu_table[y]);
+                    op_reg(d, DISASM_REG_A);
+                    op_value(d, DISASM_OP_IMM, fetch_byte(d));
+                    break;
+                case 7: // RST y*8
+                    set_mnemonic(d, DISASM_RST);
+                    op_value(d, DISASM_OP_IMM, y << 3);
                     break;
             }
             break;
     }
+    return true;
+}
+
+void disasm_decode(disasm_record_t *record, uint32_t address, const uint8_t *code, uint32_t length, bool adl) {
+    decoder_t d;
+
+    memset(record, 0, sizeof *record);
+    record->address = address;
+    record->il = record->l = adl;
+    d.record = record;
+    d.code = code;
+    d.length = length;
+    d.prefix = 0;
+
+    for (;;) {
+        uint8_t chain = record->size;
+        d.operand = 0;
+        if (decode_opcode(&d)) {
+            break;
+        }
+        if (chain && record->size + 5 > DISASM_MAX_BYTES) {
+            /* The CPU lets each prefix and suffix override the last, so the ones before this
+             * byte do nothing and end the record, leaving room for what follows them */
+            record->size = chain;
+            record->mnemonic = DISASM_NOP;
+            record->suffix = 0;
+            record->il = record->l = adl;
+            break;
+        }
+    }
+}
+
+const char *disasm_mnemonic(const disasm_record_t *record) {
+    return mnemonic_names[record->mnemonic];
+}
+
+const char *disasm_suffix(const disasm_record_t *record) {
+    return suffix_names[record->suffix];
+}
+
+typedef struct {
+    char *buffer;
+    size_t size, length;
+} text_t;
+
+static void text_printf(text_t *text, const char *format, ...) {
+    size_t room = text->length < text->size ? text->size - text->length : 0;
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(room ? text->buffer + text->length : NULL, room, format, args);
+    va_end(args);
+    if (length > 0) {
+        text->length += length;
+    }
+}
+
+static void format_address(text_t *text, const disasm_record_t *record, uint32_t value) {
+    if (!record->l) {
+        value += cpu.registers.MBASE << 16;
+    }
+    addressMap_t::const_iterator item = disasm.address_map.find(value);
+    if (item != disasm.address_map.end()) {
+        text_printf(text, "%s", item->second.c_str());
+    } else {
+        text_printf(text, record->il ? "$%06X" : "$%04X", value);
+    }
+}
+
+static void format_operand(text_t *text, const disasm_record_t *record, const disasm_operand_t *operand) {
+    const char *reg = reg_names[operand->reg];
+    char sign = operand->offset < 0 ? '-' : '+';
+    int offset = operand->offset < 0 ? -operand->offset : operand->offset;
+
+    switch (operand->kind) {
+        case DISASM_OP_REG:
+            text_printf(text, "%s", reg);
+            break;
+        case DISASM_OP_REG_IND:
+            text_printf(text, "(%s)", reg);
+            break;
+        case DISASM_OP_INDEXED:
+            if (offset) {
+                text_printf(text, "(%s%c$%02X)", reg, sign, offset);
+            } else {
+                text_printf(text, "(%s)", reg);
+            }
+            break;
+        case DISASM_OP_INDEX_OFFSET:
+            if (offset) {
+                text_printf(text, "%s%c$%02X", reg, sign, offset);
+            } else {
+                text_printf(text, "%s", reg);
+            }
+            break;
+        case DISASM_OP_IMM:
+            text_printf(text, "$%02X", operand->value);
+            break;
+        case DISASM_OP_PORT:
+            text_printf(text, "($%02X)", operand->value);
+            break;
+        case DISASM_OP_ADDR:
+            format_address(text, record, operand->value);
+            break;
+        case DISASM_OP_ADDR_IND:
+            text_printf(text, "(");
+            format_address(text, record, operand->value);
+            text_printf(text, ")");
+            break;
+        case DISASM_OP_COND:
+            text_printf(text, "%s", cc_names[operand->reg]);
+            break;
+        case DISASM_OP_BIT:
+            text_printf(text, "%u", operand->value);
+            break;
+        case DISASM_OP_IM:
+            text_printf(text, "%s", im_names[operand->value]);
+            break;
+    }
+}
+
+size_t disasm_format_arguments(const disasm_record_t *record, char *buffer, size_t size) {
+    text_t text = { buffer, size, 0 };
+    int i;
+
+    if (size) {
+        *buffer = '\0';
+    }
+    for (i = 0; i < 2 && record->operands[i].kind != DISASM_OP_NONE; i++) {
+        if (i) {
+            text_printf(&text, ",");
+        }
+        format_operand(&text, record, &record->operands[i]);
+    }
+    return text.length;
+}
+
+size_t disasm_format_data(const disasm_record_t *record, char *buffer, size_t size) {
+    text_t text = { buffer, size, 0 };
+    int i;
+
+    if (size) {
+        *buffer = '\0';
+    }
+    for (i = 0; i < record->size && i < DISASM_MAX_BYTES; i++) {
+        text_printf(&text, "%02X", record->bytes[i]);
+    }
+    return text.length;
+}
+
+void disasm_fetch(disasm_record_t *record, uint32_t address, bool adl) {
+    if (!disasm_cache_lookup(address, adl, record)) {
+        uint8_t code[DISASM_MAX_BYTES];
+        debug_read_range(address, sizeof code, code);
+        disasm_decode(record, address, code, sizeof code, adl);
+    }
 }
 
 void disassembleInstruction(void) {
-    std::string tmpstr;
-    std::string old;
-    std::string w;
+    disasm_record_t *record = &disasm.record;
+    uint32_t address = disasm.base_address & 0xFFFFFF;
+    char buffer[64];
+    int i;
 
-    disasm.new_address = disasm.base_address;
+    disasm_fetch(record, address, disasm.adl);
 
     disasmHighlight.hit_read_breakpoint = false;
     disasmHighlight.hit_write_breakpoint = false;
     disasmHighlight.hit_exec_breakpoint = false;
     disasmHighlight.hit_pc = false;
+    for (i = 0; i < record->size; i++) {
+        uint32_t byte_address = (address + i) & 0xFFFFFF;
+        uint8_t flags = mem.debug.block[byte_address];
+        disasmHighlight.hit_read_breakpoint |= !!(flags & DBG_READ_BREAKPOINT);
+        disasmHighlight.hit_write_breakpoint |= !!(flags & DBG_WRITE_BREAKPOINT);
+        disasmHighlight.hit_exec_breakpoint |= !!(flags & DBG_EXEC_BREAKPOINT);
+        disasmHighlight.hit_pc |= cpu.registers.PC == byte_address;
+    }
 
-    disasm.instruction.data = "";
-    disasm.instruction.opcode = "";
-    disasm.instruction.mode_suffix = " ";
-    disasm.instruction.arguments = "";
-    disasm.instruction.size = 0;
-
-    disasm.il = disasm.adl;
-    disasm.l = disasm.adl;
-    disasm.prefix = false;
-    disasm.suffix = false;
-
-    union {
-        uint8_t opcode;
-        struct {
-            uint8_t z : 3;
-            uint8_t y : 3;
-            uint8_t x : 2;
-        };
-        struct {
-            uint8_t r : 1;
-            uint8_t dummy : 2;
-            uint8_t q : 1;
-            uint8_t p : 2;
-        };
-    } context;
-
-    do {
-        // fetch opcode
-        context.opcode = disasm_fetch_byte();
-
-        switch (context.x) {
-            case 0:
-                switch (context.z) {
-                    case 0:
-                        switch (context.y) {
-                            case 0:  // NOP
-                                disasm.instruction.opcode = "nop";
-                                break;
-                            case 1:  // EX af,af'
-                                disasm.instruction.opcode = "ex";
-                                disasm.instruction.arguments = "af,af'";
-                                break;
-                            case 2: // DJNZ d
-                                disasm.instruction.opcode = "djnz";
-                                disasm.instruction.arguments = strW(disasm.new_address+1+disasm_fetch_offset());
-                                break;
-                            case 3: // JR d
-                                disasm.instruction.opcode = "jr";
-                                disasm.instruction.arguments = strW(disasm.new_address+1+disasm_fetch_offset());
-                                break;
-                            case 4:
-                            case 5:
-                            case 6:
-                            case 7: // JR cc[y-4], d
-                                disasm.instruction.opcode = "jr";
-                                disasm.instruction.arguments = cc_table[context.y-4]+","+ strW(disasm.new_address+1+disasm_fetch_offset());
-                                break;
-                        }
-                        break;
-                    case 1:
-                        switch (context.q) {
-                            case 0: // LD rr, Mmn
-                                if (context.p == 3 && disasm.prefix) { // LD IY/IX, (IX/IY + d)
-                                    disasm.instruction.opcode = "ld";
-                                    disasm.instruction.arguments = index_table[disasm.prefix] + ",(" + index_table[disasm.prefix ^ 1] + strOffset(disasm_fetch_offset()) + ")" ;
-                                    break;
-                                }
-                                disasm.instruction.opcode = "ld";
-                                disasm.instruction.arguments = disasm_read_rp(context.p)+","+strW(disasm_fetch_word());
-                                break;
-                            case 1: // ADD HL,rr
-                                disasm.instruction.opcode = "add";
-                                disasm.instruction.arguments = index_table[disasm.prefix]+","+disasm_read_rp(context.p);
-                                break;
-                        }
-                        break;
-                    case 2:
-                        switch (context.q) {
-                            case 0:
-                                switch (context.p) {
-                                    case 0: // LD (BC), A
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = "(bc),a";
-                                        break;
-                                    case 1: // LD (DE), A
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = "(de),a";
-                                        break;
-                                    case 2: // LD (Mmn), HL
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = strWind(disasm_fetch_word())+","+index_table[disasm.prefix];
-                                        break;
-                                    case 3: // LD (Mmn), A
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = strWind(disasm_fetch_word())+",a";
-                                        break;
-                                }
-                                break;
-                            case 1:
-                                switch (context.p) {
-                                    case 0: // LD A, (BC)
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = "a,(bc)";
-                                        break;
-                                    case 1: // LD A, (DE)
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = "a,(de)";
-                                        break;
-                                    case 2: // LD HL, (Mmn)
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = index_table[disasm.prefix]+","+strWind(disasm_fetch_word());
-                                        break;
-                                    case 3: // LD A, (Mmn)
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = "a,"+strWind(disasm_fetch_word());
-                                        break;
-                                }
-                                break;
-                        }
-                        break;
-                    case 3:
-                        switch (context.q) {
-                            case 0: // INC rp[p]
-                                disasm.instruction.opcode = "inc";
-                                disasm.instruction.arguments = disasm_read_rp(context.p);
-                                break;
-                            case 1: // DEC rp[p]
-                                disasm.instruction.opcode = "dec";
-                                disasm.instruction.arguments = disasm_read_rp(context.p);
-                                break;
-                        }
-                        break;
-                    case 4: // INC r[y]
-                        disasm.instruction.opcode = "inc";
-                        w = (context.y == 6) ? disasm_index_address() : "0";
-                        disasm.instruction.arguments = disasm_read_reg_prefetched(context.y, w);
-                        break;
-                    case 5: // DEC r[y]
-                        disasm.instruction.opcode = "dec";
-                        w = (context.y == 6) ? disasm_index_address() : "0";
-                        disasm.instruction.arguments = disasm_read_reg_prefetched(context.y, w);
-                        break;
-                    case 6: // LD r[y], n
-                        if (context.y == 7 && disasm.prefix) { // LD (IX/IY + d), IY/IX
-                            disasm.instruction.opcode = "ld";
-                            disasm.instruction.arguments = "("+index_table[disasm.prefix]+strOffset(disasm_fetch_offset())+"),"+index_table[disasm.prefix ^ 1];
-                            break;
-                        }
-                        disasm.instruction.opcode = "ld";
-                        w = (context.y == 6) ? disasm_index_address() : "0";
-                        if(!disasm.prefix) {
-                            w = "("+w+"),";
-                        }
-                        disasm_write_reg_prefetched(context.y, w, strS(disasm_fetch_byte()));
-                        break;
-                    case 7:
-                        if (disasm.prefix) {
-                            if (context.q) { // LD (IX/IY + d), rp3[p]
-                                disasm.instruction.opcode = "ld";
-                                disasm.instruction.arguments = "("+index_table[disasm.prefix]+strOffset(disasm_fetch_offset())+"),"+disasm_read_rp3(context.p);
-                            } else { // LD rp3[p], (IX/IY + d)
-                                disasm.instruction.opcode = "ld";
-                                disasm.instruction.arguments = disasm_read_rp3(context.p)+",("+index_table[disasm.prefix]+strOffset(disasm_fetch_offset())+")";
-                            }
-                        } else {
-                            disasm.instruction.opcode = rot_acc_table[context.y];
-                        }
-                        break;
-                }
-                break;
-            case 1: // ignore prefixed prefixes
-                if (context.z == context.y) {
-                    switch (context.z) {
-                        case 0: // .SIS
-                            disasm.suffix = 1;
-                            disasm.instruction.mode_suffix = ".sis ";
-                            disasm.l = false;
-                            disasm.il = false;
-                            goto exit_loop;
-                        case 1: // .LIS
-                            disasm.suffix = 1;
-                            disasm.instruction.mode_suffix = ".lis ";
-                            disasm.l = true;
-                            disasm.il = false;
-                            goto exit_loop;
-                        case 2: // .SIL
-                            disasm.suffix = 1;
-                            disasm.instruction.mode_suffix = ".sil ";
-                            disasm.l = false;
-                            disasm.il = true;
-                            goto exit_loop;
-                        case 3: // .LIL
-                            disasm.suffix = 1;
-                            disasm.instruction.mode_suffix = ".lil ";
-                            disasm.l = true;
-                            disasm.il = true;
-                            goto exit_loop;
-                        case 6: // HALT
-                            disasm.instruction.opcode = "halt";
-                            break;
-                        case 4: // LD H, H
-                            disasm.instruction.opcode = "ld";
-                            disasm.instruction.arguments = index_h[disasm.prefix]+","+index_h[disasm.prefix];
-                            break;
-                        case 5: // LD L, L
-                            disasm.instruction.opcode = "ld";
-                            disasm.instruction.arguments = index_l[disasm.prefix]+","+index_l[disasm.prefix];
-                            break;
-                        case 7: // LD A, A
-                            disasm.instruction.opcode = "ld";
-                            disasm.instruction.opcode = "a,a";
-                            break;
-                        default:
-                            abort();
-                    }
-                } else {
-                    disasm_read_write_reg(context.z, context.y);
-                }
-                break;
-            case 2: // ALU[y] r[z]
-                disasm.instruction.opcode = alu_table[context.y];
-                disasm.instruction.arguments = "a,"+disasm_read_reg(context.z);
-                break;
-            case 3:
-                switch (context.z) {
-                    case 0: // RET cc[y]
-                        disasm.instruction.opcode = "ret";
-                        disasm.instruction.arguments = cc_table[context.y];
-                        break;
-                    case 1:
-                        switch (context.q) {
-                            case 0: // POP rp2[p]
-                                disasm.instruction.opcode = "pop";
-                                disasm.instruction.arguments = disasm_read_rp2(context.p);
-                                break;
-                            case 1:
-                                switch (context.p) {
-                                    case 0: // RET
-                                        disasm.instruction.opcode = "ret";
-                                        break;
-                                    case 1: // EXX
-                                        disasm.instruction.opcode = "exx";
-                                        break;
-                                    case 2: // JP (rr)
-                                        disasm.instruction.opcode = "jp";
-                                        disasm.instruction.arguments = "("+index_table[disasm.prefix]+")";
-                                        break;
-                                    case 3: // LD SP, INDEX
-                                        disasm.instruction.opcode = "ld";
-                                        disasm.instruction.arguments = "sp,"+index_table[disasm.prefix];
-                                        break;
-                                }
-                                break;
-                        }
-                        break;
-                    case 2: // JP cc[y], nn
-                        disasm.instruction.opcode = "jp";
-                        disasm.instruction.arguments = cc_table[context.y]+","+strW(disasm_fetch_word());
-                        break;
-                    case 3:
-                        switch (context.y) {
-                            case 0: // JP nn
-                                disasm.instruction.opcode = "jp";
-                                disasm.instruction.arguments = strW(disasm_fetch_word());
-                                break;
-                            case 1: // 0xCB prefixed opcodes
-                                w = disasm_index_address();
-                                context.opcode = disasm_fetch_byte();
-                                old = disasm_read_reg_prefetched(context.z, w);
-                                switch (context.x) {
-                                    case 0: // rot[y] r[z]
-                                        disasm.instruction.opcode = rot_table[context.y];
-                                        disasm.instruction.arguments = old;
-                                        break;
-                                    case 1: // BIT y, r[z]
-                                        disasm.instruction.opcode = "bit";
-                                        disasm.instruction.arguments = std::to_string(context.y)+","+old;
-                                        break;
-                                    case 2: // RES y, r[z]
-                                        disasm.instruction.opcode = "res";
-                                        disasm.instruction.arguments = std::to_string(context.y)+","+old;
-                                        break;
-                                    case 3: // SET y, r[z]
-                                        disasm.instruction.opcode = "set";
-                                        disasm.instruction.arguments = std::to_string(context.y)+","+old;
-                                        break;
-                                }
-                                break;
-                            case 2: // OUT (n), A
-                                disasm.instruction.opcode = "out";
-                                disasm.instruction.arguments = strSind(disasm_fetch_byte())+",a";
-                                break;
-                            case 3: // IN A, (n)
-                                disasm.instruction.opcode = "in";
-                                disasm.instruction.arguments = "a,"+strSind(disasm_fetch_byte());
-                                break;
-                            case 4: // EX (SP), HL/I
-                                disasm.instruction.opcode = "ex";
-                                disasm.instruction.arguments = "(sp),"+index_table[disasm.prefix];
-                                break;
-                            case 5: // EX DE, HL
-                                disasm.instruction.opcode = "ex";
-                                disasm.instruction.arguments = "de,hl";
-                                break;
-                            case 6: // DI
-                                disasm.instruction.opcode = "di";
-                                break;
-                            case 7: // EI
-                                disasm.instruction.opcode = "ei";
-                                continue;
-                        }
-                        break;
-                    case 4: // CALL cc[y], nn
-                        disasm.instruction.opcode = "call";
-                        disasm.instruction.arguments = cc_table[context.y]+","+strW(disasm_fetch_word());
-                        break;
-                    case 5:
-                        switch (context.q) {
-                            case 0: // PUSH r2p[p]
-                                disasm.instruction.opcode = "push";
-                                disasm.instruction.arguments = disasm_read_rp2(context.p);
-                                break;
-                            case 1:
-                                switch (context.p) {
-                                    case 0: // CALL nn
-                                        disasm.instruction.opcode = "call";
-                                        disasm.instruction.arguments = strW(disasm_fetch_word());
-                                        break;
-                                    case 1: // 0xDD prefixed opcodes
-                                        disasm.prefix = 2;
-                                        goto exit_loop;
-                                    case 2: // 0xED prefixed opcodes
-                                        disasm.prefix = 0; // ED cancels effect of DD/FD prefix
-                                        context.opcode = disasm_fetch_byte();
-                                        switch (context.x) {
-                                            case 0:
-                                                switch (context.z) {
-                                                    case 0:
-                                                        if (context.y == 6) { // OPCODETRAP
-                                                            disasm.instruction.opcode = "OPCODETRAP";
-                                                        } else { // IN0 r[y], (n)
-                                                            disasm.instruction.opcode = "in0";
-                                                            disasm.instruction.arguments = disasm_read_reg(context.y)+","+strSind(disasm_fetch_byte());
-                                                        }
-                                                        break;
-                                                     case 1:
-                                                        if (context.y == 6) { // LD IY, (HL)
-                                                            disasm.instruction.opcode = "ld";
-                                                            disasm.instruction.arguments = "iy,(hl)";
-                                                        } else { // OUT0 (n), r[y]
-                                                            disasm.instruction.opcode = "out0";
-                                                            disasm.instruction.arguments = strSind(disasm_fetch_byte())+","+disasm_read_reg(context.y);
-                                                        }
-                                                        break;
-                                                    case 2: // LEA rp3[p], IX + d
-                                                    case 3: // LEA rp3[p], IY + d
-                                                        if (context.q) { // OPCODETRAP
-                                                            disasm.instruction.opcode = "OPCODETRAP";
-                                                        } else {
-                                                            disasm.prefix = context.z;
-                                                            disasm.instruction.opcode = "lea";
-                                                            disasm.instruction.arguments = disasm_read_rp3(context.p)+","+index_table[context.z]+strOffset(disasm_fetch_offset());
-                                                        }
-                                                        break;
-                                                    case 4: // TST A, r[y]
-                                                        disasm.instruction.opcode = "tst";
-                                                        disasm.instruction.arguments = "a,"+disasm_read_reg(context.y);
-                                                        break;
-                                                    case 6:
-                                                        if (context.y == 7) { // LD (HL), IY
-                                                            disasm.instruction.opcode = "ld";
-                                                            disasm.instruction.arguments = "(hl),iy";
-                                                            break;
-                                                        }
-                                                    case 5: // OPCODETRAP
-                                                        disasm.instruction.opcode = "OPCODETRAP";
-                                                        break;
-                                                    case 7:
-                                                        disasm.prefix = 2;
-                                                        if (context.q) { // LD (HL), rp3[p]
-                                                            disasm.instruction.opcode = "ld";
-                                                            disasm.instruction.arguments = "(hl),"+disasm_read_rp3(context.p);
-                                                        } else { // LD rp3[p], (HL)
-                                                            disasm.instruction.opcode = "ld";
-                                                            disasm.instruction.arguments = disasm_read_rp3(context.p)+",(hl)";
-                                                        }
-                                                        break;
-                                                }
-                                                break;
-                                            case 1:
-                                                switch (context.z) {
-                                                    case 0:
-                                                        if (context.y == 6) { // OPCODETRAP (ADL)
-                                                            disasm.instruction.opcode = "OPCODETRAP";
-                                                        } else { // IN r[y], (BC)
-                                                            disasm.instruction.opcode = "in";
-                                                            disasm.instruction.arguments = disasm_read_reg(context.y)+",(bc)";
-                                                        }
-                                                        break;
-                                                    case 1:
-                                                        if (context.y == 6) { // OPCODETRAP (ADL)
-                                                            disasm.instruction.opcode = "OPCODETRAP";
-                                                        } else { // OUT (BC), r[y]
-                                                            disasm.instruction.opcode = "out";
-                                                            disasm.instruction.arguments = "(bc),"+disasm_read_reg(context.y);
-                                                        }
-                                                        break;
-                                                    case 2:
-                                                        if (context.q == 0) { // SBC HL, rp[p]
-                                                            disasm.instruction.opcode = "sbc";
-                                                            disasm.instruction.arguments = "hl,"+disasm_read_rp(context.p);
-                                                        } else { // ADC HL, rp[p]
-                                                            disasm.instruction.opcode = "adc";
-                                                            disasm.instruction.arguments = "hl,"+disasm_read_rp(context.p);
-                                                        }
-                                                        break;
-                                                    case 3:
-                                                        if (context.q == 0) { // LD (nn), rp[p]
-                                                            disasm.instruction.opcode = "ld";
-                                                            disasm.instruction.arguments = strWind(disasm_fetch_word())+","+disasm_read_rp(context.p);
-                                                        } else { // LD rp[p], (nn)
-                                                            disasm.instruction.opcode = "ld";
-                                                            disasm.instruction.arguments = disasm_read_rp(context.p)+","+strWind(disasm_fetch_word());
-                                                        }
-                                                        break;
-                                                    case 4:
-                                                        if (context.q == 0) {
-                                                            switch (context.p) {
-                                                                case 0:  // NEG
-                                                                    disasm.instruction.opcode = "neg";
-                                                                    break;
-                                                                case 1:  // LEA IX, IY + d
-                                                                    disasm.instruction.opcode = "lea";
-                                                                    disasm.instruction.arguments = "ix,iy"+strOffset(disasm_fetch_byte());
-                                                                    break;
-                                                                case 2:  // TST A, n
-                                                                    disasm.instruction.opcode = "tst";
-                                                                    disasm.instruction.arguments = "a,"+strS(disasm_fetch_byte());
-                                                                    break;
-                                                                case 3:  // TSTIO n
-                                                                    disasm.instruction.opcode = "tstio";
-                                                                    disasm.instruction.arguments = strS(disasm_fetch_byte());
-                                                                    break;
-                                                            }
-                                                        }
-                                                        else { // MLT rp[p]
-                                                            disasm.instruction.opcode = "mlt";
-                                                            disasm.instruction.arguments = disasm_read_rp(context.p);
-                                                            break;
-                                                        }
-                                                        break;
-                                                    case 5:
-                                                        switch (context.y) {
-                                                            case 0: // RETN
-                                                                disasm.instruction.opcode = "retn";
-                                                                break;
-                                                            case 1: // RETI
-                                                                disasm.instruction.opcode = "reti";
-                                                                break;
-                                                            case 2: // LEA IY, IX + d
-                                                                disasm.instruction.opcode = "lea";
-                                                                disasm.instruction.arguments = "iy,ix"+strOffset(disasm_fetch_offset());
-                                                                break;
-                                                            case 3:
-                                                            case 6: // OPCODETRAP
-                                                                disasm.instruction.opcode = "OPCODETRAP";
-                                                                break;
-                                                            case 4: // PEA IX + d
-                                                                disasm.instruction.opcode = "pea";
-                                                                disasm.instruction.arguments = "ix"+strOffset(disasm_fetch_offset());
-                                                                break;
-                                                            case 5: // LD MB, A
-                                                                if (disasm.il) {
-                                                                    disasm.instruction.opcode = "ld";
-                                                                    disasm.instruction.arguments = "mb,a";
-                                                                } else { // OPCODETRAP
-                                                                    disasm.instruction.opcode = "OPCODETRAP";
-                                                                }
-                                                                break;
-                                                            case 7: // STMIX
-                                                                disasm.instruction.opcode = "stmix";
-                                                                break;
-                                                        }
-                                                        break;
-                                                    case 6: // IM im[y]
-                                                        switch (context.y) {
-                                                            case 0:
-                                                            case 2:
-                                                            case 3: // IM im[y]
-                                                                disasm.instruction.opcode = "im";
-                                                                disasm.instruction.arguments = im_table[context.y];
-                                                                break;
-                                                            case 1: // OPCODETRAP
-                                                                disasm.instruction.opcode = "OPCODETRAP";
-                                                                break;
-                                                            case 4: // PEA IY + d
-                                                                disasm.instruction.opcode = "pea";
-                                                                disasm.instruction.arguments = "iy"+strOffset(disasm_fetch_offset());
-                                                                break;
-                                                            case 5: // LD A, MB
-                                                                if (disasm.il) {
-                                                                    disasm.instruction.opcode = "ld";
-                                                                    disasm.instruction.arguments = "a,mb";
-                                                                } else { // OPCODETRAP
-                                                                    disasm.instruction.opcode = "OPCODETRAP";
-                                                                }
-                                                                break;
-                                                            case 6: // SLP
-                                                                disasm.instruction.arguments = "slp";
-                                                                break;
-                                                            case 7: // RSMIX
-                                                                disasm.instruction.opcode = "rsmix";
-                                                                break;
-                                                        }
-                                                        break;
-                                                    case 7:
-                                                        switch (context.y) {
-                                                            case 0: // LD I, A
-                                                                disasm.instruction.opcode = "ld";
-                                                                disasm.instruction.arguments = "i,a";
-                                                                break;
-                                                            case 1: // LD R, A
-                                                                disasm.instruction.opcode = "ld";
-                                                                disasm.instruction.arguments = "r,a";
-                                                                break;
-                                                            case 2: // LD A, I
-                                                                disasm.instruction.opcode = "ld";
-                                                                disasm.instruction.arguments = "a,i";
-                                                                break;
-                                                            case 3: // LD A, R
-                                                                disasm.instruction.opcode = "ld";
-                                                                disasm.instruction.arguments = "a,r";
-                                                                break;
-                                                            case 4: // RRD
-                                                                disasm.instruction.opcode = "rrd";
-                                                                break;
-                                                            case 5: // RLD
-                                                                disasm.instruction.opcode = "rld";
-                                                                break;
-                                                            default: // OPCODETRAP
-                                                                disasm.instruction.opcode = "OPCODETRAP";
-                                                                break;
-                                                        }
-                                                        break;
-                                                }
-                                                break;
-                                            case 2:
-                                                if (context.y >= 0 && context.z <= 4) { // bli[y,z]
-                                                    disasm_bli(context.y, context.z);
-                                                } else { // OPCODETRAP
-                                                    disasm.instruction.opcode = "OPCODETRAP";
-                                                }
-                                                break;
-                                            case 3:  // There are only a few of these, so a simple switch for these shouldn't matter too much
-                                                switch(context.opcode) {
-                                                    case 0xC2: // INIRX
-                                                        disasm.instruction.opcode = "inirx";
-                                                        break;
-                                                    case 0xC3: // OTIRX
-                                                        disasm.instruction.opcode = "otirx";
-                                                        break;
-                                                    case 0xC7: // LD I, HL
-                                                        disasm.instruction.opcode = "ld";
-                                                        disasm.instruction.arguments = "i,hl";
-                                                        break;
-                                                    case 0xD7: // LD HL, I
-                                                        disasm.instruction.opcode = "ld";
-                                                        disasm.instruction.arguments = "hl,i";
-                                                        break;
-                                                    case 0xCA: // INDRX
-                                                        disasm.instruction.opcode = "indrx";
-                                                        break;
-                                                    case 0xCB: // OTDRX
-                                                        disasm.instruction.opcode = "otdrx";
-                                                        break;
-                                                    case 0xEE: // flash erase
-                                                        disasm.instruction.opcode = "FLASH_ERASE";
-                                                        break;
-                                                    default:   // OPCODETRAP
-                                                        disasm.instruction.opcode = "OPCODETRAP";
-                                                        break;
-                                                }
-                                                break;
-                                            default: // OPCODETRAP
-                                                disasm.instruction.opcode = "OPCODETRAP";
-                                                break;
-                                        }
-                                        break;
-                                    case 3: // 0xFD prefixed opcodes
-                                        disasm.prefix = 3;
-                                        goto exit_loop;
-                                }
-                                break;
-                        }
-                        break;
-                    case 6: // alu[y] n
-                        disasm.instruction.opcode = alu_table[context.y];
-                        disasm.instruction.arguments = "a,"+strS(disasm_fetch_byte());
-                        break;
-                    case 7: // RST y*8
-                        disasm.instruction.opcode = "rst";
-                        disasm.instruction.arguments = strS(context.y << 3);
-                        break;
-                }
-                break;
-        }
-        disasm.suffix = disasm.prefix = 0;
-exit_loop:
-      continue;
-    } while (disasm.prefix || disasm.suffix);
+    disasm.instruction.opcode = disasm_mnemonic(record);
+    disasm.instruction.mode_suffix = disasm_suffix(record);
+    disasm_format_arguments(record, buffer, sizeof buffer);
+    disasm.instruction.arguments = buffer;
+    disasm_format_data(record, buffer, sizeof buffer);
+    disasm.instruction.data = buffer;
+    disasm.instruction.size = record->size;
+    disasm.new_address = disasm.base_address + record->size;
 }
-
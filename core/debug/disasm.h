@@ -3,11 +3,72 @@
 
 #include <string>
 #include <unordered_map>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 typedef std::unordered_map<uint32_t, std::string> addressMap_t;
 
+/* Longest record, prefixes and suffixes that would chain past this decode as a nop of their own */
+#define DISASM_MAX_BYTES 8
+
+enum {
+    DISASM_NOP, DISASM_EX, DISASM_DJNZ, DISASM_JR, DISASM_LD, DISASM_ADD, DISASM_ADC, DISASM_SUB,
+    DISASM_SBC, DISASM_AND, DISASM_XOR, DISASM_OR, DISASM_CP, DISASM_INC, DISASM_DEC, DISASM_RLCA,
+    DISASM_RRCA, DISASM_RLA, DISASM_RRA, DISASM_DAA, DISASM_CPL, DISASM_SCF, DISASM_CCF, DISASM_HALT,
+    DISASM_RET, DISASM_POP, DISASM_PUSH, DISASM_EXX, DISASM_JP, DISASM_CALL, DISASM_RST, DISASM_DI,
+    DISASM_EI, DISASM_OUT, DISASM_IN, DISASM_RLC, DISASM_RRC, DISASM_RL, DISASM_RR, DISASM_SLA,
+    DISASM_SRA, DISASM_SRL, DISASM_BIT, DISASM_RES, DISASM_SET, DISASM_IN0, DISASM_OUT0, DISASM_LEA,
+    DISASM_PEA, DISASM_TST, DISASM_TSTIO, DISASM_MLT, DISASM_NEG, DISASM_RETN, DISASM_RETI, DISASM_STMIX,
+    DISASM_RSMIX, DISASM_IM, DISASM_SLP, DISASM_RRD, DISASM_RLD, DISASM_INIM, DISASM_OTIM, DISASM_INI2,
+    DISASM_INDM, DISASM_OTDM, DISASM_IND2, DISASM_INIMR, DISASM_OTIMR, DISASM_INI2R, DISASM_INDMR, DISASM_OTDMR,
+    DISASM_IND2R, DISASM_LDI, DISASM_CPI, DISASM_INI, DISASM_OUTI, DISASM_OUTI2, DISASM_LDD, DISASM_CPD,
+    DISASM_IND, DISASM_OUTD, DISASM_OUTD2, DISASM_LDIR, DISASM_CPIR, DISASM_INIR, DISASM_OTIR, DISASM_OTI2R,
+    DISASM_LDDR, DISASM_CPDR, DISASM_INDR, DISASM_OTDR, DISASM_OTDR2, DISASM_INIRX, DISASM_OTIRX, DISASM_INDRX,
+    DISASM_OTDRX, DISASM_FLASH_ERASE, DISASM_TRAP
+};
+
+enum {
+    DISASM_REG_B, DISASM_REG_C, DISASM_REG_D, DISASM_REG_E, DISASM_REG_H, DISASM_REG_L, DISASM_REG_A,
+    DISASM_REG_IXH, DISASM_REG_IXL, DISASM_REG_IYH, DISASM_REG_IYL, DISASM_REG_I, DISASM_REG_R, DISASM_REG_MB,
+    DISASM_REG_BC, DISASM_REG_DE, DISASM_REG_HL, DISASM_REG_IX, DISASM_REG_IY, DISASM_REG_SP, DISASM_REG_AF,
+    DISASM_REG_AF_ALT
+};
+
+enum {
+    DISASM_OP_NONE,
+    DISASM_OP_REG,          /* reg */
+    DISASM_OP_REG_IND,      /* (reg) */
+    DISASM_OP_INDEXED,      /* (reg+offset) */
+    DISASM_OP_INDEX_OFFSET, /* reg+offset, for lea and pea */
+    DISASM_OP_IMM,          /* 8 bit value */
+    DISASM_OP_PORT,         /* (8 bit value) */
+    DISASM_OP_ADDR,         /* 16 or 24 bit value, shown as an equate if there is one */
+    DISASM_OP_ADDR_IND,     /* (address) */
+    DISASM_OP_COND,         /* Condition code in reg */
+    DISASM_OP_BIT,          /* Bit number in value */
+    DISASM_OP_IM            /* Interrupt mode in value */
+};
+
+typedef struct {
+    uint8_t kind;
+    uint8_t reg;
+    int8_t offset;
+    uint32_t value;
+} disasm_operand_t;
+
+/* One decoded instruction. Depends only on its bytes and the ADL mode it was decoded in,
+ * equates and MBASE are applied when formatting. */
+typedef struct {
+    uint32_t address;
+    uint8_t size;
+    uint8_t bytes[DISASM_MAX_BYTES];
+    uint8_t mnemonic;
+    uint8_t suffix;         /* 0 when none, else .sis, .lis, .sil, .lil */
+    bool il, l;
+    disasm_operand_t operands[2];
+} disasm_record_t;
+
 typedef struct {
     std::string opcode;
     std::string arguments;
@@ -18,15 +79,30 @@ typedef struct {
 
 typedef struct {
     eZ80_instuction_t instruction;
+    disasm_record_t record;
     int32_t base_address;
     int32_t new_address;
-    uint8_t prefix, suffix;
-    bool adl, il, l;
+    bool adl;
     addressMap_t address_map;
 } disasm_state_t;
 
 extern disasm_state_t disasm;
 
+/* Decodes the instruction starting at code, which holds length bytes from address. Bytes past the
+ * end read as zero. Never allocates. */
+void disasm_decode(disasm_record_t *record, uint32_t address, const uint8_t *code, uint32_t length, bool adl);
+
+/* Decodes the instruction at address in memory, from the cache when it has it */
+void disasm_fetch(disasm_record_t *record, uint32_t address, bool adl);
+
+/* Formatting, these return the length written like snprintf */
+const char *disasm_mnemonic(const disasm_record_t *record);
+const char *disasm_suffix(const disasm_record_t *record);
+size_t disasm_format_arguments(const disasm_record_t *record, char *buffer, size_t size);
+size_t disasm_format_data(const disasm_record_t *record, char *buffer, size_t size);
+
+/* Disassembles disasm.base_address into disasm.record and disasm.instruction, and moves
+ * disasm.new_address past it */
 void disassembleInstruction(void);
 
 #endif
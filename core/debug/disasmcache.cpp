@@ -0,0 +1,142 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "disasmcache.h"
+#include "debug.h"
+
+static const uint32_t page_size = 0x1000;
+static const uint32_t flash_end = 0x400000;
+static const size_t max_pages = 64;
+static const size_t max_queued = 8;
+
+struct CachePage {
+    std::vector<disasm_record_t> records;   /* One per address in the page */
+    uint64_t used;
+};
+
+struct CacheRequest {
+    uint32_t key;
+    std::vector<uint8_t> code;              /* Snapshot of the page and what follows it */
+};
+
+static std::mutex cache_mutex;
+static std::condition_variable requested;
+static std::thread worker;
+static bool stopping = false;
+
+/* Protected by cache_mutex, keyed by page number << 1 | adl */
+static std::unordered_map<uint32_t, CachePage> pages;
+static std::deque<CacheRequest> queue;
+static uint64_t use_clock = 0;
+
+static void cache_worker(void) {
+    std::unique_lock<std::mutex> lock(cache_mutex);
+
+    while (true) {
+        requested.wait(lock, [] { return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+        CacheRequest request = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        uint32_t base = (request.key >> 1) * page_size;
+        bool adl = request.key & 1;
+        CachePage page;
+        page.records.resize(page_size);
+        for (uint32_t i = 0; i < page_size; i++) {
+            disasm_decode(&page.records[i], base + i, &request.code[i], request.code.size() - i, adl);
+        }
+
+        lock.lock();
+        page.used = ++use_clock;
+        pages[request.key] = std::move(page);
+        while (pages.size() > max_pages) {
+            auto oldest = pages.begin();
+            for (auto it = pages.begin(); it != pages.end(); ++it) {
+                if (it->second.used < oldest->second.used) {
+                    oldest = it;
+                }
+            }
+            pages.erase(oldest);
+        }
+    }
+}
+
+/* Called with cache_mutex held */
+static void cache_request(uint32_t key) {
+    if (pages.count(key)) {
+        return;
+    }
+    for (const CacheRequest &request : queue) {
+        if (request.key == key) {
+            return;
+        }
+    }
+    if (!worker.joinable()) {
+        stopping = false;
+        worker = std::thread(cache_worker);
+    }
+    if (queue.size() >= max_queued) {
+        queue.pop_front();
+    }
+
+    CacheRequest request;
+    request.key = key;
+    request.code.resize(page_size + DISASM_MAX_BYTES);
+    debug_read_range((key >> 1) * page_size, request.code.size(), request.code.data());
+    queue.push_back(std::move(request));
+    requested.notify_one();
+}
+
+bool disasm_cache_lookup(uint32_t address, bool adl, disasm_record_t *record) {
+    uint8_t current[DISASM_MAX_BYTES];
+    uint32_t key = (address / page_size) << 1 | adl;
+
+    if (address >= flash_end) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = pages.find(key);
+    if (it == pages.end()) {
+        cache_request(key);
+        return false;
+    }
+
+    const disasm_record_t *cached = &it->second.records[address % page_size];
+    debug_read_range(address, cached->size, current);
+    if (memcmp(current, cached->bytes, cached->size)) {
+        /* Flash was written since, this page has to be decoded again */
+        pages.erase(it);
+        cache_request(key);
+        return false;
+    }
+    it->second.used = ++use_clock;
+    *record = *cached;
+
+    /* Scrolling usually goes on to the next page */
+    if (address % page_size >= page_size / 2 && address + page_size < flash_end) {
+        cache_request(key + (1 << 1));
+    }
+    return true;
+}
+
+void disasm_cache_stop(void) {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        stopping = true;
+        queue.clear();
+    }
+    requested.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    pages.clear();
+}
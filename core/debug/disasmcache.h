@@ -0,0 +1,14 @@
+#ifndef DISASMCACHE_H
+#define DISASMCACHE_H
+
+#include "disasm.h"
+
+/* Decoded flash, built by a background thread one 4K page at a time as the debugger
+ * looks at it. Records carry their bytes, so a hit is only returned while flash still
+ * holds them; a stale page is rebuilt. */
+
+/* Returns false on a miss, after queueing the page; the caller decodes it itself then */
+bool disasm_cache_lookup(uint32_t address, bool adl, disasm_record_t *record);
+void disasm_cache_stop(void);
+
+#endif
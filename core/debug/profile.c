@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "profile.h"
+#include "../apb.h"
+#include "../cpu.h"
+#include "../schedule.h"
+#include "../../os/os.h"
+
+bool profiling = false;
+
+static profile_state_t *profile;
+
+void profile_set(bool enable) {
+    if (enable) {
+        if (!profile) {
+            profile = (profile_state_t*)malloc(sizeof(profile_state_t));
+        }
+        /* Never freed, the emu thread may still be counting */
+        if (profile) {
+            memset(profile, 0, sizeof(profile_state_t));
+            profile->start = sched_cycles();
+        }
+    }
+    profiling = enable && profile;
+}
+
+const profile_state_t *profile_get(void) {
+    return profile;
+}
+
+static void profile_count(profile_count_t *count, bool write, int cycles) {
+    if (write) {
+        count->writes++;
+    } else {
+        count->reads++;
+    }
+    count->cycles += cycles;
+    count->pc = cpu.registers.PC;
+}
+
+void profile_memory(uint32_t address, bool write, int cycles) {
+    address &= 0xFFFFFF;
+    if (address >= 0xE00000) {
+        profile_count(&profile->ports[mmio_port(address)], write, cycles);
+    } else {
+        profile_count(&profile->pages[address >> 12], write, cycles);
+    }
+}
+
+void profile_port(uint16_t port, bool write, int cycles) {
+    profile_count(&profile->ports[port], write, cycles);
+}
+
+typedef void (*profile_row_t)(FILE *file, const char *kind, uint32_t address, const profile_count_t *count, bool first);
+
+/* Calls row for every entry that was accessed */
+static void profile_rows(FILE *file, profile_row_t row) {
+    bool first = true;
+    uint32_t i;
+
+    for (i = 0; i < 0x10000; i++) {
+        if (profile->ports[i].reads || profile->ports[i].writes) {
+            row(file, "port", i, &profile->ports[i], first);
+            first = false;
+        }
+    }
+    for (i = 0; i < 0x1000; i++) {
+        if (profile->pages[i].reads || profile->pages[i].writes) {
+            row(file, "page", i << 12, &profile->pages[i], first);
+            first = false;
+        }
+    }
+}
+
+static void profile_csv_row(FILE *file, const char *kind, uint32_t address, const profile_count_t *count, bool first) {
+    (void)first;
+    fprintf(file, "%s,%06X,%llu,%llu,%llu,%06X\n", kind, address, (unsigned long long)count->reads,
+            (unsigned long long)count->writes, (unsigned long long)count->cycles, count->pc);
+}
+
+static void profile_json_row(FILE *file, const char *kind, uint32_t address, const profile_count_t *count, bool first) {
+    fprintf(file, "%s\n    {\"kind\":\"%s\",\"address\":%u,\"reads\":%llu,\"writes\":%llu,\"cycles\":%llu,\"pc\":%u}",
+            first ? "" : ",", kind, address, (unsigned long long)count->reads,
+            (unsigned long long)count->writes, (unsigned long long)count->cycles, count->pc);
+}
+
+bool profile_write_csv(const char *path) {
+    FILE *file;
+
+    if (!profile || !(file = fopen_utf8(path, "w"))) {
+        return false;
+    }
+    fputs("kind,address,reads,writes,cycles,last_pc\n", file);
+    profile_rows(file, profile_csv_row);
+    return !fclose(file);
+}
+
+bool profile_write_json(const char *path) {
+    FILE *file;
+
+    if (!profile || !(file = fopen_utf8(path, "w"))) {
+        return false;
+    }
+    fprintf(file, "{\n  \"start\":%llu,\n  \"end\":%llu,\n  \"entries\":[",
+            (unsigned long long)profile->start, (unsigned long long)sched_cycles());
+    profile_rows(file, profile_json_row);
+    fputs("\n  ]\n}\n", file);
+    return !fclose(file);
+}
@@ -0,0 +1,46 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../defines.h"
+
+/* Access statistics, per port and per 4K page of the address space. Memory accesses are
+ * counted where they happen in mem.c, instruction fetches included, and port accesses both
+ * through MMIO and IN/OUT. Cycles are the ones the bus charged for the accesses, the cost of
+ * an IN or OUT instruction itself stays with the instruction. */
+
+typedef struct {
+    uint64_t reads, writes;
+    uint64_t cycles;
+    uint32_t pc;                        /* Of the last access */
+} profile_count_t;
+
+typedef struct {
+    profile_count_t ports[0x10000];
+    profile_count_t pages[0x1000];
+    uint64_t start;                     /* sched_cycles() when counting started */
+} profile_state_t;
+
+/* Checked on the memory and port paths before calling in */
+extern bool profiling;
+
+/* Counts start from zero each time profiling is turned on, and stay readable once it's off */
+void profile_set(bool enable);
+const profile_state_t *profile_get(void);
+
+void profile_memory(uint32_t address, bool write, int cycles);
+void profile_port(uint16_t port, bool write, int cycles);
+
+/* Entries that were accessed at all, as CSV rows or a JSON object. Returns false if the file
+ * can't be written or profiling was never on. */
+bool profile_write_csv(const char *path);
+bool profile_write_json(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
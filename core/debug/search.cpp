@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <thread>
+
+#include "search.h"
+#include "../mem.h"
+
+static const uint32_t ram_start = 0xD00000;
+static const uint32_t ram_size = 0x65800;
+
+/* Large regions are split in chunks of start positions, searched by a thread each */
+static const uint32_t chunk_size = 0x40000;
+static const uint32_t threaded_size = 0x100000;
+
+typedef struct {
+    const search_pattern_t *pattern;
+    uint32_t index;
+    size_t anchor, anchor_length;       /* Longest run of bytes without wildcards */
+} compiled_t;
+
+typedef struct {
+    const uint8_t *block;
+    uint32_t base, size;                /* Of the region block holds */
+    uint32_t from, to;                  /* Start positions searched, as offsets in block */
+} job_t;
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static bool parse_pattern(std::string text, search_pattern_t *pattern) {
+    size_t first = text.find_first_not_of(" \t"), last = text.find_last_not_of(" \t");
+
+    pattern->bytes.clear();
+    pattern->mask.clear();
+    if (first == std::string::npos) {
+        return false;
+    }
+    text = text.substr(first, last - first + 1);
+
+    if (text[0] == '"') {
+        if (text.size() < 3 || text.back() != '"') {
+            return false;
+        }
+        pattern->bytes.assign(text.begin() + 1, text.end() - 1);
+        pattern->mask.assign(pattern->bytes.size(), 0xFF);
+        return true;
+    }
+
+    if (text[0] == '*') {
+        uint32_t value = 0;
+        if (text.size() < 2 || text.size() > 7) {
+            return false;
+        }
+        for (size_t i = 1; i < text.size(); i++) {
+            int digit = hex_digit(text[i]);
+            if (digit < 0) {
+                return false;
+            }
+            value = value << 4 | digit;
+        }
+        pattern->bytes = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16) };
+        pattern->mask.assign(3, 0xFF);
+        return true;
+    }
+
+    std::vector<int> nibbles;
+    for (char c : text) {
+        if (c == ' ' || c == '\t') {
+            continue;
+        }
+        if (c != '?' && hex_digit(c) < 0) {
+            return false;
+        }
+        nibbles.push_back(c == '?' ? -1 : hex_digit(c));
+    }
+    if (nibbles.empty() || nibbles.size() & 1) {
+        return false;
+    }
+    for (size_t i = 0; i < nibbles.size(); i += 2) {
+        int high = nibbles[i], low = nibbles[i + 1];
+        pattern->bytes.push_back((high < 0 ? 0 : high << 4) | (low < 0 ? 0 : low));
+        pattern->mask.push_back((high < 0 ? 0 : 0xF0) | (low < 0 ? 0 : 0x0F));
+    }
+    return true;
+}
+
+bool search_parse_patterns(const std::string &text, std::vector<search_pattern_t> *patterns) {
+    bool quoted = false;
+    size_t start = 0;
+
+    patterns->clear();
+    for (size_t i = 0; i <= text.size(); i++) {
+        if (i < text.size() && text[i] == '"') {
+            quoted = !quoted;
+        }
+        if (i == text.size() || (!quoted && text[i] == '|')) {
+            search_pattern_t pattern;
+            if (!parse_pattern(text.substr(start, i - start), &pattern)) {
+                return false;
+            }
+            patterns->push_back(std::move(pattern));
+            start = i + 1;
+        }
+    }
+    return !quoted;
+}
+
+static compiled_t compile(const search_pattern_t *pattern, uint32_t index) {
+    compiled_t compiled = { pattern, index, 0, 0 };
+    size_t run = 0;
+
+    for (size_t i = 0; i < pattern->mask.size(); i++) {
+        run = pattern->mask[i] == 0xFF ? run + 1 : 0;
+        if (run > compiled.anchor_length) {
+            compiled.anchor_length = run;
+            compiled.anchor = i + 1 - run;
+        }
+    }
+    return compiled;
+}
+
+static bool matches(const uint8_t *data, const search_pattern_t *pattern) {
+    for (size_t i = 0; i < pattern->bytes.size(); i++) {
+        if ((data[i] ^ pattern->bytes[i]) & pattern->mask[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void search_job(const job_t &job, const std::vector<compiled_t> &compiled, size_t max_matches,
+                       std::vector<search_match_t> &out) {
+    for (const compiled_t &c : compiled) {
+        const search_pattern_t *pattern = c.pattern;
+        size_t length = pattern->bytes.size(), found = 0;
+        uint32_t last;
+
+        if (length > job.size) {
+            continue;
+        }
+        last = std::min<uint32_t>(job.to, job.size - length + 1);
+        if (job.from >= last) {
+            continue;
+        }
+
+        if (!c.anchor_length) {
+            for (uint32_t start = job.from; start < last && found < max_matches; start++) {
+                if (matches(job.block + start, pattern)) {
+                    out.push_back({ job.base + start, c.index });
+                    found++;
+                }
+            }
+            continue;
+        }
+
+        /* memchr skips to candidates for the first byte of the anchor, the rest is checked in place */
+        const uint8_t *anchor = &pattern->bytes[c.anchor];
+        const uint8_t *p = job.block + job.from + c.anchor, *end = job.block + last + c.anchor;
+        while (p < end && found < max_matches && (p = (const uint8_t *)memchr(p, anchor[0], end - p))) {
+            uint32_t start = p - job.block - c.anchor;
+            if (!memcmp(p + 1, anchor + 1, c.anchor_length - 1) && matches(job.block + start, pattern)) {
+                out.push_back({ job.base + start, c.index });
+                found++;
+            }
+            p++;
+        }
+    }
+}
+
+std::vector<search_match_t> search_memory(uint32_t address, uint32_t length,
+                                          const std::vector<search_pattern_t> &patterns, size_t max_matches) {
+    const job_t regions[] = {
+        { mem.flash.block, 0, mem.flash.size, 0, 0 },
+        { mem.ram.block, ram_start, ram_size, 0, 0 },
+    };
+    uint64_t end = (uint64_t)address + length, total = 0;
+    std::vector<compiled_t> compiled;
+    std::vector<job_t> jobs;
+
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (!patterns[i].bytes.empty()) {
+            compiled.push_back(compile(&patterns[i], i));
+        }
+    }
+
+    for (const job_t &region : regions) {
+        uint64_t from = std::max<uint64_t>(address, region.base);
+        uint64_t to = std::min<uint64_t>(end, (uint64_t)region.base + region.size);
+        if (!region.block || from >= to) {
+            continue;
+        }
+        total += to - from;
+        for (uint64_t chunk = from; chunk < to; chunk += chunk_size) {
+            job_t job = region;
+            job.from = chunk - region.base;
+            job.to = std::min<uint64_t>(chunk + chunk_size, to) - region.base;
+            jobs.push_back(job);
+        }
+    }
+
+    std::vector<std::vector<search_match_t>> found(jobs.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < jobs.size();) {
+            search_job(jobs[i], compiled, max_matches, found[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    if (total >= threaded_size) {
+        unsigned int count = std::thread::hardware_concurrency();
+        for (unsigned int i = 1; i < count && i < jobs.size(); i++) {
+            threads.emplace_back(worker);
+        }
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    std::vector<search_match_t> result;
+    for (const std::vector<search_match_t> &matches : found) {
+        result.insert(result.end(), matches.begin(), matches.end());
+    }
+    std::sort(result.begin(), result.end(), [](const search_match_t &a, const search_match_t &b) {
+        return a.address != b.address ? a.address < b.address : a.pattern < b.pattern;
+    });
+    if (result.size() > max_matches) {
+        result.resize(max_matches);
+    }
+    return result;
+}
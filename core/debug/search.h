@@ -0,0 +1,33 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Byte pattern search over flash and RAM, straight from their blocks. Only meant for while
+ * the emulator sits in the debugger, nothing is locked. */
+
+typedef struct {
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;          /* Bits that have to match, 0 for a wildcard */
+} search_pattern_t;
+
+typedef struct {
+    uint32_t address;
+    uint32_t pattern;                   /* Index of the pattern that matched */
+} search_match_t;
+
+/* Parses patterns separated by |, each one of
+ *   hex bytes, with ? for a wildcard nibble:   21 ?? D0 C3
+ *   a 24 bit pointer, stored little endian:    *D0C000
+ *   text in quotes:                            "Done"
+ * Returns false if any of them is malformed. */
+bool search_parse_patterns(const std::string &text, std::vector<search_pattern_t> *patterns);
+
+/* All matches of any of the patterns starting in [address, address + length), by address, at most
+ * max_matches. Parts of the range other than flash and RAM aren't searched. */
+std::vector<search_match_t> search_memory(uint32_t address, uint32_t length,
+                                          const std::vector<search_pattern_t> &patterns, size_t max_matches);
+
+#endif
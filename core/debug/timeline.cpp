@@ -0,0 +1,191 @@
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+
+#include "timeline.h"
+#include "../cpu.h"
+#include "../schedule.h"
+#include "../../os/os.h"
+
+bool timeline_recording = false;
+
+enum { PID_EMULATED = 1, PID_HOST };
+enum { TID_EVENTS = 1, TID_ACK, TID_THROTTLE, TID_IRQ = 0x10 };
+
+static const char *event_names[SCHED_NUM_ITEMS] = {
+    "Throttle", "Keypad", "LCD", "RTC", "OS timer", "Timer 1", "Timer 2", "Timer 3",
+    "Watchdog", "USB", "Input", "Script", "Budget"
+};
+
+static std::mutex timeline_lock;
+static FILE *file;
+static uint64_t host_base;
+static uint64_t cycle_base;             /* Emulated time was emulated_base at this cycle */
+static double emulated_base;
+static uint32_t irq_named;              /* IRQ tracks that got their name already */
+static uint32_t irq_raised;             /* Pending since raised_at, for the latency */
+static uint64_t raised_at[32];
+static double raised_us[32];
+
+uint64_t timeline_host_time(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Both clocks in microseconds, which is what the format wants. Only the cycles since the
+ * last rebase are at the current CPU rate, so the time doesn't jump when the rate changes. */
+static double emulated_us(uint64_t cycle) {
+    uint32_t rate = sched.clock_rates[CLOCK_CPU];
+    if (!rate || cycle < cycle_base) {
+        return emulated_base;
+    }
+    return emulated_base + (cycle - cycle_base) * 1e6 / rate;
+}
+
+static double host_us(uint64_t host) {
+    return (host - host_base) / 1e3;
+}
+
+static void thread_name(int pid, int tid, const char *name) {
+    fprintf(file, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            pid, tid, name);
+}
+
+bool timeline_start(const char *path) {
+    std::lock_guard<std::mutex> guard(timeline_lock);
+
+    if (file || !(file = fopen_utf8(path, "w"))) {
+        return false;
+    }
+    host_base = timeline_host_time();
+    cycle_base = sched_cycles();
+    emulated_base = 0;
+    irq_named = irq_raised = 0;
+
+    fputs("{\"traceEvents\":[\n"
+          "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"Emulated\"}},\n"
+          "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":2,\"args\":{\"name\":\"Host\"}}", file);
+    thread_name(PID_EMULATED, TID_EVENTS, "Events");
+    thread_name(PID_EMULATED, TID_ACK, "Acknowledge");
+    thread_name(PID_HOST, TID_EVENTS, "Event handlers");
+    thread_name(PID_HOST, TID_THROTTLE, "Throttle");
+
+    timeline_recording = true;
+    return true;
+}
+
+bool timeline_stop(void) {
+    std::lock_guard<std::mutex> guard(timeline_lock);
+    bool ok;
+
+    timeline_recording = false;
+    if (!file) {
+        return false;
+    }
+    fputs("\n],\"displayTimeUnit\":\"ns\"}\n", file);
+    ok = !ferror(file);
+    ok = !fclose(file) && ok;
+    file = NULL;
+    return ok;
+}
+
+void timeline_rebase(bool restart) {
+    uint64_t cycle = sched_cycles();
+    std::lock_guard<std::mutex> guard(timeline_lock);
+
+    if (!file) {
+        return;
+    }
+    emulated_base = emulated_us(cycle);
+    cycle_base = restart ? 0 : cycle;
+    if (restart) {
+        /* Raise cycles would be from before the reset */
+        irq_raised = 0;
+    }
+}
+
+uint64_t timeline_event_fired(int index, uint64_t cycle) {
+    std::lock_guard<std::mutex> guard(timeline_lock);
+
+    if (file) {
+        fprintf(file, ",\n{\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"args\":{\"cycle\":%llu}}",
+                event_names[index], PID_EMULATED, TID_EVENTS, emulated_us(cycle), (unsigned long long)cycle);
+    }
+    return timeline_host_time();
+}
+
+void timeline_event_done(int index, uint64_t cycle, uint64_t host_start) {
+    uint64_t host_end = timeline_host_time();
+    std::lock_guard<std::mutex> guard(timeline_lock);
+
+    if (!file) {
+        return;
+    }
+    fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cycle\":%llu}}",
+            event_names[index], PID_HOST, TID_EVENTS, host_us(host_start), (host_end - host_start) / 1e3,
+            (unsigned long long)cycle);
+}
+
+void timeline_interrupt(uint32_t int_num, bool pending) {
+    uint32_t bit = 1u << int_num;
+    uint64_t cycle = sched_cycles();
+    std::lock_guard<std::mutex> guard(timeline_lock);
+
+    if (!file) {
+        return;
+    }
+    if (!pending) {
+        /* Dropped before the CPU took it, or cleared by the handler */
+        irq_raised &= ~bit;
+        return;
+    }
+    if (irq_raised & bit) {
+        return;
+    }
+    /* Each IRQ gets a track of its own, spans of different ones overlap without nesting */
+    if (!(irq_named & bit)) {
+        fprintf(file, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"IRQ %u\"}}",
+                PID_EMULATED, TID_IRQ + int_num, int_num);
+        irq_named |= bit;
+    }
+    irq_raised |= bit;
+    raised_at[int_num] = cycle;
+    raised_us[int_num] = emulated_us(cycle);
+}
+
+void timeline_interrupt_ack(uint32_t pending) {
+    uint64_t cycle = sched_cycles();
+    uint32_t int_num;
+    double now;
+    std::lock_guard<std::mutex> guard(timeline_lock);
+
+    if (!file) {
+        return;
+    }
+    now = emulated_us(cycle);
+    fprintf(file, ",\n{\"ph\":\"i\",\"s\":\"t\",\"name\":\"Acknowledge\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+                  "\"args\":{\"cycle\":%llu,\"pc\":%u,\"pending\":%u}}",
+            PID_EMULATED, TID_ACK, now, (unsigned long long)cycle, cpu.registers.PC, pending);
+    for (int_num = 0; int_num < 32; int_num++) {
+        if (pending & irq_raised & 1u << int_num) {
+            uint64_t latency = cycle - raised_at[int_num];
+            fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"IRQ %u\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                          "\"args\":{\"cycle\":%llu,\"latency\":%llu}}",
+                    int_num, PID_EMULATED, TID_IRQ + int_num, raised_us[int_num], now - raised_us[int_num],
+                    (unsigned long long)raised_at[int_num], (unsigned long long)latency);
+        }
+    }
+    irq_raised &= ~pending;
+}
+
+void timeline_throttle(uint64_t host_start) {
+    uint64_t host_end = timeline_host_time();
+    uint64_t cycle = sched_cycles();
+    std::lock_guard<std::mutex> guard(timeline_lock);
+
+    if (!file) {
+        return;
+    }
+    fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"Sleep\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cycle\":%llu}}",
+            PID_HOST, TID_THROTTLE, host_us(host_start), (host_end - host_start) / 1e3, (unsigned long long)cycle);
+}
@@ -0,0 +1,45 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../defines.h"
+
+/* Scheduler and interrupt timeline, streamed to a file in the Chrome trace event format
+ * (chrome://tracing, ui.perfetto.dev). Two processes show up in the viewer:
+ *
+ *   Emulated  - event fire times, interrupts from the rising edge of their request to the
+ *               acknowledge, on a clock advanced by CPU cycles at the CPU rate they ran at
+ *   Host      - event handlers with their duration and throttle sleeps, in wall time
+ *
+ * Every entry also carries the CPU cycle in its args, so both can be lined up. */
+
+/* Checked before calling in from the scheduler, interrupt controller and CPU */
+extern bool timeline_recording;
+
+bool timeline_start(const char *path);
+/* Closes the trace, false if it couldn't be written completely */
+bool timeline_stop(void);
+
+/* Host clock in nanoseconds, to take the start of what gets timed */
+uint64_t timeline_host_time(void);
+
+/* Before the CPU rate changes, or the cycle count starts over from 0 on a reset */
+void timeline_rebase(bool restart);
+
+/* Around an event handler, fired returns the host start to pass to done */
+uint64_t timeline_event_fired(int index, uint64_t cycle);
+void timeline_event_done(int index, uint64_t cycle, uint64_t host_start);
+/* Whether int_num is requested and enabled, after each change through intrpt_trigger */
+void timeline_interrupt(uint32_t int_num, bool pending);
+/* pending is the mask of enabled requests being acknowledged */
+void timeline_interrupt_ack(uint32_t pending);
+void timeline_throttle(uint64_t host_start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,9 +28,13 @@
 #include "schedule.h"
 #include "asic.h"
 #include "cert.h"
+#include "input.h"
+#include "script.h"
 #include "os/os.h"
+#include "debug/timeline.h"
 
 const char *rom_image = NULL;
+int rom_backing = FLASH_MAP_PRIVATE;
 
 /* cycle_count_delta is a (usually negative) number telling what the time is relative
  * to the next scheduled event. See schedule.c */
@@ -46,6 +50,10 @@ bool turbo_mode = false;
 
 volatile bool exiting, debug_on_start, debug_on_warn;
 
+bool deterministic_mode = false;
+int64_t deterministic_epoch = 852076800; /* 1997-01-01, where the calculator's day counter starts */
+uint64_t cycle_budget = 0;
+
 const char log_type_tbl[] = LOG_TYPE_TBL;
 int log_enabled[MAX_LOG];
 FILE *log_file[MAX_LOG];
@@ -79,6 +87,20 @@ void error(const char *fmt, ...) {
 void throttle_interval_event(int index) {
     event_repeat(index, 27000000 / 60);
 
+    input_throttle_event();
+
+    /* Write back a shared ROM image about once per emulated second */
+    static int sync_intervals = 0;
+    if (++sync_intervals >= 60) {
+        sync_intervals = 0;
+        mem_flash_sync();
+    }
+
+    if (turbo_mode) {
+        gui_do_stuff(false);
+        return;
+    }
+
     static int intervals = 0, prev_intervals = 0;
     intervals += 1;
 
@@ -96,13 +118,18 @@ void throttle_interval_event(int index) {
     gui_do_stuff(true);
 
     if (speed > 0.7) {
-        throttle_timer_wait();
+        if (timeline_recording) {
+            uint64_t host_start = timeline_host_time();
+            throttle_timer_wait();
+            timeline_throttle(host_start);
+        } else {
+            throttle_timer_wait();
+        }
     }
 }
 
 bool emu_start() {
     bool ret = false;
-    long lSize;
 
     asic_init();
 
@@ -110,9 +137,9 @@ bool emu_start() {
         gui_console_printf("No ROM image specified.");
     }
     else {
-        FILE *rom = fopen_utf8(rom_image, "rb");
+        bool loaded = mem_load_flash(rom_image, rom_backing);
         do {
-            if (rom) {
+            if (loaded) {
                 uint16_t field_type;
                 const uint8_t *outer;
                 const uint8_t *current;
@@ -122,25 +149,6 @@ bool emu_start() {
                 ti_device_type device_type;
                 uint32_t offset;
 
-                // Get ROM file size
-                if (fseek(rom, 0L, SEEK_END) < 0) {
-                    break;
-                }
-
-                lSize = ftell(rom);
-                if (lSize < 0) {
-                    break;
-                }
-
-                if (fseek(rom, 0L, SEEK_SET) < 0) {
-                    break;
-                }
-
-                // Read whole ROM.
-                if (fread(asic.mem->flash.block, 1, lSize, rom) < (size_t)lSize) {
-                    break;
-                }
-
                 // Parse certificate fields to determine model.
                 //device_type = (ti_device_type)(asic.mem->flash.block[0x20017]);
                 // We've heard of the OS base being at 0x30000 on at least one calculator.
@@ -252,10 +260,6 @@ bool emu_start() {
             gui_console_printf("Error opening ROM image.\n", rom_image);
             emu_cleanup();
         }
-
-        if (rom) {
-            fclose(rom);
-        }
     }
 
     return ret;
@@ -266,6 +270,21 @@ void emu_cleanup(void) {
     asic_free();
 }
 
+static void emu_budget_event(int index) {
+    /* FNV-1a over RAM, so runs can be compared without dumping it */
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint32_t i;
+    (void)index;
+
+    for (i = 0; i < 0x65800; i++) {
+        hash = (hash ^ mem.ram.block[i]) * 0x100000001B3ULL;
+    }
+
+    gui_console_printf("Cycle budget reached after %llu cycles, RAM hash %016llX.\n",
+                       (unsigned long long)sched_cycles(), (unsigned long long)hash);
+    exiting = true;
+}
+
 static void emu_reset() {
     cpu_reset();
     cpu_events &= EVENT_DEBUG_STEP;
@@ -281,6 +300,15 @@ static void emu_reset() {
     cycle_count_delta = 0;
 
     sched_update_next_event(0);
+
+    input_reset();
+    script_reset();
+
+    if (cycle_budget) {
+        sched.items[SCHED_BUDGET].clock = CLOCK_CPU;
+        sched.items[SCHED_BUDGET].proc = emu_budget_event;
+        event_set(SCHED_BUDGET, cycle_budget);
+    }
 }
 
 #ifdef __EMSCRIPTEN__
@@ -289,6 +317,8 @@ void emu_inner_loop(void)
 {
   while (!exiting) {
       sched_process_pending_events();
+      script_poll();
+      input_poll();
       if (cpu_events & EVENT_RESET) {
           gui_console_printf("CPU Reset triggered...");
           emu_reset();
@@ -326,6 +356,8 @@ void emu_loop(bool reset) {
             debugger(DBG_STEP, 0);
         }
         sched_process_pending_events();
+        script_poll();
+        input_poll();
         if (cycle_count_delta < 0) {
             cpu_execute();  // execute instructions with available clock cycles
         } else {
@@ -16,10 +16,20 @@ extern uint32_t cpu_events;
 #define EVENT_DEBUG_STEP      2
 #define EVENT_DEBUG_STEP_OVER 4
 #define EVENT_WAITING         8
+#define EVENT_STOP            16    /* Return from cpu_execute() after this instruction */
 
 /* Settings */
 extern volatile bool exiting, debug_on_start, debug_on_warn;
 
+/* Reproducible mode: the RTC counts emulated time from deterministic_epoch (Unix time)
+ * and the host clock is never consulted. With turbo_mode throttling is off, so it runs
+ * as fast as it can. With a nonzero cycle_budget emulation stops once that many CPU
+ * cycles have run. */
+extern bool turbo_mode;
+extern bool deterministic_mode;
+extern int64_t deterministic_epoch;
+extern uint64_t cycle_budget;
+
 enum { LOG_CPU, LOG_IO, LOG_FLASH, LOG_INTRPTS, LOG_COUNT, LOG_USB, LOG_GUI, MAX_LOG };
 #define LOG_TYPE_TBL "CIFQ#UG"
 extern int log_enabled[MAX_LOG];
@@ -31,8 +41,9 @@ void throttle_timer_wait();
 void warn(const char *fmt, ...);
 void error(const char *fmt, ...);
 
-/* ROM image */
+/* ROM image, and how flash is backed by it (enum flash_backing in mem.h) */
 extern const char *rom_image;
+extern int rom_backing;
 
 /* GUI callbacks */
 void gui_do_stuff(bool wait);
@@ -0,0 +1,275 @@
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "flashimage.h"
+#include "os/os.h"
+
+static const char magic[4] = { 'C', 'E', 'F', 'S' };
+static const uint8_t version = 1;
+static const uint32_t header_size = 16;
+
+struct Sector {
+    uint32_t offset, size;
+};
+
+/* 8 sectors of 8K, then 64K ones, same as mem_init() */
+static std::vector<Sector> sector_layout(uint32_t size) {
+    std::vector<Sector> sectors;
+    uint32_t offset = 0;
+    for (int i = 0; i < 8 && offset < size; i++, offset += 0x2000) {
+        sectors.push_back({ offset, 0x2000 });
+    }
+    for (; offset < size; offset += 0x10000) {
+        sectors.push_back({ offset, 0x10000 });
+    }
+    return sectors;
+}
+
+static uint32_t load32(const uint8_t *ptr) {
+    return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | static_cast<uint32_t>(ptr[3]) << 24;
+}
+
+static void store32(uint8_t *ptr, uint32_t value) {
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+    ptr[3] = value >> 24;
+}
+
+static void put_length(std::vector<uint8_t> &out, uint32_t length) {
+    for (; length >= 255; length -= 255) {
+        out.push_back(255);
+    }
+    out.push_back(length);
+}
+
+/* LZ77 blocks made of sequences: token (literal count << 4 | match length - 4, 15 means
+ * more length bytes follow), literals, u16 match offset. The last sequence has no match. */
+static void compress(const uint8_t *src, uint32_t size, std::vector<uint8_t> &out) {
+    enum { HASH_BITS = 12, MIN_MATCH = 4 };
+    int32_t table[1 << HASH_BITS];
+    uint32_t i = 0, anchor = 0;
+
+    memset(table, 0xFF, sizeof table);
+    while (i + MIN_MATCH <= size) {
+        uint32_t word = load32(src + i), hash = (word * 2654435761u) >> (32 - HASH_BITS);
+        int32_t candidate = table[hash];
+        table[hash] = i;
+        if (candidate < 0 || i - candidate > 0xFFFF || load32(src + candidate) != word) {
+            i++;
+            continue;
+        }
+
+        uint32_t length = MIN_MATCH, literals = i - anchor, offset = i - candidate;
+        while (i + length < size && src[candidate + length] == src[i + length]) {
+            length++;
+        }
+        out.push_back((literals < 15 ? literals : 15) << 4 | (length - MIN_MATCH < 15 ? length - MIN_MATCH : 15));
+        if (literals >= 15) {
+            put_length(out, literals - 15);
+        }
+        out.insert(out.end(), src + anchor, src + i);
+        out.push_back(offset);
+        out.push_back(offset >> 8);
+        if (length - MIN_MATCH >= 15) {
+            put_length(out, length - MIN_MATCH - 15);
+        }
+        i += length;
+        anchor = i;
+    }
+
+    uint32_t literals = size - anchor;
+    out.push_back((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) {
+        put_length(out, literals - 15);
+    }
+    out.insert(out.end(), src + anchor, src + size);
+}
+
+static bool get_length(const uint8_t *&in, const uint8_t *end, uint32_t *length) {
+    uint8_t byte;
+    do {
+        if (in == end) {
+            return false;
+        }
+        *length += byte = *in++;
+    } while (byte == 255);
+    return true;
+}
+
+static bool decompress(const uint8_t *in, uint32_t in_size, uint8_t *out, uint32_t out_size) {
+    const uint8_t *end = in + in_size;
+    uint32_t pos = 0;
+
+    while (in < end) {
+        uint8_t token = *in++;
+        uint32_t literals = token >> 4, length = (token & 15) + 4, offset;
+
+        if (literals == 15 && !get_length(in, end, &literals)) {
+            return false;
+        }
+        if (literals > static_cast<uint32_t>(end - in) || literals > out_size - pos) {
+            return false;
+        }
+        memcpy(out + pos, in, literals);
+        in += literals;
+        pos += literals;
+        if (in == end) {
+            break;
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        offset = in[0] | in[1] << 8;
+        in += 2;
+        if ((token & 15) == 15 && !get_length(in, end, &length)) {
+            return false;
+        }
+        if (!offset || offset > pos || length > out_size - pos) {
+            return false;
+        }
+        /* Byte by byte, matches may overlap what they produce */
+        for (uint32_t i = 0; i < length; i++, pos++) {
+            out[pos] = out[pos - offset];
+        }
+    }
+    return pos == out_size;
+}
+
+static bool read_file(const char *file_name, std::vector<uint8_t> &data) {
+    FILE *file = fopen_utf8(file_name, "rb");
+    long size;
+    bool ok;
+
+    if (!file) {
+        return false;
+    }
+    ok = !fseek(file, 0L, SEEK_END) && (size = ftell(file)) >= 0 && !fseek(file, 0L, SEEK_SET);
+    if (ok) {
+        data.resize(size);
+        ok = fread(data.data(), 1, size, file) == static_cast<size_t>(size);
+    }
+    fclose(file);
+    return ok;
+}
+
+static bool write_file(const char *file_name, const uint8_t *data, size_t size) {
+    FILE *file = fopen_utf8(file_name, "wb");
+    bool ok;
+
+    if (!file) {
+        return false;
+    }
+    ok = fwrite(data, 1, size, file) == size;
+    ok = !fclose(file) && ok;
+    if (!ok) {
+        remove(file_name);
+    }
+    return ok;
+}
+
+static bool is_sparse(const std::vector<uint8_t> &data) {
+    return data.size() >= header_size && !memcmp(data.data(), magic, sizeof magic) && data[4] == version;
+}
+
+bool flash_image_is_sparse(const char *file_name) {
+    FILE *file = fopen_utf8(file_name, "rb");
+    uint8_t header[5];
+    bool sparse;
+
+    if (!file) {
+        return false;
+    }
+    sparse = fread(header, 1, sizeof header, file) == sizeof header &&
+             !memcmp(header, magic, sizeof magic) && header[4] == version;
+    fclose(file);
+    return sparse;
+}
+
+static bool unpack(const std::vector<uint8_t> &data, uint8_t *flash, uint32_t size) {
+    if (!is_sparse(data) || load32(&data[8]) != size) {
+        return false;
+    }
+    std::vector<Sector> sectors = sector_layout(size);
+    if (load32(&data[12]) != sectors.size() || data.size() < header_size + sectors.size() * 8) {
+        return false;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+        for (size_t i; ok && (i = next++) < sectors.size();) {
+            const uint8_t *entry = &data[header_size + i * 8];
+            uint32_t offset = load32(entry), length = load32(entry + 4);
+            if (!offset) {
+                memset(flash + sectors[i].offset, 0xFF, sectors[i].size);
+            } else if (offset > data.size() || length > data.size() - offset ||
+                       !decompress(&data[offset], length, flash + sectors[i].offset, sectors[i].size)) {
+                ok = false;
+            }
+        }
+    };
+
+    unsigned int count = std::thread::hardware_concurrency();
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < count && i < sectors.size(); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
+
+static void pack(const uint8_t *flash, uint32_t size, std::vector<uint8_t> &out) {
+    std::vector<Sector> sectors = sector_layout(size);
+
+    out.assign(header_size + sectors.size() * 8, 0);
+    memcpy(out.data(), magic, sizeof magic);
+    out[4] = version;
+    store32(&out[8], size);
+    store32(&out[12], sectors.size());
+
+    for (size_t i = 0; i < sectors.size(); i++) {
+        const uint8_t *data = flash + sectors[i].offset;
+        uint32_t j, offset = out.size();
+        for (j = 0; j < sectors[i].size && data[j] == 0xFF; j++);
+        if (j == sectors[i].size) {
+            continue;
+        }
+        compress(data, sectors[i].size, out);
+        store32(&out[header_size + i * 8], offset);
+        store32(&out[header_size + i * 8 + 4], out.size() - offset);
+    }
+}
+
+bool flash_image_load(const char *file_name, uint8_t *flash, uint32_t size) {
+    std::vector<uint8_t> data;
+    return read_file(file_name, data) && unpack(data, flash, size);
+}
+
+bool flash_image_save(const char *file_name, const uint8_t *flash, uint32_t size) {
+    std::vector<uint8_t> data;
+    pack(flash, size, data);
+    return write_file(file_name, data.data(), data.size());
+}
+
+bool flash_image_convert(const char *in_name, const char *out_name) {
+    std::vector<uint8_t> data;
+
+    if (!read_file(in_name, data)) {
+        return false;
+    }
+    if (is_sparse(data)) {
+        std::vector<uint8_t> flash(load32(&data[8]));
+        return unpack(data, flash.data(), flash.size()) && write_file(out_name, flash.data(), flash.size());
+    }
+    /* Raw images may be short, the rest of the chip is erased */
+    std::vector<uint8_t> flash(data.size() > 0x400000 ? data.size() : 0x400000, 0xFF);
+    memcpy(flash.data(), data.data(), data.size());
+    return flash_image_save(out_name, flash.data(), flash.size());
+}
@@ -0,0 +1,32 @@
+#ifndef FLASHIMAGE_H
+#define FLASHIMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Sparse flash images, for fixtures that are mostly erased flash.
+ *
+ *   "CEFS", u8 version, 3 zero bytes, u32 flash size, u32 sector count,
+ *   per sector: u32 file offset of its data (0 when the sector is erased), u32 data length,
+ *   sector data
+ *
+ * All little endian. Sectors follow the chip: 8 of 8K, then 64K ones. Each stored
+ * sector is compressed on its own in an LZ77 block format, so they can be unpacked
+ * in parallel. */
+
+bool flash_image_is_sparse(const char *file_name);
+bool flash_image_load(const char *file_name, uint8_t *flash, uint32_t size);
+bool flash_image_save(const char *file_name, const uint8_t *flash, uint32_t size);
+
+/* Sparse to raw or raw to sparse, depending on what in_name is */
+bool flash_image_convert(const char *in_name, const char *out_name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
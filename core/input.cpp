@@ -0,0 +1,411 @@
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "input.h"
+#include "emu.h"
+#include "schedule.h"
+#include "keypad.h"
+#include "link.h"
+#include "mem.h"
+#include "os/os.h"
+
+/* Journal record types */
+enum {
+    INPUT_KEY_RELEASE = 1,      /* u8 row << 4 | col */
+    INPUT_KEY_PRESS,            /* u8 row << 4 | col */
+    INPUT_UNMAPPED_KEY,         /* no payload */
+    INPUT_LINK_SEND             /* varint count, then varint length and UTF-8 name for each file */
+};
+
+enum { MODE_NONE, MODE_RECORD, MODE_REPLAY };
+
+struct InputRecord {
+    uint8_t type;
+    uint8_t key;
+    uint64_t cycle;
+    std::vector<std::string> file_names;
+};
+
+static const char magic[4] = { 'C', 'E', 'J', '1' };
+static const uint8_t version = 2;
+
+static std::mutex input_mutex;
+static std::atomic<bool> pending(false);   /* Something for input_poll to look at */
+
+/* Protected by input_mutex */
+static std::vector<InputRecord> queue;      /* From the GUI, not yet applied */
+static FILE *journal = NULL;
+static int mode = MODE_NONE, start_mode = MODE_NONE;
+static int64_t journal_epoch;
+static uint64_t journal_hash;
+static uint64_t last_cycle;
+static InputRecord next;                    /* Next record to replay */
+static bool saved_turbo, saved_deterministic;
+static int64_t saved_epoch;
+
+/* Emulator thread only */
+static bool armed = false;
+
+static uint64_t flash_hash(void) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (uint32_t i = 0; i < mem.flash.size; i++) {
+        hash = (hash ^ mem.flash.block[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static void write_u64(uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        fputc(static_cast<uint8_t>(value >> (i * 8)), journal);
+    }
+}
+
+static bool read_u64(FILE *file, uint64_t *value) {
+    uint8_t buf[8];
+    if (fread(buf, 1, 8, file) != 8) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 7; i >= 0; i--) {
+        *value = *value << 8 | buf[i];
+    }
+    return true;
+}
+
+static void write_varint(uint64_t value) {
+    while (value >= 0x80) {
+        fputc(static_cast<uint8_t>(value) | 0x80, journal);
+        value >>= 7;
+    }
+    fputc(static_cast<uint8_t>(value), journal);
+}
+
+static bool read_varint(uint64_t *value) {
+    int byte, shift = 0;
+    *value = 0;
+    do {
+        if ((byte = fgetc(journal)) == EOF || shift > 63) {
+            return false;
+        }
+        *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return true;
+}
+
+static void write_record(const InputRecord &record) {
+    /* Zigzag, so a record stamped slightly before the previous one doesn't break the stream */
+    uint64_t delta = record.cycle - last_cycle;
+    last_cycle = record.cycle;
+
+    fputc(record.type, journal);
+    write_varint(delta << 1 ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63));
+    if (record.type == INPUT_KEY_RELEASE || record.type == INPUT_KEY_PRESS) {
+        fputc(record.key, journal);
+    } else if (record.type == INPUT_LINK_SEND) {
+        write_varint(record.file_names.size());
+        for (const std::string &file_name : record.file_names) {
+            write_varint(file_name.size());
+            fwrite(file_name.data(), 1, file_name.size(), journal);
+        }
+    }
+    fflush(journal);
+}
+
+static bool read_record(InputRecord *record) {
+    uint64_t delta, count, length;
+    int type = fgetc(journal), key = 0;
+
+    if (type == EOF || !read_varint(&delta)) {
+        return false;
+    }
+    switch (type) {
+        case INPUT_KEY_RELEASE:
+        case INPUT_KEY_PRESS:
+            if ((key = fgetc(journal)) == EOF) {
+                return false;
+            }
+            break;
+        case INPUT_UNMAPPED_KEY:
+            break;
+        case INPUT_LINK_SEND:
+            if (!read_varint(&count) || count > 4096) {
+                return false;
+            }
+            record->file_names.resize(count);
+            for (std::string &file_name : record->file_names) {
+                if (!read_varint(&length) || length > 4096) {
+                    return false;
+                }
+                file_name.resize(length);
+                if (length && fread(&file_name[0], 1, length, journal) != length) {
+                    return false;
+                }
+            }
+            break;
+        default:
+            return false;
+    }
+
+    last_cycle += (delta >> 1) ^ (0 - (delta & 1));
+    record->type = type;
+    record->key = key;
+    record->cycle = last_cycle;
+    return true;
+}
+
+static void apply(const InputRecord &record) {
+    switch (record.type) {
+        case INPUT_KEY_RELEASE:
+        case INPUT_KEY_PRESS:
+            keypad_key_event(record.key >> 4, record.key & 15, record.type == INPUT_KEY_PRESS);
+            break;
+        case INPUT_UNMAPPED_KEY:
+            keypad.gpio_enable |= 0x800;
+            keypad_intrpt_check();
+            break;
+        default:
+            break;
+    }
+}
+
+static void close_journal(void) {
+    /* Both change the clock, also undone when stopped before the reset that starts them */
+    if (mode != MODE_NONE || start_mode != MODE_NONE) {
+        deterministic_mode = saved_deterministic;
+        deterministic_epoch = saved_epoch;
+    }
+    if (mode == MODE_REPLAY || start_mode == MODE_REPLAY) {
+        turbo_mode = saved_turbo;
+    }
+    if (journal) {
+        fclose(journal);
+        journal = NULL;
+    }
+    mode = start_mode = MODE_NONE;
+    queue.clear();
+    pending = false;
+}
+
+static void replay_advance(void) {
+    if (!read_record(&next)) {
+        gui_console_printf("Input replay finished at cycle %llu.\n", static_cast<unsigned long long>(sched_cycles()));
+        close_journal();
+    }
+}
+
+static void input_event(int index) {
+    /* Only here to stop the CPU on the right cycle, input_poll does the work */
+    (void)index;
+    armed = false;
+}
+
+void input_key_event(int row, int col, bool press) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (mode != MODE_REPLAY) {
+        InputRecord record;
+        record.type = press ? INPUT_KEY_PRESS : INPUT_KEY_RELEASE;
+        record.key = static_cast<uint8_t>(row << 4 | col);
+        queue.push_back(record);
+        pending = true;
+    }
+}
+
+void input_unmapped_key(void) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (mode != MODE_REPLAY) {
+        InputRecord record;
+        record.type = INPUT_UNMAPPED_KEY;
+        queue.push_back(record);
+        pending = true;
+    }
+}
+
+bool input_link_send(int count, const char *const *file_names) {
+    {
+        std::lock_guard<std::mutex> lock(input_mutex);
+        if (mode == MODE_REPLAY) {
+            return false;
+        }
+        if (mode == MODE_RECORD) {
+            /* The emulator is parked in the throttle event, stamp it with that event's cycle */
+            InputRecord record;
+            record.type = INPUT_LINK_SEND;
+            record.cycle = sched.cycle_base + sched.next_cputick;
+            record.file_names.assign(file_names, file_names + count);
+            write_record(record);
+        }
+    }
+    return sendVariablesLink(count, file_names);
+}
+
+bool input_record_start(const char *file_name) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+
+    if (mode != MODE_NONE || start_mode != MODE_NONE || !(journal = fopen_utf8(file_name, "wb"))) {
+        return false;
+    }
+
+    /* The clock has to come from emulated time for the journal to replay the same way */
+    saved_deterministic = deterministic_mode;
+    saved_epoch = deterministic_epoch;
+    if (!deterministic_mode) {
+        deterministic_epoch = time(NULL);
+        deterministic_mode = true;
+    }
+    journal_epoch = deterministic_epoch;
+    start_mode = MODE_RECORD;
+    cpu_events |= EVENT_RESET;
+    return true;
+}
+
+bool input_replay_start(const char *file_name) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    char buf[sizeof(magic) + 1];
+    uint64_t epoch;
+
+    if (mode != MODE_NONE || start_mode != MODE_NONE || !(journal = fopen_utf8(file_name, "rb"))) {
+        return false;
+    }
+    if (fread(buf, 1, sizeof(buf), journal) != sizeof(buf) || memcmp(buf, magic, sizeof(magic)) ||
+        static_cast<uint8_t>(buf[sizeof(magic)]) != version || !read_u64(journal, &epoch) || !read_u64(journal, &journal_hash)) {
+        gui_console_printf("Not an input journal: %s\n", file_name);
+        fclose(journal);
+        journal = NULL;
+        return false;
+    }
+
+    saved_turbo = turbo_mode;
+    saved_deterministic = deterministic_mode;
+    saved_epoch = deterministic_epoch;
+    journal_epoch = static_cast<int64_t>(epoch);
+    deterministic_epoch = journal_epoch;
+    deterministic_mode = true;
+    start_mode = MODE_REPLAY;
+    cpu_events |= EVENT_RESET;
+    return true;
+}
+
+void input_stop(void) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (mode == MODE_RECORD) {
+        gui_console_printf("Stopped recording input.\n");
+    }
+    if (mode == MODE_REPLAY) {
+        gui_console_printf("Stopped replaying input.\n");
+    }
+    close_journal();
+}
+
+bool input_recording(void) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    return mode == MODE_RECORD || start_mode == MODE_RECORD;
+}
+
+bool input_replaying(void) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    return mode == MODE_REPLAY || start_mode == MODE_REPLAY;
+}
+
+void input_reset(void) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+
+    sched.items[SCHED_INPUT].clock = CLOCK_CPU;
+    sched.items[SCHED_INPUT].second = -1;
+    sched.items[SCHED_INPUT].proc = input_event;
+    armed = false;
+    last_cycle = 0;
+
+    if (mode != MODE_NONE) {
+        /* Cycle counts start over, so the journal can't continue */
+        gui_console_printf("Input journal ended by reset.\n");
+        close_journal();
+    }
+
+    switch (start_mode) {
+        case MODE_RECORD:
+            fwrite(magic, 1, sizeof(magic), journal);
+            fputc(version, journal);
+            write_u64(static_cast<uint64_t>(journal_epoch));
+            write_u64(flash_hash());
+            fflush(journal);
+            mode = MODE_RECORD;
+            gui_console_printf("Started recording input.\n");
+            break;
+        case MODE_REPLAY:
+            if (journal_hash != flash_hash()) {
+                gui_console_printf("Warning: the journal was recorded with a different ROM image.\n");
+            }
+            mode = MODE_REPLAY;
+            turbo_mode = true;
+            pending = true;
+            gui_console_printf("Started replaying input.\n");
+            replay_advance();
+            break;
+        default:
+            break;
+    }
+    start_mode = MODE_NONE;
+}
+
+void input_poll(void) {
+    if (!pending) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(input_mutex);
+    uint64_t now = sched_cycles();
+
+    if (mode == MODE_REPLAY) {
+        while (mode == MODE_REPLAY && next.type != INPUT_LINK_SEND && next.cycle <= now) {
+            apply(next);
+            replay_advance();
+        }
+        if (mode == MODE_REPLAY && next.type != INPUT_LINK_SEND && !armed) {
+            event_set(SCHED_INPUT, next.cycle - now);
+            armed = true;
+        }
+        return;
+    }
+
+    for (InputRecord &record : queue) {
+        record.cycle = now;
+        apply(record);
+        if (mode == MODE_RECORD) {
+            write_record(record);
+        }
+    }
+    queue.clear();
+    pending = false;
+}
+
+void input_throttle_event(void) {
+    if (!pending) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(input_mutex);
+    uint64_t now = sched.cycle_base + sched.next_cputick;
+
+    /* Link transfers happened while the emulator was parked in this event. If the throttle
+     * interval changed since recording, none lands on that cycle again, so take the first
+     * one at or after it rather than stalling the replay for good. */
+    while (mode == MODE_REPLAY && next.type == INPUT_LINK_SEND && next.cycle <= now) {
+        std::vector<const char *> names;
+        if (next.cycle != now) {
+            gui_console_printf("Replaying link transfer late, at cycle %llu instead of %llu.\n",
+                               static_cast<unsigned long long>(now), static_cast<unsigned long long>(next.cycle));
+        }
+        for (const std::string &file_name : next.file_names) {
+            names.push_back(file_name.c_str());
+        }
+        if (!sendVariablesLink(static_cast<int>(names.size()), names.data())) {
+            gui_console_printf("Replayed link transfer failed.\n");
+        }
+        replay_advance();
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defines.h"
+
+/* Key presses and link transfers from the GUI go through here. Keys are queued
+ * and applied on the emulator thread between scheduler events, so every input
+ * lands on a well defined emulated cycle and can be journaled.
+ *
+ * A journal starts at a reset and is an append-only stream:
+ *   "CEJ1", u8 version (2), s64 RTC epoch, u64 hash of flash (little endian),
+ * followed by records of
+ *   u8 type, varint cycles since the previous record, payload
+ * See input.cpp for the record types. */
+
+/* GUI thread */
+void input_key_event(int row, int col, bool press);
+void input_unmapped_key(void);
+/* Called while the emulator is parked in link mode, sends all files in one session */
+bool input_link_send(int count, const char *const *file_names);
+
+/* Both reset the emulator and start the journal from there.
+ * Replay runs unthrottled and ignores keys from the GUI until the journal ends. */
+bool input_record_start(const char *file_name);
+bool input_replay_start(const char *file_name);
+void input_stop(void);
+bool input_recording(void);
+bool input_replaying(void);
+
+/* Emulator thread */
+void input_reset(void);
+void input_poll(void);
+void input_throttle_event(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
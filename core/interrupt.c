@@ -3,6 +3,7 @@
 #include "interrupt.h"
 #include "emu.h"
 #include "cpu.h"
+#include "debug/timeline.h"
 
 interrupt_state_t intrpt;
 
@@ -23,6 +24,9 @@ void intrpt_trigger(uint32_t int_num, interrupt_mode_t mode) {
         intrpt.status &= ~(1 << int_num);
     }
     update();
+    if (timeline_recording) {
+        timeline_interrupt(int_num, intrpt.request->status & intrpt.request->enabled & 1 << int_num);
+    }
     if (mode == INTERRUPT_PULSE) {
         intrpt_trigger(int_num, INTERRUPT_CLEAR);
     }
@@ -88,6 +88,7 @@ static void keypad_scan_event(int index) {
     } else {  /* finished scanning the keypad */
         keypad.current_row = 0;
         keypad.status |= 1;
+        keypad.scans++;
         if (keypad.mode & 1) { /* are we in mode 1 or 3 */
             event_repeat(index, keypad.scan_wait + keypad.row_wait);
         } else {
@@ -30,6 +30,7 @@ typedef struct keypad_state {
     uint16_t key_map[16];
     uint32_t gpio_status;
     uint32_t gpio_enable;
+    uint32_t scans;     /* Completed scans, so scripted input knows when a key was seen */
 } keypad_state_t;
 
 /* Global KEYPAD state */
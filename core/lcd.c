@@ -19,119 +19,91 @@
 #include "interrupt.h"
 #include "mem.h"
 #include "emu.h"
+#include "lcdframe.h"
+#include "lcdconv.h"
+#include "backlight.h"
 #include "capture/gif.h"
+#include "capture/video.h"
+#include "script.h"
 
 /* Global LCD state */
 lcd_cntrl_state_t lcd;
+lcd_dirty_state_t lcd_dirty;
 
-#define dataswap(a, b) do { (a) ^= (b); (b) ^= (a); (a) ^= (b); } while(0)
-
-/* Draw the current screen into a 16bpp upside-down bitmap. */
-void lcd_drawframe(uint16_t *buffer, uint32_t *bitfields) {
+static uint32_t lcd_bpp(void) {
     uint32_t mode = lcd.control >> 1 & 7;
-    uint32_t bpp;
-    uint32_t words,word;
-    uint32_t i,bi,color,mask;
-    uint32_t *outw;
-    uint32_t *in;
-    uint16_t *out;
-    uint8_t r,
-            g,
-            b;
+    return mode <= 5 ? 1u << mode : 16;
+}
 
-    int row;
+#define row_dirty(rows, row) (!(rows) || (rows)[(row) >> 5] >> ((row) & 31) & 1)
 
-    if (mode <= 5) {
-        bpp = 1 << mode;
-    }
-    else {
-        bpp = 16;
-    }
+static lcdconv_t lcd_conv;
 
-    if (mode == 7) {
-        // 444 format
-        bitfields[0] = 0x000F;
-        bitfields[1] = 0x00F0;
-        bitfields[2] = 0x0F00;
-    } else {
-        // 565 format
-        bitfields[0] = 0x001F;
-        bitfields[1] = 0x07E0;
-        bitfields[2] = 0xF800;
-    }
-    if (lcd.control & (1 << 8)) {
-        // BGR format (R high, B low)
-        dataswap(bitfields[0], bitfields[2]);
-    }
+/* Draw the current screen into a 32bpp ARGB bitmap with the backlight applied.
+ * If rows is not NULL, only the scanlines with their bit set are converted. */
+void lcd_drawframe(uint32_t *buffer, const uint32_t *rows) {
+    uint32_t stride = 320 / 8 * lcd_bpp();
+    const uint8_t *in;
+    int row;
 
-    in = (uint32_t *)(intptr_t)phys_mem_ptr(lcd.upcurr, (320 * 240) / 8 * bpp);
+    in = phys_mem_ptr(lcd.upcurr, 240 * stride);
     if (!in || !lcd.upcurr) {
-        memset(buffer, 0, 320 * 240 * 2);
+        memset(buffer, 0, 320 * 240 * 4);
+        lcd_conv.colors = 0;
         return;
     }
 
-    if (bpp < 16) {
-        for (row = 0; row < 240; ++row) {
-            out = buffer + (row * 320);
-            words = (320 / 32) * bpp;
-            mask = (1 << bpp) - 1;
-            bi = (lcd.control & (1 << 9)) ? 0 : 24;
-            if (!(lcd.control & (1 << 10))) {
-                bi ^= (8 - bpp);
-            }
-            do {
-                int bitpos = 32;
-                word = *in++;
-                do {
-                    color = lcd.palette[word >> ((bitpos -= bpp) ^ bi) & mask];
-                    *out++ = color + (color & 0xFFE0) + (color >> 10 & 0x20);
-                } while (bitpos != 0);
-            } while (--words != 0);
-        }
-    } else if (mode == 4) {
-        for (row = 0; row < 240; ++row) {
-            out = buffer + (row * 320);
-            words = (320 / 32) * bpp;
-            bi = lcd.control >> 9 & 1;
-            for (i = 0; i < 320; i++) {
-                color = ((uint16_t *)in)[i ^ bi];
-                r = color & 0x1F;
-                g = (color >> 5) & 0x1F;
-                b = (color >> 10) & 0x1F;
-
-                out[i] = (r << 11) | (g << 6) | b | (color >> 10 & 0x20);
-            }
-            in += 160;
-       }
-    } else if (mode == 5) {
-        for (row = 0; row < 240; ++row) {
-            out = buffer + (row * 320);
-            words = (320 / 32) * bpp;
-            // 32bpp mode: Convert 888 to 565
-            do {
-                word = *in++;
-                *out++ = (word >> 8 & 0xF800) | (word >> 5 & 0x7E0) | (word >> 3 & 0x1F);
-            } while (--words != 0);
-        }
-    } else {
-        for (row = 0; row < 240; ++row) {
-            out = buffer + (row * 320);
-            words = (320 / 32) * bpp;
-            if (!(lcd.control & (1 << 9))) {
-                memcpy(out, in, 640);
-                in += 160;
-            } else {
-                outw = (uint32_t *)out;
-                do {
-                    word = *in++;
-                    *outw++ = word << 16 | word >> 16;
-                } while (--words != 0);
-            }
+    lcdconv_setup(&lcd_conv, lcd.control, lcd.palette, backlight.scale);
+    for (row = 0; row < 240; ++row, in += stride, buffer += 320) {
+        if (row_dirty(rows, row)) {
+            lcdconv_row(&lcd_conv, buffer, in);
         }
     }
 }
 
+/* Palette used by the last lcd_drawframe() as ARGB32. Returns the number of entries, 0 in direct color modes. */
+unsigned int lcd_drawpalette(uint32_t *palette) {
+    memcpy(palette, lcd_conv.palette, lcd_conv.colors * sizeof(uint32_t));
+    return lcd_conv.colors;
+}
+
+/* Recompute the RAM range that gets scanned out, after upcurr or the bpp changed */
+static void lcd_dirty_range(void) {
+    uint32_t bpp = lcd_bpp();
+    uint32_t size = 320 * 240 / 8 * bpp;
+
+    lcd_dirty.stride = 320 / 8 * bpp;
+    lcd_dirty.base = lcd.upcurr - 0xD00000;
+    lcd_dirty.size = lcd.upcurr >= 0xD00000 && lcd_dirty.base + size <= 0x65800 ? size : 0;
+    lcd_dirty_all();
+}
+
+void lcd_dirty_ram(uint32_t offset) {
+    uint32_t row = (offset - lcd_dirty.base) / lcd_dirty.stride;
+    lcd_dirty.rows[row >> 5] |= 1u << (row & 31);
+}
+
+void lcd_dirty_ram_range(uint32_t offset, uint32_t size) {
+    uint32_t start, end, row;
+
+    if (!size || !lcd_dirty.size || offset >= lcd_dirty.base + lcd_dirty.size || offset + size <= lcd_dirty.base) {
+        return;
+    }
+    start = offset > lcd_dirty.base ? offset - lcd_dirty.base : 0;
+    end = offset + size - lcd_dirty.base;
+    end = end < lcd_dirty.size ? end : lcd_dirty.size;
+    for (row = start / lcd_dirty.stride; row <= (end - 1) / lcd_dirty.stride; row++) {
+        lcd_dirty.rows[row >> 5] |= 1u << (row & 31);
+    }
+}
+
+void lcd_dirty_all(void) {
+    memset(lcd_dirty.rows, 0xFF, sizeof(lcd_dirty.rows) - sizeof(uint32_t));
+    lcd_dirty.rows[LCD_ROW_WORDS - 1] = (1u << (240 & 31)) - 1;
+}
+
 static void lcd_event(int index) {
+    const lcd_frame_t *frame;
     int pcd = 1;
     int htime, vtime;
     if (!(lcd.timing[2] & (1 << 26))) {
@@ -147,11 +119,20 @@ static void lcd_event(int index) {
             + (lcd.timing[1]       & 0x3FF) + 1; // Active
     event_repeat(index, pcd * htime * vtime);
     /* for now, assuming vcomp occurs at same time UPBASE is loaded */
-    lcd.upcurr = lcd.upbase;
+    if (lcd.upcurr != lcd.upbase) {
+        lcd.upcurr = lcd.upbase;
+        lcd_dirty_range();
+    } else if (!lcd_dirty.size) {
+        /* Writes outside of RAM aren't tracked */
+        lcd_dirty_all();
+    }
     lcd.ris |= 0xC;
     intrpt_trigger(INT_LCD, lcd.ris & lcd.mis ? INTERRUPT_SET : INTERRUPT_CLEAR);
 
-    gif_new_frame();
+    frame = lcd_frame_publish();
+    gif_new_frame(frame);
+    video_new_frame(frame);
+    script_new_frame(frame);
 }
 
 void lcd_reset(void) {
@@ -160,6 +141,8 @@ void lcd_reset(void) {
     sched.items[SCHED_LCD].clock = CLOCK_12M;
     sched.items[SCHED_LCD].second = -1;
     sched.items[SCHED_LCD].proc = lcd_event;
+    lcd_dirty_range();
+    lcd_frame_publish();
     gui_console_printf("LCD reset.\n");
 }
 
@@ -208,11 +191,21 @@ void lcd_write(const uint16_t pio, const uint8_t value) {
             }
             lcd.lpbase &= ~0b111;
         } else if (offset == 0x018) {
-            if ((((uint32_t)value << bit_offset) ^ lcd.control) & 1) {
+            uint32_t changed = ((uint32_t)value << bit_offset) ^ lcd.control;
+            if (changed & 1) {
                 if (value & 1) { event_set(SCHED_LCD, 0); }
                 else { event_clear(SCHED_LCD); }
             }
             write8(lcd.control, bit_offset, value);
+            changed &= (uint32_t)0xFF << bit_offset;
+            /* Mode, pixel order or power changed, so every scanline looks different now */
+            if (changed & 0xF0E) {
+                lcd_dirty_range();
+            }
+            /* No more frames are coming while the LCD is off, so let the GUI know now */
+            if (changed & 0x801) {
+                lcd_frame_publish();
+            }
         } else if (offset == 0x01C) {
             write8(lcd.imsc, bit_offset, value);
             lcd.imsc &= 0x1E;
@@ -223,6 +216,7 @@ void lcd_write(const uint16_t pio, const uint8_t value) {
         }
     } else if (offset < 0x400) {
         write8(lcd.palette[pio >> 1 & 0xFF], (pio & 1) << 3, value);
+        lcd_dirty_all();
     }
 }
 
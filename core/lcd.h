@@ -41,8 +41,19 @@ typedef struct lcd_cntrl_state {
     uint32_t crsrmis;            /* Cursor masked interrupt status register - const */
 } lcd_cntrl_state_t;
 
+/* Scanlines of the scanned out framebuffer written to since the last published frame */
+#define LCD_ROW_WORDS ((240 + 31) / 32)
+
+typedef struct lcd_dirty_state {
+    uint32_t base;                  /* RAM offset of the framebuffer being scanned out */
+    uint32_t size;                  /* Its size in bytes for the current bpp, 0 if it isn't in RAM */
+    uint32_t stride;                /* Bytes per scanline */
+    uint32_t rows[LCD_ROW_WORDS];   /* One bit per scanline */
+} lcd_dirty_state_t;
+
 /* Global LCD state */
 extern lcd_cntrl_state_t lcd;
+extern lcd_dirty_state_t lcd_dirty;
 
 /* Available Functions */
 void lcd_reset(void);
@@ -50,7 +61,14 @@ eZ80portrange_t init_lcd(void);
 
 void lcd_write(const uint16_t, const uint8_t);
 uint8_t lcd_read(const uint16_t);
-void lcd_drawframe(uint16_t *buffer, uint32_t *bitfields);
+void lcd_drawframe(uint32_t *buffer, const uint32_t *rows);
+unsigned int lcd_drawpalette(uint32_t *palette);
+
+/* Dirty tracking; offset is relative to the start of RAM */
+void lcd_dirty_ram(uint32_t offset);
+/* For RAM written other than through memory_write_byte(), only marks what's scanned out */
+void lcd_dirty_ram_range(uint32_t offset, uint32_t size);
+void lcd_dirty_all(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,387 @@
+#include <string.h>
+
+#include "lcdconv.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LCDCONV_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LCDCONV_AVX2
+#define AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+typedef struct lcdconv_kernels {
+    lcdconv_row_t indexed8, rgb555, rgb565, rgb444, rgb888;
+} lcdconv_kernels_t;
+
+/* Plain C kernels, also used for the paletted modes */
+
+static uint32_t argb(uint32_t r, uint32_t g, uint32_t b, uint32_t scale) {
+    return 0xFF000000 | (r * scale >> 8) << 16 | (g * scale >> 8) << 8 | (b * scale >> 8);
+}
+
+static uint32_t from565(uint32_t c, bool bgr, uint32_t scale) {
+    uint32_t hi = c >> 11 & 0x1F, g = c >> 5 & 0x3F, lo = c & 0x1F;
+    hi = hi << 3 | hi >> 2;
+    g = g << 2 | g >> 4;
+    lo = lo << 3 | lo >> 2;
+    return bgr ? argb(hi, g, lo, scale) : argb(lo, g, hi, scale);
+}
+
+/* 1555 (intensity bit becomes the low green bit) to 565, as stored in the palette and in mode 4 */
+static uint32_t palette565(uint32_t c) {
+    return (c + (c & 0xFFE0) + (c >> 10 & 0x20)) & 0xFFFF;
+}
+
+static uint32_t mode4_565(uint32_t c) {
+    return (c & 0x1F) << 11 | (c >> 5 & 0x1F) << 6 | (c >> 10 & 0x1F) | (c >> 10 & 0x20);
+}
+
+static void row_indexed(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    unsigned int i, bytes = 320 / conv->ppb, bo = conv->bebo ? 3 : 0;
+
+    /* Constant sized copies so the compiler can turn them into vector moves */
+    switch (conv->ppb) {
+        case 8:
+            for (i = 0; i < bytes; i++, out += 8) { memcpy(out, conv->expand[in[i ^ bo]], 8 * sizeof(uint32_t)); }
+            break;
+        case 4:
+            for (i = 0; i < bytes; i++, out += 4) { memcpy(out, conv->expand[in[i ^ bo]], 4 * sizeof(uint32_t)); }
+            break;
+        case 2:
+            for (i = 0; i < bytes; i++, out += 2) { memcpy(out, conv->expand[in[i ^ bo]], 2 * sizeof(uint32_t)); }
+            break;
+        default:
+            for (i = 0; i < bytes; i++) { *out++ = conv->expand[in[i ^ bo]][0]; }
+            break;
+    }
+}
+
+static void row_555(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const uint16_t *in16 = (const uint16_t *)in;
+    unsigned int i, bi = conv->bebo;
+    for (i = 0; i < 320; i++) {
+        out[i] = from565(mode4_565(in16[i ^ bi]), conv->bgr, conv->scale);
+    }
+}
+
+static void row_565(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const uint16_t *in16 = (const uint16_t *)in;
+    unsigned int i, bi = conv->bebo;
+    for (i = 0; i < 320; i++) {
+        out[i] = from565(in16[i ^ bi], conv->bgr, conv->scale);
+    }
+}
+
+static void row_444(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const uint16_t *in16 = (const uint16_t *)in;
+    unsigned int i, bi = conv->bebo;
+    for (i = 0; i < 320; i++) {
+        uint32_t c = in16[i ^ bi];
+        uint32_t hi = (c >> 8 & 0xF) * 0x11, g = (c >> 4 & 0xF) * 0x11, lo = (c & 0xF) * 0x11;
+        out[i] = conv->bgr ? argb(hi, g, lo, conv->scale) : argb(lo, g, hi, conv->scale);
+    }
+}
+
+static void row_888(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const uint32_t *in32 = (const uint32_t *)in;
+    unsigned int i;
+    for (i = 0; i < 320; i++) {
+        uint32_t c = in32[i];
+        uint32_t hi = c >> 16 & 0xFF, g = c >> 8 & 0xFF, lo = c & 0xFF;
+        out[i] = conv->bgr ? argb(hi, g, lo, conv->scale) : argb(lo, g, hi, conv->scale);
+    }
+}
+
+static const lcdconv_kernels_t kernels_c = {
+    row_indexed, row_555, row_565, row_444, row_888
+};
+
+#ifdef LCDCONV_SSE2
+
+/* 8 pixels at a time, one 16 bit lane per channel until they get interleaved on store */
+
+static __m128i scale_sse2(__m128i x, __m128i scale) {
+    return _mm_srli_epi16(_mm_mullo_epi16(x, scale), 8);
+}
+
+static __m128i swap16_sse2(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+}
+
+static void store_argb_sse2(uint32_t *out, __m128i r, __m128i g, __m128i b) {
+    __m128i gb = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    __m128i ar = _mm_or_si128(r, _mm_set1_epi16((short)0xFF00));
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(gb, ar));
+    _mm_storeu_si128((__m128i *)out + 1, _mm_unpackhi_epi16(gb, ar));
+}
+
+static void store565_sse2(const lcdconv_t *conv, uint32_t *out, __m128i v, __m128i scale) {
+    __m128i hi = _mm_srli_epi16(v, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), _mm_set1_epi16(0x3F));
+    __m128i lo = _mm_and_si128(v, _mm_set1_epi16(0x1F));
+    hi = scale_sse2(_mm_or_si128(_mm_slli_epi16(hi, 3), _mm_srli_epi16(hi, 2)), scale);
+    g = scale_sse2(_mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4)), scale);
+    lo = scale_sse2(_mm_or_si128(_mm_slli_epi16(lo, 3), _mm_srli_epi16(lo, 2)), scale);
+    if (conv->bgr) {
+        store_argb_sse2(out, hi, g, lo);
+    } else {
+        store_argb_sse2(out, lo, g, hi);
+    }
+}
+
+static void row_555_sse2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m128i scale = _mm_set1_epi16((short)conv->scale);
+    const __m128i m5 = _mm_set1_epi16(0x1F);
+    unsigned int i;
+    for (i = 0; i < 320; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i * 2)), top;
+        if (conv->bebo) {
+            v = swap16_sse2(v);
+        }
+        top = _mm_srli_epi16(v, 10);
+        v = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(v, 11),
+                                      _mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(v, 5), m5), 6)),
+                         _mm_or_si128(_mm_and_si128(top, m5), _mm_and_si128(top, _mm_set1_epi16(0x20))));
+        store565_sse2(conv, out + i, v, scale);
+    }
+}
+
+static void row_565_sse2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m128i scale = _mm_set1_epi16((short)conv->scale);
+    unsigned int i;
+    for (i = 0; i < 320; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i * 2));
+        if (conv->bebo) {
+            v = swap16_sse2(v);
+        }
+        store565_sse2(conv, out + i, v, scale);
+    }
+}
+
+static void row_444_sse2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m128i scale = _mm_set1_epi16((short)conv->scale);
+    const __m128i m4 = _mm_set1_epi16(0xF), x11 = _mm_set1_epi16(0x11);
+    unsigned int i;
+    for (i = 0; i < 320; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i * 2)), hi, g, lo;
+        if (conv->bebo) {
+            v = swap16_sse2(v);
+        }
+        hi = scale_sse2(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(v, 8), m4), x11), scale);
+        g = scale_sse2(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(v, 4), m4), x11), scale);
+        lo = scale_sse2(_mm_mullo_epi16(_mm_and_si128(v, m4), x11), scale);
+        if (conv->bgr) {
+            store_argb_sse2(out + i, hi, g, lo);
+        } else {
+            store_argb_sse2(out + i, lo, g, hi);
+        }
+    }
+}
+
+static void row_888_sse2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m128i scale = _mm_set1_epi16((short)conv->scale);
+    const __m128i zero = _mm_setzero_si128(), m8 = _mm_set1_epi32(0xFF);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    unsigned int i;
+    for (i = 0; i < 320; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i * 4)), lo, hi;
+        if (!conv->bgr) {
+            v = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, m8), 16),
+                                          _mm_and_si128(v, _mm_set1_epi32(0xFF00))),
+                             _mm_and_si128(_mm_srli_epi32(v, 16), m8));
+        }
+        lo = scale_sse2(_mm_unpacklo_epi8(v, zero), scale);
+        hi = scale_sse2(_mm_unpackhi_epi8(v, zero), scale);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+    }
+}
+
+static const lcdconv_kernels_t kernels_sse2 = {
+    row_indexed, row_555_sse2, row_565_sse2, row_444_sse2, row_888_sse2
+};
+
+#endif
+
+#ifdef LCDCONV_AVX2
+
+/* Same as the SSE2 kernels with 16 pixels at a time; 8bpp uses a gather from the palette */
+
+AVX2 static __m256i scale_avx2(__m256i x, __m256i scale) {
+    return _mm256_srli_epi16(_mm256_mullo_epi16(x, scale), 8);
+}
+
+AVX2 static __m256i swap16_avx2(__m256i v) {
+    return _mm256_or_si256(_mm256_slli_epi32(v, 16), _mm256_srli_epi32(v, 16));
+}
+
+AVX2 static void store_argb_avx2(uint32_t *out, __m256i r, __m256i g, __m256i b) {
+    __m256i gb = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+    __m256i ar = _mm256_or_si256(r, _mm256_set1_epi16((short)0xFF00));
+    __m256i lo = _mm256_unpacklo_epi16(gb, ar);    /* Pixels 0-3, 8-11 */
+    __m256i hi = _mm256_unpackhi_epi16(gb, ar);    /* Pixels 4-7, 12-15 */
+    _mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *)out + 1, _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+AVX2 static void store565_avx2(const lcdconv_t *conv, uint32_t *out, __m256i v, __m256i scale) {
+    __m256i hi = _mm256_srli_epi16(v, 11);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi16(v, 5), _mm256_set1_epi16(0x3F));
+    __m256i lo = _mm256_and_si256(v, _mm256_set1_epi16(0x1F));
+    hi = scale_avx2(_mm256_or_si256(_mm256_slli_epi16(hi, 3), _mm256_srli_epi16(hi, 2)), scale);
+    g = scale_avx2(_mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4)), scale);
+    lo = scale_avx2(_mm256_or_si256(_mm256_slli_epi16(lo, 3), _mm256_srli_epi16(lo, 2)), scale);
+    if (conv->bgr) {
+        store_argb_avx2(out, hi, g, lo);
+    } else {
+        store_argb_avx2(out, lo, g, hi);
+    }
+}
+
+AVX2 static void row_indexed8_avx2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m128i swap = _mm_set_epi8(15, 14, 13, 12, 11, 10, 9, 8, 4, 5, 6, 7, 0, 1, 2, 3);
+    unsigned int i;
+    for (i = 0; i < 320; i += 8) {
+        __m128i idx = _mm_loadl_epi64((const __m128i *)(in + i));
+        if (conv->bebo) {
+            idx = _mm_shuffle_epi8(idx, swap);
+        }
+        /* expand[] rows are 8 entries wide, the color is in the first one */
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_i32gather_epi32((const int *)conv->expand, _mm256_slli_epi32(_mm256_cvtepu8_epi32(idx), 3), 4));
+    }
+}
+
+AVX2 static void row_555_avx2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m256i scale = _mm256_set1_epi16((short)conv->scale);
+    const __m256i m5 = _mm256_set1_epi16(0x1F);
+    unsigned int i;
+    for (i = 0; i < 320; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i * 2)), top;
+        if (conv->bebo) {
+            v = swap16_avx2(v);
+        }
+        top = _mm256_srli_epi16(v, 10);
+        v = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(v, 11),
+                                            _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(v, 5), m5), 6)),
+                            _mm256_or_si256(_mm256_and_si256(top, m5), _mm256_and_si256(top, _mm256_set1_epi16(0x20))));
+        store565_avx2(conv, out + i, v, scale);
+    }
+}
+
+AVX2 static void row_565_avx2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m256i scale = _mm256_set1_epi16((short)conv->scale);
+    unsigned int i;
+    for (i = 0; i < 320; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i * 2));
+        if (conv->bebo) {
+            v = swap16_avx2(v);
+        }
+        store565_avx2(conv, out + i, v, scale);
+    }
+}
+
+AVX2 static void row_444_avx2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m256i scale = _mm256_set1_epi16((short)conv->scale);
+    const __m256i m4 = _mm256_set1_epi16(0xF), x11 = _mm256_set1_epi16(0x11);
+    unsigned int i;
+    for (i = 0; i < 320; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i * 2)), hi, g, lo;
+        if (conv->bebo) {
+            v = swap16_avx2(v);
+        }
+        hi = scale_avx2(_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi16(v, 8), m4), x11), scale);
+        g = scale_avx2(_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi16(v, 4), m4), x11), scale);
+        lo = scale_avx2(_mm256_mullo_epi16(_mm256_and_si256(v, m4), x11), scale);
+        if (conv->bgr) {
+            store_argb_avx2(out + i, hi, g, lo);
+        } else {
+            store_argb_avx2(out + i, lo, g, hi);
+        }
+    }
+}
+
+AVX2 static void row_888_avx2(const lcdconv_t *conv, uint32_t *out, const uint8_t *in) {
+    const __m256i scale = _mm256_set1_epi16((short)conv->scale);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i rb = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    unsigned int i;
+    for (i = 0; i < 320; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i * 4)), lo, hi;
+        if (!conv->bgr) {
+            v = _mm256_shuffle_epi8(v, rb);
+        }
+        /* unpack/pack both stay within 128 bit lanes, so pixel order is preserved */
+        lo = scale_avx2(_mm256_unpacklo_epi8(v, zero), scale);
+        hi = scale_avx2(_mm256_unpackhi_epi8(v, zero), scale);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_or_si256(_mm256_packus_epi16(lo, hi), alpha));
+    }
+}
+
+static const lcdconv_kernels_t kernels_avx2 = {
+    row_indexed8_avx2, row_555_avx2, row_565_avx2, row_444_avx2, row_888_avx2
+};
+
+#endif
+
+static const lcdconv_kernels_t *lcdconv_kernels(void) {
+    static const lcdconv_kernels_t *kernels = NULL;
+
+    if (!kernels) {
+        kernels = &kernels_c;
+#ifdef LCDCONV_SSE2
+        kernels = &kernels_sse2;
+#endif
+#ifdef LCDCONV_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            kernels = &kernels_avx2;
+        }
+#endif
+    }
+
+    return kernels;
+}
+
+void lcdconv_setup(lcdconv_t *conv, uint32_t control, const uint16_t *palette, uint32_t scale) {
+    const lcdconv_kernels_t *kernels = lcdconv_kernels();
+    uint32_t mode = control >> 1 & 7;
+
+    conv->scale = scale;
+    conv->bgr = control >> 8 & 1;
+    conv->bebo = control >> 9 & 1;
+
+    if (mode <= 3) {
+        const uint32_t *colors = conv->palette;
+        unsigned int bpp = 1 << mode, mask = (1 << bpp) - 1, i, j;
+        bool bepo = control >> 10 & 1;
+
+        conv->colors = mask + 1;
+        for (i = 0; i <= mask; i++) {
+            conv->palette[i] = from565(palette565(palette[i]), conv->bgr, scale);
+        }
+
+        /* Every byte value expands into 8 / bpp pixels; high bits first for big endian pixel order */
+        conv->ppb = 8 / bpp;
+        for (i = 0; i < 256; i++) {
+            for (j = 0; j < conv->ppb; j++) {
+                unsigned int shift = bepo ? 8 - bpp * (j + 1) : bpp * j;
+                conv->expand[i][j] = colors[i >> shift & mask];
+            }
+        }
+
+        conv->row = mode == 3 ? kernels->indexed8 : row_indexed;
+    } else {
+        conv->ppb = conv->colors = 0;
+        switch (mode) {
+            case 4: conv->row = kernels->rgb555; break;
+            case 5: conv->row = kernels->rgb888; break;
+            case 6: conv->row = kernels->rgb565; break;
+            default: conv->row = kernels->rgb444; break;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef LCDCONV_H
+#define LCDCONV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defines.h"
+
+/* Converts LCD scanlines straight into ARGB32 (0xFFRRGGBB) with the backlight applied.
+ * Uses SSE2/AVX2 kernels when the host has them, plain C otherwise. */
+
+struct lcdconv;
+typedef void (*lcdconv_row_t)(const struct lcdconv *conv, uint32_t *out, const uint8_t *in);
+
+typedef struct lcdconv {
+    lcdconv_row_t row;          /* Kernel for the current mode */
+    uint32_t scale;             /* Backlight, 0-256 */
+    bool bgr;                   /* Red in the high bits */
+    bool bebo;                  /* Big endian byte order */
+    unsigned int ppb;           /* Pixels per byte in paletted modes */
+    unsigned int colors;        /* Palette entries in use, 0 in direct color modes */
+    uint32_t palette[256];      /* Paletted modes: the palette as ARGB32 */
+    uint32_t expand[256][8];    /* Paletted modes: the pixels each byte value expands to */
+} lcdconv_t;
+
+/* Prepare conv for the given LCD control register, palette and backlight scale */
+void lcdconv_setup(lcdconv_t *conv, uint32_t control, const uint16_t *palette, uint32_t scale);
+
+/* Convert one 320 pixel scanline */
+#define lcdconv_row(conv, out, in) ((conv)->row((conv), (out), (in)))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+#include <atomic>
+#include <string.h>
+
+#include "lcdframe.h"
+
+/* Triple buffer: the emulator always owns one frame to draw into, the GUI always
+ * owns one frame to display, and the third one is in flight between the two.
+ * Handing a frame over is a single atomic exchange on either side. */
+
+static const unsigned int frame_fresh = 4;  /* Set when the in flight frame hasn't been picked up yet */
+
+static lcd_frame_t frames[3];
+static unsigned int frame_back = 0;         /* Owned by the emulator thread */
+static unsigned int frame_front = 1;        /* Owned by the GUI thread */
+static std::atomic<unsigned int> frame_middle(2);
+static uint32_t frame_seq = 0;
+static const lcd_frame_t *frame_last = &frames[2];
+
+/* Emulator thread: scanlines each buffer is missing compared to the current LCD contents */
+static uint32_t frame_stale[3][LCD_ROW_WORDS];
+/* Scanlines in which frame i differs from what buffer j held when frame i was published */
+static uint32_t frame_diff[3][3][LCD_ROW_WORDS];
+/* GUI thread: scanlines changed since the last lcd_frame_acquire_dirty() */
+static uint32_t frame_gui_dirty[LCD_ROW_WORDS];
+
+const lcd_frame_t *lcd_frame_publish(void)
+{
+    lcd_frame_t *frame = &frames[frame_back];
+    uint32_t any = 0;
+    unsigned int i, j;
+
+    for (i = 0; i < LCD_ROW_WORDS; i++) {
+        any |= lcd_dirty.rows[i];
+    }
+    if (!any) {
+        return frame_last;
+    }
+
+    for (j = 0; j < 3; j++) {
+        for (i = 0; i < LCD_ROW_WORDS; i++) {
+            frame_stale[j][i] |= lcd_dirty.rows[i];
+        }
+    }
+
+    lcd_drawframe(frame->pixels, frame_stale[frame_back]);
+    frame->colors = lcd_drawpalette(frame->palette);
+    frame->powered = lcd.control & 0x800;
+    frame->seq = ++frame_seq;
+    memcpy(frame->changed, lcd_dirty.rows, sizeof(frame->changed));
+    memset(lcd_dirty.rows, 0, sizeof(lcd_dirty.rows));
+    memset(frame_stale[frame_back], 0, sizeof(frame_stale[frame_back]));
+    memcpy(frame_diff[frame_back], frame_stale, sizeof(frame_stale));
+
+    frame_last = frame;
+    frame_back = frame_middle.exchange(frame_back | frame_fresh, std::memory_order_acq_rel) & ~frame_fresh;
+
+    return frame;
+}
+
+const lcd_frame_t *lcd_frame_acquire(void)
+{
+    if (frame_middle.load(std::memory_order_relaxed) & frame_fresh) {
+        unsigned int old = frame_front, i;
+        frame_front = frame_middle.exchange(frame_front, std::memory_order_acq_rel) & ~frame_fresh;
+        for (i = 0; i < LCD_ROW_WORDS; i++) {
+            frame_gui_dirty[i] |= frame_diff[frame_front][old][i];
+        }
+    }
+
+    return &frames[frame_front];
+}
+
+const lcd_frame_t *lcd_frame_acquire_dirty(unsigned int *top, unsigned int *bottom)
+{
+    const lcd_frame_t *frame = lcd_frame_acquire();
+    unsigned int row;
+
+    *top = *bottom = 0;
+    for (row = 0; row < 240; row++) {
+        if (frame_gui_dirty[row >> 5] >> (row & 31) & 1) {
+            if (*top == *bottom) {
+                *top = row;
+            }
+            *bottom = row + 1;
+        }
+    }
+    memset(frame_gui_dirty, 0, sizeof(frame_gui_dirty));
+
+    return frame;
+}
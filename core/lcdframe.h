@@ -0,0 +1,39 @@
+#ifndef LCDFRAME_H
+#define LCDFRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defines.h"
+#include "lcd.h"
+
+/* A completed LCD frame, converted to ARGB32 and ready to be displayed */
+typedef struct lcd_frame {
+    uint32_t pixels[320 * 240];
+    bool powered;                       /* LCD power bit at the time the frame was taken */
+    uint32_t seq;                       /* Incremented for every published frame */
+    uint32_t changed[LCD_ROW_WORDS];    /* Scanlines that differ from the previously published frame */
+    unsigned int colors;                /* Palette entries in paletted modes, 0 otherwise */
+    uint32_t palette[256];              /* Every pixel is one of these in paletted modes */
+} lcd_frame_t;
+
+/* Emulator thread: convert the current LCD contents and hand them off to the GUI.
+ * Only dirty scanlines get converted. If nothing changed since the last call,
+ * nothing is published and the previous frame (with the same seq) is returned.
+ * The returned frame stays valid and unchanged until the next call. */
+const lcd_frame_t *lcd_frame_publish(void);
+
+/* GUI thread: get the latest complete frame. Lock-free; never touches emulator state.
+ * The returned frame stays valid and unchanged until the next call. */
+const lcd_frame_t *lcd_frame_acquire(void);
+
+/* GUI thread: like lcd_frame_acquire(), and also reports the scanlines [*top, *bottom)
+ * that changed since the previous call to this function. *top == *bottom if none did. */
+const lcd_frame_t *lcd_frame_acquire_dirty(unsigned int *top, unsigned int *bottom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
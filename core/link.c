@@ -1,13 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "link.h"
 #include "asic.h"
 #include "emu.h"
 #include "os/os.h"
+#include "debug/debug.h"
 
 volatile bool emu_is_sending = false;
 volatile bool emu_is_recieving = false;
+volatile int link_mode = LINK_OS;
 
 static const int ram_start = 0xD00000;
 static const int safe_ram_loc = 0xD052C6;
@@ -29,6 +32,8 @@ static const uint8_t archivevar[14] = {
     0x18, 0xFE                  // _sink: jr _sink
 };
 
+static const int archivevar_sink = 12;
+
 static const uint8_t header_data[10] = {
     0x2A, 0x2A, 0x54, 0x49, 0x38, 0x33, 0x46, 0x2A, 0x1A, 0x0A
 };
@@ -47,6 +52,8 @@ static const uint8_t pgrm_loader[39] = {
   0x18, 0xFE                    // _sink: jr _sink
 };
 
+static const int pgrm_loader_sink = 29;
+
 void enterVariableLink(void) {
     /* Wait for the GUI to finish whatever it needs to do */
     do {
@@ -67,9 +74,33 @@ bool listVariablesLink(void) {
     return true;
 }
 
-/* Really hackish way to send a variable -- Like, on a scale of 1 to hackish, it's like really hackish */
-/* Proper USB emulation should really be a thing at some point :P */
-bool sendVariableLink(const char *var_name) {
+/* Run the stub at safe_ram_loc until it reaches its sink. Stubs without one jump into the OS
+ * and never come back, they are done once the OS halts in its key loop, which is what
+ * jforcegraph and jforcehome end in. The budget is only an upper bound in case neither
+ * happens, not a delay every transfer pays. */
+static void link_run(uint32_t sink, int budget) {
+    cpu.halted = cpu.IEF_wait = 0;
+    cpu_flush(safe_ram_loc, 1);
+
+    if (sink) {
+        mem.debug.block[sink] |= DBG_STOP_BREAKPOINT;
+        mem.debug.stoppedAt = -1;
+    }
+
+    cycle_count_delta = -budget;
+    while (!exiting && cycle_count_delta < 0) {
+        if (sink ? mem.debug.stoppedAt == sink : cpu.halted) {
+            break;
+        }
+        cpu_execute();
+    }
+
+    if (sink) {
+        mem.debug.block[sink] &= ~DBG_STOP_BREAKPOINT;
+    }
+}
+
+static bool link_send_file(const char *var_name, uint8_t *run_asm_safe, uint8_t *op1) {
     FILE *file;
     uint8_t tmp_buf[0x80];
 
@@ -78,21 +109,13 @@ bool sendVariableLink(const char *var_name) {
             var_type,
             var_arc;
 
-    uint8_t *run_asm_safe = phys_mem_ptr(safe_ram_loc, 1),
-            *cxCurApp     = phys_mem_ptr(0xD007E0, 1),
-            *op1          = phys_mem_ptr(0xD005F8, 1),
-            *var_ptr;
+    uint8_t *var_ptr;
 
     uint16_t var_size;
 
     const size_t h_size = sizeof(header_data);
     const size_t op_size = 9;
 
-    /* Return if we are at an error menu */
-    if(*cxCurApp == 0x52) {
-        return false;
-    }
-
     file = fopen_utf8(var_name,"rb");
 
     if (!file) return false;
@@ -109,15 +132,8 @@ bool sendVariableLink(const char *var_name) {
     if (fseek(file, 0x45, 0))                             goto r_err;
     if (fread(&var_arc, 1, 1, file) != 1)                 goto r_err;
 
-    cpu.halted = cpu.IEF_wait = 0;
-    memcpy(run_asm_safe, jforcegraph, sizeof(jforcegraph));
-    cpu_flush(safe_ram_loc, 1);
-    cycle_count_delta = -5000000;
-    cpu_execute();
-
     if (fseek(file, 0x3B, 0))                            goto r_err;
     if (fread(op1, 1, op_size, file) != op_size)         goto r_err;
-    cpu.halted = cpu.IEF_wait = 0;
     run_asm_safe[0] = 0x21;
     run_asm_safe[1] = var_size_low;
     run_asm_safe[2] = var_size_high;
@@ -125,9 +141,7 @@ bool sendVariableLink(const char *var_name) {
     run_asm_safe[4] = 0x3E;
     run_asm_safe[5] = var_type;
     memcpy(&run_asm_safe[6], pgrm_loader, sizeof(pgrm_loader));
-    cpu_flush(safe_ram_loc, 1);
-    cycle_count_delta = -10000000;
-    cpu_execute();
+    link_run(safe_ram_loc + 6 + pgrm_loader_sink, 10000000);
 
     var_ptr = phys_mem_ptr((run_asm_safe[0])      |
                            (run_asm_safe[1] << 8) |
@@ -136,22 +150,14 @@ bool sendVariableLink(const char *var_name) {
     var_size = (var_size_high << 8) | var_size_low;
 
     if (fseek(file, 0x48, 0))                           goto r_err;
+    if (!var_ptr)                                       goto r_err;
     if (fread(var_ptr, 1, var_size, file) != var_size)  goto r_err;
 
     if (var_arc == 0x80) {
-        cpu.halted = cpu.IEF_wait = 0;
         memcpy(run_asm_safe, archivevar, sizeof(archivevar));
-        cpu_flush(safe_ram_loc, 1);
-        cycle_count_delta = -1000000;
-        cpu_execute();
+        link_run(safe_ram_loc + archivevar_sink, 1000000);
     }
 
-    cpu.halted = cpu.IEF_wait = 0;
-    memcpy(run_asm_safe, jforcehome, sizeof(jforcehome));
-    cpu_flush(safe_ram_loc, 1);
-    cycle_count_delta = -5000000;
-    cpu_execute();
-
     return !fclose(file);
 
 r_err:
@@ -159,44 +165,268 @@ r_err:
     return false;
 }
 
+/* Really hackish way to send variables -- Like, on a scale of 1 to hackish, it's like really hackish */
+/* Proper USB emulation should really be a thing at some point :P */
+static bool link_send_os(int count, const char *const *var_names) {
+    uint8_t *run_asm_safe = phys_mem_ptr(safe_ram_loc, 1),
+            *cxCurApp     = phys_mem_ptr(0xD007E0, 1),
+            *op1          = phys_mem_ptr(0xD005F8, 1);
+    int saved_delta = cycle_count_delta;
+    bool ok = true;
+    int i;
+
+    /* Return if we are at an error menu */
+    if(*cxCurApp == 0x52) {
+        return false;
+    }
+
+    /* The whole batch goes in one session: get out of whatever the OS is doing, load, go home */
+    memcpy(run_asm_safe, jforcegraph, sizeof(jforcegraph));
+    link_run(0, 5000000);
+
+    for (i = 0; i < count; i++) {
+        if (!link_send_file(var_names[i], run_asm_safe, op1)) {
+            gui_console_printf("Failed to send %s.\n", var_names[i]);
+            ok = false;
+        }
+    }
+
+    memcpy(run_asm_safe, jforcehome, sizeof(jforcehome));
+    link_run(0, 5000000);
+
+    /* The stubs run outside of the scheduler, so don't let them move emulated time */
+    cycle_count_delta = saved_delta;
+    return ok;
+}
+
+static bool link_send_direct(int count, const char *const *var_names) {
+    bool ok = true;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!vat_load_file(var_names[i], true)) {
+            gui_console_printf("Failed to load %s.\n", var_names[i]);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+typedef struct {
+    uint8_t type, namelen, name[8];
+    uint16_t size;
+    bool archived;
+    uint32_t hash;
+} link_var_summary_t;
+
+static int link_summarize(link_var_summary_t *vars, int max) {
+    calc_var_t var;
+    int count = 0;
+    uint16_t i;
+
+    vat_search_init(&var);
+    while (count < max && vat_search_next(&var)) {
+        link_var_summary_t *summary = &vars[count++];
+        summary->type = var.type;
+        summary->namelen = var.namelen;
+        memcpy(summary->name, var.name, sizeof summary->name);
+        summary->size = var.size;
+        summary->archived = var.archived;
+        summary->hash = 0x811C9DC5;
+        for (i = 0; i < var.size; i++) {
+            summary->hash = (summary->hash ^ var.data[i]) * 0x01000193;
+        }
+    }
+    return count;
+}
+
+static const link_var_summary_t *link_find_summary(const link_var_summary_t *vars, int count, const link_var_summary_t *target) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (vars[i].type == target->type && vars[i].namelen == target->namelen &&
+            !memcmp(vars[i].name, target->name, target->namelen)) {
+            return &vars[i];
+        }
+    }
+    return NULL;
+}
+
+/* Load the batch directly, then again through the OS from the same state, and compare the VATs */
+static bool link_send_verify(int count, const char *const *var_names) {
+    enum { MAX_VARS = 4096 };
+    static const uint32_t ram_size = 0x65800;
+    uint8_t *ram_copy = (uint8_t*)malloc(ram_size),
+            *flash_copy = (uint8_t*)malloc(mem.flash.size);
+    link_var_summary_t *direct = (link_var_summary_t*)malloc(MAX_VARS * sizeof *direct),
+                       *os = (link_var_summary_t*)malloc(MAX_VARS * sizeof *os);
+    int direct_count, os_count, i, mismatches = 0;
+    bool ok = false;
+
+    if (!ram_copy || !flash_copy || !direct || !os) {
+        goto done;
+    }
+    memcpy(ram_copy, mem.ram.block, ram_size);
+    memcpy(flash_copy, mem.flash.block, mem.flash.size);
+
+    link_send_direct(count, var_names);
+    direct_count = link_summarize(direct, MAX_VARS);
+
+    memcpy(mem.ram.block, ram_copy, ram_size);
+    lcd_dirty_ram_range(0, ram_size);
+    memcpy(mem.flash.block, flash_copy, mem.flash.size);
+    mem_flash_touched(0, mem.flash.size);
+
+    ok = link_send_os(count, var_names);
+    os_count = link_summarize(os, MAX_VARS);
+
+    for (i = 0; i < os_count; i++) {
+        const link_var_summary_t *match = link_find_summary(direct, direct_count, &os[i]);
+        const char *name = calc_var_name_to_utf8(os[i].name);
+        if (!match) {
+            gui_console_printf("Verify: %s is missing from the direct load.\n", name);
+        } else if (match->size != os[i].size || match->hash != os[i].hash) {
+            gui_console_printf("Verify: %s differs (%u bytes direct, %u bytes through the OS).\n", name, match->size, os[i].size);
+        } else if (match->archived != os[i].archived) {
+            gui_console_printf("Verify: %s is %sarchived in the direct load.\n", name, match->archived ? "" : "not ");
+        } else {
+            continue;
+        }
+        mismatches++;
+    }
+    for (i = 0; i < direct_count; i++) {
+        if (!link_find_summary(os, os_count, &direct[i])) {
+            gui_console_printf("Verify: %s is only in the direct load.\n", calc_var_name_to_utf8(direct[i].name));
+            mismatches++;
+        }
+    }
+    gui_console_printf("Verify: %d variable%s differ%s.\n", mismatches, mismatches == 1 ? "" : "s", mismatches == 1 ? "s" : "");
+    ok = ok && !mismatches;
+
+done:
+    free(ram_copy);
+    free(flash_copy);
+    free(direct);
+    free(os);
+    return ok;
+}
+
+bool sendVariablesLink(int count, const char *const *var_names) {
+    switch (link_mode) {
+        case LINK_DIRECT:
+            return link_send_direct(count, var_names);
+        case LINK_VERIFY:
+            return link_send_verify(count, var_names);
+        default:
+            return link_send_os(count, var_names);
+    }
+}
+
+bool sendVariableLink(const char *var_name) {
+    return sendVariablesLink(1, &var_name);
+}
+
 #define STRINGIFYMAGIC(x) #x
 #define STRINGIFY(x) STRINGIFYMAGIC(x)
 static char header[] = "**TI83F*\x1A\x0A\0File dumped from CEmu " STRINGIFY(CEMU_VERSION);
 #undef STRIGIFY
 #undef STRIGIFYMAGIC
-bool receiveVariableLink(int count, const calc_var_t *vars, const char *file_name) {
+/* Build the whole file in memory so the checksum doesn't need a second pass over it */
+static bool link_write_file(int count, const calc_var_t *const *vars, const char *file_name) {
     FILE *file;
-    calc_var_t var;
-    uint16_t header_size = 13, size = 0, checksum = 0;
-    int byte;
-    file = fopen_utf8(file_name, "w+b");
-    setbuf(file, NULL);
-    if (!file) return false;
-    if (fwrite(header, sizeof header - 1, 1, file) != 1) goto w_err;
-    if (fseek(file, 0x37, SEEK_SET))                     goto w_err;
-    while (count--) {
-        if (!vat_search_find(vars++, &var))              goto w_err;
-        if (fwrite(&header_size,       2, 1, file) != 1) goto w_err;
-        if (fwrite(&var.size,          2, 1, file) != 1) goto w_err;
-        if (fwrite(&var.type,          1, 1, file) != 1) goto w_err;
-        if (fwrite(&var.name,          8, 1, file) != 1) goto w_err;
-        if (fwrite(&var.version,       1, 1, file) != 1) goto w_err;
-        if (fputc(var.archived << 7, file) == EOF)       goto w_err;
-        if (fwrite(&var.size,          2, 1, file) != 1) goto w_err;
-        if (fwrite(var.data,    var.size, 1, file) != 1) goto w_err;
-        size += 17 + var.size;
-    }
-    if (fseek(file, 0x35, SEEK_SET))                     goto w_err;
-    if (fwrite(&size,                  2, 1, file) != 1) goto w_err;
-    while (size--) {
-        if ((byte = fgetc(file)) == EOF)                 goto w_err;
-        checksum += byte;
-    }
-    if (fwrite(&checksum,              2, 1, file) != 1) goto w_err;
-    return !fclose(file);
+    uint8_t *buf, *ptr;
+    uint32_t size = 0, i;
+    uint16_t checksum = 0;
+    bool ok;
+    int j;
+
+    for (j = 0; j < count; j++) {
+        size += 17 + vars[j]->size;
+    }
+    if (size > 0xFFFF || !(buf = (uint8_t*)malloc(0x37 + size + 2))) {
+        return false;
+    }
 
-  w_err:
-    fclose(file);
-    remove(file_name);
-    return false;
+    memset(buf, 0, 0x35);
+    memcpy(buf, header, sizeof header - 1 < 0x35 ? sizeof header - 1 : 0x35);
+    buf[0x35] = size;
+    buf[0x36] = size >> 8;
+    ptr = buf + 0x37;
+    for (j = 0; j < count; j++) {
+        const calc_var_t *var = vars[j];
+        *ptr++ = 13;
+        *ptr++ = 0;
+        *ptr++ = var->size;
+        *ptr++ = var->size >> 8;
+        *ptr++ = var->type;
+        memcpy(ptr, var->name, 8);
+        ptr += 8;
+        *ptr++ = var->version;
+        *ptr++ = var->archived << 7;
+        *ptr++ = var->size;
+        *ptr++ = var->size >> 8;
+        memcpy(ptr, var->data, var->size);
+        ptr += var->size;
+    }
+    for (i = 0x37; i < 0x37 + size; i++) {
+        checksum += buf[i];
+    }
+    *ptr++ = checksum;
+    *ptr++ = checksum >> 8;
+
+    if (!(file = fopen_utf8(file_name, "wb"))) {
+        free(buf);
+        return false;
+    }
+    ok = fwrite(buf, 1, ptr - buf, file) == (size_t)(ptr - buf);
+    ok = !fclose(file) && ok;
+    free(buf);
+    if (!ok) {
+        remove(file_name);
+    }
+    return ok;
+}
+
+bool receiveVariableLink(int count, const calc_var_t *vars, const char *file_name) {
+    vat_index_t index;
+    const calc_var_t **found;
+    bool ok = false;
+    int i;
+
+    if (!vat_index_build(&index)) {
+        return false;
+    }
+    if ((found = (const calc_var_t**)malloc((count ? count : 1) * sizeof *found))) {
+        for (i = 0; i < count && (found[i] = vat_index_find(&index, &vars[i])); i++);
+        ok = i == count && link_write_file(count, found, file_name);
+        free(found);
+    }
+    vat_index_free(&index);
+    return ok;
+}
+
+int receiveAllVariablesLink(const char *dir_name) {
+    vat_index_t index;
+    char file_name[1024];
+    uint32_t i;
+    int written = 0;
+
+    if (!vat_index_build(&index)) {
+        return -1;
+    }
+    for (i = 0; i < index.count; i++) {
+        const calc_var_t *var = &index.vars[i];
+        const char *ext = calc_var_type_exts[var->type];
+        /* Skip system variables, same as the variable list */
+        if (!ext || var->name[0] == '!' || var->name[0] == '#' || var->name[0] == '.' || var->name[0] == '@') {
+            continue;
+        }
+        snprintf(file_name, sizeof file_name, "%s/%s.%s", dir_name, calc_var_name_to_utf8((uint8_t*)var->name), ext);
+        if (link_write_file(1, &var, file_name)) {
+            written++;
+        } else {
+            gui_console_printf("Failed to write %s.\n", file_name);
+        }
+    }
+    vat_index_free(&index);
+    return written;
 }
@@ -12,10 +12,18 @@ extern "C" {
 extern volatile bool emu_is_sending;
 extern volatile bool emu_is_recieving;
 
+/* How sendVariableLink() loads files: by running OS routines, by editing the VAT
+ * directly, or both from the same state with the resulting VATs compared */
+enum { LINK_OS, LINK_DIRECT, LINK_VERIFY };
+extern volatile int link_mode;
+
 void enterVariableLink(void);
 bool listVariablesLink(void);
 bool sendVariableLink(const char *var_name);
+bool sendVariablesLink(int count, const char *const *var_names);
 bool receiveVariableLink(int count, const calc_var_t *vars, const char *file_name);
+/* Writes every user variable to its own file in dir_name, returns how many or -1 */
+int receiveAllVariablesLink(const char *dir_name);
 
 
 #ifdef __cplusplus
@@ -4,7 +4,11 @@
 #include "emu.h"
 #include "cpu.h"
 #include "flash.h"
+#include "lcd.h"
+#include "flashimage.h"
 #include "debug/disasmc.h"
+#include "debug/profile.h"
+#include "os/os.h"
 
 // Global MEMORY state
 mem_state_t mem;
@@ -19,22 +23,106 @@ static const uint32_t flash_sector_size_64K = 0x10000;
 static const uint32_t flash_sectors_8K = 8;
 static const uint32_t flash_sectors_64K = 63;
 
+/* Sparse images can't be mapped, they are written back on exit instead */
+static char *flash_image_path;
+
+static void mem_flash_sectors(void) {
+    unsigned int i;
+
+    for (i = 0; i < flash_sectors_8K; i++) {
+        mem.flash.sector[i].ptr = mem.flash.block + (i*flash_sector_size_8K);
+    }
+    for (i = flash_sectors_8K; i < flash_sectors_64K+flash_sectors_8K; i++) {
+        mem.flash.sector[i].ptr = mem.flash.block + (i*flash_sector_size_64K);
+    }
+}
+
+bool mem_load_flash(const char *file_name, int backing) {
+    uint8_t *mapped;
+    FILE *file;
+    long size;
+    bool ok;
+
+    free(flash_image_path);
+    flash_image_path = NULL;
+    if (flash_image_is_sparse(file_name)) {
+        if (!flash_image_load(file_name, mem.flash.block, flash_size)) {
+            return false;
+        }
+        if (backing == FLASH_MAP_SHARED && (flash_image_path = (char*)malloc(strlen(file_name) + 1))) {
+            strcpy(flash_image_path, file_name);
+        }
+        return true;
+    }
+    if (backing != FLASH_COPY) {
+        if ((mapped = (uint8_t*)os_map_file(file_name, flash_size, backing == FLASH_MAP_SHARED))) {
+            free(mem.flash.block);
+            mem.flash.block = mapped;
+            mem.flash.backing = backing;
+            mem.flash.dirty = 0;
+            mem_flash_sectors();
+            return true;
+        }
+        gui_console_printf("Could not map the ROM image, reading it instead.\n");
+    }
+
+    if (!(file = fopen_utf8(file_name, "rb"))) {
+        return false;
+    }
+    ok = !fseek(file, 0L, SEEK_END) && (size = ftell(file)) >= 0 && (uint32_t)size <= flash_size &&
+         !fseek(file, 0L, SEEK_SET) && fread(mem.flash.block, 1, size, file) == (size_t)size;
+    fclose(file);
+    return ok;
+}
+
+void mem_flash_touched(uint32_t address, uint32_t size) {
+    uint32_t first, last;
+
+    if (!size || address >= flash_size) {
+        return;
+    }
+    if (size > flash_size - address) {
+        size = flash_size - address;
+    }
+    first = address / flash_sector_size_64K;
+    last = (address + size - 1) / flash_sector_size_64K;
+    while (first <= last) {
+        mem.flash.dirty |= 1ULL << first++;
+    }
+}
+
+void mem_flash_sync(void) {
+    unsigned int i;
+
+    if (mem.flash.backing != FLASH_MAP_SHARED) {
+        mem.flash.dirty = 0;
+        return;
+    }
+    for (i = 0; mem.flash.dirty; i++) {
+        if (mem.flash.dirty & 1ULL << i) {
+            os_sync_file(mem.flash.block + i * flash_sector_size_64K, flash_sector_size_64K);
+            mem.flash.dirty &= ~(1ULL << i);
+        }
+    }
+}
+
 void mem_init(void) {
     unsigned int i;
 
     mem.flash.block = (uint8_t*)malloc(flash_size);               /* allocate Flash memory */
     memset(mem.flash.block, 0xFF, flash_size);
     mem.flash.size = flash_size;
+    mem.flash.backing = FLASH_COPY;
+    mem.flash.dirty = 0;
 
     for (i = 0; i < flash_sectors_8K; i++) {
-        mem.flash.sector[i].ptr = mem.flash.block + (i*flash_sector_size_8K);
         mem.flash.sector[i].locked = true;
     }
 
     for (i = flash_sectors_8K; i < flash_sectors_64K+flash_sectors_8K; i++) {
-        mem.flash.sector[i].ptr = mem.flash.block + (i*flash_sector_size_64K);
         mem.flash.sector[i].locked = false;
     }
+    mem_flash_sectors();
 
     /* Sector 9 is locked */
     mem.flash.sector[9].locked = true;
@@ -43,8 +131,11 @@ void mem_init(void) {
     mem.ram.block = (uint8_t*)calloc(ram_size, sizeof(uint8_t));      /* Allocate RAM */
 
     mem.debug.stepOverAddress = -1;
+    mem.debug.stoppedAt = -1;
     mem.debug.block = (uint8_t*)calloc(0x1000000, sizeof(uint8_t));    /* Allocate Debug memory */
     mem.debug.ports = (uint8_t*)calloc(0x10000, sizeof(uint8_t));      /* Allocate Debug Port Monitor */
+    mem.debug.ports_armed = 0;
+    apb_update_slow_path();
 
     mem.flash.mapped = false;
     mem.flash.write_index = 0;
@@ -58,7 +149,19 @@ void mem_free(void) {
         mem.ram.block = NULL;
     }
     if (mem.flash.block) {
-        free(mem.flash.block);
+        if (mem.flash.backing == FLASH_COPY) {
+            if (flash_image_path) {
+                if (!flash_image_save(flash_image_path, mem.flash.block, flash_size)) {
+                    gui_console_printf("Could not write back %s.\n", flash_image_path);
+                }
+                free(flash_image_path);
+                flash_image_path = NULL;
+            }
+            free(mem.flash.block);
+        } else {
+            mem_flash_sync();
+            os_unmap_file(mem.flash.block, flash_size);
+        }
         mem.flash.block = NULL;
     }
     if (mem.debug.block) {
@@ -74,6 +177,7 @@ void mem_free(void) {
 
 void mem_reset(void) {
     memset(mem.ram.block, 0, ram_size);
+    lcd_dirty_all();
     gui_console_printf("RAM reset.\n");
 }
 
@@ -103,6 +207,7 @@ static void flash_reset_write_index(uint32_t addr, uint8_t byte) {
 
 static void flash_write(uint32_t addr, uint8_t byte) {
     mem.flash.block[addr] &= byte;
+    mem_flash_touched(addr, 1);
 }
 
 static void flash_erase(uint32_t addr, uint8_t byte) {
@@ -112,6 +217,7 @@ static void flash_erase(uint32_t addr, uint8_t byte) {
     mem.flash.command = FLASH_CHIP_ERASE;
 
     memset(mem.flash.block, 0xFF, flash_size);
+    mem_flash_touched(0, flash_size);
     gui_console_printf("Erased entire Flash chip.\n");
 }
 
@@ -126,6 +232,7 @@ static void flash_erase_sector(uint32_t addr, uint8_t byte) {
     sector = addr / flash_sector_size_64K;
     if(mem.flash.sector[sector].locked == false) {
         memset(mem.flash.sector[sector].ptr, 0xFF, flash_sector_size_64K);
+        mem_flash_touched(mem.flash.sector[sector].ptr - mem.flash.block, flash_sector_size_64K);
     }
 }
 
@@ -272,6 +379,7 @@ uint8_t memory_read_byte(const uint32_t address)
 {
     uint8_t value = 0;
     uint32_t addr = address & 0xFFFFFF;
+    int cycles = cpu.cycles;
 
     switch((addr >> 20) & 0xF) {
         // FLASH
@@ -314,7 +422,7 @@ uint8_t memory_read_byte(const uint32_t address)
 
         case 0xE: case 0xF:
             cpu.cycles += 2;
-            value = port_read_byte(mmio_range(addr)<<12 | addr_range(addr));          // read byte from mmio
+            value = mmio_read_byte(addr);                                             // read byte from mmio
             break;
 
         default:
@@ -326,20 +434,28 @@ uint8_t memory_read_byte(const uint32_t address)
         disasmHighlight.hit_read_breakpoint = mem.debug.block[address] & DBG_READ_BREAKPOINT;
         disasmHighlight.hit_write_breakpoint = mem.debug.block[address] & DBG_WRITE_BREAKPOINT;
         disasmHighlight.hit_exec_breakpoint = mem.debug.block[address] & DBG_EXEC_BREAKPOINT;
-        if (!in_debugger && disasmHighlight.hit_read_breakpoint) {
+        if (!in_debugger && disasmHighlight.hit_read_breakpoint &&
+            (!(mem.debug.block[address] & DBG_CONDITIONAL) || debug_condition_check(address, DBG_READ_BREAKPOINT))) {
             debugger(HIT_READ_BREAKPOINT, address);
         }
     }
+    if (mem.debug.watched[(address & 0xFFFFFF) >> 12] & DBG_READ_BREAKPOINT) {
+        debug_watch_access(address & 0xFFFFFF, value, DBG_READ_BREAKPOINT);
+    }
 
     if (cpu.registers.PC == address) {
         disasmHighlight.hit_pc = true;
     }
+    if (profiling) {
+        profile_memory(address, false, cpu.cycles - cycles);
+    }
 
     return value;
 }
 
 void memory_write_byte(const uint32_t address, const uint8_t byte) {
     uint32_t addr = address & 0xFFFFFF;
+    int cycles = cpu.cycles;
 
     switch((addr >> 20) & 0xF) {
         // FLASH
@@ -374,6 +490,9 @@ void memory_write_byte(const uint32_t address, const uint8_t byte) {
             if (addr < 0x65800) {
                 cpu.cycles += 2;
                 mem.ram.block[addr] = byte;
+                if (addr - lcd_dirty.base < lcd_dirty.size) {
+                    lcd_dirty_ram(addr);
+                }
                 break;
             }
             // UNMAPPED
@@ -389,7 +508,7 @@ void memory_write_byte(const uint32_t address, const uint8_t byte) {
         // MMIO <-> Advanced Perphrial Bus
         case 0xE: case 0xF:
             cpu.cycles += 2;
-            port_write_byte(mmio_range(addr)<<12 | addr_range(addr), byte);         // write byte to the mmio port
+            mmio_write_byte(addr, byte);                                            // write byte to the mmio port
             break;
 
         default:
@@ -397,9 +516,16 @@ void memory_write_byte(const uint32_t address, const uint8_t byte) {
             break;
     }
 
-    if (!in_debugger && mem.debug.block[address&0xFFFFFF] & DBG_WRITE_BREAKPOINT) {
+    if (!in_debugger && mem.debug.block[address&0xFFFFFF] & DBG_WRITE_BREAKPOINT &&
+        (!(mem.debug.block[address&0xFFFFFF] & DBG_CONDITIONAL) || debug_condition_check(address, DBG_WRITE_BREAKPOINT))) {
         debugger(HIT_WRITE_BREAKPOINT, address);
     }
+    if (mem.debug.watched[(address & 0xFFFFFF) >> 12] & DBG_WRITE_BREAKPOINT) {
+        debug_watch_access(address & 0xFFFFFF, byte, DBG_WRITE_BREAKPOINT);
+    }
+    if (profiling) {
+        profile_memory(address, true, cpu.cycles - cycles);
+    }
 
     return;
 }
@@ -411,12 +537,14 @@ void memory_force_write_byte(const uint32_t address, const uint8_t byte) {
         // FLASH
         case 0x0: case 0x1: case 0x2: case 0x3:
             mem.flash.block[addr] = byte;
+            mem_flash_touched(addr, 1);
             break;
 
         // MAYBE FLASH
         case 0x4: case 0x5: case 0x6: case 0x7:
             addr -= 0x400000;
             mem.flash.block[addr] = byte;
+            mem_flash_touched(addr, 1);
             break;
 
         // UNMAPPED
@@ -428,6 +556,9 @@ void memory_force_write_byte(const uint32_t address, const uint8_t byte) {
             addr -= 0xD00000;
             if (addr < 0x65800) {
                 mem.ram.block[addr] = byte;
+                if (addr - lcd_dirty.base < lcd_dirty.size) {
+                    lcd_dirty_ram(addr);
+                }
                 break;
             }
             // UNMAPPED
@@ -36,6 +36,8 @@ typedef struct {
     flash_sector_state_t sector[8+63];
     uint8_t *block;     /* Flash mem */
     uint32_t size;
+    uint8_t backing;    /* FLASH_COPY or a mapping of the ROM image */
+    uint64_t dirty;     /* 64K regions written since the last mem_flash_sync() */
 
     /* Internal */
     bool mapped;
@@ -43,6 +45,13 @@ typedef struct {
     flash_write_t writes[6];
 } flash_chip_t;
 
+/* How mem.flash.block relates to the ROM image */
+enum flash_backing {
+    FLASH_COPY,             /* Read into memory */
+    FLASH_MAP_PRIVATE,      /* Mapped copy on write, the file never changes */
+    FLASH_MAP_SHARED        /* Mapped, flash writes go back to the file */
+};
+
 typedef struct {
     uint8_t *block;       /* RAM mem */
 } ram_chip_t;
@@ -69,6 +78,12 @@ void memory_force_write_byte(const uint32_t address, const uint8_t byte);
 
 uint8_t *phys_mem_ptr(uint32_t address, uint32_t size);
 
+/* Falls back to FLASH_COPY if the image can't be mapped */
+bool mem_load_flash(const char *file_name, int backing);
+/* Anything writing mem.flash.block directly has to report it, so shared images get written back */
+void mem_flash_touched(uint32_t address, uint32_t size);
+void mem_flash_sync(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,12 +9,20 @@
 /* Global GPT state */
 rtc_state_t rtc;
 
+static time_t rtc_now(void) {
+    if (deterministic_mode) {
+        return (time_t)(deterministic_epoch + rtc.elapsed / 12000000);
+    }
+    return time(NULL);
+}
+
 static void rtc_event(int index) {
     time_t currsec;
     /* Update 3 or so times a second just so we don't miss a step */
     event_repeat(index, 27000000 / 4);
+    rtc.elapsed += 27000000 / 4;
 
-    currsec = time(NULL);
+    currsec = rtc_now();
     if (!(rtc.control & 1)) {
         return;
     }
@@ -140,7 +148,19 @@ static void rtc_write(const uint16_t pio, const uint8_t byte)
 
 void rtc_reset() {
     memset(&rtc,0,sizeof(rtc));
-    rtc.prevsec = time(NULL);
+    rtc.prevsec = rtc_now();
+
+    if (deterministic_mode) {
+        /* Start from the epoch rather than whatever the counters held, day 0 is 1997-01-01 */
+        int64_t secs = deterministic_epoch - 852076800;
+        if (secs > 0) {
+            rtc.read_day = secs / 86400;
+            rtc.read_hour = secs / 3600 % 24;
+            rtc.read_min = secs / 60 % 60;
+            rtc.read_sec = secs % 60;
+            hold_read();
+        }
+    }
 
     sched.items[SCHED_RTC].clock = CLOCK_12M;
     sched.items[SCHED_RTC].proc = rtc_event;
@@ -11,6 +11,8 @@ extern "C" {
 typedef struct rtc_state {
     /* Previos second counter */
     time_t prevsec;
+    /* 12MHz ticks since reset, the time source in deterministic mode */
+    uint64_t elapsed;
 
     /* Registers */
     uint8_t read_sec;
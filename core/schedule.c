@@ -16,6 +16,7 @@
 
 #include "emu.h"
 #include "schedule.h"
+#include "debug/timeline.h"
 
 sched_state_t sched;
 
@@ -32,9 +33,13 @@ static uint32_t muldiv(uint32_t a, uint32_t b, uint32_t c) {
 
 void sched_reset(void) {
     const uint32_t def_rates[] = { 0, 0, 27000000, 12000000, 32768 };
+    if (timeline_recording) {
+        timeline_rebase(true);
+    }
     memcpy(sched.clock_rates, def_rates, sizeof(def_rates));
     memset(sched.items, 0, sizeof sched.items);
     sched.next_index = 0;
+    sched.cycle_base = 0;
 }
 
 void event_repeat(int index, uint64_t ticks) {
@@ -74,10 +79,19 @@ uint32_t sched_process_pending_events(void) {
                 }
             }
             cputick -= sched.clock_rates[CLOCK_CPU];
+            sched.cycle_base += sched.clock_rates[CLOCK_CPU];
         } else {
             //printf("[%8d/%8d] Event %d\n", cputick, sched.next_cputick, sched.next_index);
-            sched.items[sched.next_index].second = -1;
-            sched.items[sched.next_index].proc(sched.next_index);
+            int index = sched.next_index;
+            sched.items[index].second = -1;
+            if (timeline_recording) {
+                uint64_t cycle = sched_cycles();
+                uint64_t host_start = timeline_event_fired(index, cycle);
+                sched.items[index].proc(index);
+                timeline_event_done(index, cycle, host_start);
+            } else {
+                sched.items[index].proc(index);
+            }
         }
         sched_update_next_event(cputick);
     }
@@ -101,14 +115,20 @@ void event_set(int index, uint64_t ticks) {
     sched_update_next_event(cputick);
 }
 
-uint32_t event_ticks_remaining(int index) {
-    uint32_t cputick = sched_process_pending_events();
-
+static uint32_t ticks_remaining(int index, uint32_t cputick) {
     struct sched_item *item = &sched.items[index];
     return item->second * sched.clock_rates[item->clock]
         + item->tick - muldiv(cputick, sched.clock_rates[item->clock], sched.clock_rates[CLOCK_CPU]);
 }
 
+uint32_t event_ticks_remaining(int index) {
+    return ticks_remaining(index, sched_process_pending_events());
+}
+
+uint32_t event_ticks_remaining_peek(int index) {
+    return ticks_remaining(index, sched.next_cputick + cycle_count_delta);
+}
+
 void sched_set_clocks(int count, uint32_t *new_rates) {
     uint32_t cputick = sched_process_pending_events();
 
@@ -120,7 +140,13 @@ void sched_set_clocks(int count, uint32_t *new_rates) {
             remaining[i] = event_ticks_remaining(i);
         }
     }
+    if (timeline_recording) {
+        timeline_rebase(false);
+    }
+    /* The current second now has a different length, keep the cycle count where it is */
+    sched.cycle_base += cputick;
     cputick = muldiv(cputick, new_rates[CLOCK_CPU], sched.clock_rates[CLOCK_CPU]);
+    sched.cycle_base -= cputick;
     memcpy(sched.clock_rates, new_rates, sizeof(uint32_t) * count);
     for (i = 0; i < SCHED_NUM_ITEMS; i++) {
         struct sched_item *item = &sched.items[i];
@@ -132,3 +158,8 @@ void sched_set_clocks(int count, uint32_t *new_rates) {
 
     sched_update_next_event(cputick);
 }
+
+/* CPU cycles elapsed since reset */
+uint64_t sched_cycles(void) {
+    return sched.cycle_base + sched.next_cputick + cycle_count_delta;
+}
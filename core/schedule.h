@@ -19,6 +19,10 @@ enum sched_item_index {
     SCHED_TIMER2,
     SCHED_TIMER3,
     SCHED_WATCHDOG,
+    SCHED_USB,
+    SCHED_INPUT,
+    SCHED_SCRIPT,
+    SCHED_BUDGET,
     SCHED_NUM_ITEMS
 };
 
@@ -35,6 +39,7 @@ typedef struct sched_state {
     uint32_t clock_rates[6];
     uint32_t next_cputick;
     int next_index; /* -1 if no more events this second */
+    uint64_t cycle_base; /* CPU cycles before the current second */
 } sched_state_t;
 
 extern sched_state_t sched;
@@ -46,7 +51,10 @@ uint32_t sched_process_pending_events(void);
 void event_clear(int index);
 void event_set(int index, uint64_t ticks);
 uint32_t event_ticks_remaining(int index);
+/* Same, but doesn't run pending events first, for the debugger */
+uint32_t event_ticks_remaining_peek(int index);
 void sched_set_clocks(int count, uint32_t *new_rates);
+uint64_t sched_cycles(void);
 
 #ifdef __cplusplus
 }
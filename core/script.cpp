@@ -0,0 +1,423 @@
+#include <atomic>
+#include <ctype.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "script.h"
+#include "emu.h"
+#include "schedule.h"
+#include "keypad.h"
+#include "input.h"
+#include "mem.h"
+#include "os/os.h"
+
+#define KEY(row, col) static_cast<uint8_t>((row) << 4 | (col))
+
+enum {
+    OP_DOWN,
+    OP_UP,
+    OP_WAIT_FRAMES,
+    OP_WAIT_RAM,
+    OP_WAIT_PC,
+    OP_WAIT_SCREEN,
+    OP_HASH
+};
+
+struct ScriptOp {
+    int type;
+    uint32_t a, b, c;
+    uint64_t hash;
+};
+
+struct KeyName {
+    const char *name;
+    uint8_t key;
+};
+
+static const KeyName key_names[] = {
+    { "graph", KEY(1, 0) }, { "trace", KEY(1, 1) }, { "zoom", KEY(1, 2) }, { "window", KEY(1, 3) },
+    { "y=", KEY(1, 4) }, { "2nd", KEY(1, 5) }, { "mode", KEY(1, 6) }, { "del", KEY(1, 7) },
+    { "on", KEY(2, 0) }, { "sto", KEY(2, 1) }, { "ln", KEY(2, 2) }, { "log", KEY(2, 3) },
+    { "x2", KEY(2, 4) }, { "xinv", KEY(2, 5) }, { "math", KEY(2, 6) }, { "alpha", KEY(2, 7) },
+    { "0", KEY(3, 0) }, { "1", KEY(3, 1) }, { "4", KEY(3, 2) }, { "7", KEY(3, 3) },
+    { "comma", KEY(3, 4) }, { "sin", KEY(3, 5) }, { "apps", KEY(3, 6) }, { "xton", KEY(3, 7) },
+    { "period", KEY(4, 0) }, { "2", KEY(4, 1) }, { "5", KEY(4, 2) }, { "8", KEY(4, 3) },
+    { "(", KEY(4, 4) }, { "cos", KEY(4, 5) }, { "prgm", KEY(4, 6) }, { "stat", KEY(4, 7) },
+    { "neg", KEY(5, 0) }, { "3", KEY(5, 1) }, { "6", KEY(5, 2) }, { "9", KEY(5, 3) },
+    { ")", KEY(5, 4) }, { "tan", KEY(5, 5) }, { "vars", KEY(5, 6) },
+    { "enter", KEY(6, 0) }, { "+", KEY(6, 1) }, { "-", KEY(6, 2) }, { "*", KEY(6, 3) },
+    { "/", KEY(6, 4) }, { "^", KEY(6, 5) }, { "clear", KEY(6, 6) },
+    { "down", KEY(7, 0) }, { "left", KEY(7, 1) }, { "right", KEY(7, 2) }, { "up", KEY(7, 3) }
+};
+
+/* What the keys type on the home screen, without and with alpha. '>' stands for the store arrow */
+static const char key_chars[8][8] = {
+    { 0 },
+    { 0 },
+    { 0, '>', 0, 0, 0, 0, 0, 0 },
+    { '0', '1', '4', '7', ',', 0, 0, 0 },
+    { '.', '2', '5', '8', '(', 0, 0, 0 },
+    { 0, '3', '6', '9', ')', 0, 0, 0 },
+    { '\n', '+', '-', '*', '/', '^', 0, 0 },
+    { 0 }
+};
+static const char alpha_chars[8][8] = {
+    { 0 },
+    { 0 },
+    { 0, 'X', 'S', 'N', 'I', 'D', 'A', 0 },
+    { ' ', 'Y', 'T', 'O', 'J', 'E', 'B', 0 },
+    { ':', 'Z', 'U', 'P', 'K', 'F', 'C', 0 },
+    { '?', 0, 'V', 'Q', 'L', 'G', 0, 0 },
+    { 0, '"', 'W', 'R', 'M', 'H', 0, 0 },
+    { 0 }
+};
+
+/* A key needs to be seen by this many complete scans; if the OS isn't scanning, give up after the timeout */
+static const uint32_t settle_scans = 2;
+static const uint32_t settle_timeout = 50;  /* polls */
+static const uint32_t poll_ticks = 12000;   /* 1ms of CLOCK_12M */
+
+static std::mutex script_mutex;
+static std::atomic<bool> pending(false), busy(false);
+
+/* Protected by script_mutex */
+static std::vector<ScriptOp> incoming;
+static bool clear_requested = false;
+
+/* Emulator thread only */
+static std::deque<ScriptOp> ops;
+static bool started = false, armed = false;
+static uint32_t polls, scans_start, frames, frames_target;
+static const lcd_frame_t *last_frame = NULL;
+static uint64_t screen_hash;
+static uint32_t screen_seq;
+
+static uint64_t frame_hash(const lcd_frame_t *frame) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(frame->pixels);
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < sizeof(frame->pixels); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static bool parse_number(const std::string &str, uint32_t *value) {
+    const char *s = str.c_str();
+    char *end;
+    int base = 10;
+
+    if (*s == '$') {
+        s++;
+        base = 16;
+    } else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        s += 2;
+        base = 16;
+    }
+    *value = strtoul(s, &end, base);
+    return *s && !*end;
+}
+
+static bool parse_key(const std::string &name, uint8_t *key) {
+    for (const KeyName &entry : key_names) {
+        if (!strcmp(entry.name, name.c_str())) {
+            *key = entry.key;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void push_tap(std::vector<ScriptOp> &out, uint8_t key) {
+    out.push_back({ OP_DOWN, key, 0, 0, 0 });
+    out.push_back({ OP_UP, key, 0, 0, 0 });
+}
+
+static bool push_char(std::vector<ScriptOp> &out, char c) {
+    c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    for (unsigned int row = 0; row < 8; row++) {
+        for (unsigned int col = 0; col < 8; col++) {
+            if (key_chars[row][col] == c) {
+                push_tap(out, KEY(row, col));
+                return true;
+            }
+        }
+    }
+    for (unsigned int row = 0; row < 8; row++) {
+        for (unsigned int col = 0; col < 8; col++) {
+            if (alpha_chars[row][col] == c) {
+                push_tap(out, KEY(2, 7));
+                push_tap(out, KEY(row, col));
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool parse_line(const std::string &line, std::vector<ScriptOp> &out) {
+    std::vector<std::string> args;
+    size_t pos = 0;
+    uint32_t addr, value, mask;
+    uint8_t key;
+
+    while (pos < line.size() && line[pos] != '#') {
+        size_t end = line.find_first_of(" \t\r\n#", pos);
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+        if (end > pos) {
+            args.push_back(line.substr(pos, end - pos));
+        }
+        pos = end < line.size() && line[end] != '#' ? end + 1 : end;
+        if (args.size() == 1 && args[0] == "text") {
+            break;
+        }
+    }
+
+    if (args.empty()) {
+        return true;
+    }
+
+    const std::string &cmd = args[0];
+    if (cmd == "text") {
+        /* The rest of the line, optionally in quotes */
+        std::string text = line.substr(pos);
+        text.erase(0, text.find_first_not_of(" \t"));
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        if (text.size() >= 2 && text.front() == '"' && text.back() == '"') {
+            text = text.substr(1, text.size() - 2);
+        }
+        for (char c : text) {
+            if (!push_char(out, c)) {
+                gui_console_printf("Script: can't type '%c'.\n", c);
+                return false;
+            }
+        }
+        return true;
+    }
+    if (cmd == "key" && args.size() >= 2) {
+        for (size_t i = 1; i < args.size(); i++) {
+            if (!parse_key(args[i], &key)) {
+                gui_console_printf("Script: unknown key %s.\n", args[i].c_str());
+                return false;
+            }
+            push_tap(out, key);
+        }
+        return true;
+    }
+    if ((cmd == "down" || cmd == "up") && args.size() == 2 && parse_key(args[1], &key)) {
+        out.push_back({ cmd == "down" ? OP_DOWN : OP_UP, key, 0, 0, 0 });
+        return true;
+    }
+    if (cmd == "hash" && args.size() == 1) {
+        out.push_back({ OP_HASH, 0, 0, 0, 0 });
+        return true;
+    }
+    if (cmd == "wait" && args.size() >= 3) {
+        if (args[1] == "frames" && args.size() == 3 && parse_number(args[2], &value)) {
+            out.push_back({ OP_WAIT_FRAMES, value, 0, 0, 0 });
+            return true;
+        }
+        if (args[1] == "pc" && args.size() == 3 && parse_number(args[2], &value) && value < 0x1000000) {
+            out.push_back({ OP_WAIT_PC, value, 0, 0, 0 });
+            return true;
+        }
+        if (args[1] == "screen" && args.size() == 3) {
+            out.push_back({ OP_WAIT_SCREEN, 0, 0, 0, strtoull(args[2].c_str(), NULL, 16) });
+            return true;
+        }
+        if (args[1] == "ram" && (args.size() == 4 || args.size() == 5) &&
+            parse_number(args[2], &addr) && (addr < 0x400000 || (addr >= 0xD00000 && addr < 0xD65800)) &&
+            parse_number(args[3], &value) && value < 0x100) {
+            mask = 0xFF;
+            if (args.size() == 5 && (!parse_number(args[4], &mask) || mask > 0xFF)) {
+                return false;
+            }
+            out.push_back({ OP_WAIT_RAM, addr, value & mask, mask, 0 });
+            return true;
+        }
+    }
+
+    gui_console_printf("Script: can't parse: %s\n", line.c_str());
+    return false;
+}
+
+static bool queue_ops(std::vector<ScriptOp> &out) {
+    std::lock_guard<std::mutex> lock(script_mutex);
+    incoming.insert(incoming.end(), out.begin(), out.end());
+    pending = busy = true;
+    return true;
+}
+
+bool script_command(const char *line) {
+    std::vector<ScriptOp> out;
+    return parse_line(line, out) && queue_ops(out);
+}
+
+bool script_load(const char *file_name) {
+    std::vector<ScriptOp> out;
+    std::string line;
+    FILE *file = fopen_utf8(file_name, "rb");
+    int c;
+
+    if (!file) {
+        return false;
+    }
+    do {
+        c = fgetc(file);
+        if (c == EOF || c == '\n') {
+            if (!parse_line(line, out)) {
+                fclose(file);
+                return false;
+            }
+            line.clear();
+        } else {
+            line += static_cast<char>(c);
+        }
+    } while (c != EOF);
+    fclose(file);
+
+    return queue_ops(out);
+}
+
+void script_clear(void) {
+    std::lock_guard<std::mutex> lock(script_mutex);
+    incoming.clear();
+    clear_requested = pending = true;
+}
+
+bool script_busy(void) {
+    return busy;
+}
+
+static void op_start(const ScriptOp &op) {
+    switch (op.type) {
+        case OP_DOWN:
+        case OP_UP:
+            input_key_event(op.a >> 4, op.a & 15, op.type == OP_DOWN);
+            scans_start = keypad.scans;
+            polls = 0;
+            break;
+        case OP_WAIT_FRAMES:
+            frames_target = frames + op.a;
+            break;
+        case OP_WAIT_PC:
+            mem.debug.stoppedAt = -1;
+            mem.debug.block[op.a] |= DBG_STOP_BREAKPOINT;
+            break;
+        case OP_WAIT_SCREEN:
+            screen_seq = 0;
+            break;
+        case OP_HASH:
+            if (!last_frame) {
+                last_frame = lcd_frame_publish();
+            }
+            gui_console_printf("Screen hash: %016llX\n", static_cast<unsigned long long>(frame_hash(last_frame)));
+            break;
+        default:
+            break;
+    }
+}
+
+static bool op_done(const ScriptOp &op) {
+    const uint8_t *ptr;
+
+    switch (op.type) {
+        case OP_DOWN:
+        case OP_UP:
+            return keypad.scans - scans_start >= settle_scans || polls >= settle_timeout;
+        case OP_WAIT_FRAMES:
+            return static_cast<int32_t>(frames - frames_target) >= 0;
+        case OP_WAIT_RAM:
+            ptr = phys_mem_ptr(op.a, 1);
+            return ptr && (*ptr & op.c) == op.b;
+        case OP_WAIT_PC:
+            return mem.debug.stoppedAt == op.a;
+        case OP_WAIT_SCREEN:
+            return screen_seq && screen_hash == op.hash;
+        default:
+            return true;
+    }
+}
+
+static void op_cancel(const ScriptOp &op) {
+    if (op.type == OP_WAIT_PC) {
+        mem.debug.block[op.a] &= ~DBG_STOP_BREAKPOINT;
+    }
+}
+
+static void script_step(void) {
+    while (!ops.empty()) {
+        ScriptOp &op = ops.front();
+        if (!started) {
+            op_start(op);
+            started = true;
+        }
+        if (!op_done(op)) {
+            return;
+        }
+        op_cancel(op);
+        ops.pop_front();
+        started = false;
+    }
+}
+
+static void script_event(int index) {
+    polls++;
+    script_step();
+    if (ops.empty()) {
+        armed = false;
+        busy = pending.load();
+    } else {
+        event_repeat(index, poll_ticks);
+    }
+}
+
+void script_reset(void) {
+    sched.items[SCHED_SCRIPT].clock = CLOCK_12M;
+    sched.items[SCHED_SCRIPT].second = -1;
+    sched.items[SCHED_SCRIPT].proc = script_event;
+    armed = false;
+    last_frame = NULL;
+}
+
+void script_poll(void) {
+    if (!pending && ops.empty()) {
+        return;
+    }
+
+    if (pending) {
+        std::lock_guard<std::mutex> lock(script_mutex);
+        if (clear_requested) {
+            if (started) {
+                op_cancel(ops.front());
+            }
+            ops.clear();
+            started = clear_requested = false;
+        }
+        ops.insert(ops.end(), incoming.begin(), incoming.end());
+        incoming.clear();
+        pending = false;
+    }
+
+    script_step();
+    if (ops.empty()) {
+        busy = pending.load();
+    } else if (!armed) {
+        event_set(SCHED_SCRIPT, poll_ticks);
+        armed = true;
+    }
+}
+
+void script_new_frame(const lcd_frame_t *frame) {
+    frames++;
+    last_frame = frame;
+
+    if (!ops.empty() && started && ops.front().type == OP_WAIT_SCREEN && frame->seq != screen_seq) {
+        screen_seq = frame->seq;
+        screen_hash = frame_hash(frame);
+    }
+}
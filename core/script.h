@@ -0,0 +1,43 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defines.h"
+#include "lcdframe.h"
+
+/* Scripted input for test drivers. Commands are queued from any thread and run
+ * on the emulator thread, driven by a scheduler event. Keys are held and released
+ * for as many keypad scans as the OS needs to register them, so typing goes at
+ * emulated speed rather than GUI speed. One command per line:
+ *
+ *   key <name>...              tap keys: enter, 2nd, alpha, clear, up, sin, 7, ...
+ *   down <name> / up <name>    press or release a key and let the keypad see it
+ *   text <string>              type characters, letters go through alpha and '>' is
+ *                              the sto key, which types the store arrow
+ *   wait frames <n>            wait for n LCD frames
+ *   wait ram <addr> <value> [<mask>]
+ *   wait pc <addr>             wait until the CPU executes addr
+ *   wait screen <hash>         wait until the screen has this hash
+ *   hash                       print the hash of the current screen
+ *
+ * Numbers are decimal, or hex with a 0x or $ prefix. '#' starts a comment. */
+
+/* Any thread */
+bool script_command(const char *line);
+bool script_load(const char *file_name);
+void script_clear(void);
+bool script_busy(void);
+
+/* Emulator thread */
+void script_reset(void);
+void script_poll(void);
+void script_new_frame(const lcd_frame_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
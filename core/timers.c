@@ -95,6 +95,23 @@ static uint8_t gpt_read(uint16_t address) {
     return value;
 }
 
+/* Same as gpt_read(), but catches the counters up in a copy instead of rescheduling */
+static uint8_t gpt_peek(uint16_t address) {
+    general_timers_state_t copy = gpt;
+    int which = address >> 4 & 0b11, index = which < 3 ? which : 0;
+    uint32_t invert;
+    if (address >= 0x40) {
+        return 0;
+    }
+    do {
+        invert = gpt.control >> (9 + index) & 1 ? ~0 : 0;
+        if (gpt.control >> index * 3 & 1) {
+            copy.timer[index].counter += (event_ticks_remaining_peek(SCHED_TIMER1 + index) + invert) ^ invert;
+        }
+    } while (++index < which);
+    return ((uint8_t *)&copy)[address];
+}
+
 static void gpt_write(uint16_t address, uint8_t value) {
     int timer;
     if (address >= 0x34 && address < 0x38) {
@@ -127,7 +144,8 @@ void gpt_reset() {
 
 static const eZ80portrange_t device = {
     .read_in    = gpt_read,
-    .write_out  = gpt_write
+    .write_out  = gpt_write,
+    .peek       = gpt_peek
 };
 
 eZ80portrange_t init_gpt(void) {
@@ -1,28 +1,574 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* A host going away while there's data for it mustn't raise SIGPIPE, which would kill us */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
 #include "usb.h"
 #include "emu.h"
+#include "mem.h"
 #include "schedule.h"
 #include "interrupt.h"
 
-/* Global GPT state */
+/* Global USB state */
 usb_state_t usb;
 
+#define REG(offset) usb.regs[(offset) >> 2]
+
+/* Virtual host, it drives the bus the way a computer running TI Connect would:
+ * reset, enumerate, then shovel bulk data between the socket and the FIFOs */
+enum {
+    HOST_IDLE,          /* No client */
+    HOST_ATTACHED,      /* Client connected, waiting for the OS to enable the controller */
+    HOST_CONTROL,       /* Enumerating, waiting for the control transfer to finish */
+    HOST_CONFIGURED     /* Bulk transfers flow */
+};
+
+enum {
+    ENUM_DEVICE,
+    ENUM_ADDRESS,
+    ENUM_CONFIG_HEADER,
+    ENUM_CONFIG,
+    ENUM_SET_CONFIG
+};
+
+#define HOST_POLL_TICKS     12000       /* 1ms of CLOCK_12M, one frame */
+#define HOST_DMA_TICKS      12
+#define HOST_TIMEOUT        500         /* Frames */
+#define HOST_BUF_SIZE       0x10100
+
+static struct {
+    int listen_fd, fd;
+    int state, step, timeout;
+    uint8_t config_value;
+    uint16_t config_length;
+    uint8_t in_ep, out_ep;
+    uint16_t in_mps, out_mps;
+    uint8_t rx[HOST_BUF_SIZE];      /* From the client, raw DUSB packets */
+    uint32_t rx_len, rx_sent;       /* rx_sent bytes of the first packet are already in a FIFO */
+    uint8_t *tx;                    /* To the client */
+    uint32_t tx_len, tx_size;
+} host = { -1, -1, HOST_IDLE, 0, 0, 0, 0, 0, 0, 0, 0, {0}, 0, 0, NULL, 0, 0 };
+
+static void usb_intrpt_check(void) {
+    uint32_t groups = 0, i;
+
+    for (i = 0; i < 3; i++) {
+        if (REG(USB_DISGR0 + i * 4) & ~REG(USB_DMISGR0 + i * 4)) {
+            groups |= 1 << i;
+        }
+    }
+    REG(USB_DIGR) = groups;
+    REG(USB_GISR) = (groups & ~REG(USB_DMIGR) ? USB_GISR_DEV : 0) |
+                    (REG(USB_OTGISR) & REG(USB_OTGIER) ? USB_GISR_OTG : 0);
+
+    intrpt_trigger(INT_USB, REG(USB_DMCR) & USB_DMCR_GLINT_EN && REG(USB_GISR) & ~REG(USB_GMIR) ? INTERRUPT_SET : INTERRUPT_CLEAR);
+}
+
+static void usb_fifo_status(void) {
+    uint32_t empty = 0, fifo;
+
+    REG(USB_DISGR1) &= 0xFFFF0000;
+    for (fifo = 0; fifo < USB_FIFOS; fifo++) {
+        uint16_t len = usb.fifo_len[fifo];
+        REG(USB_FIBCR + fifo * 4) = (REG(USB_FIBCR + fifo * 4) & ~0x7FFu) | len;
+        if (!len) {
+            empty |= 1 << 8 << fifo;
+            REG(USB_DISGR1) |= USB_DISGR1_IN(fifo);
+        } else {
+            REG(USB_DISGR1) &= ~USB_DISGR1_IN(fifo);
+            REG(USB_DISGR1) |= len == host.out_mps ? USB_DISGR1_OUT(fifo) : USB_DISGR1_SPK(fifo);
+        }
+    }
+    REG(USB_DCFESR) = (REG(USB_DCFESR) & 0xFF & ~USB_DCFESR_CX_EMP) | empty | (usb.cx_len ? 0 : USB_DCFESR_CX_EMP);
+    usb_intrpt_check();
+}
+
+static void usb_reset_device(void) {
+    memset(usb.fifo_len, 0, sizeof usb.fifo_len);
+    usb.cx_len = 0;
+    usb.setup_index = 0;
+    usb.dma_pending = usb.cx_done = false;
+    REG(USB_DAR) = 0;
+    REG(USB_DISGR0) = REG(USB_DISGR2) = 0;
+}
+
+static void usb_otg_status(bool attached, bool changed) {
+    uint32_t status = USB_OTGCSR_CROLE | USB_OTGCSR_ID |
+                      (attached ? USB_OTGCSR_B_SESS_VLD | USB_OTGCSR_A_VBUS_VLD : USB_OTGCSR_B_SESS_END);
+    REG(USB_OTGCSR) = (REG(USB_OTGCSR) & 0xFFFF) | status;
+    if (changed) {
+        REG(USB_OTGISR) |= attached ? USB_OTGISR_BPLGRMV : USB_OTGISR_BSESSEND;
+    }
+    usb_intrpt_check();
+}
+
+/* Host side */
+
+static void host_disconnect(void) {
+#ifndef _WIN32
+    if (host.fd >= 0) {
+        close(host.fd);
+    }
+#endif
+    host.fd = -1;
+    host.state = HOST_IDLE;
+    host.rx_len = host.rx_sent = host.tx_len = 0;
+    usb_otg_status(false, true);
+    gui_console_printf("USB: host disconnected.\n");
+}
+
+static int fifo_for(uint8_t ep, bool out) {
+    if (ep < 1 || ep > 4) {
+        return -1;
+    }
+    return (REG(USB_EPMAP) >> ((ep - 1) * 8 + (out ? 4 : 0))) & 0xF;
+}
+
+static void host_send(const uint8_t *data, uint32_t len) {
+    if (host.fd < 0) {
+        return;
+    }
+    if (host.tx_len + len > host.tx_size) {
+        uint32_t size = host.tx_size ? host.tx_size : 0x1000;
+        uint8_t *grown;
+        while (size < host.tx_len + len) {
+            size *= 2;
+        }
+        if (!(grown = (uint8_t*)realloc(host.tx, size))) {
+            return;
+        }
+        host.tx = grown;
+        host.tx_size = size;
+    }
+    memcpy(host.tx + host.tx_len, data, len);
+    host.tx_len += len;
+}
+
+static void host_control(uint8_t type, uint8_t request, uint16_t value, uint16_t index, uint16_t length) {
+    uint8_t *setup = usb.setup;
+    setup[0] = type;
+    setup[1] = request;
+    setup[2] = value;
+    setup[3] = value >> 8;
+    setup[4] = index;
+    setup[5] = index >> 8;
+    setup[6] = length;
+    setup[7] = length >> 8;
+    usb.setup_index = 0;
+    usb.cx_len = 0;
+    REG(USB_DISGR0) |= USB_DISGR0_CX_SETUP;
+    host.state = HOST_CONTROL;
+    host.timeout = HOST_TIMEOUT;
+    usb_fifo_status();
+}
+
+static void host_bus_reset(void) {
+    usb_reset_device();
+    REG(USB_DISGR2) |= USB_DISGR2_USBRST;
+    host.step = ENUM_DEVICE;
+    host.in_ep = host.out_ep = 0;
+    host.in_mps = host.out_mps = 64;
+    host_control(0x80, 6, 0x0100, 0, 18);
+}
+
+static bool host_parse_config(void) {
+    uint32_t i;
+    for (i = 0; i + 2 <= usb.cx_len && usb.cx[i]; i += usb.cx[i]) {
+        const uint8_t *desc = &usb.cx[i];
+        if (desc[1] == 5 && i + 7 <= usb.cx_len && (desc[3] & 3) == 2) {
+            if (desc[2] & 0x80) {
+                host.in_ep = desc[2] & 0xF;
+                host.in_mps = desc[4] | desc[5] << 8;
+            } else {
+                host.out_ep = desc[2] & 0xF;
+                host.out_mps = desc[4] | desc[5] << 8;
+            }
+        }
+    }
+    return host.in_ep && host.out_ep && host.out_mps;
+}
+
+/* The OS finished the current control transfer, look at the answer and start the next one */
+static void host_control_done(void) {
+    switch (host.step++) {
+        case ENUM_DEVICE:
+            host_control(0x00, 5, 1, 0, 0);
+            break;
+        case ENUM_ADDRESS:
+            host_control(0x80, 6, 0x0200, 0, 9);
+            break;
+        case ENUM_CONFIG_HEADER:
+            if (usb.cx_len < 9) {
+                goto fail;
+            }
+            host.config_value = usb.cx[5];
+            host.config_length = usb.cx[2] | usb.cx[3] << 8;
+            host_control(0x80, 6, 0x0200, 0, host.config_length);
+            break;
+        case ENUM_CONFIG:
+            if (!host_parse_config()) {
+                goto fail;
+            }
+            host_control(0x00, 9, host.config_value, 0, 0);
+            break;
+        default:
+            host.state = HOST_CONFIGURED;
+            gui_console_printf("USB: configured, bulk in %u, out %u, %u byte packets.\n", host.in_ep, host.out_ep, host.out_mps);
+            break;
+    }
+    return;
+
+fail:
+    gui_console_printf("USB: unexpected configuration descriptor, giving up until the host reconnects.\n");
+    host.state = HOST_IDLE;
+}
+
+/* Hand the next piece of the first complete raw packet to the OUT FIFO */
+static void host_bulk_out(void) {
+    int fifo = fifo_for(host.out_ep, true);
+    uint32_t packet, chunk;
+
+    if (fifo < 0 || fifo >= USB_FIFOS || usb.fifo_len[fifo] || host.rx_len < 5) {
+        return;
+    }
+    packet = 5 + ((uint32_t)host.rx[0] << 24 | host.rx[1] << 16 | host.rx[2] << 8 | host.rx[3]);
+    if (packet > HOST_BUF_SIZE) {
+        gui_console_printf("USB: raw packet too large, dropping the connection.\n");
+        host_disconnect();
+        return;
+    }
+    if (host.rx_len < packet) {
+        return;
+    }
+    chunk = packet - host.rx_sent;
+    if (chunk > host.out_mps) {
+        chunk = host.out_mps;
+    }
+    if (chunk > USB_FIFO_SIZE) {
+        chunk = USB_FIFO_SIZE;
+    }
+    memcpy(usb.fifo[fifo], host.rx + host.rx_sent, chunk);
+    usb.fifo_len[fifo] = chunk;
+    if ((host.rx_sent += chunk) == packet) {
+        memmove(host.rx, host.rx + packet, host.rx_len -= packet);
+        host.rx_sent = 0;
+    }
+    usb_fifo_status();
+}
+
+#ifndef _WIN32
+static void host_io(void) {
+    ssize_t count;
+
+    if (host.fd < 0 && host.listen_fd >= 0 && (host.fd = accept(host.listen_fd, NULL, NULL)) >= 0) {
+        fcntl(host.fd, F_SETFL, fcntl(host.fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+        {
+            int on = 1;
+            setsockopt(host.fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+        }
+#endif
+        host.rx_len = host.rx_sent = host.tx_len = 0;
+        host.state = HOST_ATTACHED;
+        usb_otg_status(true, true);
+        gui_console_printf("USB: host connected.\n");
+    }
+    if (host.fd < 0) {
+        return;
+    }
+
+    if (host.rx_len < HOST_BUF_SIZE) {
+        count = read(host.fd, host.rx + host.rx_len, HOST_BUF_SIZE - host.rx_len);
+        if (count > 0) {
+            host.rx_len += count;
+        } else if (!count || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            host_disconnect();
+            return;
+        }
+    }
+    if (host.tx_len) {
+        count = send(host.fd, host.tx, host.tx_len, MSG_NOSIGNAL);
+        if (count > 0) {
+            memmove(host.tx, host.tx + count, host.tx_len -= count);
+        } else if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            host_disconnect();
+        }
+    }
+}
+#else
+static void host_io(void) {
+}
+#endif
+
+/* Device side */
+
+static void usb_dma(void) {
+    uint32_t len = (REG(USB_DMACPSR1) >> 8) & 0x1FFFF,
+             address = REG(USB_DMACPSR2) & 0xFFFFFF,
+             target = REG(USB_DMATFNR);
+    bool to_fifo = REG(USB_DMACPSR1) & USB_DMACPSR1_TO_FIFO;
+    uint8_t *ptr = phys_mem_ptr(address, len);
+    int fifo;
+
+    REG(USB_DMACPSR1) &= ~USB_DMACPSR1_START;
+    if (!ptr) {
+        REG(USB_DISGR2) |= USB_DISGR2_DMA_ERROR;
+        usb_fifo_status();
+        return;
+    }
+
+    if (target & USB_DMATFNR_CX) {
+        if (to_fifo) {
+            if (len > sizeof usb.cx - usb.cx_len) {
+                len = sizeof usb.cx - usb.cx_len;
+            }
+            memcpy(usb.cx + usb.cx_len, ptr, len);
+            usb.cx_len += len;
+        }
+    } else {
+        for (fifo = 0; fifo < USB_FIFOS && !(target & 1 << fifo); fifo++);
+        if (fifo < USB_FIFOS) {
+            if (to_fifo) {
+                /* IN data goes straight out on the bus */
+                host_send(ptr, len);
+            } else {
+                if (len > usb.fifo_len[fifo]) {
+                    len = usb.fifo_len[fifo];
+                }
+                memcpy(ptr, usb.fifo[fifo], len);
+                memmove(usb.fifo[fifo], usb.fifo[fifo] + len, usb.fifo_len[fifo] -= len);
+            }
+        }
+    }
+    REG(USB_DISGR2) |= USB_DISGR2_DMA_CMPLT;
+    usb_fifo_status();
+}
+
+static void usb_event(int index) {
+    (void)index;
+
+    if (usb.dma_pending) {
+        usb.dma_pending = false;
+        usb_dma();
+    }
+
+    host_io();
+
+    switch (host.state) {
+        case HOST_ATTACHED:
+            if ((REG(USB_DMCR) & USB_DMCR_CHIP_EN) && host.fd >= 0) {
+                host_bus_reset();
+            }
+            break;
+        case HOST_CONTROL:
+            if (usb.cx_done) {
+                usb.cx_done = false;
+                host_control_done();
+            } else if (!--host.timeout) {
+                gui_console_printf("USB: no answer to a control request, resetting the bus.\n");
+                host.state = HOST_ATTACHED;
+            }
+            break;
+        case HOST_CONFIGURED:
+            host_bulk_out();
+            break;
+        default:
+            break;
+    }
+
+    if (host.listen_fd >= 0 || host.fd >= 0) {
+        event_repeat(SCHED_USB, HOST_POLL_TICKS);
+    }
+}
+
 static uint8_t usb_read(const uint16_t pio) {
-    (void)pio;
-    return 0xFF;
+    uint16_t offset = pio & 0x1FF;
+    uint8_t value;
+
+    if (pio >= 0x200) {
+        return 0;
+    }
+    if ((offset & ~3) == USB_CXPORT) {
+        /* The setup packet comes out as two words, reading the top byte moves to the next */
+        value = usb.setup[(usb.setup_index & 1) << 2 | (offset & 3)];
+        if ((offset & 3) == 3 && ++usb.setup_index == 2) {
+            REG(USB_DISGR0) &= ~USB_DISGR0_CX_SETUP;
+            usb_intrpt_check();
+        }
+        return value;
+    }
+    return usb.regs[offset >> 2] >> ((offset & 3) << 3);
+}
+
+static uint8_t usb_peek(const uint16_t pio) {
+    uint16_t offset = pio & 0x1FF;
+
+    if (pio < 0x200 && (offset & ~3) == USB_CXPORT) {
+        return usb.setup[(usb.setup_index & 1) << 2 | (offset & 3)];
+    }
+    return usb_read(pio);
 }
 
 static void usb_write(const uint16_t pio, const uint8_t byte) {
-    (void)pio;
-    (void)byte;
+    uint16_t offset = pio & 0x1FF, reg = offset & ~3;
+    uint8_t bit_offset = (offset & 3) << 3;
+    uint32_t value = (uint32_t)byte << bit_offset, mask = 0xFFu << bit_offset;
+    int fifo;
+
+    if (pio >= 0x200) {
+        return;
+    }
+
+    switch (reg) {
+        case USB_OTGCSR:
+            mask &= 0xFFFF;
+            break;
+        case USB_OTGISR:
+            /* Write one to clear */
+            REG(reg) &= ~value;
+            usb_intrpt_check();
+            return;
+        case USB_GISR:
+        case USB_DIGR:
+        case USB_CXPORT:
+            return;
+        case USB_DISGR0:
+        case USB_DISGR1:
+        case USB_DISGR2:
+            /* Sources are cleared by writing the register back without them */
+            REG(reg) &= value | ~mask;
+            usb_intrpt_check();
+            return;
+        case USB_DCFESR:
+            if (value & USB_DCFESR_CX_DONE) {
+                usb.cx_done = true;
+                event_set(SCHED_USB, HOST_DMA_TICKS);
+            }
+            if (value & USB_DCFESR_CX_CLR) {
+                usb.cx_len = 0;
+            }
+            if (value & USB_DCFESR_CX_STL && host.state == HOST_CONTROL) {
+                usb.cx_done = true;
+                event_set(SCHED_USB, HOST_DMA_TICKS);
+            }
+            mask &= USB_DCFESR_CX_STL;
+            break;
+        case USB_DMCR:
+            if (value & USB_DMCR_SFRST) {
+                usb_reset_device();
+                value &= ~USB_DMCR_SFRST;
+            }
+            break;
+        case USB_DTR:
+            if (value & USB_DTR_TST_CLRFF) {
+                memset(usb.fifo_len, 0, sizeof usb.fifo_len);
+                value &= ~USB_DTR_TST_CLRFF;
+            }
+            break;
+        case USB_FIBCR:
+        case USB_FIBCR + 4:
+        case USB_FIBCR + 8:
+        case USB_FIBCR + 12:
+            fifo = (reg - USB_FIBCR) >> 2;
+            if (value & USB_FIBCR_FFRST) {
+                usb.fifo_len[fifo] = 0;
+                value &= ~USB_FIBCR_FFRST;
+            }
+            mask &= ~0x7FFu;
+            break;
+        case USB_DMACPSR1:
+            /* The length bytes may still follow, so do the transfer a little later */
+            if (value & USB_DMACPSR1_START) {
+                usb.dma_pending = true;
+                event_set(SCHED_USB, HOST_DMA_TICKS);
+            }
+            break;
+        default:
+            if (reg < USB_OTGCSR) {
+                return;
+            }
+            break;
+    }
+
+    REG(reg) = (REG(reg) & ~mask) | (value & mask);
+    usb_fifo_status();
 }
 
 void usb_reset(void) {
+    memset(&usb, 0, sizeof usb);
+    /* Everything masked until the OS says otherwise */
+    REG(USB_GMIR) = 7;
+    REG(USB_DMIGR) = 7;
+    usb_otg_status(host.fd >= 0, false);
+    usb_fifo_status();
+
+    host.state = host.fd >= 0 ? HOST_ATTACHED : HOST_IDLE;
+    host.rx_sent = 0;
+
+    sched.items[SCHED_USB].clock = CLOCK_12M;
+    sched.items[SCHED_USB].second = -1;
+    sched.items[SCHED_USB].proc = usb_event;
+    if (host.listen_fd >= 0 || host.fd >= 0) {
+        event_repeat(SCHED_USB, HOST_POLL_TICKS);
+    }
+}
+
+bool usb_host_listen(const char *path) {
+#ifndef _WIN32
+    struct sockaddr_un addr;
+
+    usb_host_close();
+    if (strlen(path) >= sizeof addr.sun_path || (host.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return false;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(host.listen_fd, (struct sockaddr*)&addr, sizeof addr) || listen(host.listen_fd, 1)) {
+        close(host.listen_fd);
+        host.listen_fd = -1;
+        return false;
+    }
+    fcntl(host.listen_fd, F_SETFL, fcntl(host.listen_fd, F_GETFL) | O_NONBLOCK);
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
 
+void usb_host_close(void) {
+#ifndef _WIN32
+    if (host.fd >= 0) {
+        close(host.fd);
+    }
+    if (host.listen_fd >= 0) {
+        close(host.listen_fd);
+    }
+#endif
+    host.fd = host.listen_fd = -1;
+    host.state = HOST_IDLE;
+    free(host.tx);
+    host.tx = NULL;
+    host.tx_len = host.tx_size = 0;
 }
 
 static const eZ80portrange_t device = {
     .read_in    = usb_read,
-    .write_out  = usb_write
+    .write_out  = usb_write,
+    .peek       = usb_peek
 };
 
 eZ80portrange_t init_usb(void) {
@@ -7,18 +7,98 @@ extern "C" {
 
 #include "apb.h"
 
-/* Standard USB state */
+/* The CE's USB controller is a Faraday FOTG210. Only the device side is
+ * emulated, the host controller registers read as zero. */
+
+#define USB_OTGCSR        0x080     /* OTG control and status */
+#define USB_OTGISR        0x084     /* OTG interrupt status */
+#define USB_OTGIER        0x088     /* OTG interrupt enable */
+#define USB_GISR          0x0C0     /* Global interrupt status */
+#define USB_GMIR          0x0C4     /* Global interrupt mask */
+#define USB_DMCR          0x100     /* Device main control */
+#define USB_DAR           0x104     /* Device address */
+#define USB_DTR           0x108     /* Device test */
+#define USB_DCFESR        0x120     /* CX configuration and FIFO empty status */
+#define USB_DMIGR         0x130     /* Device interrupt group mask */
+#define USB_DMISGR0       0x134     /* Device interrupt source masks, groups 0-2 */
+#define USB_DMISGR1       0x138
+#define USB_DMISGR2       0x13C
+#define USB_DIGR          0x140     /* Device interrupt group status */
+#define USB_DISGR0        0x144     /* Device interrupt sources, groups 0-2 */
+#define USB_DISGR1        0x148
+#define USB_DISGR2        0x14C
+#define USB_INEPMPSR      0x160     /* IN endpoint 1-8 max packet size */
+#define USB_OUTEPMPSR     0x180     /* OUT endpoint 1-8 max packet size */
+#define USB_EPMAP         0x1A0     /* Endpoint 1-4 to FIFO map */
+#define USB_FIFOMAP       0x1A8
+#define USB_FIFOCF        0x1AC
+#define USB_FIBCR         0x1B0     /* FIFO 0-3 byte count */
+#define USB_DMATFNR       0x1C0     /* DMA target FIFO */
+#define USB_DMACPSR1      0x1C8     /* DMA length, direction and start */
+#define USB_DMACPSR2      0x1CC     /* DMA memory address */
+#define USB_CXPORT        0x1D0     /* Setup packet read port */
+
+#define USB_OTGCSR_B_SESS_END   (1 << 16)
+#define USB_OTGCSR_B_SESS_VLD   (1 << 17)
+#define USB_OTGCSR_A_VBUS_VLD   (1 << 19)
+#define USB_OTGCSR_CROLE        (1 << 20)   /* Current role is device */
+#define USB_OTGCSR_ID           (1 << 21)   /* B device, no A plug */
+#define USB_OTGISR_BSESSEND     (1 << 1)
+#define USB_OTGISR_BPLGRMV      (1 << 11)
+#define USB_GISR_DEV            (1 << 0)
+#define USB_GISR_OTG            (1 << 1)
+#define USB_DMCR_GLINT_EN       (1 << 2)
+#define USB_DMCR_SFRST          (1 << 4)
+#define USB_DMCR_CHIP_EN        (1 << 5)
+#define USB_DAR_AFT_CONF        (1 << 7)
+#define USB_DTR_TST_CLRFF       (1 << 0)
+#define USB_DCFESR_CX_DONE      (1 << 0)
+#define USB_DCFESR_CX_STL       (1 << 2)
+#define USB_DCFESR_CX_CLR       (1 << 3)
+#define USB_DCFESR_CX_EMP       (1 << 5)
+#define USB_DISGR0_CX_SETUP     (1 << 0)
+#define USB_DISGR0_CX_IN        (1 << 1)
+#define USB_DISGR0_CX_COMEND    (1 << 3)
+#define USB_DISGR0_CX_COMFAIL   (1 << 4)
+#define USB_DISGR1_OUT(fifo)    (1 << ((fifo) * 2))
+#define USB_DISGR1_SPK(fifo)    (2 << ((fifo) * 2))
+#define USB_DISGR1_IN(fifo)     (1 << 16 << (fifo))
+#define USB_DISGR2_USBRST       (1 << 0)
+#define USB_DISGR2_SUSP         (1 << 1)
+#define USB_DISGR2_DMA_CMPLT    (1 << 7)
+#define USB_DISGR2_DMA_ERROR    (1 << 8)
+#define USB_FIBCR_FFRST         (1 << 12)
+#define USB_DMATFNR_CX          (1 << 4)
+#define USB_DMACPSR1_START      (1 << 0)
+#define USB_DMACPSR1_TO_FIFO    (1 << 1)
+
+#define USB_FIFOS     4
+#define USB_FIFO_SIZE 0x400
+
 typedef struct usb_state {
-    uint8_t dummy;
+    uint32_t regs[0x200 >> 2];
+    uint8_t setup[8];
+    uint8_t setup_index;            /* Words of setup read through USB_CXPORT */
+    uint8_t fifo[USB_FIFOS][USB_FIFO_SIZE];
+    uint16_t fifo_len[USB_FIFOS];
+    uint8_t cx[0x200];              /* Data written to the control FIFO */
+    uint16_t cx_len;
+    bool dma_pending, cx_done;
 } usb_state_t;
 
-/* Global GPT state */
+/* Global USB state */
 extern usb_state_t usb;
 
 /* Available Functions */
 eZ80portrange_t init_usb(void);
 void usb_reset(void);
 
+/* Host side: a virtual host enumerates the calculator and bridges its bulk pipe
+ * to a Unix socket. A client writes raw DUSB packets (u32 big endian size, u8 type,
+ * payload) and reads the calculator's raw packets back. Call before the emulator starts. */
+bool usb_host_listen(const char *path);
+void usb_host_close(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,9 @@
 #include "vat.h"
 #include "mem.h"
+#include "lcd.h"
+#include "os/os.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -71,6 +74,15 @@ const char *calc_var_type_names[0x40] = {
     "Unknown #25",
 };
 
+/* File extensions for export, NULL for types that don't get a file */
+const char *calc_var_type_exts[0x40] = {
+    "8xn", "8xl", "8xm", "8xy", "8xs", "8xp", "8xp", "8ci",
+    "8xd", NULL,  "8xy", "8xy", "8xc", "8xl", NULL,  "8xw",
+    "8xz", "8xt", NULL,  NULL,  NULL,  "8xv", "8xp", "8cg",
+    "8xn", NULL,  "8ca", "8xc", "8xn", "8xc", "8xc", "8xc",
+    "8xn", "8xn",
+};
+
 const char *calc_var_name_to_utf8(uint8_t name[8]) {
     static char buffer[17];
     char *dest = buffer;
@@ -177,7 +189,7 @@ void vat_search_init(calc_var_t *var) {
     var->vat = phys_mem_ptr(0xD3FFFF, 1);
 }
 
-static uint32_t load_long(uint8_t *ptr) {
+static uint32_t load_long(const uint8_t *ptr) {
     return ptr[0] | ptr[1] << 8 | ptr[2] << 16;
 }
 
@@ -253,3 +265,426 @@ bool vat_search_find(const calc_var_t *target, calc_var_t *result) {
     }
     return false;
 }
+
+/* OS RAM layout, see ti84pce.inc */
+#define VAT_TEMPMEM     0xD02587
+#define VAT_FPBASE      0xD0258A
+#define VAT_FPS         0xD0258D
+#define VAT_OPBASE      0xD02590
+#define VAT_OPS         0xD02593
+#define VAT_PTEMP       0xD0259A
+#define VAT_PROGPTR     0xD0259D
+#define VAT_NEWDATAPTR  0xD025A0
+#define VAT_USERMEM     0xD1A881
+#define VAT_SYMTABLE    0xD3FFFF
+#define VAT_RAM_END     0xD40000
+
+#define ARCHIVE_START   0x0C0000
+#define ARCHIVE_END     0x3B0000
+#define ARCHIVE_SECTOR  0x10000
+#define ARCHIVE_VALID   0xFC
+#define ARCHIVE_DELETED 0xF0
+
+static uint8_t *ram_ptr(uint32_t address) {
+    return mem.ram.block + (address - 0xD00000);
+}
+
+static uint32_t ram_address(const uint8_t *ptr) {
+    return (uint32_t)(ptr - mem.ram.block) + 0xD00000;
+}
+
+static uint32_t get_ptr(uint32_t address) {
+    return load_long(ram_ptr(address));
+}
+
+static void set_ptr(uint32_t address, uint32_t value) {
+    uint8_t *ptr = ram_ptr(address);
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+}
+
+/* VAT entries are stored downward, so the address field reads low byte first from the top */
+static uint32_t get_entry_address(uint32_t top) {
+    const uint8_t *ptr = ram_ptr(top);
+    return ptr[-3] | ptr[-4] << 8 | ptr[-5] << 16;
+}
+
+static void set_entry_address(uint32_t top, uint32_t value) {
+    uint8_t *ptr = ram_ptr(top);
+    ptr[-3] = value;
+    ptr[-4] = value >> 8;
+    ptr[-5] = value >> 16;
+}
+
+static bool has_namelen(calc_var_type_t type) {
+    switch (type) {
+        case CALC_VAR_TYPE_REAL_LIST:
+        case CALC_VAR_TYPE_CPLX_LIST:
+        case CALC_VAR_TYPE_PROG:
+        case CALC_VAR_TYPE_PROT_PROG:
+        case CALC_VAR_TYPE_APP_VAR:
+        case CALC_VAR_TYPE_TEMP_PROG:
+        case CALC_VAR_TYPE_GROUP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Move the data pointer of every RAM entry at or above from, temporaries included */
+static void vat_adjust_data(uint32_t from, int32_t delta) {
+    uint32_t vat = VAT_SYMTABLE,
+             progPtr = get_ptr(VAT_PROGPTR),
+             bottom = get_ptr(VAT_OPBASE);
+    while (vat > bottom && vat >= VAT_USERMEM) {
+        bool prog = vat <= progPtr;
+        uint8_t namelen = prog ? *ram_ptr(vat - 6) : 3;
+        uint32_t address = get_entry_address(vat);
+        if (!namelen || namelen > 8) {
+            break;
+        }
+        if (address >= from && address < VAT_RAM_END) {
+            set_entry_address(vat, address + delta);
+        }
+        vat -= 6 + prog + namelen;
+    }
+}
+
+/* Free RAM is the gap between the floating point stack and the operator stack */
+static uint32_t vat_free(void) {
+    uint32_t fps = get_ptr(VAT_FPS), ops = get_ptr(VAT_OPS);
+    return ops > fps ? ops - fps : 0;
+}
+
+/* RAM is written directly here, bypassing the LCD's dirty tracking of memory_write_byte() */
+static void ram_touched(uint32_t from, uint32_t to) {
+    lcd_dirty_ram_range(from - 0xD00000, to - from);
+}
+
+static void insert_mem(uint32_t at, uint32_t size) {
+    static const uint32_t ptrs[] = { VAT_TEMPMEM, VAT_FPBASE, VAT_FPS, VAT_NEWDATAPTR };
+    uint32_t i;
+    memmove(ram_ptr(at + size), ram_ptr(at), get_ptr(VAT_FPS) - at);
+    ram_touched(at, get_ptr(VAT_FPS) + size);
+    vat_adjust_data(at, size);
+    for (i = 0; i < sizeof ptrs / sizeof *ptrs; i++) {
+        if (get_ptr(ptrs[i]) >= at) {
+            set_ptr(ptrs[i], get_ptr(ptrs[i]) + size);
+        }
+    }
+}
+
+static void delete_mem(uint32_t at, uint32_t size) {
+    static const uint32_t ptrs[] = { VAT_TEMPMEM, VAT_FPBASE, VAT_FPS, VAT_NEWDATAPTR };
+    uint32_t i;
+    memmove(ram_ptr(at), ram_ptr(at + size), get_ptr(VAT_FPS) - at - size);
+    ram_touched(at, get_ptr(VAT_FPS));
+    vat_adjust_data(at + size, -(int32_t)size);
+    for (i = 0; i < sizeof ptrs / sizeof *ptrs; i++) {
+        if (get_ptr(ptrs[i]) >= at + size) {
+            set_ptr(ptrs[i], get_ptr(ptrs[i]) - size);
+        }
+    }
+}
+
+/* Open a gap of size bytes just below top for a VAT entry, pushing the rest of the VAT and
+ * the operator stack down. progPtr only moves for named variables, the sections can be empty. */
+static void insert_entry(uint32_t top, uint32_t size, bool named) {
+    static const uint32_t ptrs[] = { VAT_OPS, VAT_OPBASE, VAT_PTEMP, VAT_PROGPTR };
+    uint32_t ops = get_ptr(VAT_OPS), i;
+    memmove(ram_ptr(ops + 1 - size), ram_ptr(ops + 1), top - ops);
+    ram_touched(ops + 1 - size, top + 1);
+    for (i = 0; i < sizeof ptrs / sizeof *ptrs - !named; i++) {
+        set_ptr(ptrs[i], get_ptr(ptrs[i]) - size);
+    }
+}
+
+static void delete_entry(uint32_t top, uint32_t size, bool named) {
+    static const uint32_t ptrs[] = { VAT_OPS, VAT_OPBASE, VAT_PTEMP, VAT_PROGPTR };
+    uint32_t ops = get_ptr(VAT_OPS), i;
+    memmove(ram_ptr(ops + 1 + size), ram_ptr(ops + 1), top - size - ops);
+    ram_touched(ops + 1, top + 1);
+    for (i = 0; i < sizeof ptrs / sizeof *ptrs - !named; i++) {
+        set_ptr(ptrs[i], get_ptr(ptrs[i]) + size);
+    }
+}
+
+/* First free spot in an archive sector in use that fits size bytes. Entries don't cross sectors */
+static uint32_t archive_alloc(uint32_t size) {
+    const uint8_t *flash = mem.flash.block;
+    uint32_t sector, pos, end;
+    for (sector = ARCHIVE_START; sector < ARCHIVE_END; sector += ARCHIVE_SECTOR) {
+        if (flash[sector] != 0xF0) {
+            continue;
+        }
+        end = sector + ARCHIVE_SECTOR;
+        for (pos = sector + 1; pos + 3 <= end && flash[pos] != 0xFF;) {
+            pos += 3 + (flash[pos + 1] | flash[pos + 2] << 8);
+        }
+        if (pos + size <= end && flash[pos] == 0xFF) {
+            return pos;
+        }
+    }
+    return 0;
+}
+
+bool vat_delete(const calc_var_t *var) {
+    uint32_t vat, top, size;
+    bool named;
+    if (!var->vat) {
+        return false;
+    }
+    /* var->vat is just past the entry, and entries at or below progPtr have a name length */
+    vat = ram_address(var->vat);
+    top = vat + 7 + var->namelen;
+    size = 7 + var->namelen;
+    if ((named = top > get_ptr(VAT_PROGPTR))) {
+        top--;
+        size--;
+    }
+    if (var->archived) {
+        mem.flash.block[get_entry_address(top)] &= ARCHIVE_DELETED;
+        mem_flash_touched(get_entry_address(top), 1);
+    } else {
+        delete_mem(ram_address(var->data), var->size);
+    }
+    delete_entry(top, size, named);
+    return true;
+}
+
+/* Whether vat_create() would succeed once freed more bytes of RAM are available */
+static bool vat_fits(const calc_var_t *var, bool archive, uint32_t freed) {
+    bool prog = has_namelen(var->type1 & 0x3F);
+    uint32_t entry_size = 6 + prog + var->namelen;
+
+    if (!var->namelen || var->namelen > 8) {
+        return false;
+    }
+    if (archive) {
+        return vat_free() + freed > entry_size && archive_alloc(9 + prog + var->namelen + var->size);
+    }
+    return vat_free() + freed > entry_size + var->size;
+}
+
+bool vat_create(calc_var_t *var, const uint8_t *data, bool archive) {
+    bool prog = has_namelen(var->type = var->type1 & 0x3F);
+    uint32_t entry_size = 6 + prog + var->namelen,
+             top = prog ? get_ptr(VAT_PTEMP) : get_ptr(VAT_PROGPTR),
+             address, i;
+    uint8_t *entry;
+
+    if (!vat_fits(var, archive, 0)) {
+        return false;
+    }
+    if (archive) {
+        uint32_t archive_size = 9 + prog + var->namelen + var->size;
+        address = archive_alloc(archive_size);
+        entry = mem.flash.block + address;
+        entry[0] = ARCHIVE_VALID;
+        entry[1] = (archive_size - 3);
+        entry[2] = (archive_size - 3) >> 8;
+        entry[3] = var->type1;
+        entry[4] = var->type2;
+        entry[5] = var->version;
+        entry[6] = address;
+        entry[7] = address >> 8;
+        entry[8] = address >> 16;
+        entry += 9;
+        if (prog) {
+            *entry++ = var->namelen;
+        }
+        memcpy(entry, var->name, var->namelen);
+        memcpy(entry + var->namelen, data, var->size);
+        var->data = entry + var->namelen;
+        mem_flash_touched(address, archive_size);
+    } else {
+        /* New data goes at the end of the user variables, before any temporaries */
+        address = get_ptr(VAT_TEMPMEM);
+        insert_mem(address, var->size);
+        memcpy(var->data = ram_ptr(address), data, var->size);
+    }
+
+    insert_entry(top, entry_size, !prog);
+    entry = ram_ptr(top);
+    *entry-- = var->type1;
+    *entry-- = var->type2;
+    *entry-- = var->version;
+    *entry-- = address;
+    *entry-- = address >> 8;
+    *entry-- = address >> 16;
+    if (prog) {
+        *entry-- = var->namelen;
+    }
+    for (i = 0; i < var->namelen; i++) {
+        *entry-- = var->name[i];
+    }
+    var->vat = entry;
+    var->archived = archive;
+    return true;
+}
+
+static bool is_prog(calc_var_type_t type) {
+    return type == CALC_VAR_TYPE_PROG || type == CALC_VAR_TYPE_PROT_PROG;
+}
+
+/* Like _ChkFindSym, programs are found whether protected or not */
+static bool vat_find_any(const calc_var_t *target, calc_var_t *result) {
+    vat_search_init(result);
+    while (vat_search_next(result)) {
+        if ((result->type == target->type || (is_prog(result->type) && is_prog(target->type))) &&
+            result->namelen == target->namelen &&
+            !memcmp(result->name, target->name, target->namelen)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint16_t load_short(const uint8_t *ptr) {
+    return ptr[0] | ptr[1] << 8;
+}
+
+bool vat_load_file(const char *file_name, bool archive) {
+    static const uint8_t header[11] = "**TI83F*\x1A\x0A";
+    FILE *file = fopen_utf8(file_name, "rb");
+    uint8_t *buf = NULL;
+    long length;
+    uint32_t pos, end;
+    uint16_t checksum = 0;
+    bool ok = false;
+
+    if (!file) {
+        return false;
+    }
+    if (fseek(file, 0, SEEK_END) || (length = ftell(file)) < 0x37 + 2 || fseek(file, 0, SEEK_SET) ||
+        !(buf = (uint8_t*)malloc(length)) || fread(buf, 1, length, file) != (size_t)length) {
+        goto done;
+    }
+    end = 0x37 + load_short(&buf[0x35]);
+    if (memcmp(buf, header, sizeof header - 1) || end + 2 > (uint32_t)length) {
+        goto done;
+    }
+    for (pos = 0x37; pos < end; pos++) {
+        checksum += buf[pos];
+    }
+    if (checksum != load_short(&buf[end])) {
+        goto done;
+    }
+
+    for (pos = 0x37; pos < end;) {
+        calc_var_t var, old;
+        uint32_t freed;
+        bool found;
+        uint16_t header_size = load_short(&buf[pos]);
+        const uint8_t *entry = &buf[pos + 2];
+        if (header_size < 11 || pos + 2 + header_size + 2 > end) {
+            goto done;
+        }
+        memset(&var, 0, sizeof var);
+        var.size = load_short(&entry[0]);
+        var.type1 = entry[2];
+        var.type = var.type1 & 0x3F;
+        memcpy(var.name, &entry[3], 8);
+        if (header_size >= 13) {
+            var.version = entry[11];
+            var.archived = entry[12] & 0x80;
+        }
+        if (pos + 2 + header_size + 2 + var.size > end) {
+            goto done;
+        }
+        if (!has_namelen(var.type)) {
+            var.namelen = 3;
+        } else {
+            for (var.namelen = 0; var.namelen < 8 && var.name[var.namelen]; var.namelen++);
+            if ((var.type == CALC_VAR_TYPE_REAL_LIST || var.type == CALC_VAR_TYPE_CPLX_LIST) && var.namelen < 3) {
+                var.namelen = 3;
+            }
+        }
+        /* Only replace the old variable once the new one is sure to fit where it's freed */
+        found = vat_find_any(&var, &old);
+        freed = found ? 6 + has_namelen(old.type) + old.namelen + (old.archived ? 0 : old.size) : 0;
+        if (!vat_fits(&var, archive && var.archived, freed)) {
+            goto done;
+        }
+        if (found) {
+            vat_delete(&old);
+        }
+        if (!vat_create(&var, &buf[pos + 2 + header_size + 2], archive && var.archived)) {
+            goto done;
+        }
+        pos += 2 + header_size + 2 + var.size;
+    }
+    ok = true;
+
+done:
+    free(buf);
+    fclose(file);
+    return ok;
+}
+
+static uint32_t vat_index_hash(uint8_t type, uint8_t namelen, const uint8_t *name) {
+    uint32_t hash = (0x811C9DC5 ^ type) * 0x01000193;
+    uint8_t i;
+    hash = (hash ^ namelen) * 0x01000193;
+    for (i = 0; i < namelen; i++) {
+        hash = (hash ^ name[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+bool vat_index_build(vat_index_t *index) {
+    calc_var_t var, *grown;
+    uint32_t capacity = 64, i, slot;
+
+    memset(index, 0, sizeof *index);
+    if (!(index->vars = (calc_var_t*)malloc(capacity * sizeof *index->vars))) {
+        return false;
+    }
+
+    vat_search_init(&var);
+    while (vat_search_next(&var)) {
+        if (index->count == capacity) {
+            if (!(grown = (calc_var_t*)realloc(index->vars, (capacity *= 2) * sizeof *index->vars))) {
+                vat_index_free(index);
+                return false;
+            }
+            index->vars = grown;
+        }
+        index->vars[index->count++] = var;
+    }
+
+    /* Open addressing at no more than half full */
+    for (index->mask = 15; index->mask < index->count * 2; index->mask = index->mask << 1 | 1);
+    if (!(index->slots = (int32_t*)malloc((index->mask + 1) * sizeof *index->slots))) {
+        vat_index_free(index);
+        return false;
+    }
+    memset(index->slots, 0xFF, (index->mask + 1) * sizeof *index->slots);
+    for (i = 0; i < index->count; i++) {
+        const calc_var_t *entry = &index->vars[i];
+        for (slot = vat_index_hash(entry->type, entry->namelen, entry->name) & index->mask;
+             index->slots[slot] >= 0; slot = (slot + 1) & index->mask);
+        index->slots[slot] = i;
+    }
+    return true;
+}
+
+const calc_var_t *vat_index_find(const vat_index_t *index, const calc_var_t *target) {
+    uint32_t slot;
+    for (slot = vat_index_hash(target->type, target->namelen, target->name) & index->mask;
+         index->slots[slot] >= 0; slot = (slot + 1) & index->mask) {
+        const calc_var_t *entry = &index->vars[index->slots[slot]];
+        if (entry->type == target->type && entry->namelen == target->namelen &&
+            !memcmp(entry->name, target->name, target->namelen)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void vat_index_free(vat_index_t *index) {
+    free(index->vars);
+    free(index->slots);
+    memset(index, 0, sizeof *index);
+}
@@ -76,6 +76,7 @@ typedef enum calc_var_type {
 } calc_var_type_t;
 
 extern const char *calc_var_type_names[0x40];
+extern const char *calc_var_type_exts[0x40];
 const char *calc_var_name_to_utf8(uint8_t name[8]);
 
 typedef struct calc_var {
@@ -89,6 +90,25 @@ void vat_search_init(calc_var_t *);
 bool vat_search_next(calc_var_t *);
 bool vat_search_find(const calc_var_t *, calc_var_t *);
 
+/* Every variable in the VAT from a single walk, hashed on type and name.
+ * Only valid until the VAT changes. */
+typedef struct vat_index {
+    calc_var_t *vars;
+    uint32_t count, mask;
+    int32_t *slots;
+} vat_index_t;
+
+bool vat_index_build(vat_index_t *index);
+const calc_var_t *vat_index_find(const vat_index_t *index, const calc_var_t *target);
+void vat_index_free(vat_index_t *index);
+
+/* Edit the VAT and user memory directly, the way _CreateVar and _DelVarArc would,
+ * without running any OS code. Archived variables go into a free spot of an
+ * archive sector that's already in use; nothing is ever garbage collected. */
+bool vat_delete(const calc_var_t *var);
+bool vat_create(calc_var_t *var, const uint8_t *data, bool archive);
+bool vat_load_file(const char *file_name, bool archive);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,57 +1,507 @@
 #include <QtWidgets>
+#include <algorithm>
+#include <cctype>
 
 #include "disasmwidget.h"
+#include "core/debug/disasm.h"
+#include "core/debug/disasmc.h"
 
-/* extraHighlights (0) = current line selection */
+/* Instructions are decoded forward from an anchor at most this far back */
+static const uint32_t anchor_reach = 0x100;
+/* Without one, from this far back, which is enough for the stream to fall in step */
+static const uint32_t resync_reach = 0x20;
+static const uint32_t address_end = 0x1000000;
 
-DisasmWidget::DisasmWidget(QWidget *p) : QPlainTextEdit(p) {
-    connect(this, &QPlainTextEdit::cursorPositionChanged, this, &DisasmWidget::highlightCurrentLine);
+static QString hexAddress(uint32_t address) {
+    return QString("%1").arg(address, 6, 16, QLatin1Char('0')).toUpper();
 }
 
-void DisasmWidget::clearAllHighlights() {
-    while (!extraHighlights.isEmpty()) {
-        extraHighlights.removeFirst();
+DisasmWidget::DisasmWidget(QWidget *p) : QAbstractScrollArea(p) {
+    top = { 0, false };
+    label_count = ~static_cast<size_t>(0);
+    selected = 0;
+    pc = target = ~0u;
+    adl = true;
+    data_column = true;
+    rows_end = 0;
+
+    setFocusPolicy(Qt::StrongFocus);
+    verticalScrollBar()->setRange(0, address_end - 1);
+    connect(verticalScrollBar(), &QAbstractSlider::actionTriggered, this, &DisasmWidget::scrollAction);
+    connect(verticalScrollBar(), &QAbstractSlider::valueChanged, this, &DisasmWidget::scrollValue);
+    updateMetrics();
+}
+
+void DisasmWidget::setAdl(bool mode) {
+    if (adl != mode) {
+        adl = mode;
+        viewport()->update();
     }
+}
 
-    extraHighlights.clear();
-    updateAllHighlights();
+void DisasmWidget::setDataColumn(bool show) {
+    if (data_column != show) {
+        data_column = show;
+        updateMetrics();
+    }
 }
 
-void DisasmWidget::updateAllHighlights() {
-    setExtraSelections(extraHighlights);
+void DisasmWidget::gotoAddress(uint32_t address) {
+    address &= address_end - 1;
+    anchors.clear();
+    anchors.insert(target = address);
+    if (pc < address_end) {
+        anchors.insert(pc);
+    }
+    selected = address;
+    updateLabels();
+
+    top = { address, hasLabel(address) };
+    scrollRows(-(fullRows() / 2));
+    verticalScrollBar()->setValue(top.address);
+}
+
+void DisasmWidget::setPC(uint32_t address) {
+    uint32_t old = pc;
+    bool relayout = false;
+    int row;
+
+    pc = address & (address_end - 1);
+    /* Only the current PC is kept as an anchor, every PC visited would split rows for good */
+    if (old != pc && old != target && anchors.erase(old)) {
+        relayout = rowOf(old) >= 0;
+    }
+    anchors.insert(pc);
+
+    /* A new anchor in the middle of a row on screen splits it, everything after moves, and
+     * dropping the old one may join rows again */
+    row = rowOf(pc);
+    if (relayout || (row >= 0 && rows[row].address != pc)) {
+        viewport()->update();
+    } else {
+        updateRow(old);
+        updateRow(pc);
+    }
+}
+
+void DisasmWidget::followPC(uint32_t address) {
+    int row;
+
+    setPC(address);
+    row = rowOf(pc);
+    if (row < 0 || rows[row].address != pc || row >= fullRows() - 1) {
+        gotoAddress(pc);
+    } else {
+        select(pc);
+    }
+}
+
+void DisasmWidget::refresh() {
+    label_count = ~static_cast<size_t>(0);
+    viewport()->update();
 }
 
 QString DisasmWidget::getSelectedAddress() {
-  QTextCursor c = textCursor();
-  c.movePosition(QTextCursor::StartOfLine, QTextCursor::MoveAnchor);
-  c.setPosition(c.position()+3, QTextCursor::MoveAnchor); // +3 == 3 debug symbols
-  c.setPosition(c.position()+6, QTextCursor::KeepAnchor); // +6 == size of the address
-                                                          // See MainWindow::drawNextDisassembleLine() for details
-  return c.selectedText();
+    return hexAddress(selected);
 }
 
-void DisasmWidget::addHighlight(QColor color) {
-    QTextEdit::ExtraSelection selection;
+void DisasmWidget::select(uint32_t address) {
+    uint32_t old = selected;
+    selected = address;
+    updateRow(old);
+    updateRow(selected);
+}
+
+/* ================================================ */
+/* Row index                                        */
+/* ================================================ */
 
-    selection.format.setBackground(color);
-    selection.format.setProperty(QTextFormat::FullWidthSelection, true);
-    selection.cursor = textCursor();
-    selection.cursor.movePosition(QTextCursor::StartOfLine);
+void DisasmWidget::updateLabels() {
+    if (disasm.address_map.size() == label_count) {
+        return;
+    }
+    label_count = disasm.address_map.size();
+    labels.clear();
+    labels.reserve(label_count);
+    for (const auto &item : disasm.address_map) {
+        if (item.first < address_end) {
+            labels.push_back(item.first);
+        }
+    }
+    std::sort(labels.begin(), labels.end());
+}
 
-    extraHighlights.append(selection);
+bool DisasmWidget::hasLabel(uint32_t address) const {
+    return std::binary_search(labels.begin(), labels.end(), address);
 }
 
-void DisasmWidget::cursorState(bool moveable) {
-    cursor_state = moveable;
-    if (moveable) {
-        addHighlight(QColor(Qt::yellow).lighter(160));
+uint32_t DisasmWidget::nextAnchor(uint32_t address) const {
+    uint32_t next = address_end;
+    auto anchor = anchors.upper_bound(address);
+    auto label = std::upper_bound(labels.begin(), labels.end(), address);
+
+    if (anchor != anchors.end()) {
+        next = std::min(next, *anchor);
+    }
+    if (label != labels.end()) {
+        next = std::min(next, *label);
     }
+    if (top.address > address) {
+        next = std::min(next, top.address);
+    }
+    return next;
 }
 
-void DisasmWidget::highlightCurrentLine() {
-    if(cursor_state == true) {
-        extraHighlights.removeLast();
-        addHighlight(QColor(Qt::yellow).lighter(160));
-        updateAllHighlights();
+/* Returns ~0 when there is none */
+uint32_t DisasmWidget::previousAnchor(uint32_t address) const {
+    uint32_t previous = ~0u;
+    auto anchor = anchors.upper_bound(address);
+    auto label = std::upper_bound(labels.begin(), labels.end(), address);
+
+    if (anchor != anchors.begin()) {
+        previous = *--anchor;
+    }
+    if (label != labels.begin() && (previous == ~0u || *(label - 1) > previous)) {
+        previous = *(label - 1);
+    }
+    if (top.address <= address && (previous == ~0u || top.address > previous)) {
+        previous = top.address;
+    }
+    return previous;
+}
+
+/* Start of the row after the one at address. Rows are cut short at anchors, so every anchor starts one. */
+uint32_t DisasmWidget::nextInstruction(uint32_t address) {
+    disasm_record_t record;
+    uint32_t next, anchor;
+
+    disasm_fetch(&record, address, adl);
+    next = address + record.size;
+    anchor = nextAnchor(address);
+    return next < anchor ? next : anchor;
+}
+
+/* Start of the row holding address */
+uint32_t DisasmWidget::instructionAt(uint32_t address) {
+    uint32_t start = previousAnchor(address), next;
+
+    if (start > address || address - start > anchor_reach) {
+        start = address > resync_reach ? address - resync_reach : 0;
+    }
+    while ((next = nextInstruction(start)) <= address) {
+        start = next;
+    }
+    return start;
+}
+
+DisasmWidget::Row DisasmWidget::nextRow(Row row) {
+    uint32_t next;
+
+    if (row.label) {
+        return { row.address, false };
+    }
+    next = nextInstruction(row.address);
+    if (next >= address_end) {
+        return row;
+    }
+    return { next, hasLabel(next) };
+}
+
+DisasmWidget::Row DisasmWidget::previousRow(Row row) {
+    if (!row.label && hasLabel(row.address)) {
+        return { row.address, true };
+    }
+    if (!row.address) {
+        return row;
+    }
+    return { instructionAt(row.address - 1), false };
+}
+
+void DisasmWidget::layoutRows() {
+    int count = viewport()->height() / char_height + 1;
+    Row row = top;
+
+    updateLabels();
+    rows.clear();
+    rows_end = address_end;
+    while (count--) {
+        Row next = nextRow(row);
+        rows.push_back(row);
+        if (next.address == row.address && next.label == row.label) {
+            break;
+        }
+        row = next;
+        rows_end = row.address;
+    }
+}
+
+/* Index of the instruction row holding address, -1 when it isn't on screen */
+int DisasmWidget::rowOf(uint32_t address) const {
+    int row = -1;
+
+    if (address >= rows_end) {
+        return -1;
+    }
+    for (size_t i = 0; i < rows.size() && rows[i].address <= address; i++) {
+        if (!rows[i].label) {
+            row = i;
+        }
+    }
+    return row;
+}
+
+void DisasmWidget::updateRow(uint32_t address) {
+    int row = rowOf(address);
+
+    if (row >= 0) {
+        viewport()->update(0, row * char_height, viewport()->width(), char_height);
+    }
+}
+
+int DisasmWidget::fullRows() const {
+    return std::max(1, viewport()->height() / char_height);
+}
+
+/* ================================================ */
+/* Scrolling                                        */
+/* ================================================ */
+
+void DisasmWidget::scrollRows(int count) {
+    for (; count > 0; count--) {
+        top = nextRow(top);
+    }
+    for (; count < 0; count++) {
+        top = previousRow(top);
+    }
+    layoutRows();
+    viewport()->update();
+}
+
+/* The scroll bar position is the address of the top row, steps go by rows rather than bytes */
+void DisasmWidget::scrollAction(int action) {
+    switch (action) {
+        case QAbstractSlider::SliderSingleStepAdd:
+            scrollRows(1);
+            break;
+        case QAbstractSlider::SliderSingleStepSub:
+            scrollRows(-1);
+            break;
+        case QAbstractSlider::SliderPageStepAdd:
+            scrollRows(fullRows() - 1);
+            break;
+        case QAbstractSlider::SliderPageStepSub:
+            scrollRows(1 - fullRows());
+            break;
+        default:
+            return;
+    }
+    verticalScrollBar()->setSliderPosition(top.address);
+}
+
+/* Dragging lands anywhere, find the instruction there */
+void DisasmWidget::scrollValue(int value) {
+    uint32_t address = static_cast<uint32_t>(value);
+
+    if (address != top.address) {
+        top = { instructionAt(address), false };
+        top.label = hasLabel(top.address);
+        layoutRows();
+        viewport()->update();
+    }
+}
+
+void DisasmWidget::scrollContentsBy(int, int) {
+    viewport()->update();
+}
+
+void DisasmWidget::wheelEvent(QWheelEvent *event) {
+    int count = -event->angleDelta().y() / 40;
+
+    if (count) {
+        scrollRows(count);
+        verticalScrollBar()->setValue(top.address);
+    }
+    event->accept();
+}
+
+void DisasmWidget::keyPressEvent(QKeyEvent *event) {
+    Row row;
+
+    switch (event->key()) {
+        case Qt::Key_Up:
+            row = previousRow({ selected, false });
+            if (row.label) {
+                row = previousRow(row);
+            }
+            select(row.address);
+            if (rowOf(selected) <= 0) {
+                top = { selected, hasLabel(selected) };
+                layoutRows();
+                verticalScrollBar()->setValue(top.address);
+            }
+            break;
+        case Qt::Key_Down:
+            row = nextRow({ selected, false });
+            if (row.label) {
+                row = nextRow(row);
+            }
+            select(row.address);
+            for (int i = 0; i < 2 && (rowOf(selected) < 0 || rowOf(selected) >= fullRows()); i++) {
+                scrollRows(1);
+            }
+            verticalScrollBar()->setValue(top.address);
+            break;
+        case Qt::Key_PageUp:
+            scrollRows(1 - fullRows());
+            verticalScrollBar()->setValue(top.address);
+            break;
+        case Qt::Key_PageDown:
+            scrollRows(fullRows() - 1);
+            verticalScrollBar()->setValue(top.address);
+            break;
+        default:
+            QAbstractScrollArea::keyPressEvent(event);
+            break;
+    }
+}
+
+void DisasmWidget::mousePressEvent(QMouseEvent *event) {
+    size_t row = event->pos().y() / char_height;
+
+    if (row < rows.size()) {
+        select(rows[row].address);
+    }
+    QAbstractScrollArea::mousePressEvent(event);
+}
+
+/* ================================================ */
+/* Painting                                         */
+/* ================================================ */
+
+void DisasmWidget::updateMetrics() {
+    /* Symbols, address, gap, data, gap, instruction */
+    int columns = 3 + 6 + 4 + (data_column ? 12 : 0) + 2 + 32;
+
+    char_width = fontMetrics().width(QLatin1Char('D'));
+    char_height = std::max(1, fontMetrics().height());
+    char_ascent = fontMetrics().ascent();
+    horizontalScrollBar()->setRange(0, std::max(0, columns * char_width - viewport()->width()));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    verticalScrollBar()->setPageStep(fullRows());
+    viewport()->update();
+}
+
+void DisasmWidget::changeEvent(QEvent *event) {
+    if (event->type() == QEvent::FontChange) {
+        updateMetrics();
+    }
+    QAbstractScrollArea::changeEvent(event);
+}
+
+void DisasmWidget::resizeEvent(QResizeEvent *event) {
+    QAbstractScrollArea::resizeEvent(event);
+    updateMetrics();
+}
+
+/* Hex numbers, parentheses and a leading decimal digit get their own color */
+static void drawArguments(QPainter &painter, int x, int y, int char_width, const QString &arguments) {
+    const QColor text = painter.pen().color();
+    int hex = 0;
+
+    for (int i = 0; i < arguments.size(); i++) {
+        QChar c = arguments.at(i);
+        QColor color = text;
+
+        if (c == QLatin1Char('$')) {
+            hex = 1;
+        } else if (hex && !isxdigit(c.toLatin1())) {
+            hex = 0;
+        }
+        if (hex) {
+            color = QColor(Qt::darkGreen);
+        } else if (c == QLatin1Char('(') || c == QLatin1Char(')')) {
+            color = QColor(0x66, 0, 0);
+        } else if (!i && c.isDigit()) {
+            color = QColor(Qt::blue);
+        }
+        painter.setPen(color);
+        painter.drawText(x + i * char_width, y, QString(c));
+    }
+    painter.setPen(text);
+}
+
+void DisasmWidget::paintEvent(QPaintEvent *event) {
+    static const QColor symbol_colors[3] = { QColor(0xA3, 0xFF, 0xA3), QColor(0xA3, 0xA3, 0xFF), QColor(0xFF, 0xA3, 0xA3) };
+    const QColor address_color(0x44, 0x44, 0x44);
+    const QColor text_color = viewport()->palette().color(QPalette::Text);
+    const int address_x = 3 * char_width;
+    const int data_x = address_x + 10 * char_width;
+    const int mnemonic_x = data_x + ((data_column ? 12 : 0) + 2) * char_width;
+    const int width = viewport()->width() + horizontalScrollBar()->value();
+    QPainter painter(viewport());
+    QFont normal = font(), bold = font();
+    int selected_row;
+
+    bold.setBold(true);
+    layoutRows();
+    selected_row = rowOf(selected);
+    disasm.adl = adl;
+    painter.translate(-horizontalScrollBar()->value(), 0);
+
+    for (size_t i = 0; i < rows.size(); i++) {
+        const Row &row = rows[i];
+        const int y = i * char_height, baseline = y + char_ascent;
+        bool flags[3];
+
+        if (!event->rect().intersects(QRect(0, y, viewport()->width(), char_height))) {
+            continue;
+        }
+
+        if (row.label) {
+            addressMap_t::const_iterator item = disasm.address_map.find(row.address);
+            painter.setFont(bold);
+            painter.setPen(address_color);
+            painter.drawText(address_x, baseline, hexAddress(row.address));
+            painter.setFont(normal);
+            painter.setPen(text_color);
+            if (item != disasm.address_map.end()) {
+                painter.drawText(data_x, baseline, QString::fromStdString(item->second) + QLatin1Char(':'));
+            }
+            continue;
+        }
+
+        disasm.base_address = row.address;
+        disassembleInstruction();
+
+        if (static_cast<int>(i) == selected_row) {
+            painter.fillRect(0, y, width, char_height, QColor(Qt::yellow).lighter(160));
+        } else if (disasmHighlight.hit_pc) {
+            painter.fillRect(0, y, width, char_height, QColor(Qt::red).lighter(160));
+        }
+        painter.setFont(bold);
+        painter.setPen(address_color);
+        painter.drawText(address_x, baseline, hexAddress(row.address));
+
+        flags[0] = disasmHighlight.hit_read_breakpoint;
+        flags[1] = disasmHighlight.hit_write_breakpoint;
+        flags[2] = disasmHighlight.hit_exec_breakpoint;
+        painter.setFont(normal);
+        for (int j = 0; j < 3; j++) {
+            if (flags[j]) {
+                painter.setPen(symbol_colors[j]);
+                painter.drawText(j * char_width, baseline, QString(QChar(0x25CF)));
+            }
+        }
+
+        painter.setPen(text_color);
+        if (data_column) {
+            painter.drawText(data_x, baseline, QString::fromStdString(disasm.instruction.data));
+        }
+        QString mnemonic = QString::fromStdString(disasm.instruction.opcode + disasm.instruction.mode_suffix);
+        painter.setPen(QColor(Qt::darkBlue));
+        painter.drawText(mnemonic_x, baseline, mnemonic);
+        painter.setPen(text_color);
+        drawArguments(painter, mnemonic_x + mnemonic.size() * char_width, baseline, char_width,
+                      QString::fromStdString(disasm.instruction.arguments));
     }
 }
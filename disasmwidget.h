@@ -1,34 +1,73 @@
-#ifndef CODEEDITOR_H
-#define CODEEDITOR_H
+#ifndef DISASMWIDGET_H
+#define DISASMWIDGET_H
 
-#include <QPlainTextEdit>
-#include <QObject>
+#include <QtWidgets/QAbstractScrollArea>
+#include <set>
+#include <vector>
+#include <stdint.h>
 
-QT_BEGIN_NAMESPACE
-class QPaintEvent;
-class QResizeEvent;
-class QSize;
-class QWidget;
-QT_END_NAMESPACE
-
-class DisasmWidget : public QPlainTextEdit
-{
+/* Disassembly of the whole 24 bit address space. Only the rows on screen are decoded,
+ * each time they are painted. Instructions have no fixed alignment, so rows are found by
+ * decoding forward from anchors: the goto target, the PC, labels and the top row. */
+class DisasmWidget : public QAbstractScrollArea {
     Q_OBJECT
 
 public:
     DisasmWidget(QWidget *parent = 0);
-    void clearAllHighlights();
-    void updateAllHighlights();
-    void addHighlight(QColor);
-    void cursorState(bool movable);
+
+    void setAdl(bool adl);
+    void setDataColumn(bool show);
+    void gotoAddress(uint32_t address);     /* Selects address and centers it */
+    void setPC(uint32_t pc);                /* Repaints the old and new PC rows, or all if rows moved */
+    void followPC(uint32_t pc);             /* Like setPC, also selects it and scrolls to it if needed */
+    void refresh();                         /* Memory, equates or breakpoints changed */
     QString getSelectedAddress();
 
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void changeEvent(QEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void keyPressEvent(QKeyEvent *event);
+    void wheelEvent(QWheelEvent *event);
+    void scrollContentsBy(int dx, int dy);
+
 private:
-    void highlightCurrentLine();
+    struct Row {
+        uint32_t address;
+        bool label;                         /* The equate line above the instruction at address */
+    };
 
-    bool cursor_state = false;
-    QList<QTextEdit::ExtraSelection> extraHighlights;
-};
+    void scrollAction(int action);
+    void scrollValue(int value);
+    void scrollRows(int count);
+    void select(uint32_t address);
+    void updateMetrics();
+    int fullRows() const;
+    void layoutRows();
+    int rowOf(uint32_t address) const;
+    void updateRow(uint32_t address);
+    void updateLabels();
+
+    /* Row index */
+    bool hasLabel(uint32_t address) const;
+    uint32_t nextAnchor(uint32_t address) const;
+    uint32_t previousAnchor(uint32_t address) const;
+    uint32_t nextInstruction(uint32_t address);
+    uint32_t instructionAt(uint32_t address);
+    Row nextRow(Row row);
+    Row previousRow(Row row);
 
+    Row top;
+    std::vector<Row> rows;                  /* Rows on screen as last laid out */
+    uint32_t rows_end;                      /* Address after the last of them */
+    std::set<uint32_t> anchors;
+    std::vector<uint32_t> labels;           /* Sorted keys of disasm.address_map */
+    size_t label_count;
+    uint32_t selected, pc;
+    uint32_t target;                        /* Of the last goto, anchored along with the PC */
+    bool adl, data_column;
+    int char_width, char_height, char_ascent;
+};
 
 #endif
@@ -6,6 +6,7 @@
 #include <iostream>
 #include "core/asic.h"
 #include "core/emu.h"
+#include "core/lcdframe.h"
 #include "core/debug/debug.h"
 
 extern "C" {
@@ -68,19 +69,15 @@ void gui_debugger_entered_or_left(bool entered)
 
 void getScreenshot(void)
 {
-    uint16_t *framebuffer = reinterpret_cast<uint16_t*>(malloc(320 * 240 * 2));
-    uint32_t bitfields[] = { 0x01F, 0x000, 0x000 };
+    const uint32_t *framebuffer = lcd_frame_acquire()->pixels;
 
-    lcd_drawframe(framebuffer, bitfields);
-
-    char buf[5] = {0};
-    for (uint32_t i = 0; i < 320 * 240 * 2; i++)
+    char buf[7] = {0};
+    for (uint32_t i = 0; i < 320 * 240; i++)
     {
-        sprintf(buf, "%04X", framebuffer[i]);
+        sprintf(buf, "%06X", framebuffer[i] & 0xFFFFFF);
         std::cerr << buf << "\t";
     }
     std::cerr << std::endl;
-    free(framebuffer);
 }
 
 int main(int argc, char* argv[])
@@ -17,9 +17,10 @@
 
 #include "lcdwidget.h"
 #include "qtframebuffer.h"
+#include "core/lcdframe.h"
 
 LCDWidget::LCDWidget(QWidget *p) : QWidget(p) {
-    connect(&refresh_timer, SIGNAL(timeout()), this, SLOT(repaint()));
+    connect(&refresh_timer, &QTimer::timeout, this, &LCDWidget::refresh);
     connect(this, &QWidget::customContextMenuRequested, this, &LCDWidget::drawContext);
 
     setMaximumWidth(320*2);
@@ -69,6 +70,18 @@ void LCDWidget::paintEvent(QPaintEvent */*event*/) {
     paintFramebuffer(&painter);
 }
 
+void LCDWidget::refresh() {
+    unsigned int top, bottom;
+    lcd_frame_acquire_dirty(&top, &bottom);
+
+    // Only repaint the scanlines that actually changed
+    if (top != bottom) {
+        int y0 = top * height() / 240;
+        int y1 = (bottom * height() + 239) / 240;
+        repaint(0, y0, width(), y1 - y0);
+    }
+}
+
 void LCDWidget::refreshRate(int newrate) {
     // Change fps to fit cpu load
     refresh_timer.stop();
@@ -26,6 +26,7 @@ class LCDWidget : public QWidget
 
   private:
       void drawContext(const QPoint& posa);
+      void refresh();
 
       bool state_set = false;
       QTimer refresh_timer;
@@ -1,8 +1,20 @@
 #include <QtWidgets/QApplication>
 #include <QtQml/QtQml>
+#include <QtCore/QCommandLineParser>
 
 #include "mainwindow.h"
 #include "qmlbridge.h"
+#include "core/emu.h"
+#include "core/mem.h"
+#include "core/flashimage.h"
+#include "core/input.h"
+#include "core/link.h"
+#include "core/script.h"
+#include "core/usb.h"
+#include "core/capture/video.h"
+#include "core/debug/disasmcache.h"
+#include "core/debug/profile.h"
+#include "core/debug/timeline.h"
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
@@ -14,8 +26,124 @@ int main(int argc, char *argv[]) {
     // Register QMLBridge for Keypad<->Emu communication
     qmlRegisterSingletonType<QMLBridge>("CE.emu", 1, 0, "Emu", qmlBridgeFactory);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption videoOption("video", "Stream every LCD frame to <file> (or a named pipe).", "file");
+    QCommandLineOption videoFormatOption("video-format", "Format of --video: y4m (default) or rgb24.", "format", "y4m");
+    QCommandLineOption videoShmOption("video-shm", "Publish every LCD frame into the shared memory ring <name>.", "name");
+    parser.addOption(videoOption);
+    parser.addOption(videoFormatOption);
+    parser.addOption(videoShmOption);
+    QCommandLineOption deterministicOption("deterministic", "Run reproducibly: unthrottled, with the clock derived from emulated time only.");
+    QCommandLineOption epochOption("epoch", "Clock start in deterministic mode, as Unix time.", "seconds");
+    QCommandLineOption cyclesOption("cycles", "Stop emulation after <count> CPU cycles and print a hash of RAM.", "count");
+    parser.addOption(deterministicOption);
+    parser.addOption(epochOption);
+    parser.addOption(cyclesOption);
+    QCommandLineOption profileOption("profile", "Count accesses per port and 4K page, and write them to <file> on exit, as JSON if it ends in .json, else CSV.", "file");
+    parser.addOption(profileOption);
+    QCommandLineOption timelineOption("timeline", "Record scheduler events, interrupts and throttle sleeps to <file> as a Chrome trace (chrome://tracing, Perfetto).", "file");
+    parser.addOption(timelineOption);
+    QCommandLineOption recordInputOption("record-input", "Reset and journal all input to <file>.", "file");
+    QCommandLineOption replayInputOption("replay-input", "Reset and replay the input journal <file>, unthrottled.", "file");
+    parser.addOption(recordInputOption);
+    parser.addOption(replayInputOption);
+    QCommandLineOption scriptOption("script", "Run the key script <file> once the emulator is up.", "file");
+    parser.addOption(scriptOption);
+    QCommandLineOption linkModeOption("link-mode", "How variables are sent: os (default), direct to write the VAT without running OS code, or verify to do both and compare.", "mode", "os");
+    parser.addOption(linkModeOption);
+    QCommandLineOption usbSocketOption("usb-socket", "Plug the calculator into a virtual host that relays raw DUSB packets over the Unix socket <path>.", "path");
+    parser.addOption(usbSocketOption);
+    QCommandLineOption romMappingOption("rom-mapping", "How flash is backed by the ROM image: private (default, mapped, changes are discarded), shared (mapped, changes are written back to the image) or copy (read into memory).", "mode", "private");
+    parser.addOption(romMappingOption);
+    QCommandLineOption convertRomOption("convert-rom", "Convert the ROM image <file> between raw and sparse, writing it to the output path given as argument, then exit.", "file");
+    parser.addOption(convertRomOption);
+    parser.addPositionalArgument("output", "Output path for --convert-rom.");
+    parser.process(app);
+
+    if (parser.isSet(convertRomOption)) {
+        if (parser.positionalArguments().isEmpty()) {
+            qWarning("--convert-rom needs an output path");
+            return 1;
+        }
+        QString output = parser.positionalArguments().first();
+        if (!flash_image_convert(parser.value(convertRomOption).toUtf8().constData(), output.toUtf8().constData())) {
+            qWarning("Could not convert %s", qPrintable(parser.value(convertRomOption)));
+            return 1;
+        }
+        return 0;
+    }
+
+    deterministic_mode = turbo_mode = parser.isSet(deterministicOption);
+    if (parser.isSet(epochOption)) {
+        deterministic_epoch = parser.value(epochOption).toLongLong();
+    }
+    cycle_budget = parser.value(cyclesOption).toULongLong();
+    if (parser.value(romMappingOption) == "shared") {
+        rom_backing = FLASH_MAP_SHARED;
+    } else if (parser.value(romMappingOption) == "copy") {
+        rom_backing = FLASH_COPY;
+    }
+    if (parser.value(linkModeOption) == "direct") {
+        link_mode = LINK_DIRECT;
+    } else if (parser.value(linkModeOption) == "verify") {
+        link_mode = LINK_VERIFY;
+    }
+
+    if (parser.isSet(usbSocketOption) && !usb_host_listen(parser.value(usbSocketOption).toUtf8().constData())) {
+        qWarning("Could not listen on %s", qPrintable(parser.value(usbSocketOption)));
+    }
+
     MainWindow EmuWin;
+
+    if (parser.isSet(videoOption)) {
+        video_format_t format = parser.value(videoFormatOption) == "rgb24" ? VIDEO_RGB24 : VIDEO_Y4M;
+        if (!video_start_stream(parser.value(videoOption).toUtf8().constData(), format)) {
+            qWarning("Could not open %s for streaming video", qPrintable(parser.value(videoOption)));
+        }
+    } else if (parser.isSet(videoShmOption)) {
+        if (!video_start_shm(parser.value(videoShmOption).toUtf8().constData(), 4)) {
+            qWarning("Could not create shared memory %s", qPrintable(parser.value(videoShmOption)));
+        }
+    }
+
+    if (parser.isSet(recordInputOption) && !input_record_start(parser.value(recordInputOption).toUtf8().constData())) {
+        qWarning("Could not record input to %s", qPrintable(parser.value(recordInputOption)));
+    }
+    if (parser.isSet(replayInputOption) && !input_replay_start(parser.value(replayInputOption).toUtf8().constData())) {
+        qWarning("Could not replay input from %s", qPrintable(parser.value(replayInputOption)));
+    }
+
+    if (parser.isSet(profileOption)) {
+        profile_set(true);
+    }
+    if (parser.isSet(timelineOption)) {
+        if (!timeline_start(parser.value(timelineOption).toUtf8().constData())) {
+            qWarning("Could not record a timeline to %s", qPrintable(parser.value(timelineOption)));
+        }
+        EmuWin.updateTimelineAction();
+    }
+
+    if (parser.isSet(scriptOption) && !script_load(parser.value(scriptOption).toUtf8().constData())) {
+        qWarning("Could not load script %s", qPrintable(parser.value(scriptOption)));
+    }
+
     EmuWin.show();
 
-    return app.exec();
+    int ret = app.exec();
+    if (parser.isSet(profileOption)) {
+        QString profile_file = parser.value(profileOption);
+        bool json = profile_file.endsWith(".json", Qt::CaseInsensitive);
+        if (!(json ? profile_write_json : profile_write_csv)(profile_file.toUtf8().constData())) {
+            qWarning("Could not write access statistics to %s", qPrintable(profile_file));
+        }
+    }
+    if (timeline_recording && !timeline_stop()) {
+        qWarning("Could not write the timeline");
+    }
+    video_stop();
+    input_stop();
+    usb_host_close();
+    disasm_cache_stop();
+    return ret;
 }
@@ -14,15 +14,18 @@
 
 #include <QtCore/QFileInfo>
 #include <QtCore/QRegularExpression>
+#include <QtCore/QSignalBlocker>
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QDockWidget>
 #include <QtWidgets/QShortcut>
 #include <QtWidgets/QInputDialog>
+#include <QtWidgets/QScrollBar>
 #include <QtQuickWidgets/QQuickWidget>
 #include <QtGui/QFont>
 #include <QtGui/QPixmap>
 #include <fstream>
 #include <iostream>
+#include <vector>
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
@@ -34,15 +37,18 @@
 #include "keybindings.h"
 
 #include "core/schedule.h"
-#include "core/debug/disasmc.h"
 #include "core/link.h"
+#include "core/input.h"
+#include "core/lcd.h"
+#include "core/lcdframe.h"
 #include "core/capture/gif.h"
+#include "core/debug/timeline.h"
 #include "utils.h"
 #include "os/os.h"
 
 static const constexpr int WindowStateVersion = 0;
-static const int flash_size = 0x400000;
-static const uint32_t ram_size = 0x65800;
+static const int hex_line_size = 8; // BYTES_PER_LINE of QHexEdit
+static const size_t max_search_results = 0x10000;
 
 MainWindow::MainWindow(QWidget *p) : QMainWindow(p), ui(new Ui::MainWindow) {
     // Setup the UI
@@ -62,6 +68,8 @@ MainWindow::MainWindow(QWidget *p) : QMainWindow(p), ui(new Ui::MainWindow) {
     // View
     detached_lcd.setContextMenuPolicy(Qt::CustomContextMenu);
     connect(ui->actionDetached_LCD, &QAction::triggered, this, &MainWindow::popoutLCD);
+    connect(ui->actionAccess_Statistics, &QAction::triggered, this, &MainWindow::showAccessStatistics);
+    connect(ui->actionRecord_Timeline, &QAction::toggled, this, &MainWindow::recordTimeline);
     connect(&detached_lcd, &LCDWidget::closed, this, &MainWindow::popoutLCD);
     connect(&detached_lcd, &LCDWidget::lcdOpenRequested, this, &MainWindow::selectFiles);
     connect(ui->lcdWidget, &LCDWidget::lcdOpenRequested, this, &MainWindow::selectFiles);
@@ -104,6 +112,7 @@ MainWindow::MainWindow(QWidget *p) : QMainWindow(p), ui(new Ui::MainWindow) {
     connect(ui->buttonRefreshList, &QPushButton::clicked, this, &MainWindow::refreshVariableList);
     connect(this, &MainWindow::setReceiveState, &emu, &EmuThread::setReceiveState);
     connect(ui->buttonReceiveFiles, &QPushButton::clicked, this, &MainWindow::saveSelected);
+    connect(ui->buttonReceiveAll, &QPushButton::clicked, this, &MainWindow::saveAll);
 
 
     // Console actions
@@ -117,6 +126,8 @@ MainWindow::MainWindow(QWidget *p) : QMainWindow(p), ui(new Ui::MainWindow) {
     connect(ui->buttonGIF, &QPushButton::clicked, this, &MainWindow::recordGIF);
     connect(ui->actionTake_GIF_Screenshot, &QAction::triggered, this, &MainWindow::screenshotGIF);
     connect(ui->buttonGIF_Screenshot, &QPushButton::clicked, this, &MainWindow::screenshotGIF);
+    connect(ui->actionRecord_Input, &QAction::triggered, this, &MainWindow::recordInput);
+    connect(ui->actionReplay_Input, &QAction::triggered, this, &MainWindow::replayInput);
 
     // About
     connect(ui->actionAbout, &QAction::triggered, this, &MainWindow::showAbout);
@@ -139,6 +150,12 @@ MainWindow::MainWindow(QWidget *p) : QMainWindow(p), ui(new Ui::MainWindow) {
     connect(ui->buttonMemGoto, &QPushButton::clicked, this, &MainWindow::memGotoPressed);
     connect(ui->buttonMemSearch, &QPushButton::clicked, this, &MainWindow::memSearchPressed);
     connect(ui->buttonMemSync, &QPushButton::clicked, this, &MainWindow::memSyncPressed);
+    for (QHexEdit *edit : { ui->flashEdit, ui->ramEdit, ui->memEdit }) {
+        QShortcut *next = new QShortcut(QKeySequence::FindNext, edit, nullptr, nullptr, Qt::WidgetShortcut);
+        QShortcut *previous = new QShortcut(QKeySequence::FindPrevious, edit, nullptr, nullptr, Qt::WidgetShortcut);
+        connect(next, &QShortcut::activated, this, &MainWindow::searchNextPressed);
+        connect(previous, &QShortcut::activated, this, &MainWindow::searchPreviousPressed);
+    }
 
     // Set up monospace fonts
     QFont monospace = QFontDatabase::systemFont(QFontDatabase::FixedFont);
@@ -221,6 +238,36 @@ void MainWindow::popoutLCD() {
     ui->actionDetached_LCD->setChecked(detached_state);
 }
 
+void MainWindow::showAccessStatistics() {
+    if (!profile_dialog) {
+        profile_dialog = new ProfileDialog(this);
+    }
+    profile_dialog->show();
+    profile_dialog->raise();
+}
+
+void MainWindow::updateTimelineAction() {
+    QSignalBlocker blocker(ui->actionRecord_Timeline);
+    ui->actionRecord_Timeline->setChecked(timeline_recording);
+}
+
+void MainWindow::recordTimeline(bool checked) {
+    if (!checked) {
+        if (timeline_recording && !timeline_stop()) {
+            QMessageBox::warning(this, tr("Timeline"), tr("Could not write the timeline"));
+        }
+        return;
+    }
+
+    QString filename = QFileDialog::getSaveFileName(this, tr("Record Timeline"), QString(), tr("Chrome trace (*.json)"));
+    if (filename.isEmpty()) {
+        ui->actionRecord_Timeline->setChecked(false);
+    } else if (!timeline_start(filename.toUtf8().constData())) {
+        QMessageBox::warning(this, tr("Timeline"), tr("Could not write ") + filename);
+        ui->actionRecord_Timeline->setChecked(false);
+    }
+}
+
 void MainWindow::changeKeys() {
     KeyBindings keys;
     keys.show();
@@ -304,7 +351,7 @@ void MainWindow::screenshotGIF() {
 
     // TODO: Fix this and do it correctly //
     gif_start_recording(filename.toStdString().c_str(), 1);
-    gif_new_frame();
+    gif_new_frame(lcd_frame_acquire());
     if (!gif_stop_recording()) {
         QMessageBox::critical(this, tr("Screenshot failed"), tr("Failed to save screenshot!"));
     }
@@ -317,6 +364,7 @@ void MainWindow::recordGIF() {
       // TODO: Use QTemporaryFile?
       path = QDir::tempPath() + QDir::separator() + QStringLiteral("cemu_tmp.gif");
 
+        gif_set_backpressure(ui->checkGIFBlock->isChecked() ? GIF_BLOCK : GIF_DROP_FRAMES);
         gif_start_recording(path.toStdString().c_str(), ui->gif_frame_skip_slider->value());
     } else {
         if (gif_stop_recording()) {
@@ -335,6 +383,31 @@ void MainWindow::recordGIF() {
     ui->buttonGIF->setText((!path.isEmpty()) ? QString("Stop Recording") : QString("Record GIF"));
 }
 
+void MainWindow::recordInput() {
+    if (input_recording()) {
+        input_stop();
+    } else {
+        QString filename = QFileDialog::getSaveFileName(this, tr("Record Input"), QString(), tr("Input journals (*.cej)"));
+        if (!filename.isEmpty() && !input_record_start(filename.toUtf8())) {
+            QMessageBox::warning(this, tr("Failed recording input"), tr("Could not start recording to: ")+filename);
+        }
+    }
+
+    ui->actionRecord_Input->setChecked(input_recording());
+}
+
+void MainWindow::replayInput() {
+    if (input_replaying()) {
+        input_stop();
+        return;
+    }
+
+    QString filename = QFileDialog::getOpenFileName(this, tr("Replay Input"), QString(), tr("Input journals (*.cej)"));
+    if (!filename.isEmpty() && !input_replay_start(filename.toUtf8())) {
+        QMessageBox::warning(this, tr("Failed replaying input"), tr("Could not replay: ")+filename);
+    }
+}
+
 void MainWindow::clearConsole(void) {
     ui->console->clear();
     consoleStr("Console Cleared.\n");
@@ -412,14 +485,23 @@ void MainWindow::selectFiles() {
 
     QStringList fileNames = showVariableFileDialog(QFileDialog::AcceptOpen);
 
+    QList<QByteArray> utf8Names;
+    std::vector<const char *> names;
+
+    for (const QString &fileName : fileNames) {
+        utf8Names.append(fileName.toUtf8());
+    }
+    for (const QByteArray &name : utf8Names) {
+        names.push_back(name.constData());
+    }
+
     ui->sendBar->setMaximum(fileNames.size());
 
-    for (int i = 0; i < fileNames.size(); i++) {
-        if(!sendVariableLink(fileNames.at(i).toUtf8())) {
-            QMessageBox::warning(this, tr("Failed Transfer"), tr("A failure occured during transfer of: ")+fileNames.at(i));
-        }
-        ui->sendBar->setValue(ui->sendBar->value()+1);
+    /* All files go in one session, failed ones are listed in the console */
+    if (!names.empty() && !input_link_send(static_cast<int>(names.size()), names.data())) {
+        QMessageBox::warning(this, tr("Failed Transfer"), tr("A failure occured during transfer, see the console for details."));
     }
+    ui->sendBar->setValue(fileNames.size());
 
     setSendState(false);
 
@@ -443,10 +525,12 @@ void MainWindow::refreshVariableList() {
     if (in_recieving_mode) {
         ui->buttonRefreshList->setText("Refresh Emulator Variable List...");
         ui->buttonReceiveFiles->setEnabled(false);
+        ui->buttonReceiveAll->setEnabled(false);
         setReceiveState(false);
     } else {
         ui->buttonRefreshList->setText("Continue Emulation");
         ui->buttonReceiveFiles->setEnabled(true);
+        ui->buttonReceiveAll->setEnabled(true);
         setReceiveState(true);
         QThread::msleep(500);
 
@@ -489,6 +573,18 @@ void MainWindow::saveSelected() {
     }
 }
 
+void MainWindow::saveAll() {
+    QString dirName = QFileDialog::getExistingDirectory(this, tr("Save all variables to"), QDir::homePath());
+    if (!dirName.isEmpty()) {
+        int count = receiveAllVariablesLink(dirName.toUtf8());
+        if (count < 0) {
+            QMessageBox::warning(this, tr("Failed Transfer"), tr("Could not read the variable table."));
+        } else {
+            consoleStr(tr("Saved %1 variables to %2\n").arg(count).arg(dirName));
+        }
+    }
+}
+
 /* ================================================ */
 /* Debugger Things                                  */
 /* ================================================ */
@@ -555,7 +651,7 @@ void MainWindow::updateDebuggerChanges() {
 
       cpu_flush((uint32_t)hex2int(ui->pcregView->text()), ui->checkADL->isChecked());
 
-      backlight.brightness = (uint8_t)ui->brightnessSlider->value();
+      backlight_update((uint8_t)ui->brightnessSlider->value());
   }
 }
 
@@ -599,6 +695,7 @@ void MainWindow::setDebuggerState(bool state) {
     ui->buttonRefreshList->setEnabled( !debugger_on );
     ui->emuVarView->setEnabled( !debugger_on );
     ui->buttonReceiveFiles->setEnabled( !debugger_on && in_recieving_mode);
+    ui->buttonReceiveAll->setEnabled( !debugger_on && in_recieving_mode);
 
     if (!debugger_on) {
         updateDebuggerChanges();
@@ -672,35 +769,21 @@ void MainWindow::populateDebugWindow() {
     memUpdate();
 }
 
-void MainWindow::updateDisasmView(const int sentBase, const bool fromPane) {
-    address_pane = sentBase;
-    from_pane = fromPane;
-    disasm_offset_set = false;
-    disasm.adl = ui->checkADL->isChecked();
-    disasm.base_address = -1;
-    disasm.new_address = address_pane - ((fromPane) ? 0x80 : 0);
-    if(disasm.new_address < 0) disasm.new_address = 0;
-
-    ui->disassemblyView->clear();
-    ui->disassemblyView->clearAllHighlights();
-
-    ui->disassemblyView->cursorState(false);
-
-    for(int i=0; i<0x80; i++) {
-        drawNextDisassembleLine();
-        if (disasm.new_address > 0xFFFFFF) break;
-    }
-
-    ui->disassemblyView->cursorState(true);
-
-    ui->disassemblyView->updateAllHighlights();
-
+void MainWindow::prepareDisasmView() {
     QFont disasmFont = ui->disassemblyView->font();
-    disasmFont.setPointSize(ui->textSizeSlider->value());
-    ui->disassemblyView->setFont(disasmFont);
+    if (disasmFont.pointSize() != ui->textSizeSlider->value()) {
+        disasmFont.setPointSize(ui->textSizeSlider->value());
+        ui->disassemblyView->setFont(disasmFont);
+    }
+    ui->disassemblyView->setAdl(ui->checkADL->isChecked());
+    ui->disassemblyView->setDataColumn(ui->checkDataCol->isChecked());
+}
 
-    ui->disassemblyView->setTextCursor(disasm_offset);
-    ui->disassemblyView->centerCursor();
+void MainWindow::updateDisasmView(const int sentBase) {
+    address_pane = sentBase;
+    prepareDisasmView();
+    ui->disassemblyView->setPC(cpu.registers.PC);
+    ui->disassemblyView->gotoAddress(address_pane);
 }
 
 void MainWindow::portMonitorCheckboxToggled(QTableWidgetItem * item) {
@@ -723,9 +806,9 @@ void MainWindow::portMonitorCheckboxToggled(QTableWidgetItem * item) {
             value = DBG_PORT_FREEZE;
         }
         if (item->checkState() != Qt::Checked) {
-            mem.debug.ports[port] &= ~value;
+            debug_port_set(port, mem.debug.ports[port] & ~value);
         } else {
-            mem.debug.ports[port] |= value;
+            debug_port_set(port, mem.debug.ports[port] | value);
         }
     }
 }
@@ -787,20 +870,65 @@ void MainWindow::deletePort() {
     const int currentRow = ui->portView->currentRow();
 
     uint16_t port = (uint16_t)ui->portView->item(currentRow, 0)->text().toInt(nullptr,16);
-    mem.debug.ports[port] = DBG_NO_HANDLE;
+    debug_port_set(port, DBG_NO_HANDLE);
 
     ui->portView->removeRow(currentRow);
 }
 
+/* Breakpoint rows hold an address, or START-END for a watch range over [START, END) */
+static bool parseWatchRange(const QString &text, uint32_t *start, uint32_t *end) {
+    QStringList parts = text.split(QLatin1Char('-'));
+    bool ok_start, ok_end;
+
+    if (parts.size() != 2) {
+        return false;
+    }
+    *start = parts.at(0).toUInt(&ok_start, 16);
+    *end = parts.at(1).toUInt(&ok_end, 16);
+    return ok_start && ok_end && *start < *end && *end <= 0x1000000;
+}
+
+uint8_t MainWindow::breakpointFlags(int row) {
+    static const uint8_t flags[] = { DBG_READ_BREAKPOINT, DBG_WRITE_BREAKPOINT, DBG_EXEC_BREAKPOINT };
+    uint8_t value = DBG_NO_HANDLE;
+
+    for (int col = 1; col <= 3; col++) {
+        QTableWidgetItem *item = ui->breakpointView->item(row, col);
+        if (item && item->checkState() == Qt::Checked) {
+            value |= flags[col - 1];
+        }
+    }
+    return value;
+}
+
 void MainWindow::breakpointCheckboxToggled(QTableWidgetItem * item) {
     auto col = item->column();
     auto row = item->row();
     uint8_t value = DBG_NO_HANDLE;
+    uint32_t start, end;
+
+    if (parseWatchRange(ui->breakpointView->item(row, 0)->text(), &start, &end)) {
+        debug_watch_set(start, end, breakpointFlags(row));
+        return;
+    }
 
     uint32_t address = (uint32_t)ui->breakpointView->item(row, 0)->text().toInt(nullptr,16)&0xFFFFFF;
 
+    // Condition, compiled as edited; the compiled one is kept in UserRole and put back on error
+    if (col == 4) {
+        QString condition = item->text().trimmed();
+        if (condition != item->data(Qt::UserRole).toString()) {
+            QSignalBlocker blocker(ui->breakpointView);
+            if (setBreakpointCondition(address, condition)) {
+                item->setData(Qt::UserRole, condition);
+            }
+            item->setText(item->data(Qt::UserRole).toString());
+        }
+        return;
+    }
+
     // Handle R_Break, W_Break, and E_Break
-    if (col > 0)
+    if (col > 0 && col <= 3)
     {
         if (col == 1) { // Break on read
             value = DBG_READ_BREAKPOINT;
@@ -818,50 +946,99 @@ void MainWindow::breakpointCheckboxToggled(QTableWidgetItem * item) {
         }
     }
 
-    updateDisasmView(address, true);
+    updateDisasmView(address);
+}
+
+bool MainWindow::setBreakpointCondition(uint32_t address, const QString &condition) {
+    std::string error;
+
+    if (!debug_condition_set(address, condition.toStdString(), &error)) {
+        QMessageBox::warning(this, tr("Invalid condition"), QString::fromStdString(error));
+        return false;
+    }
+    return true;
 }
 
 bool MainWindow::addBreakpoint() {
-    uint32_t address;
+    uint32_t address, end;
+    bool range;
 
     const int currentRow = ui->breakpointView->rowCount();
 
-    if (ui->breakRequest->text().isEmpty()) {
+    /* An address or range, then optionally a condition or tracepoint, see condition.h */
+    QString request = ui->breakRequest->text().trimmed();
+    int split = request.indexOf(QRegularExpression("\\s"));
+    QString condition = split < 0 ? QString() : request.mid(split + 1).trimmed();
+
+    if (request.isEmpty()) {
         return false;
     }
 
-    std::string s = ui->breakRequest->text().toUpper().toStdString();
-    if (s.find_first_not_of("0123456789ABCDEF") != std::string::npos) {
+    std::string s = request.left(split).toUpper().toStdString();
+    if (s.find_first_not_of("0123456789ABCDEF-") != std::string::npos) {
         return false;
     }
 
-    address = (uint32_t)hex2int(QString::fromStdString(s));
-
-    QString address_string = int2hex(address,6).toUpper();
+    QString address_string;
+    range = s.find('-') != std::string::npos;
+    if (range) {
+        if (!parseWatchRange(QString::fromStdString(s), &address, &end)) {
+            return false;
+        }
+        if (!condition.isEmpty()) {
+            QMessageBox::warning(this, tr("Invalid condition"), tr("Conditions can only be set on single addresses"));
+            return false;
+        }
+        address_string = int2hex(address,6).toUpper() + "-" + int2hex(end,6).toUpper();
+    } else {
+        address = (uint32_t)hex2int(QString::fromStdString(s)) & 0xFFFFFF;
+        address_string = int2hex(address,6).toUpper();
+    }
 
-    /* return if address is already set */
+    /* if address is already set, replace its condition, entering it alone clears it */
     for (int i=0; i<currentRow; ++i) {
         if (ui->breakpointView->item(i, 0)->text() == address_string) {
             ui->breakpointView->selectRow(i);
+            if (!range && setBreakpointCondition(address, condition)) {
+                QSignalBlocker blocker(ui->breakpointView);
+                ui->breakpointView->item(i, 4)->setText(condition);
+                ui->breakpointView->item(i, 4)->setData(Qt::UserRole, condition);
+                ui->breakRequest->clear();
+            }
             return false;
         }
     }
 
+    if (!range && !setBreakpointCondition(address, condition)) {
+        return false;
+    }
+
     ui->breakpointView->setRowCount(currentRow + 1);
 
     QTableWidgetItem *iaddress = new QTableWidgetItem(address_string.toUpper());
     QTableWidgetItem *rBreak = new QTableWidgetItem();
     QTableWidgetItem *wBreak = new QTableWidgetItem();
     QTableWidgetItem *eBreak = new QTableWidgetItem();
+    QTableWidgetItem *icondition = new QTableWidgetItem(condition);
 
+    // Ranges are mostly buffers, watch them for writes
     rBreak->setCheckState(Qt::Unchecked);
-    wBreak->setCheckState(Qt::Unchecked);
-    eBreak->setCheckState(Qt::Checked);
+    wBreak->setCheckState(range ? Qt::Checked : Qt::Unchecked);
+    eBreak->setCheckState(range ? Qt::Unchecked : Qt::Checked);
+    icondition->setData(Qt::UserRole, condition);
+    if (range) {
+        icondition->setFlags(icondition->flags() & ~Qt::ItemIsEditable);
+    }
 
     ui->breakpointView->setItem(currentRow, 0, iaddress);
     ui->breakpointView->setItem(currentRow, 1, rBreak);
     ui->breakpointView->setItem(currentRow, 2, wBreak);
     ui->breakpointView->setItem(currentRow, 3, eBreak);
+    ui->breakpointView->setItem(currentRow, 4, icondition);
+
+    if (range) {
+        debug_watch_set(address, end, breakpointFlags(currentRow));
+    }
 
     ui->breakpointView->selectRow(currentRow);
 
@@ -875,20 +1052,42 @@ void MainWindow::deleteBreakpoint() {
     }
 
     const int currentRow = ui->breakpointView->currentRow();
+    uint32_t start, end;
 
-    uint32_t address = (uint32_t)ui->breakpointView->item(currentRow, 0)->text().toInt(nullptr,16);
-    mem.debug.block[address] = DBG_NO_HANDLE;
+    if (parseWatchRange(ui->breakpointView->item(currentRow, 0)->text(), &start, &end)) {
+        debug_watch_set(start, end, 0);
+    } else {
+        uint32_t address = (uint32_t)ui->breakpointView->item(currentRow, 0)->text().toInt(nullptr,16);
+        mem.debug.block[address] &= ~(DBG_READ_BREAKPOINT | DBG_WRITE_BREAKPOINT | DBG_EXEC_BREAKPOINT);
+        debug_condition_remove(address);
+    }
 
     ui->breakpointView->removeRow(currentRow);
 }
 
+void MainWindow::printTraces() {
+    std::vector<debug_trace_entry_t> entries;
+    uint64_t lost = debug_trace_read(&trace_cursor, &entries);
+
+    if (lost) {
+        consoleStr(tr("%1 trace entries were dropped\n").arg(lost));
+    }
+    for (const debug_trace_entry_t &entry : entries) {
+        consoleStr(QString::fromStdString(debug_trace_format(entry)) + "\n");
+    }
+}
+
 void MainWindow::processDebugCommand(int reason, uint32_t input) {
     int row = 0;
     bool ok;
 
+    printTraces();
+
     if (reason == DBG_STEP || reason == DBG_USER) {
         if (reason == DBG_STEP) { ui->tabDebugging->setCurrentIndex(0); }
-        updateDisasmView(cpu.registers.PC, true);
+        address_pane = cpu.registers.PC;
+        prepareDisasmView();
+        ui->disassemblyView->followPC(cpu.registers.PC);
     }
 
     // We hit a normal breakpoint; raise the correct entry in the port monitor table
@@ -896,13 +1095,34 @@ void MainWindow::processDebugCommand(int reason, uint32_t input) {
         ui->tabDebugging->setCurrentIndex(0);
 
         // find the correct entry
-        while( (uint32_t)ui->breakpointView->item(row++, 0)->text().toInt(&ok,16) != input );
+        while( (uint32_t)ui->breakpointView->item(row++, 0)->text().toInt(&ok,16) != input || !ok );
         row--;
 
         ui->breakChangeView->setText("Address "+ui->breakpointView->item(row, 0)->text()+" "+((reason == HIT_READ_BREAKPOINT) ? "Read" : (reason == HIT_WRITE_BREAKPOINT) ? "Write" : "Executed"));
         ui->breakpointView->selectRow(row);
 
-        updateDisasmView(input, true);
+        updateDisasmView(input);
+    }
+
+    // We hit a watch range; raise the range holding the address
+    if (reason == HIT_WATCHPOINT) {
+        const debug_watch_hit_t &hit = mem.debug.watch_hit;
+        uint32_t start, end;
+        ui->tabDebugging->setCurrentIndex(0);
+
+        for (row = 0; row < ui->breakpointView->rowCount(); row++) {
+            if (parseWatchRange(ui->breakpointView->item(row, 0)->text(), &start, &end) &&
+                hit.address >= start && hit.address < end) {
+                ui->breakpointView->selectRow(row);
+                break;
+            }
+        }
+
+        ui->breakChangeView->setText("Address "+int2hex(hit.address, 6).toUpper()+" "+
+                                     ((hit.type == DBG_READ_BREAKPOINT) ? "Read" : (hit.type == DBG_WRITE_BREAKPOINT) ? "Write" : "Executed")+
+                                     " $"+int2hex(hit.value, 2).toUpper()+", PC "+int2hex(hit.pc, 6).toUpper());
+
+        updateDisasmView(hit.type == DBG_EXEC_BREAKPOINT ? hit.address : hit.pc);
     }
 
     // We hit a port read or write; raise the correct entry in the port monitor table
@@ -937,80 +1157,18 @@ void MainWindow::updateStackView() {
 
     QString formattedLine;
 
+    uint8_t stack[30];
+    debug_read_range(cpu.registers.SPL, sizeof stack, stack);
+
     for(int i=0; i<30; i+=3) {
        formattedLine = QString("<pre><b><font color='#444'>%1</font></b> %2</pre>")
                                 .arg(int2hex(cpu.registers.SPL+i, 6).toUpper(),
-                                     int2hex(memory_read_byte(cpu.registers.SPL+i) | memory_read_byte(cpu.registers.SPL+1+i)<<8 | memory_read_byte(cpu.registers.SPL+2+i)<<16,6).toUpper());
+                                     int2hex(stack[i] | stack[i+1]<<8 | stack[i+2]<<16,6).toUpper());
         ui->stackView->appendHtml(formattedLine);
     }
     ui->stackView->moveCursor(QTextCursor::Start);
 }
 
-void MainWindow::drawNextDisassembleLine() {
-    std::string *label = 0;
-    if (disasm.base_address != disasm.new_address) {
-        disasm.base_address = disasm.new_address;
-        addressMap_t::iterator item = disasm.address_map.find(disasm.new_address);
-        if (item != disasm.address_map.end()) {
-            disasmHighlight.hit_read_breakpoint = false;
-            disasmHighlight.hit_write_breakpoint = false;
-            disasmHighlight.hit_exec_breakpoint = false;
-            disasmHighlight.hit_pc = false;
-
-            disasm.instruction.data = "";
-            disasm.instruction.opcode = "";
-            disasm.instruction.mode_suffix = " ";
-            disasm.instruction.arguments = "";
-            disasm.instruction.size = 0;
-
-            label = &item->second;
-        } else {
-            disassembleInstruction();
-        }
-    } else {
-        disassembleInstruction();
-    }
-
-    // Watch out, maintainers: the (unformatted) line is later "parsed" in DisasmWidget::getSelectedAddress()
-    // with a cursor getting the address from it. Make sure the start position is correct.
-
-    // Some round symbol things
-    QString breakpointSymbols = QString("<font color='#A3FFA3'><big>%1</big></font><font color='#A3A3FF'><big>%2</big></font><font color='#FFA3A3'><big>%3</big></font>")
-                                   .arg(((disasmHighlight.hit_read_breakpoint == true)  ? "&#9679;" : " "),
-                                        ((disasmHighlight.hit_write_breakpoint == true) ? "&#9679;" : " "),
-                                        ((disasmHighlight.hit_exec_breakpoint == true)  ? "&#9679;" : " "));
-
-    // Simple syntax highlighting
-    QString instructionArgsHighlighted = QString::fromStdString(disasm.instruction.arguments)
-                                        .replace(QRegularExpression("(\\$[0-9a-fA-F]+)"), "<font color='green'>\\1</font>") // hex numbers
-                                        .replace(QRegularExpression("(^\\d)"), "<font color='blue'>\\1</font>")             // dec number
-                                        .replace(QRegularExpression("([()])"), "<font color='#600'>\\1</font>");            // parentheses
-
-    QString formattedLine = QString("<pre><b>%1<font color='#444'>%2</font></b>    %3  <font color='darkblue'>%4%5</font>%6</pre>")
-                               .arg(breakpointSymbols,
-                                    int2hex(disasm.base_address, 6).toUpper(),
-                                    label ? QString::fromStdString(*label) + ":" : ui->checkDataCol->isChecked() ? QString::fromStdString(disasm.instruction.data).leftJustified(12, ' ') : "",
-                                    QString::fromStdString(disasm.instruction.opcode),
-                                    QString::fromStdString(disasm.instruction.mode_suffix),
-                                    instructionArgsHighlighted);
-
-    ui->disassemblyView->appendHtml(formattedLine);
-
-    if (address_pane == disasm.base_address) {
-        disasm_offset_set = true;
-        disasm_offset = ui->disassemblyView->textCursor();
-        disasm_offset.movePosition(QTextCursor::StartOfLine);
-    } else if (disasm_offset_set == false && address_pane <= disasm.base_address+7) {
-        disasm_offset_set = true;
-        disasm_offset = ui->disassemblyView->textCursor();
-        disasm_offset.movePosition(QTextCursor::StartOfLine);
-    }
-
-    if (disasmHighlight.hit_pc == true) {
-        ui->disassemblyView->addHighlight(QColor(Qt::red).lighter(160));
-    }
-}
-
 void MainWindow::setPCaddress(const QPoint& posa) {
     QString set_pc = "Set PC to this address";
     QString toggle_break = "Toggle breakpoint";
@@ -1025,7 +1183,7 @@ void MainWindow::setPCaddress(const QPoint& posa) {
         if (selectedItem->text() == set_pc) {
             ui->pcregView->setText(ui->disassemblyView->getSelectedAddress());
             cpu_flush((uint32_t)hex2int(ui->pcregView->text()), cpu.ADL);
-            updateDisasmView(cpu.registers.PC, true);
+            updateDisasmView(cpu.registers.PC);
         } else  if (selectedItem->text() == toggle_break) {
             breakpointPressed();
         }
@@ -1055,7 +1213,7 @@ void MainWindow::breakpointPressed() {
 
     ui->breakRequest->clear();
 
-    updateDisasmView(address.toInt(&ok, 16), true);
+    updateDisasmView(address.toInt(&ok, 16));
 }
 
 QString MainWindow::getAddressString(bool &ok, QString String) {
@@ -1080,82 +1238,113 @@ void MainWindow::gotoPressed() {
         return;
     }
 
-    updateDisasmView(hex2int(address), false);
+    updateDisasmView(hex2int(address));
 }
 
 /* ================================================ */
 /* Hex Editor Things                                */
 /* ================================================ */
 
+/* Rereads what a hex view shows. When none of it changed, the view is left alone along with
+ * any edits not synced yet. */
+void MainWindow::hexUpdate(QHexEdit *edit, MemoryDevice &device) {
+    qint64 first = (qint64)edit->getLine() * hex_line_size;
+    qint64 shown = (qint64)(edit->verticalScrollBar()->pageStep() + 1) * hex_line_size;
+
+    if (device.refresh(first, shown)) {
+        int line = edit->getLine();
+        qint64 cursor = edit->cursorPosition();
+        qint64 offset = edit->addressOffset();
+        edit->setData(device);
+        edit->setAddressOffset(offset);
+        edit->setCursorPosition(cursor);
+        edit->setLine(line);
+    } else {
+        edit->viewport()->update();
+    }
+}
+
 void MainWindow::flashUpdate() {
     ui->flashEdit->setFocus();
-    int line = ui->flashEdit->getLine();
-    ui->flashEdit->setData(QByteArray::fromRawData((char*)mem.flash.block, 0x400000));
-    ui->flashEdit->setLine(line);
+    hexUpdate(ui->flashEdit, flash_device);
 }
 
 void MainWindow::ramUpdate() {
     ui->ramEdit->setFocus();
-    int line = ui->ramEdit->getLine();
-    ui->ramEdit->setData(QByteArray::fromRawData((char*)mem.ram.block, 0x65800));
+    hexUpdate(ui->ramEdit, ram_device);
     ui->ramEdit->setAddressOffset(0xD00000);
-    ui->ramEdit->setLine(line);
 }
 
 void MainWindow::memUpdate() {
     ui->memEdit->setFocus();
-    QByteArray mem_data;
+    hexUpdate(ui->memEdit, mem_device);
 
-    bool locked = ui->checkLockPosition->isChecked();
-    int start, line;
-    if (locked) {
-        start = (int)ui->memEdit->addressOffset();
-        line = ui->memEdit->getLine();
-    } else {
-        start = cpu.registers.PC-0x1000;
+    if (!ui->checkLockPosition->isChecked()) {
+        ui->memEdit->setCursorPosition((qint64)cpu.registers.PC<<1);
+        ui->memEdit->ensureVisible();
     }
+}
 
-    if (start < 0) { start = 0; }
-    int end = start+0x2000;
-    if (end > 0xFFFFFF) { end = 0xFFFFFF; }
-
-    mem_hex_size = end-start;
-
-    for (int i=start; i<end; i++) {
-        mem_data.append(memory_read_byte(i));
+void MainWindow::searchEdit(QHexEdit *editor, MemoryDevice &device) {
+    bool ok;
+    QString search_string = QInputDialog::getText(this, tr("Search"),
+                                                  tr("Hex bytes with ? for any digit, *address for a pointer or \"text\".\n"
+                                                     "Separate several with |, F3 goes to the next match:"), QLineEdit::Normal,
+                                                  search_text, &ok);
+    editor->setFocus();
+    if (!ok || search_string.isEmpty()) {
+        return;
     }
 
-    ui->memEdit->setData(mem_data);
-    ui->memEdit->setAddressOffset(start);
+    std::vector<search_pattern_t> patterns;
+    if (!search_parse_patterns(search_string.toStdString(), &patterns)) {
+        QMessageBox::warning(this, tr("Search"), tr("Couldn't understand this search string."));
+        return;
+    }
+    search_text = search_string;
+    search_results = search_memory(device.base(), device.size(), patterns, max_search_results);
+    search_view = editor;
+    search_device = &device;
 
-    if (locked) {
-        ui->memEdit->setLine(line);
-    } else {
-        ui->memEdit->setCursorPosition((cpu.registers.PC-start)<<1);
-        ui->memEdit->ensureVisible();
+    if (search_results.empty()) {
+        QMessageBox::information(this, tr("Search"), tr("No matches."));
+        return;
     }
+    gotoSearchResult(0);
 }
 
-void MainWindow::searchEdit(QHexEdit *editor) {
-    bool ok;
-    QString search_string = QInputDialog::getText(this, tr("Search"),
-                                                  tr("Input Hexadecimal Search String:"), QLineEdit::Normal,
-                                                  "", &ok).toUpper();
-    editor->setFocus();
-    if(!ok || (search_string.length() & 1)) {
+/* Moves the cursor of the view searched last to the next match after it, the previous one
+ * before it, or for 0 the first one at or after it, wrapping around */
+void MainWindow::gotoSearchResult(int direction) {
+    if (!search_view || search_results.empty()) {
         return;
     }
-    QByteArray string_int;
-    for (int i=0; i<search_string.length(); i+=2) {
-        QString a = search_string.at(i);
-        a.append(search_string.at(i+1));
-        string_int.append(a.toInt(&ok, 16));
+
+    uint32_t cursor = search_device->base() + (uint32_t)(search_view->cursorPosition() >> 1);
+    auto after = [](const search_match_t &match, uint32_t address) { return match.address < address; };
+    auto it = std::lower_bound(search_results.begin(), search_results.end(), cursor + (direction > 0), after);
+
+    if (direction < 0) {
+        it = it == search_results.begin() ? search_results.end() - 1 : it - 1;
+    } else if (it == search_results.end()) {
+        it = search_results.begin();
     }
-    editor->indexOf(string_int, editor->cursorPosition());
+
+    search_view->setFocus();
+    search_view->setCursorPosition((qint64)(it->address - search_device->base()) << 1);
+    search_view->ensureVisible();
+}
+
+void MainWindow::searchNextPressed() {
+    gotoSearchResult(1);
+}
+
+void MainWindow::searchPreviousPressed() {
+    gotoSearchResult(-1);
 }
 
 void MainWindow::flashSearchPressed() {
-    searchEdit(ui->flashEdit);
+    searchEdit(ui->flashEdit, flash_device);
 }
 
 void MainWindow::flashGotoPressed() {
@@ -1176,7 +1365,7 @@ void MainWindow::flashGotoPressed() {
 }
 
 void MainWindow::ramSearchPressed() {
-    searchEdit(ui->ramEdit);
+    searchEdit(ui->ramEdit, ram_device);
 }
 
 void MainWindow::ramGotoPressed() {
@@ -1196,7 +1385,7 @@ void MainWindow::ramGotoPressed() {
     ui->ramEdit->ensureVisible();
 }
 void MainWindow::memSearchPressed() {
-    searchEdit(ui->memEdit);
+    searchEdit(ui->memEdit, mem_device);
 }
 
 void MainWindow::memGotoPressed() {
@@ -1212,50 +1401,32 @@ void MainWindow::memGotoPressed() {
         return;
     }
 
-    QByteArray mem_data;
-    int start = int_address-0x500;
-    if (start < 0) { start = 0; }
-    int end = start+0x1000;
-    if (end > 0xFFFFFF) { end = 0xFFFFFF; }
-
-    mem_hex_size = end-start;
-
-    for (int i=start; i<end; i++) {
-        mem_data.append(memory_read_byte(i));
-    }
-
-    ui->memEdit->setData(mem_data);
-    ui->memEdit->setAddressOffset(start);
-    ui->memEdit->setCursorPosition((int_address-start)<<1);
+    ui->memEdit->setCursorPosition((qint64)int_address<<1);
     ui->memEdit->ensureVisible();
 }
 
 void MainWindow::syncHexView(int posa, QHexEdit *hex_view) {
     populateDebugWindow();
-    updateDisasmView(address_pane, from_pane);
+    updateDisasmView(address_pane);
     hex_view->setFocus();
     hex_view->setCursorPosition(posa);
 }
 
 void MainWindow::flashSyncPressed() {
     qint64 posa = ui->flashEdit->cursorPosition();
-    memcpy(mem.flash.block, (uint8_t*)ui->flashEdit->data().data(), flash_size);
+    flash_device.commit(*ui->flashEdit);
     syncHexView(posa, ui->flashEdit);
 }
 
 void MainWindow::ramSyncPressed() {
     qint64 posa = ui->ramEdit->cursorPosition();
-    memcpy(mem.ram.block, (uint8_t*)ui->ramEdit->data().data(), ram_size);
+    ram_device.commit(*ui->ramEdit);
     syncHexView(posa, ui->ramEdit);
 }
 
 void MainWindow::memSyncPressed() {
-    int start = ui->memEdit->addressOffset();
     qint64 posa = ui->memEdit->cursorPosition();
-
-    for (int i = 0; i<mem_hex_size; i++) {
-        memory_force_write_byte(i+start, ui->memEdit->dataAt(i, 1).at(0));
-    }
+    mem_device.commit(*ui->memEdit);
 
     syncHexView(posa, ui->memEdit);
 }
@@ -1263,6 +1434,7 @@ void MainWindow::memSyncPressed() {
 void MainWindow::clearEquateFile() {
     // Reset the map
     disasm.address_map.clear();
+    ui->disassemblyView->refresh();
     QMessageBox::warning(this, tr("Equates Cleared"), tr("Cleared disassembly equates."));
 }
 
@@ -1312,6 +1484,7 @@ void MainWindow::addEquateFile() {
             }
         }
         in.close();
+        ui->disassemblyView->refresh();
         QMessageBox::information(this, tr("Equates Loaded"), tr("Loaded disassembly equates."));
     } else {
         QMessageBox messageBox;
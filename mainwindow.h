@@ -6,7 +6,6 @@
 #include <QtWidgets/QTableWidgetItem>
 #include <QtWidgets/QFileDialog>
 #include <QtCore/QSettings>
-#include <QTextCursor>
 
 #include "lcdwidget.h"
 #include "romselection.h"
@@ -15,6 +14,10 @@
 #include "core/debug/debug.h"
 #include "core/debug/disasm.h"
 #include "qhexedit/qhexedit.h"
+#include "memorydevice.h"
+#include "profiledialog.h"
+#include "core/debug/search.h"
+#include "core/debug/condition.h"
 
 namespace Ui {
     class MainWindow;
@@ -27,6 +30,7 @@ class MainWindow : public QMainWindow
 public:
     explicit MainWindow(QWidget *p = 0);
     ~MainWindow();
+    void updateTimelineAction();    // After the timeline was started from the command line
 
 public slots:
     // Misc.
@@ -37,6 +41,8 @@ public slots:
     void screenshot(void);
     void screenshotGIF();
     void recordGIF();
+    void recordInput();
+    void replayInput();
     void showAbout(void);
     void setUIMode(bool);
 
@@ -69,14 +75,17 @@ private:
     bool addBreakpoint();
     void deleteBreakpoint();
     void breakpointCheckboxToggled(QTableWidgetItem *);
+    void printTraces();
+    bool setBreakpointCondition(uint32_t, const QString&);
+    uint8_t breakpointFlags(int);
 
-    void drawNextDisassembleLine();
     void resetCalculator();
 
     void stepPressed();
     void stepOverPressed();
     void updateStackView();
-    void updateDisasmView(const int, const bool);
+    void prepareDisasmView();
+    void updateDisasmView(const int);
 
     void gotoPressed();
     void breakpointPressed();
@@ -91,6 +100,8 @@ private:
     void changeLCDRefresh(int value);
     void alwaysOnTop(int state);
     void popoutLCD();
+    void showAccessStatistics();
+    void recordTimeline(bool checked);
     void changeKeys();
 
     // Linking
@@ -98,6 +109,7 @@ private:
     void selectFiles();
     void refreshVariableList();
     void saveSelected();
+    void saveAll();
 
     // Hex Editor
     void flashUpdate();
@@ -112,23 +124,35 @@ private:
     void memGotoPressed();
     void memSearchPressed();
     void memSyncPressed();
+    void hexUpdate(QHexEdit*, MemoryDevice&);
     void syncHexView(int, QHexEdit*);
-    void searchEdit(QHexEdit*);
+    void searchEdit(QHexEdit*, MemoryDevice&);
+    void gotoSearchResult(int);
+    void searchNextPressed();
+    void searchPreviousPressed();
 
     QString getAddressString(bool&, QString);
 
     Ui::MainWindow *ui = nullptr;
     QSettings *settings = nullptr;
     QDockWidget *dock_debugger = nullptr;
-    QTextCursor disasm_offset;
     bool detached_state = false;
-    bool disasm_offset_set;
-    bool from_pane;
     int address_pane;
-    int mem_hex_size;
 
     EmuThread emu;
     LCDWidget detached_lcd;
+    ProfileDialog *profile_dialog = nullptr;
+
+    MemoryDevice flash_device{0x000000, 0x400000};
+    MemoryDevice ram_device{0xD00000, 0x65800};
+    MemoryDevice mem_device{0x000000, 0x1000000};
+
+    QString search_text;
+    std::vector<search_match_t> search_results;
+    QHexEdit *search_view = nullptr;
+    MemoryDevice *search_device = nullptr;
+
+    uint64_t trace_cursor = 0;
 
     bool debugger_on = false;
     bool in_recieving_mode = false;
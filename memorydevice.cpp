@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <string.h>
+
+#include "memorydevice.h"
+#include "qhexedit/qhexedit.h"
+#include "core/debug/debug.h"
+
+/* Same as the chunks QHexEdit reads in */
+static const uint32_t page_size = 0x1000;
+
+MemoryDevice::MemoryDevice(uint32_t base, uint32_t size, QObject *p) : QIODevice(p) {
+    base_address = base;
+    length = size;
+    generation = 0;
+}
+
+/* QIODevice would read ahead a whole buffer, pulling in pages nobody looks at */
+bool MemoryDevice::open(OpenMode mode) {
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+bool MemoryDevice::isSequential() const {
+    return false;
+}
+
+qint64 MemoryDevice::size() const {
+    return length;
+}
+
+uint32_t MemoryDevice::base() const {
+    return base_address;
+}
+
+void MemoryDevice::load(uint32_t index, Page &page) {
+    uint32_t offset = index * page_size;
+
+    page.data.resize(std::min(page_size, length - offset));
+    debug_read_range(base_address + offset, page.data.size(), page.data.data());
+    page.generation = generation;
+}
+
+MemoryDevice::Page &MemoryDevice::fetch(uint32_t index) {
+    Page &page = pages[index];
+
+    if (page.data.empty() || page.generation != generation) {
+        load(index, page);
+    }
+    return page;
+}
+
+qint64 MemoryDevice::readData(char *data, qint64 maxSize) {
+    qint64 position = pos(), done = 0;
+
+    if (position >= length) {
+        return 0;
+    }
+    maxSize = std::min(maxSize, length - position);
+    while (done < maxSize) {
+        const Page &page = fetch(position / page_size);
+        qint64 offset = position % page_size;
+        qint64 count = std::min<qint64>(page.data.size() - offset, maxSize - done);
+
+        memcpy(data + done, page.data.data() + offset, count);
+        done += count;
+        position += count;
+    }
+    return done;
+}
+
+qint64 MemoryDevice::writeData(const char *data, qint64 maxSize) {
+    (void)data;
+    (void)maxSize;
+    return -1;
+}
+
+bool MemoryDevice::refresh(qint64 pos, qint64 count) {
+    bool changed = pages.empty();
+    uint32_t index;
+
+    generation++;
+    if (pos < 0 || pos >= length) {
+        return changed;
+    }
+    count = std::min(count, length - pos);
+    for (index = pos / page_size; index * page_size < pos + count; index++) {
+        auto it = pages.find(index);
+        if (it != pages.end()) {
+            std::vector<uint8_t> old = std::move(it->second.data);
+            load(index, it->second);
+            changed |= old != it->second.data;
+        }
+    }
+    return changed;
+}
+
+void MemoryDevice::commit(QHexEdit &edit) {
+    for (auto &item : pages) {
+        uint32_t offset = item.first * page_size;
+        std::vector<uint8_t> &snapshot = item.second.data;
+        QByteArray edited = edit.dataAt(offset, snapshot.size());
+        const uint8_t *bytes = reinterpret_cast<const uint8_t*>(edited.constData());
+        uint32_t size = std::min<uint32_t>(snapshot.size(), edited.size());
+        uint32_t i = 0;
+
+        /* Only the runs that were edited, writes to ports can have side effects */
+        while (i < size) {
+            uint32_t start;
+            if (bytes[i] == snapshot[i]) {
+                i++;
+                continue;
+            }
+            for (start = i; i < size && bytes[i] != snapshot[i]; i++) {
+                snapshot[i] = bytes[i];
+            }
+            debug_write_range(base_address + offset + start, i - start, bytes + start);
+        }
+    }
+    pages.clear();
+}
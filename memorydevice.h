@@ -0,0 +1,52 @@
+#ifndef MEMORYDEVICE_H
+#define MEMORYDEVICE_H
+
+#include <QtCore/QIODevice>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+class QHexEdit;
+
+/* A range of the emulated address space as a read-only QIODevice, for QHexEdit. Pages are read
+ * through the debugger the first time they are looked at after a refresh and kept, so what the
+ * view shows and edits stays consistent until the next refresh. Nothing is copied up front. */
+class MemoryDevice : public QIODevice {
+    Q_OBJECT
+
+public:
+    MemoryDevice(uint32_t base, uint32_t size, QObject *parent = 0);
+
+    bool open(OpenMode mode);
+    bool isSequential() const;
+    qint64 size() const;
+    uint32_t base() const;
+
+    /* Starts a new snapshot. Pages overlapping [pos, pos + length), the ones on screen, are read
+     * again right away and the rest when next looked at. Returns whether any page on screen changed,
+     * or there was no snapshot yet. */
+    bool refresh(qint64 pos, qint64 length);
+
+    /* Writes back the bytes edit holds that differ from the snapshot, then drops it so the next
+     * refresh reloads the view */
+    void commit(QHexEdit &edit);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    struct Page {
+        std::vector<uint8_t> data;
+        uint32_t generation;
+    };
+
+    Page &fetch(uint32_t index);
+    void load(uint32_t index, Page &page);
+
+    uint32_t base_address, length;
+    uint32_t generation;
+    std::unordered_map<uint32_t, Page> pages;
+};
+
+#endif
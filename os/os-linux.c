@@ -1,7 +1,41 @@
 #include "os.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 FILE *fopen_utf8(const char *filename, const char *mode)
 {
     return fopen(filename, mode);
 }
+
+void *os_map_file(const char *filename, size_t size, bool shared)
+{
+    struct stat st;
+    void *ptr = NULL;
+    int fd = open(filename, shared ? O_RDWR : O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!fstat(fd, &st) && (size_t)st.st_size == size) {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            ptr = NULL;
+        }
+    }
+    /* The mapping keeps the file open */
+    close(fd);
+    return ptr;
+}
+
+void os_unmap_file(void *ptr, size_t size)
+{
+    munmap(ptr, size);
+}
+
+bool os_sync_file(void *ptr, size_t size)
+{
+    return !msync(ptr, size, MS_ASYNC);
+}
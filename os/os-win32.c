@@ -10,3 +10,39 @@ FILE *fopen_utf8(const char *filename, const char *mode)
     MultiByteToWideChar(CP_UTF8, 0, mode, -1, mode_w, 5);
     return _wfopen(filename_w, mode_w);
 }
+
+void *os_map_file(const char *filename, size_t size, bool shared)
+{
+    wchar_t filename_w[MAX_PATH];
+    HANDLE file, mapping;
+    LARGE_INTEGER file_size;
+    void *ptr = NULL;
+
+    MultiByteToWideChar(CP_UTF8, 0, filename, -1, filename_w, MAX_PATH);
+    file = CreateFileW(filename_w, GENERIC_READ | (shared ? GENERIC_WRITE : 0), FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    if (GetFileSizeEx(file, &file_size) && (size_t)file_size.QuadPart == size) {
+        mapping = CreateFileMappingW(file, NULL, shared ? PAGE_READWRITE : PAGE_WRITECOPY, 0, 0, NULL);
+        if (mapping) {
+            ptr = MapViewOfFile(mapping, shared ? FILE_MAP_WRITE : FILE_MAP_COPY, 0, 0, size);
+            /* The view keeps the mapping and the file open */
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return ptr;
+}
+
+void os_unmap_file(void *ptr, size_t size)
+{
+    (void)size;
+    UnmapViewOfFile(ptr);
+}
+
+bool os_sync_file(void *ptr, size_t size)
+{
+    return FlushViewOfFile(ptr, size) != 0;
+}
@@ -5,6 +5,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,6 +13,13 @@ extern "C" {
 /* Some really crappy APIs don't use UTF-8 in fopen. */
 FILE *fopen_utf8(const char *filename, const char *mode);
 
+/* Map exactly size bytes of a file, which has to be that long. Shared mappings
+ * write back to the file, private ones are copy on write and never touch it. */
+void *os_map_file(const char *filename, size_t size, bool shared);
+void os_unmap_file(void *ptr, size_t size);
+/* Start writing back a page aligned range of a shared mapping */
+bool os_sync_file(void *ptr, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
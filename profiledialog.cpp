@@ -0,0 +1,135 @@
+#include <QtGui/QColor>
+#include <QtWidgets/QFileDialog>
+#include <QtWidgets/QHBoxLayout>
+#include <QtWidgets/QHeaderView>
+#include <QtWidgets/QMessageBox>
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QTableWidget>
+#include <QtWidgets/QVBoxLayout>
+
+#include <algorithm>
+#include <cmath>
+
+#include "profiledialog.h"
+#include "core/debug/profile.h"
+
+static QString hex(uint32_t value, int width) {
+    return QString("%1").arg(value, width, 16, QChar('0')).toUpper();
+}
+
+enum { COL_KIND, COL_ADDRESS, COL_READS, COL_WRITES, COL_CYCLES, COL_PC, COL_COUNT };
+
+/* Sorts by value rather than as text */
+static QTableWidgetItem *numberItem(qulonglong value) {
+    QTableWidgetItem *item = new QTableWidgetItem();
+    item->setData(Qt::DisplayRole, value);
+    item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+    return item;
+}
+
+ProfileDialog::ProfileDialog(QWidget *p) : QDialog(p) {
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    QHBoxLayout *buttons = new QHBoxLayout();
+    QPushButton *refresh_button = new QPushButton(tr("Refresh"));
+    QPushButton *export_button = new QPushButton(tr("Export..."));
+
+    setWindowTitle(tr("Access Statistics"));
+    resize(560, 480);
+
+    table = new QTableWidget(0, COL_COUNT, this);
+    table->setHorizontalHeaderLabels({ tr("Kind"), tr("Address"), tr("Reads"), tr("Writes"), tr("Cycles"), tr("Last PC") });
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    table->verticalHeader()->setVisible(false);
+    table->horizontalHeader()->setStretchLastSection(true);
+
+    record_button = new QPushButton(tr("Record"));
+    record_button->setCheckable(true);
+    record_button->setChecked(profiling);
+
+    buttons->addWidget(record_button);
+    buttons->addWidget(refresh_button);
+    buttons->addStretch();
+    buttons->addWidget(export_button);
+    layout->addWidget(table);
+    layout->addLayout(buttons);
+
+    connect(record_button, &QPushButton::toggled, this, &ProfileDialog::recordToggled);
+    connect(refresh_button, &QPushButton::clicked, this, &ProfileDialog::refresh);
+    connect(export_button, &QPushButton::clicked, this, &ProfileDialog::exportStats);
+
+    refresh();
+}
+
+void ProfileDialog::recordToggled(bool checked) {
+    profile_set(checked);
+    refresh();
+}
+
+void ProfileDialog::refresh() {
+    const profile_state_t *state = profile_get();
+    uint64_t most = 1;
+    int rows = 0, row = 0;
+
+    table->setSortingEnabled(false);
+    table->setRowCount(0);
+    if (!state) {
+        return;
+    }
+
+    for (const profile_count_t &count : state->ports) {
+        rows += count.reads || count.writes;
+        most = std::max<uint64_t>(most, count.reads + count.writes);
+    }
+    for (const profile_count_t &count : state->pages) {
+        rows += count.reads || count.writes;
+        most = std::max<uint64_t>(most, count.reads + count.writes);
+    }
+    table->setRowCount(rows);
+
+    for (int kind = 0; kind < 2; kind++) {
+        const profile_count_t *counts = kind ? state->pages : state->ports;
+        uint32_t size = kind ? 0x1000 : 0x10000;
+
+        for (uint32_t i = 0; i < size && row < rows; i++) {
+            const profile_count_t &count = counts[i];
+            if (!count.reads && !count.writes) {
+                continue;
+            }
+
+            /* Heat on a log scale, a polling loop is orders of magnitude above the rest */
+            QTableWidgetItem *address = new QTableWidgetItem(hex(kind ? i << 12 : i, kind ? 6 : 4));
+            double heat = std::log(double(count.reads + count.writes)) / std::log(double(most) + 1);
+            address->setBackground(QColor::fromHsvF(0, heat, 1));
+
+            table->setItem(row, COL_KIND, new QTableWidgetItem(kind ? tr("Page") : tr("Port")));
+            table->setItem(row, COL_ADDRESS, address);
+            table->setItem(row, COL_READS, numberItem(count.reads));
+            table->setItem(row, COL_WRITES, numberItem(count.writes));
+            table->setItem(row, COL_CYCLES, numberItem(count.cycles));
+            table->setItem(row, COL_PC, new QTableWidgetItem(hex(count.pc, 6)));
+            row++;
+        }
+    }
+
+    table->setSortingEnabled(true);
+    table->sortByColumn(COL_READS, Qt::DescendingOrder);
+}
+
+void ProfileDialog::exportStats() {
+    QString filename = QFileDialog::getSaveFileName(this, tr("Export Statistics"), QString(),
+                                                    tr("CSV (*.csv);;JSON (*.json)"));
+    bool ok;
+
+    if (filename.isEmpty()) {
+        return;
+    }
+    if (filename.endsWith(".json", Qt::CaseInsensitive)) {
+        ok = profile_write_json(filename.toUtf8().constData());
+    } else {
+        ok = profile_write_csv(filename.toUtf8().constData());
+    }
+    if (!ok) {
+        QMessageBox::warning(this, tr("Export failed"), tr("Could not write ") + filename);
+    }
+}
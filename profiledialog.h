@@ -0,0 +1,26 @@
+#ifndef PROFILEDIALOG_H
+#define PROFILEDIALOG_H
+
+#include <QtWidgets/QDialog>
+
+class QPushButton;
+class QTableWidget;
+
+/* Port and page access statistics from core/debug/profile.h, as a sortable table. Counting
+ * runs while Record is checked, the table is filled from a snapshot on Refresh. */
+class ProfileDialog : public QDialog {
+    Q_OBJECT
+
+public:
+    ProfileDialog(QWidget *parent = 0);
+
+private:
+    void recordToggled(bool checked);
+    void refresh();
+    void exportStats();
+
+    QTableWidget *table;
+    QPushButton *record_button;
+};
+
+#endif
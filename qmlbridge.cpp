@@ -18,7 +18,7 @@
 #include <cassert>
 
 #include "qmlbridge.h"
-#include "core/keypad.h"
+#include "core/input.h"
 
 QMLBridge::QMLBridge(QObject *p) : QObject(p) {
 }
@@ -32,7 +32,7 @@ void QMLBridge::keypadStateChanged(int keymap_id, bool state) {
     int col = keymap_id % COLS, row = keymap_id / COLS;
     assert(row < ROWS);
 
-    keypad_key_event(row, col, state);
+    input_key_event(row, col, state);
 }
 
 static QObject *buttons[ROWS][COLS];
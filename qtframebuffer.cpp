@@ -16,48 +16,44 @@
 
 #include "qtframebuffer.h"
 #include "qtkeypadbridge.h"
-#include "core/asic.h"
-
-#define CLAMP(a) ( ((a) > 255) ? 255 : (((a) < 0) ? 0 : (int)(a)) )
+#include "core/lcdframe.h"
 
 QImage brighten(QImage &img, float factor) {
-    int r,g,b;
+    int scale = qBound(0, static_cast<int>(factor * 256), 0x10000);
+
     /* Scale each RGB value by the brightening factor */
+    img = img.convertToFormat(QImage::Format_RGB32);
     for(int y = 0; y < img.height(); y++) {
+        QRgb *line = reinterpret_cast<QRgb*>(img.scanLine(y));
         for(int x = 0; x < img.width(); x++) {
-            QRgb p = img.pixel(x, y);
-            r = qRed(p) * factor;
-            r = CLAMP(r);
-            g = qGreen(p) * factor;
-            g = CLAMP(g);
-            b = qBlue(p) * factor;
-            b = CLAMP(b);
-            img.setPixel(x, y, qRgb(r, g, b));
-          }
+            QRgb p = line[x];
+            line[x] = qRgb(qMin(qRed(p) * scale >> 8, 255),
+                           qMin(qGreen(p) * scale >> 8, 255),
+                           qMin(qBlue(p) * scale >> 8, 255));
+        }
     }
 
     return img;
 }
 
-static uint32_t bitfields[3] = { 0x01F, 0x000, 0x000};
-static uint16_t framebuffer[320 * 240];
+static QImage frameImage(const lcd_frame_t *frame) {
+    return QImage(reinterpret_cast<const uchar*>(frame->pixels), 320, 240, 320 * 4, QImage::Format_RGB32);
+}
 
 QImage renderFramebuffer() {
-    lcd_drawframe(framebuffer, bitfields);
-
-    QImage::Format format = *bitfields == 0x00F ? QImage::Format_RGB444 : QImage::Format_RGB16;
-
-    return QImage(reinterpret_cast<const uchar*>(framebuffer), 320, 240, 320 * 2, format);
+    /* The frame gets recycled on the next acquire, so hand out a copy */
+    return frameImage(lcd_frame_acquire()).copy();
 }
 
 void paintFramebuffer(QPainter *p) {
-    if (!(lcd.control & 0x800)) {
+    const lcd_frame_t *frame = lcd_frame_acquire();
+
+    if (!frame->powered) {
         p->fillRect(p->window(), Qt::black);
         p->setPen(Qt::white);
         p->drawText(p->window(), Qt::AlignCenter, QObject::tr("LCD OFF"));
     } else {
-        QImage img = renderFramebuffer();
-        p->drawImage(p->window(), img);
+        p->drawImage(p->window(), frameImage(frame));
     }
 }
 
@@ -15,7 +15,7 @@
 #include "qtkeypadbridge.h"
 #include "qmlbridge.h"
 #include "keymap.h"
-#include "core/keypad.h"
+#include "core/input.h"
 
 QtKeypadBridge qt_keypad_bridge;
 
@@ -32,7 +32,7 @@ void QtKeypadBridge::keyEvent(QKeyEvent *event, bool press)
             {
                 if(key == keymap[row][col].key[index] && keymap[row][col].alt == (bool(event->modifiers() & Qt::AltModifier) || bool(event->modifiers() & Qt::MetaModifier)))
                 {
-                    keypad_key_event(row, col, press);
+                    input_key_event(row, col, press);
                     notifyKeypadStateChanged(row, col, press);
                     return;
                 }
@@ -40,8 +40,7 @@ void QtKeypadBridge::keyEvent(QKeyEvent *event, bool press)
         }
     }
 
-    keypad.gpio_enable |= 0x800;
-    keypad_intrpt_check();
+    input_unmapped_key();
 }
 
 bool QtKeypadBridge::eventFilter(QObject *obj, QEvent *e)